@@ -19,17 +19,25 @@ limitations under the License.
 #include <string.h>
 #include <stdlib.h>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "driver/i2c.h"
 #include "esp_bit_defs.h"
 #include "esp_check.h"
 #include "esp_log.h"
 #include "CH422G.h"
+#include "i2c_bus.h"
 
 
 #define ESP_IO_EXPANDER_I2C_CH422G_ADDRESS_000    (0x24)
 
-// Timeout of each I2C communication 
-#define I2C_TIMEOUT_MS          (10)
+// Longest wait for the I2C bus
+#define CH422G_BUS_TIMEOUT_MS   (100)
+
+// IO pins settle after switching to input mode before they are read. The pins were
+// driven high as outputs and are pulled up as inputs, only a pressed switch pulls one low
+#define CH422G_INPUT_SETTLE_US  (100)
 
 #define IO_COUNT                (8)
 #define DIR_OUT_VALUE           (0xFFF)
@@ -59,7 +67,6 @@ limitations under the License.
 
 typedef struct 
 {
-    i2c_port_t i2c_num;
     uint32_t i2c_address;
     
     struct 
@@ -69,10 +76,12 @@ typedef struct
 
 	struct 
 	{
-        uint8_t wr_set;
+        uint8_t wr_set;                         // also the mode, CH422G_Mode is the same register
         uint8_t wr_oc;
         uint8_t wr_io;
     } regs;
+
+    uint8_t wr_set_valid;                       // wr_set matches the chip, writes of the same value are skipped
 } esp_io_expander_ch422g_t;
 
 
@@ -82,7 +91,39 @@ typedef struct
  */
 static esp_io_expander_ch422g_t ch422g;
 static const char *TAG = "app_ch422g";
-static SemaphoreHandle_t I2CMutexHandle;
+static SemaphoreHandle_t ModeMutex;
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Write the mode (WR-SET) register
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Skipped if it already holds the value. Call with ModeMutex held
+*****************************************************************************/
+static esp_err_t CH422G_write_mode(uint8_t data)
+{
+    esp_err_t res;
+    const tI2CBusOp ops[] = {I2C_BUS_WRITE(CH422G_REG_WR_SET, &data, sizeof(data))};
+
+    if (ch422g.wr_set_valid && (ch422g.regs.wr_set == data))
+    {
+        return ESP_OK;
+    }
+
+    res = i2c_bus_transaction(I2C_BUS_PRIORITY_HOUSEKEEPING, ops, 1, CH422G_BUS_TIMEOUT_MS);
+    if (res == ESP_OK)
+    {
+        ch422g.regs.wr_set = data;
+        ch422g.wr_set_valid = 1;
+    }
+    else
+    {
+        // chip may or may not have it
+        ch422g.wr_set_valid = 0;
+    }
+
+    return res;
+}
 
 /****************************************************************************
 * NAME:        
@@ -93,23 +134,16 @@ static SemaphoreHandle_t I2CMutexHandle;
 *****************************************************************************/
 esp_err_t CH422G_enableAllIO_Input(void)
 {
-    uint8_t data = (uint8_t)(ch422g.regs.wr_set & ~REG_WR_SET_BIT_IO_OE);
-    esp_err_t res = ESP_FAIL;
+    esp_err_t res;
 
     // WR-SET
-    if (xSemaphoreTake(I2CMutexHandle, (TickType_t)100) == pdTRUE)
+    xSemaphoreTake(ModeMutex, portMAX_DELAY);
+    res = CH422G_write_mode((uint8_t)(ch422g.regs.wr_set & ~REG_WR_SET_BIT_IO_OE));
+    xSemaphoreGive(ModeMutex);
+
+    if (res != ESP_OK)
     {
-        res = i2c_master_write_to_device(ch422g.i2c_num, CH422G_REG_WR_SET, &data, sizeof(data), pdMS_TO_TICKS(I2C_TIMEOUT_MS));
-        if (res == ESP_OK)
-        {
-            ch422g.regs.wr_set = data;
-        }
-        else
-        {
-            ESP_LOGE(TAG, "CH422G_enableAllIO_Input() failed");
-        }
-
-        xSemaphoreGive(I2CMutexHandle);
+        ESP_LOGE(TAG, "CH422G_enableAllIO_Input() failed");
     }
     
     // Delay 1ms to wait for the IO expander to switch to input mode
@@ -120,58 +154,87 @@ esp_err_t CH422G_enableAllIO_Input(void)
 
 /****************************************************************************
 * NAME:        
-* DESCRIPTION: 
-* PARAMETERS:  
+* DESCRIPTION: Read all the IO pins
+* PARAMETERS:  inputs: bit per pin, CH422G_IO_x
 * RETURN:      
-* NOTES:       
+* NOTES:       One bus transaction. Inputs can only be read with the whole
+*              port in input mode, so unless it already is, it's switched to
+*              input and back to output around the read
 *****************************************************************************/
-esp_err_t CH422G_read_input(uint8_t pin_bit, uint8_t* value)
+esp_err_t CH422G_read_inputs(uint8_t* inputs)
 {
+    uint8_t input_mode = 0;
+    uint8_t output_mode = CH422G_Mode_IO_OE;
     uint8_t temp = 0;
-    uint8_t data;
-    esp_err_t res = ESP_FAIL;
-    *value = 0;
+    uint8_t count;
+    esp_err_t res;
 
-    if (xSemaphoreTake(I2CMutexHandle, (TickType_t)100) == pdTRUE)
+    const tI2CBusOp scan_ops[] = 
     {
         // first set the pins to input mode (can't do separate input/output per pin)
-        data = 0;
-        res = i2c_master_write_to_device(ch422g.i2c_num, CH422G_Mode, &data, 1, pdMS_TO_TICKS(I2C_TIMEOUT_MS));
-        esp_rom_delay_us(1000);
+        I2C_BUS_WRITE(CH422G_Mode, &input_mode, 1),
+        I2C_BUS_DELAY(CH422G_INPUT_SETTLE_US),
+
+        // read pin state
+        I2C_BUS_READ(CH422G_REG_RD_IO, &temp, 1),
+
+        // return to output mode
+        I2C_BUS_WRITE(CH422G_Mode, &output_mode, 1)
+    };
 
-        if (res == ESP_OK)
-        {
-            // read pin state
-            res = i2c_master_read_from_device(ch422g.i2c_num, ch422g.i2c_address, &temp, 1, pdMS_TO_TICKS(I2C_TIMEOUT_MS));
+    const tI2CBusOp read_ops[] = {I2C_BUS_READ(CH422G_REG_RD_IO, &temp, 1)};
 
-            if (res == ESP_OK)
-            {
-                res = i2c_master_read_from_device(ch422g.i2c_num, CH422G_REG_RD_IO, &temp, 1, pdMS_TO_TICKS(I2C_TIMEOUT_MS));
+    *inputs = 0;
 
-                // return to output mode
-                data = CH422G_Mode_IO_OE;
-                res = i2c_master_write_to_device(ch422g.i2c_num, CH422G_Mode, &data, 1, pdMS_TO_TICKS(I2C_TIMEOUT_MS));
-            }
-        }
+    xSemaphoreTake(ModeMutex, portMAX_DELAY);
 
-        xSemaphoreGive(I2CMutexHandle);
+    if (ch422g.wr_set_valid && ((ch422g.regs.wr_set & CH422G_Mode_IO_OE) == 0))
+    {
+        // already in input mode
+        res = i2c_bus_transaction(I2C_BUS_PRIORITY_FOOTSWITCH, read_ops, 1, CH422G_BUS_TIMEOUT_MS);
     }
-    
+    else
+    {
+        count = sizeof(scan_ops) / sizeof(scan_ops[0]);
+        res = i2c_bus_transaction(I2C_BUS_PRIORITY_FOOTSWITCH, scan_ops, count, CH422G_BUS_TIMEOUT_MS);
+
+        // left in output mode, unless it failed part way
+        ch422g.regs.wr_set = output_mode;
+        ch422g.wr_set_valid = (res == ESP_OK);
+    }
+
+    xSemaphoreGive(ModeMutex);
+
     if (res == ESP_OK)
     {
-        if ((temp & (1 << pin_bit)) != 0)
-        {
-            *value = 1;
-        }
+        *inputs = temp;
     }
     else
     {
-        ESP_LOGE(TAG, "CH422G_read_input_reg() failed");
+        ESP_LOGE(TAG, "CH422G_read_inputs() failed");
     }
 
     return res;
 }
 
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Read one IO pin
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Reads them all, use CH422G_read_inputs() for more than one
+*****************************************************************************/
+esp_err_t CH422G_read_input(uint8_t pin_bit, uint8_t* value)
+{
+    uint8_t inputs;
+    esp_err_t res;
+
+    res = CH422G_read_inputs(&inputs);
+    *value = ((inputs & (1 << pin_bit)) != 0) ? 1 : 0;
+
+    return res;
+}
+
 /****************************************************************************
 * NAME:        
 * DESCRIPTION: 
@@ -181,7 +244,7 @@ esp_err_t CH422G_read_input(uint8_t pin_bit, uint8_t* value)
 *****************************************************************************/
 esp_err_t CH422G_write_output(uint8_t pin_bit, uint8_t value)
 {
-	esp_err_t res = ESP_FAIL;
+	esp_err_t res;
 
     if (value)
     {
@@ -192,17 +255,13 @@ esp_err_t CH422G_write_output(uint8_t pin_bit, uint8_t value)
         ch422g.regs.wr_io &= ~(1 << pin_bit);
     }
     
+    const tI2CBusOp ops[] = {I2C_BUS_WRITE(CH422G_REG_WR_IO, &ch422g.regs.wr_io, sizeof(ch422g.regs.wr_io))};
+
     // WR-IO
-    if (xSemaphoreTake(I2CMutexHandle, (TickType_t)100) == pdTRUE)
+    res = i2c_bus_transaction(I2C_BUS_PRIORITY_HOUSEKEEPING, ops, 1, CH422G_BUS_TIMEOUT_MS);
+    if (res != ESP_OK)
     {
-        res = i2c_master_write_to_device(ch422g.i2c_num, CH422G_REG_WR_IO, &ch422g.regs.wr_io, sizeof(ch422g.regs.wr_io), pdMS_TO_TICKS(I2C_TIMEOUT_MS));
-        
-        if (res != ESP_OK)
-        {
-            ESP_LOGE(TAG, "CH422G_write_output_reg() failed 1");
-        }
-
-        xSemaphoreGive(I2CMutexHandle);
+        ESP_LOGE(TAG, "CH422G_write_output_reg() failed 1");
     }
 	
     return res;
@@ -230,8 +289,12 @@ esp_err_t CH422G_read_output_reg(uint32_t *value)
 *****************************************************************************/
 esp_err_t CH422G_write_direction(uint8_t pin_bit, uint8_t value)
 {
-    esp_err_t res = ESP_FAIL;
-    uint8_t data = ch422g.regs.wr_set;
+    esp_err_t res;
+    uint8_t data;
+
+    xSemaphoreTake(ModeMutex, portMAX_DELAY);
+
+    data = ch422g.regs.wr_set;
 
     // REG_WR_SET_BIT_IO_OE??
     if (value)
@@ -244,20 +307,13 @@ esp_err_t CH422G_write_direction(uint8_t pin_bit, uint8_t value)
     }
 
     // WR-SET
-    if (xSemaphoreTake(I2CMutexHandle, (TickType_t)100) == pdTRUE)
+    res = CH422G_write_mode(data);
+
+    xSemaphoreGive(ModeMutex);
+
+    if (res != ESP_OK)
     {
-        res = i2c_master_write_to_device(ch422g.i2c_num, CH422G_REG_WR_SET, &data, sizeof(data), pdMS_TO_TICKS(I2C_TIMEOUT_MS));
-
-        if (res == ESP_OK)
-        {
-            ch422g.regs.wr_set = data;
-        }
-        else
-        {
-            ESP_LOGE(TAG, "CH422G_write_direction_reg() failed 1");
-        }
-
-        xSemaphoreGive(I2CMutexHandle);
+        ESP_LOGE(TAG, "CH422G_write_direction_reg() failed 1");
     }
 
     return res;
@@ -286,7 +342,7 @@ esp_err_t CH422G_read_direction_reg(uint32_t *value)
 *****************************************************************************/
 esp_err_t CH422G_set_io_mode(uint8_t output_mode)
 {
-    esp_err_t res = ESP_FAIL;
+    esp_err_t res;
     uint8_t data;
 
     if (output_mode)
@@ -298,12 +354,9 @@ esp_err_t CH422G_set_io_mode(uint8_t output_mode)
         data = 0;
     }
 
-    if (xSemaphoreTake(I2CMutexHandle, (TickType_t)100) == pdTRUE)
-    {
-        res = i2c_master_write_to_device(ch422g.i2c_num, CH422G_Mode, &data, 1, pdMS_TO_TICKS(I2C_TIMEOUT_MS));
-
-        xSemaphoreGive(I2CMutexHandle);
-    }
+    xSemaphoreTake(ModeMutex, portMAX_DELAY);
+    res = CH422G_write_mode(data);
+    xSemaphoreGive(ModeMutex);
 
     return res;
 }
@@ -330,11 +383,14 @@ esp_err_t CH422G_reset(void)
 * RETURN:      
 * NOTES:       
 *****************************************************************************/
-esp_err_t CH422G_init(i2c_port_t i2c_num, SemaphoreHandle_t I2CMutex)
+esp_err_t CH422G_init(void)
 {
-    I2CMutexHandle = I2CMutex;
+    ModeMutex = xSemaphoreCreateMutex();
+    if (ModeMutex == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
 
-    ch422g.i2c_num = i2c_num;
     ch422g.i2c_address = ESP_IO_EXPANDER_I2C_CH422G_ADDRESS_000;
     ch422g.config.io_count = IO_COUNT;
 	ch422g.regs.wr_set = REG_WR_SET_DEFAULT_VAL;
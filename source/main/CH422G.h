@@ -70,9 +70,10 @@ typedef enum
     IO_EXPANDER_OUTPUT,         /*!< Output dircetion */
 } esp_io_expander_dir_t;
 
-esp_err_t CH422G_init(i2c_port_t i2c_num, SemaphoreHandle_t I2CMutex);
+esp_err_t CH422G_init(void);
 esp_err_t CH422G_reset(void);
 esp_err_t CH422G_read_input(uint8_t pin_bit, uint8_t* value);
+esp_err_t CH422G_read_inputs(uint8_t* inputs);
 esp_err_t CH422G_write_direction(uint8_t pin_bit, uint8_t value);
 esp_err_t CH422G_write_output(uint8_t pin_bit, uint8_t value);
 esp_err_t CH422G_set_io_mode(uint8_t output_mode);
\ No newline at end of file
@@ -25,6 +25,8 @@ limitations under the License.
 #include "freertos/semphr.h"
 #include "esp_check.h"
 #include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
 #include "usb/usb_host.h"
 #include "driver/i2c.h"
 #include "nvs_flash.h"
@@ -36,38 +38,80 @@ limitations under the License.
 #include "footswitches.h"
 #include "display.h"
 #include "usb_comms.h"
+#include "event_bus.h"
+#include "macro.h"
+#include "midi_parser.h"
+#include "midi_map.h"
+#include "midi_serial.h"
 #include "task_priorities.h"
 
 #define CTRL_TASK_STACK_SIZE   (3 * 1024)
-#define NVS_USERDATA_NAME       "userdata"        
+#define NVS_USERDATA_NAME       "userdata"        // legacy config + inline preset table
+#define NVS_CONFIG_NAME         "config"
+#define NVS_PRESET_MAP_NAME     "udmap"
+#define NVS_PRESET_KEY_FORMAT   "ud%03d"
+#define NVS_SETLIST_NAME        "setlist"
+#define NVS_MACROS_NAME         "macros"
+#define NVS_MIDI_MAP_NAME       "midimap"
+#define NVS_PRESETS_PARTITION   "presets"         // preset table, when the partition table has it
 
 #define MAX_TEXT_LENGTH                         128
-#define MAX_PRESETS_DEFAULT                     20
+#define MAX_PRESETS_LEGACY                      20
+#define MIDI_CC_BANK_SELECT_MSB                 0
+#define MIDI_CC_BANK_SELECT_LSB                 32
+
+#define PRESET_BITMAP_SIZE                      ((MAX_LOGICAL_PRESETS + 7) / 8)
+#define SETLIST_SONG_NONE                       -1
+#define SETLIST_SKIN_PRESET                     0xFFFF      // use the skin saved with the preset
+#define SETLIST_QUEUE_WAIT_MS                   50
+#define DEDUPE_WINDOW_UNITS_MS                  10          // config stores the window in 10 msec units
+#define DEDUPE_WINDOW_DEFAULT                   10
+#define MIDI_CC_MACRO_TRIGGER_FIRST             102         // undefined CCs 102 to 119, one per macro
+#define MIDI_CC_SWITCH_ON_THRESHOLD             64
+#define MACRO_NONE                              -1
 
 enum CommandEvents
 {
     EVENT_PRESET_DOWN,
     EVENT_PRESET_UP,
     EVENT_PRESET_INDEX,
+    EVENT_BANK_SELECT_MSB,
+    EVENT_BANK_SELECT_LSB,
+    EVENT_BANK_DOWN,
+    EVENT_BANK_UP,
+    EVENT_BYPASS_TOGGLE,
+    EVENT_BYPASS_SET,
     EVENT_SET_PRESET_DETAILS,
     EVENT_SET_USB_STATUS,
     EVENT_SET_BT_STATUS,
     EVENT_SET_AMP_SKIN,
     EVENT_SAVE_USER_DATA,
     EVENT_SET_USER_TEXT,
+    EVENT_SETLIST_CLEAR,
+    EVENT_SETLIST_SET_SONG,
+    EVENT_MACRO_SET,
+    EVENT_MACRO_RUN,
+    EVENT_MACRO_CONTINUE,
+    EVENT_MIDI_MAP_SET,
+    EVENT_MIDI_MAP_LEARNED,
     EVENT_SET_CONFIG_BT_MODE,
     EVENT_SET_CONFIG_MV_CHOC_ENABLE,
     EVENT_SET_CONFIG_XV_MD1_ENABLE,
     EVENT_SET_CONFIG_MIDI_ENABLE,
     EVENT_SET_CONFIG_MIDI_CHANNEL,
-    EVENT_SET_CONFIG_TOGGLE_BYPASS
+    EVENT_SET_CONFIG_TOGGLE_BYPASS,
+    EVENT_SET_CONFIG_SETLIST_MODE,
+    EVENT_SET_CONFIG_DEDUPE_WINDOW,
+    EVENT_SET_CONFIG_PERF_OVERLAY
 };
 
 typedef struct
 {
     uint8_t Event;
+    uint8_t Source;                 // enum ControlSources, preset requests only
     char Text[MAX_TEXT_LENGTH];
     uint32_t Value;
+    int64_t Timestamp;              // usec, time of the request
 } tControlMessage;
 
 typedef struct __attribute__ ((packed)) 
@@ -78,8 +122,6 @@ typedef struct __attribute__ ((packed))
 
 typedef struct __attribute__ ((packed)) 
 {
-    tUserData UserData[MAX_PRESETS_DEFAULT];
-
     uint8_t BTMode;
 
     // bt client flags
@@ -95,14 +137,45 @@ typedef struct __attribute__ ((packed))
 
     // general flags
     uint16_t GeneralDoublePressToggleBypass: 1;
-    uint16_t GeneralSpare: 15;
+    uint16_t GeneralSetlistMode: 1;
+    uint16_t GeneralPerfOverlay: 1;
+    uint16_t GeneralSpare: 13;
 
-    uint8_t Spare;
+    // preset requests repeated inside this window are dropped. 0 = disabled
+    uint8_t InputDedupeWindow;                   // in DEDUPE_WINDOW_UNITS_MS
 } tConfigData;
 
+// layout used by firmware up to 1.0.4.x, with the preset table inline. Only used for migration
+typedef struct __attribute__ ((packed)) 
+{
+    tUserData UserData[MAX_PRESETS_LEGACY];
+    tConfigData ConfigData;
+} tLegacyConfigData;
+
+typedef struct __attribute__ ((packed)) 
+{
+    uint16_t LogicalPreset;                      // 0-based bank/preset index
+    uint16_t SkinIndex;                          // or SETLIST_SKIN_PRESET
+    uint8_t Bypass;                              // enum USB_Bypass
+    char Name[SETLIST_SONG_NAME_LENGTH];
+} tSetlistSong;
+
+typedef struct __attribute__ ((packed)) 
+{
+    uint8_t Count;
+    tSetlistSong Songs[MAX_SETLIST_SONGS];
+} tSetlist;
+
 typedef struct 
 {
-    uint32_t PresetIndex;                        // 0-based index
+    uint32_t PresetIndex;                        // 0-based pedal preset index
+    uint16_t LogicalPreset;                      // 0-based bank/preset index
+    uint16_t BankIndex;
+    uint8_t BankMSB;
+    uint8_t BankLSB;
+    uint8_t BankLSBReceived;                     // 0 while the controller only sends CC 0
+    int16_t SongIndex;                           // current setlist song, or SETLIST_SONG_NONE
+    int16_t StagedSong;                          // song pre-staged in USB and UI, or SETLIST_SONG_NONE
     char PresetName[MAX_TEXT_LENGTH];
     uint32_t USBStatus;
     uint32_t BTStatus;
@@ -112,6 +185,54 @@ typedef struct
 static const char *TAG = "app_control";
 static QueueHandle_t control_input_queue;
 static tControlData ControlData;
+static tSetlist Setlist;
+
+// macro engine. Compiled code per macro, one macro runs at a time
+typedef struct
+{
+    int8_t Index;                   // running macro or MACRO_NONE
+    uint8_t PC;
+    uint32_t Generation;            // bumped on each start, stale timer events are ignored
+    int64_t NextTime;               // usec, schedule is relative to the macro start so waits don't drift
+    int32_t PendingPreset;          // logical preset to send at the next flush, or -1
+    uint8_t PendingBypass;          // enum USB_Bypass
+    int32_t PendingSkin;            // skin to show at the next flush, or -1. Not saved to the preset
+    uint8_t PendingUI;
+} tMacroState;
+
+static uint8_t MacroCode[MAX_MACROS][MACRO_MAX_CODE];
+static tMacroState MacroState;
+static esp_timer_handle_t MacroTimer;
+static tMidiMapping MidiMappings[MAX_MIDI_MAPPINGS];
+
+// input arbitration
+static tControlSourceStats SourceStats[CONTROL_SOURCE_MAX];
+static uint8_t LastRequestEvent;
+static uint32_t LastRequestValue;
+static uint8_t LastRequestSource;
+static int64_t LastRequestTime;
+
+// higher value wins. Inside the dedupe window, requests from a lower priority
+// source than the last accepted one are dropped
+static const uint8_t SourcePriority[CONTROL_SOURCE_MAX] = 
+{
+    [CONTROL_SOURCE_FOOTSWITCH] = 3,
+    [CONTROL_SOURCE_TOUCH] = 3,
+    [CONTROL_SOURCE_MIDI_SERIAL] = 2,
+    [CONTROL_SOURCE_BT_CENTRAL] = 1,
+    [CONTROL_SOURCE_BT_PERIPHERAL] = 1,
+};
+
+// sparse per-preset user data. Table of pointers indexed by logical preset, entries
+// only allocated once a preset has been customised. Lives in PSRAM
+static tUserData** UserDataTable;
+static uint8_t UserDataDirty[PRESET_BITMAP_SIZE];
+static const char* PresetPartition = NVS_DEFAULT_PART_NAME;
+static const tUserData DefaultUserData = 
+{
+    .SkinIndex = 0,
+    .PresetDescription = "Description"
+};
 
 static uint8_t SaveUserData(void);
 static uint8_t LoadUserData(void);
@@ -123,208 +244,1205 @@ static uint8_t LoadUserData(void);
 * RETURN:      
 * NOTES:       
 *****************************************************************************/
-static uint8_t process_control_command(tControlMessage* message)
+static const tUserData* get_user_data(uint16_t logical_preset)
 {
-    ESP_LOGI(TAG, "Control command %d", message->Event);
+    if ((UserDataTable != NULL) && (logical_preset < MAX_LOGICAL_PRESETS) && (UserDataTable[logical_preset] != NULL))
+    {
+        return UserDataTable[logical_preset];
+    }
 
-    // check what we got
-    switch (message->Event)
+    return &DefaultUserData;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Must only be called from the control task
+*****************************************************************************/
+static tUserData* get_user_data_writable(uint16_t logical_preset)
+{
+    if ((UserDataTable == NULL) || (logical_preset >= MAX_LOGICAL_PRESETS))
     {
-        case EVENT_PRESET_DOWN:
+        return NULL;
+    }
+
+    if (UserDataTable[logical_preset] == NULL)
+    {
+        // first change to this preset, create an entry from the defaults
+        tUserData* entry = heap_caps_malloc(sizeof(tUserData), MALLOC_CAP_SPIRAM);
+        if (entry == NULL)
         {
-            if (ControlData.USBStatus != 0)
-            {
-                // send message to USB
-                usb_previous_preset();
-            }
-        } break;
+            entry = malloc(sizeof(tUserData));
+        }
 
-        case EVENT_PRESET_UP:
+        if (entry == NULL)
         {
-            if (ControlData.USBStatus != 0)
-            {
-                // send message to USB
-                usb_next_preset();
-            }
-        } break;
+            ESP_LOGE(TAG, "Failed to allocate user data for preset %d", (int)logical_preset);
+            return NULL;
+        }
 
-        case EVENT_PRESET_INDEX:
+        memcpy((void*)entry, (void*)&DefaultUserData, sizeof(tUserData));
+        UserDataTable[logical_preset] = entry;
+    }
+
+    UserDataDirty[logical_preset / 8] |= (1 << (logical_preset % 8));
+
+    return UserDataTable[logical_preset];
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      1 if the current preset was selected from the setlist
+* NOTES:       
+*****************************************************************************/
+static uint8_t is_setlist_song_active(void)
+{
+    return ControlData.ConfigData.GeneralSetlistMode && 
+           (ControlData.SongIndex != SETLIST_SONG_NONE) && 
+           (ControlData.SongIndex < Setlist.Count) &&
+           (Setlist.Songs[ControlData.SongIndex].LogicalPreset == ControlData.LogicalPreset);
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static void format_song_label(uint16_t song, char* label, size_t length)
+{
+    snprintf(label, length, "%d: %s", (int)song + 1, Setlist.Songs[song].Name);
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static uint16_t get_song_skin(uint16_t song)
+{
+    if (Setlist.Songs[song].SkinIndex < SKIN_MAX)
+    {
+        return Setlist.Songs[song].SkinIndex;
+    }
+
+    return get_user_data(Setlist.Songs[song].LogicalPreset)->SkinIndex;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static void update_preset_ui(void)
+{
+#if !CONFIG_TONEX_CONTROLLER_DISPLAY_NONE
+    const tUserData* user_data = get_user_data(ControlData.LogicalPreset);
+    char label[MAX_TEXT_LENGTH];
+    uint16_t skin = user_data->SkinIndex;
+
+    if (is_setlist_song_active())
+    {
+        // showing a song, use its name and skin
+        format_song_label(ControlData.SongIndex, label, sizeof(label));
+        skin = get_song_skin(ControlData.SongIndex);
+    }
+    else
+    {
+        snprintf(label, sizeof(label), "%d: %s", (int)ControlData.LogicalPreset + 1, ControlData.PresetName);
+    }
+
+    // update UI
+    UI_SetPresetLabel(label);
+    UI_SetAmpSkin(skin);
+    UI_SetPresetDescription((char*)user_data->PresetDescription);
+
+    // get the skins either side ready, the next song is already staged
+    if (is_setlist_song_active())
+    {
+        if (ControlData.SongIndex > 0)
         {
-            if (ControlData.USBStatus != 0)
-            {
-                // send message to USB
-                usb_set_preset(message->Value);
-            }
-        } break;
+            UI_PrefetchSkin(get_song_skin(ControlData.SongIndex - 1));
+        }
+    }
+    else
+    {
+        if (ControlData.LogicalPreset > 0)
+        {
+            UI_PrefetchSkin(get_user_data(ControlData.LogicalPreset - 1)->SkinIndex);
+        }
 
-        case EVENT_SET_PRESET_DETAILS:
+        if ((ControlData.LogicalPreset + 1) < MAX_LOGICAL_PRESETS)
         {
-            ControlData.PresetIndex = message->Value;
+            UI_PrefetchSkin(get_user_data(ControlData.LogicalPreset + 1)->SkinIndex);
+        }
+    }
+#endif //CONFIG_TONEX_CONTROLLER_DISPLAY_NONE            
+}
 
-            memcpy((void*)ControlData.PresetName, (void*)message->Text, MAX_TEXT_LENGTH);
-            ControlData.PresetName[MAX_TEXT_LENGTH - 1] = 0;
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static void select_logical_preset(int32_t logical_preset)
+{
+    if ((logical_preset < 0) || (logical_preset >= MAX_LOGICAL_PRESETS))
+    {
+        ESP_LOGW(TAG, "Logical preset %d out of range", (int)logical_preset);
+        return;
+    }
+
+    uint16_t pedal_preset = logical_preset % MAX_PEDAL_PRESETS;
+    uint8_t bank_switch_only = (pedal_preset == ControlData.PresetIndex) && (logical_preset != ControlData.LogicalPreset);
+
+    ControlData.LogicalPreset = logical_preset;
+    ControlData.BankIndex = logical_preset / PRESETS_PER_BANK;
+
+    if (ControlData.USBStatus != 0)
+    {
+        if (bank_switch_only)
+        {
+            // another bank mapped to the preset already loaded, nothing for the pedal to do
+            update_preset_ui();
+        }
+        else
+        {
+            // send message to USB
+            usb_set_preset(pedal_preset);
+        }
+    }
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Pre-stage a song so selecting it is a single USB write and UI swap
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static void stage_song(int32_t song)
+{
+    if ((song < 0) || (song >= Setlist.Count))
+    {
+        ControlData.StagedSong = SETLIST_SONG_NONE;
+        return;
+    }
+
+    tSetlistSong* entry = &Setlist.Songs[song];
+
+    if (ControlData.USBStatus != 0)
+    {
+        usb_stage_preset(entry->LogicalPreset % MAX_PEDAL_PRESETS, entry->Bypass);
+    }
 
 #if !CONFIG_TONEX_CONTROLLER_DISPLAY_NONE
-            // update UI
-            UI_SetPresetLabel(ControlData.PresetName);
-            UI_SetAmpSkin(ControlData.ConfigData.UserData[ControlData.PresetIndex].SkinIndex);
-            UI_SetPresetDescription(ControlData.ConfigData.UserData[ControlData.PresetIndex].PresetDescription);
+    char label[MAX_TEXT_LENGTH];
+
+    format_song_label(song, label, sizeof(label));
+    UI_StageSong(get_song_skin(song), label, (char*)get_user_data(entry->LogicalPreset)->PresetDescription);
 #endif //CONFIG_TONEX_CONTROLLER_DISPLAY_NONE            
-        } break;
 
-        case EVENT_SET_USB_STATUS:
+    ControlData.StagedSong = song;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static void select_song(int32_t song)
+{
+    if ((song < 0) || (song >= Setlist.Count))
+    {
+        ESP_LOGW(TAG, "Song %d out of range", (int)song);
+        return;
+    }
+
+    tSetlistSong* entry = &Setlist.Songs[song];
+    uint8_t was_staged = (ControlData.StagedSong == song);
+
+    ESP_LOGI(TAG, "Song %d: %s", (int)song + 1, entry->Name);
+
+    ControlData.SongIndex = song;
+    ControlData.LogicalPreset = entry->LogicalPreset;
+    ControlData.BankIndex = entry->LogicalPreset / PRESETS_PER_BANK;
+
+    if (ControlData.USBStatus != 0)
+    {
+        // uses the pre-built frame if staged, otherwise builds it on the spot
+        usb_set_staged_preset(entry->LogicalPreset % MAX_PEDAL_PRESETS, entry->Bypass);
+    }
+
+#if !CONFIG_TONEX_CONTROLLER_DISPLAY_NONE
+    if (was_staged)
+    {
+        UI_CommitStagedSong();
+    }
+    else
+    {
+        update_preset_ui();
+    }
+#endif //CONFIG_TONEX_CONTROLLER_DISPLAY_NONE            
+
+    // get the next song ready
+    stage_song(song + 1);
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Parse a song entry "preset,skin,bypass,name"
+* PARAMETERS:  
+* RETURN:      1 if valid
+* NOTES:       preset is 1-based, skin is 1-based or 0 to use the preset skin,
+*              bypass is one of on, off or blank to leave unchanged
+*****************************************************************************/
+static uint8_t parse_song(char* text, tSetlistSong* song)
+{
+    unsigned int preset = 0;
+    unsigned int skin = 0;
+    char bypass[8] = {0};
+    int consumed = 0;
+
+    memset((void*)song, 0, sizeof(tSetlistSong));
+
+    if (sscanf(text, " %u , %u ,%7[^,],%n", &preset, &skin, bypass, &consumed) < 3)
+    {
+        // bypass field may be empty
+        consumed = 0;
+        if (sscanf(text, " %u , %u ,,%n", &preset, &skin, &consumed) < 2)
         {
-            ControlData.USBStatus = message->Value;
+            return 0;
+        }
+    }
+
+    if ((preset == 0) || (preset > MAX_LOGICAL_PRESETS) || (skin > SKIN_MAX) || (consumed == 0))
+    {
+        return 0;
+    }
+
+    song->LogicalPreset = preset - 1;
+    song->SkinIndex = (skin == 0) ? SETLIST_SKIN_PRESET : (skin - 1);
+
+    if (strstr(bypass, "on") != NULL)
+    {
+        song->Bypass = USB_BYPASS_ON;
+    }
+    else if (strstr(bypass, "off") != NULL)
+    {
+        song->Bypass = USB_BYPASS_OFF;
+    }
+    else
+    {
+        song->Bypass = USB_BYPASS_UNCHANGED;
+    }
+
+    while (text[consumed] == ' ')
+    {
+        consumed++;
+    }
+
+    strncpy(song->Name, &text[consumed], SETLIST_SONG_NAME_LENGTH - 1);
+    song->Name[SETLIST_SONG_NAME_LENGTH - 1] = 0;
+
+    return 1;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Send any preset/bypass change accumulated by the macro
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Consecutive steps between waits go out as a single USB write
+*****************************************************************************/
+static void macro_flush(void)
+{
+    if ((MacroState.PendingPreset >= 0) || (MacroState.PendingBypass != USB_BYPASS_UNCHANGED))
+    {
+        if (MacroState.PendingPreset >= 0)
+        {
+            ControlData.LogicalPreset = MacroState.PendingPreset;
+            ControlData.BankIndex = MacroState.PendingPreset / PRESETS_PER_BANK;
+        }
+
+        if (ControlData.USBStatus != 0)
+        {
+            usb_set_preset_state(ControlData.LogicalPreset % MAX_PEDAL_PRESETS, MacroState.PendingBypass);
+        }
+
+        MacroState.PendingUI = 1;
+    }
+
+    if (MacroState.PendingUI)
+    {
+        update_preset_ui();
+
+#if !CONFIG_TONEX_CONTROLLER_DISPLAY_NONE
+        if (MacroState.PendingSkin >= 0)
+        {
+            // over the preset's own skin
+            UI_SetAmpSkin(MacroState.PendingSkin);
+        }
+#endif
+    }
+
+    MacroState.PendingPreset = -1;
+    MacroState.PendingBypass = USB_BYPASS_UNCHANGED;
+    MacroState.PendingSkin = -1;
+    MacroState.PendingUI = 0;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Run the current macro up to the next wait or the end
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static void macro_execute(void)
+{
+    tMacroOp op;
+
+    if (MacroState.Index == MACRO_NONE)
+    {
+        return;
+    }
+
+    while (macro_decode(MacroCode[MacroState.Index], &MacroState.PC, &op))
+    {
+        switch (op.Opcode)
+        {
+            case MACRO_OP_PRESET:
+            {
+                if (op.Operand < MAX_LOGICAL_PRESETS)
+                {
+                    MacroState.PendingPreset = op.Operand;
+                }
+            } break;
+
+            case MACRO_OP_BYPASS:
+            {
+                if ((op.Operand == USB_BYPASS_TOGGLE) && (MacroState.PendingBypass == USB_BYPASS_TOGGLE))
+                {
+                    // toggled twice before sending
+                    MacroState.PendingBypass = USB_BYPASS_UNCHANGED;
+                }
+                else
+                {
+                    MacroState.PendingBypass = op.Operand;
+                }
+            } break;
+
+            case MACRO_OP_SKIN:
+            {
+                // display only, the preset's saved skin is left alone
+                if (op.Operand < SKIN_MAX)
+                {
+                    MacroState.PendingSkin = op.Operand;
+                    MacroState.PendingUI = 1;
+                }
+            } break;
+
+            case MACRO_OP_MIDI_PC:
+            {
+                midi_serial_send_program(op.Operand);
+            } break;
+
+            case MACRO_OP_WAIT:
+            {
+                int64_t delay;
+
+                macro_flush();
+
+                MacroState.NextTime += (int64_t)op.Operand * 1000;
+                delay = MacroState.NextTime - esp_timer_get_time();
+
+                if (delay > 0)
+                {
+                    esp_timer_start_once(MacroTimer, delay);
+                    return;
+                }
+            } break;
+        }
+    }
+
+    macro_flush();
+
+    ESP_LOGI(TAG, "Macro %d done", (int)MacroState.Index + 1);
+    MacroState.Index = MACRO_NONE;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static void macro_start(uint8_t index)
+{
+    if ((index >= MAX_MACROS) || (MacroCode[index][0] == MACRO_OP_END))
+    {
+        ESP_LOGW(TAG, "Macro %d not defined", (int)index + 1);
+        return;
+    }
+
+    // a new macro replaces any running one
+    esp_timer_stop(MacroTimer);
+
+    ESP_LOGI(TAG, "Macro %d start", (int)index + 1);
+
+    MacroState.Index = index;
+    MacroState.PC = 0;
+    MacroState.Generation++;
+    MacroState.NextTime = esp_timer_get_time();
+    MacroState.PendingPreset = -1;
+    MacroState.PendingBypass = USB_BYPASS_UNCHANGED;
+    MacroState.PendingSkin = -1;
+    MacroState.PendingUI = 0;
+
+    macro_execute();
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Decide if a preset request should be actioned
+* PARAMETERS:  
+* RETURN:      1 if accepted
+* NOTES:       
+*****************************************************************************/
+static uint8_t arbitrate_preset_request(tControlMessage* message)
+{
+    int64_t window = (int64_t)ControlData.ConfigData.InputDedupeWindow * DEDUPE_WINDOW_UNITS_MS * 1000;
+    tControlSourceStats* stats;
+
+    if (message->Source >= CONTROL_SOURCE_MAX)
+    {
+        ESP_LOGW(TAG, "Unknown request source %d", (int)message->Source);
+        return 0;
+    }
+
+    stats = &SourceStats[message->Source];
+    stats->Received++;
+
+    if ((window != 0) && (LastRequestTime != 0) && ((message->Timestamp - LastRequestTime) < window))
+    {
+        if ((message->Event == LastRequestEvent) && (message->Value == LastRequestValue))
+        {
+            ESP_LOGI(TAG, "Duplicate request from source %d dropped", (int)message->Source);
+            stats->Duplicates++;
+            return 0;
+        }
+
+        if (SourcePriority[message->Source] < SourcePriority[LastRequestSource])
+        {
+            ESP_LOGI(TAG, "Request from source %d preempted by source %d", (int)message->Source, (int)LastRequestSource);
+            stats->Preempted++;
+            return 0;
+        }
+    }
+
+    LastRequestEvent = message->Event;
+    LastRequestValue = message->Value;
+    LastRequestSource = message->Source;
+    LastRequestTime = message->Timestamp;
+    stats->Accepted++;
+
+    return 1;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static uint8_t process_control_command(tControlMessage* message)
+{
+    ESP_LOGI(TAG, "Control command %d", message->Event);
+
+    if ((message->Event == EVENT_PRESET_DOWN) || (message->Event == EVENT_PRESET_UP) || (message->Event == EVENT_PRESET_INDEX) ||
+        (message->Event == EVENT_BANK_DOWN) || (message->Event == EVENT_BANK_UP))
+    {
+        if (!arbitrate_preset_request(message))
+        {
+            return 0;
+        }
+    }
+
+    // check what we got
+    switch (message->Event)
+    {
+        case EVENT_PRESET_DOWN:
+        {
+            if (ControlData.ConfigData.GeneralSetlistMode && (Setlist.Count > 0))
+            {
+                select_song((int32_t)ControlData.SongIndex - 1);
+            }
+            else
+            {
+                select_logical_preset((int32_t)ControlData.LogicalPreset - 1);
+            }
+        } break;
+
+        case EVENT_PRESET_UP:
+        {
+            if (ControlData.ConfigData.GeneralSetlistMode && (Setlist.Count > 0))
+            {
+                select_song((int32_t)ControlData.SongIndex + 1);
+            }
+            else
+            {
+                select_logical_preset((int32_t)ControlData.LogicalPreset + 1);
+            }
+        } break;
+
+        case EVENT_PRESET_INDEX:
+        {
+            if (ControlData.ConfigData.GeneralSetlistMode && (Setlist.Count > 0))
+            {
+                // program change selects the song directly
+                select_song(message->Value);
+            }
+            else
+            {
+                // program change is relative to the currently selected bank
+                select_logical_preset(((int32_t)ControlData.BankIndex * PRESETS_PER_BANK) + message->Value);
+            }
+        } break;
+
+        case EVENT_BANK_SELECT_MSB:
+        case EVENT_BANK_SELECT_LSB:
+        {
+            if (message->Event == EVENT_BANK_SELECT_MSB)
+            {
+                ControlData.BankMSB = (uint8_t)message->Value;
+            }
+            else
+            {
+                ControlData.BankLSB = (uint8_t)message->Value;
+                ControlData.BankLSBReceived = 1;
+            }
+
+            // bank select takes effect on the next program change. Many controllers only
+            // send CC 0, in which case it is the bank on its own
+            uint16_t bank = ControlData.BankMSB;
+
+            if (ControlData.BankLSBReceived)
+            {
+                bank = ((uint16_t)ControlData.BankMSB << 7) | ControlData.BankLSB;
+            }
+
+            if (bank < MAX_BANKS)
+            {
+                ESP_LOGI(TAG, "Bank select %d", (int)bank);
+                ControlData.BankIndex = bank;
+            }
+            else
+            {
+                ESP_LOGW(TAG, "Bank select %d out of range", (int)bank);
+            }
+        } break;
+
+        case EVENT_BANK_DOWN:
+        case EVENT_BANK_UP:
+        {
+            // same preset position in the next bank
+            int32_t bank = (int32_t)ControlData.BankIndex + ((message->Event == EVENT_BANK_UP) ? 1 : -1);
+
+            if ((bank >= 0) && (bank < MAX_BANKS))
+            {
+                select_logical_preset((bank * PRESETS_PER_BANK) + (ControlData.LogicalPreset % PRESETS_PER_BANK));
+            }
+        } break;
+
+        case EVENT_BYPASS_TOGGLE:
+        {
+            if (ControlData.USBStatus != 0)
+            {
+                usb_set_preset_bypass(ControlData.LogicalPreset % MAX_PEDAL_PRESETS, USB_BYPASS_TOGGLE);
+            }
+        } break;
+
+        case EVENT_BYPASS_SET:
+        {
+            if (ControlData.USBStatus != 0)
+            {
+                usb_set_preset_bypass(ControlData.LogicalPreset % MAX_PEDAL_PRESETS, message->Value ? USB_BYPASS_ON : USB_BYPASS_OFF);
+            }
+        } break;
+
+        case EVENT_SET_PRESET_DETAILS:
+        {
+            ControlData.PresetIndex = message->Value;
+
+            // if the pedal changed preset by itself, follow it within the current bank
+            if ((ControlData.LogicalPreset % MAX_PEDAL_PRESETS) != ControlData.PresetIndex)
+            {
+                uint32_t logical_preset = (ControlData.BankIndex * PRESETS_PER_BANK) + ControlData.PresetIndex;
+
+                if (logical_preset >= MAX_LOGICAL_PRESETS)
+                {
+                    logical_preset = ControlData.PresetIndex;
+                }
+
+                ControlData.LogicalPreset = logical_preset;
+            }
+
+            memcpy((void*)ControlData.PresetName, (void*)message->Text, MAX_TEXT_LENGTH);
+            ControlData.PresetName[MAX_TEXT_LENGTH - 1] = 0;
+
+            update_preset_ui();
+
+            event_bus_publish(EVENT_BUS_TOPIC_PRESET_CHANGED, ControlData.LogicalPreset, ControlData.PresetName);
+        } break;
+
+        case EVENT_SET_USB_STATUS:
+        {
+            ControlData.USBStatus = message->Value;
+
+            if ((ControlData.USBStatus != 0) && ControlData.ConfigData.GeneralSetlistMode)
+            {
+                // stage the first song, or the next one if reconnecting mid set
+                stage_song((int32_t)ControlData.SongIndex + 1);
+            }
+
+#if !CONFIG_TONEX_CONTROLLER_DISPLAY_NONE
+            // update UI
+            UI_SetUSBStatus(ControlData.USBStatus);
+#endif //CONFIG_TONEX_CONTROLLER_DISPLAY_NONE            
+
+            event_bus_publish(EVENT_BUS_TOPIC_USB_STATUS, ControlData.USBStatus, NULL);
+        } break;
+
+        case EVENT_SET_BT_STATUS:
+        {
+            ControlData.BTStatus = message->Value;
+
+#if !CONFIG_TONEX_CONTROLLER_DISPLAY_NONE
+            // update UI
+            UI_SetBTStatus(ControlData.BTStatus);
+#endif //CONFIG_TONEX_CONTROLLER_DISPLAY_NONE                        
+
+            event_bus_publish(EVENT_BUS_TOPIC_BT_STATUS, ControlData.BTStatus, NULL);
+        } break;
+
+        case EVENT_SET_AMP_SKIN:
+        {
+            tUserData* user_data = get_user_data_writable(ControlData.LogicalPreset);
+
+            if ((user_data != NULL) && (message->Value < SKIN_MAX))
+            {
+                user_data->SkinIndex = message->Value;
+
+#if !CONFIG_TONEX_CONTROLLER_DISPLAY_NONE
+                // update UI
+                UI_SetAmpSkin(user_data->SkinIndex);
+#endif //CONFIG_TONEX_CONTROLLER_DISPLAY_NONE                                    
+            }
+        } break;
+
+        case EVENT_SAVE_USER_DATA:
+        {
+            // save it
+            SaveUserData();
+
+            event_bus_publish(EVENT_BUS_TOPIC_CONFIG_CHANGED, 0, NULL);
+
+            if (message->Value != 0)
+            {
+                ESP_LOGI(TAG, "Config save rebooting");
+                vTaskDelay(10);
+                esp_restart();
+            }
+        } break;
+
+        case EVENT_SET_USER_TEXT:
+        {
+            tUserData* user_data = get_user_data_writable(ControlData.LogicalPreset);
+
+            if (user_data != NULL)
+            {
+                memcpy((void*)user_data->PresetDescription, (void*)message->Text, MAX_TEXT_LENGTH);
+                user_data->PresetDescription[MAX_TEXT_LENGTH - 1] = 0;
+            }
+        } break;
+
+        case EVENT_SETLIST_CLEAR:
+        {
+            memset((void*)&Setlist, 0, sizeof(Setlist));
+            ControlData.SongIndex = SETLIST_SONG_NONE;
+            ControlData.StagedSong = SETLIST_SONG_NONE;
+        } break;
+
+        case EVENT_SETLIST_SET_SONG:
+        {
+            if (message->Value >= MAX_SETLIST_SONGS)
+            {
+                ESP_LOGW(TAG, "Setlist full");
+            }
+            else if (parse_song(message->Text, &Setlist.Songs[message->Value]))
+            {
+                if (message->Value >= Setlist.Count)
+                {
+                    Setlist.Count = message->Value + 1;
+                }
+            }
+            else
+            {
+                ESP_LOGW(TAG, "Setlist song %d invalid: %s", (int)message->Value + 1, message->Text);
+            }
+        } break;
+
+        case EVENT_MACRO_SET:
+        {
+            if (message->Value < MAX_MACROS)
+            {
+                uint8_t code[MACRO_MAX_CODE];
+
+                if (macro_compile(message->Text, code, sizeof(code)) != 0)
+                {
+                    if (MacroState.Index == message->Value)
+                    {
+                        esp_timer_stop(MacroTimer);
+                        MacroState.Index = MACRO_NONE;
+                    }
+
+                    memcpy((void*)MacroCode[message->Value], (void*)code, sizeof(code));
+                }
+            }
+        } break;
+
+        case EVENT_MIDI_MAP_SET:
+        {
+            if (message->Value < MAX_MIDI_MAPPINGS)
+            {
+                tMidiMapping mapping;
+
+                if (midi_map_compile(message->Text, &mapping))
+                {
+                    MidiMappings[message->Value] = mapping;
+                    midi_map_set(MidiMappings, MAX_MIDI_MAPPINGS);
+                }
+            }
+        } break;
+
+        case EVENT_MIDI_MAP_LEARNED:
+        {
+            // index, number, channel, type and inputs packed by control_learn_midi_mapping
+            uint8_t index = message->Value & 0xFF;
+
+            if ((index < MAX_MIDI_MAPPINGS) && (MidiMappings[index].Type == MIDI_MAP_TYPE_LEARN))
+            {
+                MidiMappings[index].Number = (message->Value >> 8) & 0x7F;
+                MidiMappings[index].Channel = (message->Value >> 16) & 0x0F;
+                MidiMappings[index].Type = (message->Value >> 20) & 0x0F;
+                MidiMappings[index].Inputs = (message->Value >> 24) & 0xFF;
+
+                // takes effect now, and the next learn entry waits for its message
+                midi_map_set(MidiMappings, MAX_MIDI_MAPPINGS);
+                SaveUserData();
+            }
+        } break;
+
+        case EVENT_MACRO_RUN:
+        {
+            macro_start(message->Value);
+        } break;
+
+        case EVENT_MACRO_CONTINUE:
+        {
+            if (message->Value == MacroState.Generation)
+            {
+                macro_execute();
+            }
+        } break;
+
+        case EVENT_SET_CONFIG_BT_MODE:
+        {
+            ESP_LOGI(TAG, "Config set BT mode %d", (int)message->Value);
+            ControlData.ConfigData.BTMode = (uint8_t)message->Value;
+        } break;
+
+        case EVENT_SET_CONFIG_MV_CHOC_ENABLE:
+        {
+            ESP_LOGI(TAG, "Config set MV Choc enable %d", (int)message->Value);
+            ControlData.ConfigData.BTClientMvaveChocolateEnable = (uint8_t)message->Value;
+        } break;
+
+        case EVENT_SET_CONFIG_XV_MD1_ENABLE:
+        {
+            ESP_LOGI(TAG, "Config set XV MD1 enable %d", (int)message->Value);
+            ControlData.ConfigData.BTClientXviveMD1Enable = (uint8_t)message->Value;
+        } break;
+
+        case EVENT_SET_CONFIG_MIDI_ENABLE:
+        {
+            ESP_LOGI(TAG, "Config set Midi enable %d", (int)message->Value);
+            ControlData.ConfigData.MidiSerialEnable = (uint8_t)message->Value;
+        } break;
+
+        case EVENT_SET_CONFIG_MIDI_CHANNEL:
+        {
+            ESP_LOGI(TAG, "Config set Midi channel %d", (int)message->Value);
+            ControlData.ConfigData.MidiChannel = (uint8_t)message->Value;
+        } break;
+
+        case EVENT_SET_CONFIG_TOGGLE_BYPASS:
+        {
+            ESP_LOGI(TAG, "Config set Toggle Bypass %d", (int)message->Value);
+            ControlData.ConfigData.GeneralDoublePressToggleBypass = (uint8_t)message->Value;
+        } break;
+
+        case EVENT_SET_CONFIG_SETLIST_MODE:
+        {
+            ESP_LOGI(TAG, "Config set Setlist mode %d", (int)message->Value);
+            ControlData.ConfigData.GeneralSetlistMode = (uint8_t)message->Value;
+        } break;
+
+        case EVENT_SET_CONFIG_DEDUPE_WINDOW:
+        {
+            ESP_LOGI(TAG, "Config set dedupe window %d", (int)message->Value);
+            ControlData.ConfigData.InputDedupeWindow = (uint8_t)MIN(message->Value / DEDUPE_WINDOW_UNITS_MS, UINT8_MAX);
+        } break;
+
+        case EVENT_SET_CONFIG_PERF_OVERLAY:
+        {
+            ESP_LOGI(TAG, "Config set Perf overlay %d", (int)message->Value);
+            ControlData.ConfigData.GeneralPerfOverlay = (uint8_t)message->Value;
+        } break;
+    }
+
+    return 1;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void control_request_preset_down(uint8_t source)
+{
+    tControlMessage message;
+
+    ESP_LOGI(TAG, "control_request_preset_down %d", source);            
+
+    message.Event = EVENT_PRESET_DOWN;
+    message.Source = source;
+    message.Value = 0;
+    message.Timestamp = esp_timer_get_time();
+
+    // send to queue
+    if (xQueueSend(control_input_queue, (void*)&message, 0) != pdPASS)
+    {
+        ESP_LOGE(TAG, "control_request_preset_down queue send failed!");            
+    }
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void control_request_preset_up(uint8_t source)
+{
+    tControlMessage message;
+
+    ESP_LOGI(TAG, "control_request_preset_up %d", source);
+
+    message.Event = EVENT_PRESET_UP;
+    message.Source = source;
+    message.Value = 0;
+    message.Timestamp = esp_timer_get_time();
+
+    // send to queue
+    if (xQueueSend(control_input_queue, (void*)&message, 0) != pdPASS)
+    {
+        ESP_LOGE(TAG, "control_request_preset_up queue send failed!");            
+    }
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void control_request_preset_index(uint8_t source, uint8_t index)
+{
+    tControlMessage message;
+
+    ESP_LOGI(TAG, "control_request_preset_index %d %d", source, index);
+
+    message.Event = EVENT_PRESET_INDEX;
+    message.Source = source;
+    message.Value = index;
+    message.Timestamp = esp_timer_get_time();
+
+    // send to queue
+    if (xQueueSend(control_input_queue, (void*)&message, 0) != pdPASS)
+    {
+        ESP_LOGE(TAG, "control_request_preset_index queue send failed!");            
+    }
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Move to the same preset position in the previous or next bank
+* PARAMETERS:  up: 1 for the next bank
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void control_request_bank_step(uint8_t source, uint8_t up)
+{
+    tControlMessage message;
 
-#if !CONFIG_TONEX_CONTROLLER_DISPLAY_NONE
-            // update UI
-            UI_SetUSBStatus(ControlData.USBStatus);
-#endif //CONFIG_TONEX_CONTROLLER_DISPLAY_NONE            
-        } break;
+    ESP_LOGI(TAG, "control_request_bank_step %d %d", source, up);
 
-        case EVENT_SET_BT_STATUS:
-        {
-            ControlData.BTStatus = message->Value;
+    message.Event = up ? EVENT_BANK_UP : EVENT_BANK_DOWN;
+    message.Source = source;
+    message.Value = 0;
+    message.Timestamp = esp_timer_get_time();
 
-#if !CONFIG_TONEX_CONTROLLER_DISPLAY_NONE
-            // update UI
-            UI_SetBTStatus(ControlData.BTStatus);
-#endif //CONFIG_TONEX_CONTROLLER_DISPLAY_NONE                        
-        } break;
+    // send to queue
+    if (xQueueSend(control_input_queue, (void*)&message, 0) != pdPASS)
+    {
+        ESP_LOGE(TAG, "control_request_bank_step queue send failed!");            
+    }
+}
 
-        case EVENT_SET_AMP_SKIN:
-        {
-            ControlData.ConfigData.UserData[ControlData.PresetIndex].SkinIndex = message->Value;
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Toggle bypass of the current preset
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void control_request_bypass_toggle(uint8_t source)
+{
+    tControlMessage message;
 
-#if !CONFIG_TONEX_CONTROLLER_DISPLAY_NONE
-            // update UI
-            UI_SetAmpSkin(ControlData.ConfigData.UserData[ControlData.PresetIndex].SkinIndex);
-#endif //CONFIG_TONEX_CONTROLLER_DISPLAY_NONE                                    
-        } break;
+    ESP_LOGI(TAG, "control_request_bypass_toggle %d", source);
 
-        case EVENT_SAVE_USER_DATA:
-        {
-            // save it
-            SaveUserData();
+    message.Event = EVENT_BYPASS_TOGGLE;
+    message.Source = source;
+    message.Value = 0;
+    message.Timestamp = esp_timer_get_time();
 
-            if (message->Value != 0)
-            {
-                ESP_LOGI(TAG, "Config save rebooting");
-                vTaskDelay(10);
-                esp_restart();
-            }
-        } break;
+    // send to queue
+    if (xQueueSend(control_input_queue, (void*)&message, 0) != pdPASS)
+    {
+        ESP_LOGE(TAG, "control_request_bypass_toggle queue send failed!");            
+    }
+}
 
-        case EVENT_SET_USER_TEXT:
-        {
-            memcpy((void*)ControlData.ConfigData.UserData[ControlData.PresetIndex].PresetDescription, (void*)message->Text, MAX_TEXT_LENGTH);
-            ControlData.ConfigData.UserData[ControlData.PresetIndex].PresetDescription[MAX_TEXT_LENGTH - 1] = 0;
-        } break;
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Set bypass of the current preset
+* PARAMETERS:  on: 1 to bypass, 0 to take it out of bypass
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void control_request_bypass(uint8_t source, uint8_t on)
+{
+    tControlMessage message;
 
-        case EVENT_SET_CONFIG_BT_MODE:
-        {
-            ESP_LOGI(TAG, "Config set BT mode %d", (int)message->Value);
-            ControlData.ConfigData.BTMode = (uint8_t)message->Value;
-        } break;
+    ESP_LOGI(TAG, "control_request_bypass %d %d", source, on);
 
-        case EVENT_SET_CONFIG_MV_CHOC_ENABLE:
-        {
-            ESP_LOGI(TAG, "Config set MV Choc enable %d", (int)message->Value);
-            ControlData.ConfigData.BTClientMvaveChocolateEnable = (uint8_t)message->Value;
-        } break;
+    message.Event = EVENT_BYPASS_SET;
+    message.Source = source;
+    message.Value = on;
+    message.Timestamp = esp_timer_get_time();
 
-        case EVENT_SET_CONFIG_XV_MD1_ENABLE:
-        {
-            ESP_LOGI(TAG, "Config set XV MD1 enable %d", (int)message->Value);
-            ControlData.ConfigData.BTClientXviveMD1Enable = (uint8_t)message->Value;
-        } break;
+    // send to queue
+    if (xQueueSend(control_input_queue, (void*)&message, 0) != pdPASS)
+    {
+        ESP_LOGE(TAG, "control_request_bypass queue send failed!");            
+    }
+}
 
-        case EVENT_SET_CONFIG_MIDI_ENABLE:
-        {
-            ESP_LOGI(TAG, "Config set Midi enable %d", (int)message->Value);
-            ControlData.ConfigData.MidiSerialEnable = (uint8_t)message->Value;
-        } break;
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Handle a Midi control change
+* PARAMETERS:  controller: Midi CC number. 0 (MSB) or 32 (LSB) for bank select,
+*                          102 onwards to trigger macros
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void control_request_midi_cc(uint8_t controller, uint8_t value)
+{
+    tControlMessage message;
 
-        case EVENT_SET_CONFIG_MIDI_CHANNEL:
-        {
-            ESP_LOGI(TAG, "Config set Midi channel %d", (int)message->Value);
-            ControlData.ConfigData.MidiChannel = (uint8_t)message->Value;
-        } break;
+    ESP_LOGI(TAG, "control_request_midi_cc %d %d", controller, value);
 
-        case EVENT_SET_CONFIG_TOGGLE_BYPASS:
+    if (controller == MIDI_CC_BANK_SELECT_MSB)
+    {
+        message.Event = EVENT_BANK_SELECT_MSB;
+        message.Value = value;
+    }
+    else if (controller == MIDI_CC_BANK_SELECT_LSB)
+    {
+        message.Event = EVENT_BANK_SELECT_LSB;
+        message.Value = value;
+    }
+    else if ((controller >= MIDI_CC_MACRO_TRIGGER_FIRST) && (controller < (MIDI_CC_MACRO_TRIGGER_FIRST + MAX_MACROS)))
+    {
+        if (value < MIDI_CC_SWITCH_ON_THRESHOLD)
         {
-            ESP_LOGI(TAG, "Config set Toggle Bypass %d", (int)message->Value);
-            ControlData.ConfigData.GeneralDoublePressToggleBypass = (uint8_t)message->Value;
-        } break;
+            // switch released
+            return;
+        }
+
+        message.Event = EVENT_MACRO_RUN;
+        message.Value = controller - MIDI_CC_MACRO_TRIGGER_FIRST;
+    }
+    else
+    {
+        return;
     }
 
-    return 1;
+    // send to queue
+    if (xQueueSend(control_input_queue, (void*)&message, 0) != pdPASS)
+    {
+        ESP_LOGE(TAG, "control_request_midi_cc queue send failed!");            
+    }
 }
 
 /****************************************************************************
 * NAME:        
 * DESCRIPTION: 
-* PARAMETERS:  
+* PARAMETERS:  index: 0-based macro
 * RETURN:      
 * NOTES:       
 *****************************************************************************/
-void control_request_preset_down(void)
+void control_request_macro(uint8_t index)
 {
     tControlMessage message;
 
-    ESP_LOGI(TAG, "control_request_preset_down");            
+    ESP_LOGI(TAG, "control_request_macro %d", index);
 
-    message.Event = EVENT_PRESET_DOWN;
+    message.Event = EVENT_MACRO_RUN;
+    message.Value = index;
 
     // send to queue
     if (xQueueSend(control_input_queue, (void*)&message, 0) != pdPASS)
     {
-        ESP_LOGE(TAG, "control_request_preset_down queue send failed!");            
+        ESP_LOGE(TAG, "control_request_macro queue send failed!");            
     }
 }
 
 /****************************************************************************
 * NAME:        
 * DESCRIPTION: 
-* PARAMETERS:  
+* PARAMETERS:  index: 0-based macro, text: steps, see macro_compile()
 * RETURN:      
-* NOTES:       
+* NOTES:       Waits for queue space, used in bursts from the web config
 *****************************************************************************/
-void control_request_preset_up(void)
+void control_set_macro(uint8_t index, char* text)
 {
     tControlMessage message;
 
-    ESP_LOGI(TAG, "control_request_preset_up");
+    ESP_LOGI(TAG, "control_set_macro %d", index);            
 
-    message.Event = EVENT_PRESET_UP;
+    message.Event = EVENT_MACRO_SET;
+    message.Value = index;
+    strncpy(message.Text, text, MAX_TEXT_LENGTH - 1);
+    message.Text[MAX_TEXT_LENGTH - 1] = 0;
 
     // send to queue
-    if (xQueueSend(control_input_queue, (void*)&message, 0) != pdPASS)
+    if (xQueueSend(control_input_queue, (void*)&message, pdMS_TO_TICKS(SETLIST_QUEUE_WAIT_MS)) != pdPASS)
     {
-        ESP_LOGE(TAG, "control_request_preset_up queue send failed!");            
+        ESP_LOGE(TAG, "control_set_macro queue send failed!");            
     }
 }
 
 /****************************************************************************
 * NAME:        
 * DESCRIPTION: 
-* PARAMETERS:  
+* PARAMETERS:  index: 0-based mapping, text: see midi_map_compile(), blank clears it
 * RETURN:      
-* NOTES:       
+* NOTES:       Waits for queue space, used in bursts from the web config
 *****************************************************************************/
-void control_request_preset_index(uint8_t index)
+void control_set_midi_mapping(uint8_t index, char* text)
 {
     tControlMessage message;
 
-    ESP_LOGI(TAG, "control_request_preset_index %d", index);
+    ESP_LOGI(TAG, "control_set_midi_mapping %d", index);            
 
-    message.Event = EVENT_PRESET_INDEX;
+    message.Event = EVENT_MIDI_MAP_SET;
     message.Value = index;
+    strncpy(message.Text, text, MAX_TEXT_LENGTH - 1);
+    message.Text[MAX_TEXT_LENGTH - 1] = 0;
+
+    // send to queue
+    if (xQueueSend(control_input_queue, (void*)&message, pdMS_TO_TICKS(SETLIST_QUEUE_WAIT_MS)) != pdPASS)
+    {
+        ESP_LOGE(TAG, "control_set_midi_mapping queue send failed!");            
+    }
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: A learn mapping has caught its message
+* PARAMETERS:  index: 0-based mapping, inputs: MIDI_MAP_INPUT_x, channel: 0-based,
+*              type: enum MidiMapTypes, number: CC or note number
+* RETURN:      
+* NOTES:       Called from the Midi tasks. The mapping is saved
+*****************************************************************************/
+void control_learn_midi_mapping(uint8_t index, uint8_t inputs, uint8_t channel, uint8_t type, uint8_t number)
+{
+    tControlMessage message;
+
+    ESP_LOGI(TAG, "control_learn_midi_mapping %d", index);            
+
+    message.Event = EVENT_MIDI_MAP_LEARNED;
+    message.Value = (uint32_t)index | ((uint32_t)(number & 0x7F) << 8) | ((uint32_t)(channel & 0x0F) << 16) | 
+                    ((uint32_t)(type & 0x0F) << 20) | ((uint32_t)inputs << 24);
 
     // send to queue
     if (xQueueSend(control_input_queue, (void*)&message, 0) != pdPASS)
     {
-        ESP_LOGE(TAG, "control_request_preset_index queue send failed!");            
+        ESP_LOGE(TAG, "control_learn_midi_mapping queue send failed!");            
+    }
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Macro wait expired
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Runs in the esp_timer task
+*****************************************************************************/
+static void macro_timer_callback(void* arg)
+{
+    tControlMessage message;
+
+    message.Event = EVENT_MACRO_CONTINUE;
+    message.Value = MacroState.Generation;
+
+    // jump the queue to keep the timing tight
+    if (xQueueSendToFront(control_input_queue, (void*)&message, 0) != pdPASS)
+    {
+        ESP_LOGE(TAG, "macro_timer_callback queue send failed!");            
     }
 }
 
@@ -343,8 +1461,8 @@ void control_sync_preset_details(uint16_t index, char* name)
 
     message.Event = EVENT_SET_PRESET_DETAILS;
     message.Value = index;
-    sprintf(message.Text, "%d: ", (int)index + 1);
-    strncat(message.Text, name, MAX_TEXT_LENGTH - 1);
+    strncpy(message.Text, name, MAX_TEXT_LENGTH - 1);
+    message.Text[MAX_TEXT_LENGTH - 1] = 0;
 
     // send to queue
     if (xQueueSend(control_input_queue, (void*)&message, 0) != pdPASS)
@@ -376,6 +1494,53 @@ void control_set_user_text(char* text)
     }
 }
 
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Waits for queue space, used in bursts from the web config
+*****************************************************************************/
+void control_clear_setlist(void)
+{
+    tControlMessage message;
+
+    ESP_LOGI(TAG, "control_clear_setlist");            
+
+    message.Event = EVENT_SETLIST_CLEAR;
+
+    // send to queue
+    if (xQueueSend(control_input_queue, (void*)&message, pdMS_TO_TICKS(SETLIST_QUEUE_WAIT_MS)) != pdPASS)
+    {
+        ESP_LOGE(TAG, "control_clear_setlist queue send failed!");            
+    }
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  index: 0-based song position, text: "preset,skin,bypass,name"
+* RETURN:      
+* NOTES:       Waits for queue space, used in bursts from the web config
+*****************************************************************************/
+void control_set_setlist_song(uint8_t index, char* text)
+{
+    tControlMessage message;
+
+    ESP_LOGI(TAG, "control_set_setlist_song %d", index);            
+
+    message.Event = EVENT_SETLIST_SET_SONG;
+    message.Value = index;
+    strncpy(message.Text, text, MAX_TEXT_LENGTH - 1);
+    message.Text[MAX_TEXT_LENGTH - 1] = 0;
+
+    // send to queue
+    if (xQueueSend(control_input_queue, (void*)&message, pdMS_TO_TICKS(SETLIST_QUEUE_WAIT_MS)) != pdPASS)
+    {
+        ESP_LOGE(TAG, "control_set_setlist_song queue send failed!");            
+    }
+}
+
 /****************************************************************************
 * NAME:        
 * DESCRIPTION: 
@@ -544,65 +1709,134 @@ void control_set_config_xv_md1_enable(uint32_t status)
 * RETURN:      
 * NOTES:       
 *****************************************************************************/
-void control_set_config_serial_midi_enable(uint32_t status)
+void control_set_config_serial_midi_enable(uint32_t status)
+{
+    tControlMessage message;
+
+    ESP_LOGI(TAG, "control_set_config_serial_midi_enable");
+
+    message.Event = EVENT_SET_CONFIG_MIDI_ENABLE;
+    message.Value = status;
+
+    // send to queue
+    if (xQueueSend(control_input_queue, (void*)&message, 0) != pdPASS)
+    {
+        ESP_LOGE(TAG, "control_set_config_serial_midi_enable queue send failed!");            
+    }
+}    
+    
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void control_set_config_serial_midi_channel(uint32_t status)
+{
+    tControlMessage message;
+
+    ESP_LOGI(TAG, "control_set_config_serial_midi_channel");
+
+    message.Event = EVENT_SET_CONFIG_MIDI_CHANNEL;
+    message.Value = status;
+
+    // send to queue
+    if (xQueueSend(control_input_queue, (void*)&message, 0) != pdPASS)
+    {
+        ESP_LOGE(TAG, "control_set_config_serial_midi_channel queue send failed!");            
+    }
+}        
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void control_set_config_toggle_bypass(uint32_t status)
+{
+    tControlMessage message;
+
+    ESP_LOGI(TAG, "control_set_config_toggle_bypass");
+
+    message.Event = EVENT_SET_CONFIG_TOGGLE_BYPASS;
+    message.Value = status;
+
+    // send to queue
+    if (xQueueSend(control_input_queue, (void*)&message, 0) != pdPASS)
+    {
+        ESP_LOGE(TAG, "control_set_config_toggle_bypass queue send failed!");            
+    }
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void control_set_config_setlist_mode(uint32_t status)
 {
     tControlMessage message;
 
-    ESP_LOGI(TAG, "control_set_config_serial_midi_enable");
+    ESP_LOGI(TAG, "control_set_config_setlist_mode");
 
-    message.Event = EVENT_SET_CONFIG_MIDI_ENABLE;
+    message.Event = EVENT_SET_CONFIG_SETLIST_MODE;
     message.Value = status;
 
     // send to queue
     if (xQueueSend(control_input_queue, (void*)&message, 0) != pdPASS)
     {
-        ESP_LOGE(TAG, "control_set_config_serial_midi_enable queue send failed!");            
+        ESP_LOGE(TAG, "control_set_config_setlist_mode queue send failed!");            
     }
-}    
-    
+}
+
 /****************************************************************************
 * NAME:        
 * DESCRIPTION: 
-* PARAMETERS:  
+* PARAMETERS:  window_ms: dedupe window in msec, 0 to disable
 * RETURN:      
 * NOTES:       
 *****************************************************************************/
-void control_set_config_serial_midi_channel(uint32_t status)
+void control_set_config_dedupe_window(uint32_t window_ms)
 {
     tControlMessage message;
 
-    ESP_LOGI(TAG, "control_set_config_serial_midi_channel");
+    ESP_LOGI(TAG, "control_set_config_dedupe_window");
 
-    message.Event = EVENT_SET_CONFIG_MIDI_CHANNEL;
-    message.Value = status;
+    message.Event = EVENT_SET_CONFIG_DEDUPE_WINDOW;
+    message.Value = window_ms;
 
     // send to queue
     if (xQueueSend(control_input_queue, (void*)&message, 0) != pdPASS)
     {
-        ESP_LOGE(TAG, "control_set_config_serial_midi_channel queue send failed!");            
+        ESP_LOGE(TAG, "control_set_config_dedupe_window queue send failed!");            
     }
-}        
+}           
 
 /****************************************************************************
 * NAME:        
 * DESCRIPTION: 
-* PARAMETERS:  
+* PARAMETERS:  status: 1 to show the display performance overlay at boot
 * RETURN:      
 * NOTES:       
 *****************************************************************************/
-void control_set_config_toggle_bypass(uint32_t status)
+void control_set_config_perf_overlay(uint32_t status)
 {
     tControlMessage message;
 
-    ESP_LOGI(TAG, "control_set_config_toggle_bypass");
+    ESP_LOGI(TAG, "control_set_config_perf_overlay");
 
-    message.Event = EVENT_SET_CONFIG_TOGGLE_BYPASS;
+    message.Event = EVENT_SET_CONFIG_PERF_OVERLAY;
     message.Value = status;
 
     // send to queue
     if (xQueueSend(control_input_queue, (void*)&message, 0) != pdPASS)
     {
-        ESP_LOGE(TAG, "control_set_config_toggle_bypass queue send failed!");            
+        ESP_LOGE(TAG, "control_set_config_perf_overlay queue send failed!");            
     }
 }           
 
@@ -615,10 +1849,17 @@ void control_set_config_toggle_bypass(uint32_t status)
 *****************************************************************************/
 void control_set_skin_next(void)
 {
-    if (ControlData.ConfigData.UserData[ControlData.PresetIndex].SkinIndex < (SKIN_MAX - 1))
+    uint16_t skin_index = get_user_data(ControlData.LogicalPreset)->SkinIndex;
+    uint16_t skin_count = SKIN_MAX;
+
+#if CONFIG_TONEX_CONTROLLER_SKINS_SD_CARD
+    // only as many as the SD card lists
+    skin_count = UI_GetSkinCount();
+#endif
+
+    if ((skin_index + 1) < skin_count)
     {
-        ControlData.ConfigData.UserData[ControlData.PresetIndex].SkinIndex++;
-        control_set_amp_skin_index(ControlData.ConfigData.UserData[ControlData.PresetIndex].SkinIndex);
+        control_set_amp_skin_index(skin_index + 1);
     }
 }
 
@@ -631,11 +1872,11 @@ void control_set_skin_next(void)
 *****************************************************************************/
 void control_set_skin_previous(void)
 {
-    if (ControlData.ConfigData.UserData[ControlData.PresetIndex].SkinIndex > 0)
+    uint16_t skin_index = get_user_data(ControlData.LogicalPreset)->SkinIndex;
+
+    if (skin_index > 0)
     {
-        ControlData.ConfigData.UserData[ControlData.PresetIndex].SkinIndex--;
-    
-        control_set_amp_skin_index(ControlData.ConfigData.UserData[ControlData.PresetIndex].SkinIndex);
+        control_set_amp_skin_index(skin_index - 1);
     }
 }
 
@@ -711,6 +1952,162 @@ uint8_t control_get_config_midi_channel(void)
     return ControlData.ConfigData.MidiChannel;
 }
 
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+uint8_t control_get_config_setlist_mode(void)
+{
+    return ControlData.ConfigData.GeneralSetlistMode;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      dedupe window in msec
+* NOTES:       
+*****************************************************************************/
+uint32_t control_get_config_dedupe_window(void)
+{
+    return (uint32_t)ControlData.ConfigData.InputDedupeWindow * DEDUPE_WINDOW_UNITS_MS;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+uint8_t control_get_config_perf_overlay(void)
+{
+    return ControlData.ConfigData.GeneralPerfOverlay;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Get the preset request counters for a source
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Counters are only written by the control task, values may be 
+*              one request behind
+*****************************************************************************/
+void control_get_source_stats(uint8_t source, tControlSourceStats* stats)
+{
+    if (source < CONTROL_SOURCE_MAX)
+    {
+        memcpy((void*)stats, (void*)&SourceStats[source], sizeof(tControlSourceStats));
+    }
+    else
+    {
+        memset((void*)stats, 0, sizeof(tControlSourceStats));
+    }
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Tell the user a save ran out of flash space
+* PARAMETERS:  what: what was not saved
+* RETURN:      none
+* NOTES:       Shown on screen, as it is otherwise only in the log
+****************************************************************************/
+static void ReportStorageFull(const char* what)
+{
+    char text[64];
+
+    snprintf(text, sizeof(text), "Storage full, %s not saved", what);
+    ESP_LOGE(TAG, "%s", text);
+
+#if !CONFIG_TONEX_CONTROLLER_DISPLAY_NONE
+    UI_ShowMessage(text);
+#endif
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Write the presets changed since the last save
+* PARAMETERS:  
+* RETURN:      1 on success
+* NOTES:       One key per preset, in PresetPartition
+****************************************************************************/
+static uint8_t SavePresetUserData(void)
+{
+    esp_err_t err;
+    nvs_handle_t my_handle;
+    uint8_t result = 1;
+    uint8_t storage_full = 0;
+    uint8_t present_map[PRESET_BITMAP_SIZE];
+    char key[NVS_KEY_NAME_MAX_SIZE];
+
+    err = nvs_open_from_partition(PresetPartition, "storage", NVS_READWRITE, &my_handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error (%s) opening preset storage", esp_err_to_name(err));
+        return 0;
+    }
+
+    memset((void*)present_map, 0, sizeof(present_map));
+
+    for (uint16_t loop = 0; loop < MAX_LOGICAL_PRESETS; loop++)
+    {
+        if ((UserDataTable == NULL) || (UserDataTable[loop] == NULL))
+        {
+            continue;
+        }
+
+        present_map[loop / 8] |= (1 << (loop % 8));
+
+        // once full, the rest stay dirty and are tried again on the next save
+        if ((UserDataDirty[loop / 8] & (1 << (loop % 8))) && !storage_full)
+        {
+            snprintf(key, sizeof(key), NVS_PRESET_KEY_FORMAT, (int)loop);
+            err = nvs_set_blob(my_handle, key, (void*)UserDataTable[loop], sizeof(tUserData));
+
+            if (err == ESP_OK)
+            {
+                UserDataDirty[loop / 8] &= ~(1 << (loop % 8));
+            }
+            else if (err == ESP_ERR_NVS_NOT_ENOUGH_SPACE)
+            {
+                ESP_LOGE(TAG, "No space for preset %d", (int)loop);
+                storage_full = 1;
+                result = 0;
+            }
+            else
+            {
+                ESP_LOGE(TAG, "Error (%s) writing preset %d", esp_err_to_name(err), (int)loop);
+                result = 0;
+            }
+        }
+    }
+
+    err = nvs_set_blob(my_handle, NVS_PRESET_MAP_NAME, (void*)present_map, sizeof(present_map));
+    if (err == ESP_ERR_NVS_NOT_ENOUGH_SPACE)
+    {
+        storage_full = 1;
+        result = 0;
+    }
+    else if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error (%s) writing preset map", esp_err_to_name(err));
+        result = 0;
+    }
+
+    if (storage_full)
+    {
+        ReportStorageFull("preset changes");
+    }
+
+    nvs_commit(my_handle);
+    nvs_close(my_handle);
+
+    return result;
+}
+
 /****************************************************************************
 * NAME:        
 * DESCRIPTION: 
@@ -733,7 +2130,7 @@ static uint8_t SaveUserData(void)
     {
         // write value
         size_t required_size = sizeof(ControlData.ConfigData);
-        err = nvs_set_blob(my_handle, NVS_USERDATA_NAME, (void*)&ControlData.ConfigData, required_size);
+        err = nvs_set_blob(my_handle, NVS_CONFIG_NAME, (void*)&ControlData.ConfigData, required_size);
 
         switch (err) 
         {
@@ -744,17 +2141,65 @@ static uint8_t SaveUserData(void)
                 ESP_LOGI(TAG, "Wrote User Data OK");
             } break;
             
+            case ESP_ERR_NVS_NOT_ENOUGH_SPACE:
+            {
+                ReportStorageFull("settings");
+            } break;
+
             default:
             {
                 ESP_LOGE(TAG, "Error (%s) writing User Data\n", esp_err_to_name(err));
             } break;
         }
 
+        err = nvs_set_blob(my_handle, NVS_MACROS_NAME, (void*)MacroCode, sizeof(MacroCode));
+        if (err == ESP_ERR_NVS_NOT_ENOUGH_SPACE)
+        {
+            ReportStorageFull("macros");
+            result = 0;
+        }
+        else if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Error (%s) writing macros", esp_err_to_name(err));
+            result = 0;
+        }
+
+        err = nvs_set_blob(my_handle, NVS_MIDI_MAP_NAME, (void*)MidiMappings, sizeof(MidiMappings));
+        if (err == ESP_ERR_NVS_NOT_ENOUGH_SPACE)
+        {
+            ReportStorageFull("Midi mappings");
+            result = 0;
+        }
+        else if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Error (%s) writing Midi mappings", esp_err_to_name(err));
+            result = 0;
+        }
+
+        // setlist, only the used songs
+        err = nvs_set_blob(my_handle, NVS_SETLIST_NAME, (void*)&Setlist, sizeof(Setlist.Count) + (Setlist.Count * sizeof(tSetlistSong)));
+        if (err == ESP_ERR_NVS_NOT_ENOUGH_SPACE)
+        {
+            ReportStorageFull("setlist");
+            result = 0;
+        }
+        else if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Error (%s) writing setlist", esp_err_to_name(err));
+            result = 0;
+        }
+
         // commit value
         err = nvs_commit(my_handle);
 
         // close
         nvs_close(my_handle);
+
+        // write only the presets that changed since the last save
+        if (!SavePresetUserData())
+        {
+            result = 0;
+        }
     }
     else
     {
@@ -764,6 +2209,175 @@ static uint8_t SaveUserData(void)
     return result;
 }
 
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      none
+* NOTES:       Converts the pre-bank config, which held 20 presets inline
+****************************************************************************/
+static uint8_t MigrateLegacyUserData(nvs_handle_t my_handle)
+{
+    size_t required_size = sizeof(tLegacyConfigData);
+    uint8_t result = 0;
+
+    tLegacyConfigData* legacy = malloc(sizeof(tLegacyConfigData));
+    if (legacy == NULL)
+    {
+        return 0;
+    }
+
+    if (nvs_get_blob(my_handle, NVS_USERDATA_NAME, (void*)legacy, &required_size) == ESP_OK)
+    {
+        ESP_LOGI(TAG, "Migrating legacy User Data");
+
+        memcpy((void*)&ControlData.ConfigData, (void*)&legacy->ConfigData, sizeof(tConfigData));
+
+        // the legacy data had a spare byte here
+        ControlData.ConfigData.InputDedupeWindow = DEDUPE_WINDOW_DEFAULT;
+
+        for (uint16_t loop = 0; loop < MAX_PRESETS_LEGACY; loop++)
+        {
+            legacy->UserData[loop].PresetDescription[MAX_TEXT_LENGTH - 1] = 0;
+
+            // only keep presets that were customised
+            if (memcmp((void*)&legacy->UserData[loop], (void*)&DefaultUserData, sizeof(tUserData)) != 0)
+            {
+                tUserData* user_data = get_user_data_writable(loop);
+
+                if (user_data != NULL)
+                {
+                    memcpy((void*)user_data, (void*)&legacy->UserData[loop], sizeof(tUserData));
+                }
+            }
+        }
+
+        nvs_erase_key(my_handle, NVS_USERDATA_NAME);
+        result = 1;
+    }
+
+    free(legacy);
+    return result;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      1 if the partition has a preset map
+* NOTES:       dirty: 1 to write them all on the next save, when moving them
+*              to another partition
+****************************************************************************/
+static uint8_t LoadPresetUserData(const char* partition, uint8_t dirty)
+{
+    nvs_handle_t my_handle;
+    uint8_t present_map[PRESET_BITMAP_SIZE];
+    size_t required_size = sizeof(present_map);
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    uint16_t count = 0;
+
+    if (nvs_open_from_partition(partition, "storage", NVS_READONLY, &my_handle) != ESP_OK)
+    {
+        return 0;
+    }
+
+    if (nvs_get_blob(my_handle, NVS_PRESET_MAP_NAME, (void*)present_map, &required_size) != ESP_OK)
+    {
+        nvs_close(my_handle);
+        return 0;
+    }
+
+    for (uint16_t loop = 0; loop < MAX_LOGICAL_PRESETS; loop++)
+    {
+        if ((present_map[loop / 8] & (1 << (loop % 8))) == 0)
+        {
+            continue;
+        }
+
+        tUserData* user_data = get_user_data_writable(loop);
+        if (user_data == NULL)
+        {
+            break;
+        }
+
+        snprintf(key, sizeof(key), NVS_PRESET_KEY_FORMAT, (int)loop);
+        required_size = sizeof(tUserData);
+
+        if (nvs_get_blob(my_handle, key, (void*)user_data, &required_size) == ESP_OK)
+        {
+            user_data->PresetDescription[MAX_TEXT_LENGTH - 1] = 0;
+            count++;
+        }
+
+        if (!dirty)
+        {
+            // freshly loaded, nothing to write back
+            UserDataDirty[loop / 8] &= ~(1 << (loop % 8));
+        }
+    }
+
+    nvs_close(my_handle);
+
+    ESP_LOGI(TAG, "Loaded %d preset entries from %s", (int)count, partition);
+
+    return 1;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Remove the preset entries from a partition
+* PARAMETERS:  
+* RETURN:      none
+* NOTES:       After they have been moved to the presets partition
+****************************************************************************/
+static void ErasePresetUserData(const char* partition)
+{
+    nvs_handle_t my_handle;
+    char key[NVS_KEY_NAME_MAX_SIZE];
+
+    if (nvs_open_from_partition(partition, "storage", NVS_READWRITE, &my_handle) != ESP_OK)
+    {
+        return;
+    }
+
+    for (uint16_t loop = 0; loop < MAX_LOGICAL_PRESETS; loop++)
+    {
+        snprintf(key, sizeof(key), NVS_PRESET_KEY_FORMAT, (int)loop);
+        nvs_erase_key(my_handle, key);
+    }
+
+    nvs_erase_key(my_handle, NVS_PRESET_MAP_NAME);
+    nvs_commit(my_handle);
+    nvs_close(my_handle);
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      none
+* NOTES:       none
+****************************************************************************/
+static void LoadSetlist(nvs_handle_t my_handle)
+{
+    size_t required_size = sizeof(Setlist);
+
+    if ((nvs_get_blob(my_handle, NVS_SETLIST_NAME, (void*)&Setlist, &required_size) != ESP_OK) ||
+        (Setlist.Count > MAX_SETLIST_SONGS) ||
+        (required_size < (sizeof(Setlist.Count) + (Setlist.Count * sizeof(tSetlistSong)))))
+    {
+        memset((void*)&Setlist, 0, sizeof(Setlist));
+        return;
+    }
+
+    for (uint8_t loop = 0; loop < Setlist.Count; loop++)
+    {
+        Setlist.Songs[loop].Name[SETLIST_SONG_NAME_LENGTH - 1] = 0;
+    }
+
+    ESP_LOGI(TAG, "Loaded setlist with %d songs", (int)Setlist.Count);
+}
+
 /****************************************************************************
 * NAME:        
 * DESCRIPTION: 
@@ -777,6 +2391,7 @@ static uint8_t LoadUserData(void)
     nvs_handle_t my_handle;
     uint8_t result = 0;
     uint8_t save_needed = 0;
+    uint8_t move_presets = 0;
 
     ESP_LOGI(TAG, "Load User Data");
 
@@ -787,12 +2402,32 @@ static uint8_t LoadUserData(void)
     {
         // read data
         size_t required_size = sizeof(ControlData.ConfigData);
-        err = nvs_get_blob(my_handle, NVS_USERDATA_NAME, (void*)&ControlData.ConfigData, &required_size);
+        err = nvs_get_blob(my_handle, NVS_CONFIG_NAME, (void*)&ControlData.ConfigData, &required_size);
 
          switch (err) 
          {
             case ESP_OK:
             {
+                if (!LoadPresetUserData(PresetPartition, 0) && (strcmp(PresetPartition, NVS_DEFAULT_PART_NAME) != 0))
+                {
+                    // saved before the presets partition was added
+                    move_presets = LoadPresetUserData(NVS_DEFAULT_PART_NAME, 1);
+                }
+
+                LoadSetlist(my_handle);
+
+                required_size = sizeof(MacroCode);
+                if (nvs_get_blob(my_handle, NVS_MACROS_NAME, (void*)MacroCode, &required_size) != ESP_OK)
+                {
+                    memset((void*)MacroCode, MACRO_OP_END, sizeof(MacroCode));
+                }
+
+                required_size = sizeof(MidiMappings);
+                if (nvs_get_blob(my_handle, NVS_MIDI_MAP_NAME, (void*)MidiMappings, &required_size) != ESP_OK)
+                {
+                    memset((void*)MidiMappings, 0, sizeof(MidiMappings));
+                }
+
                 // close
                 nvs_close(my_handle);
 
@@ -806,10 +2441,12 @@ static uint8_t LoadUserData(void)
             {
                 ESP_LOGE(TAG, "Error (%s) reading User Data \n", esp_err_to_name(err));
 
+                result = MigrateLegacyUserData(my_handle);
+
                 // close
                 nvs_close(my_handle);
 
-                // write default values
+                // write default or migrated values
                 SaveUserData();
             } break;
         }
@@ -839,12 +2476,22 @@ static uint8_t LoadUserData(void)
         SaveUserData();
     }
 
+    // only removed from the nvs partition once they are safely in the presets partition
+    if (move_presets && SavePresetUserData())
+    {
+        ESP_LOGI(TAG, "Moved preset entries to the %s partition", PresetPartition);
+        ErasePresetUserData(NVS_DEFAULT_PART_NAME);
+    }
+
     ESP_LOGI(TAG, "Config BT Mode: %d", (int)ControlData.ConfigData.BTMode);
     ESP_LOGI(TAG, "Config BT Mvave Choc: %d", (int)ControlData.ConfigData.BTClientMvaveChocolateEnable);
     ESP_LOGI(TAG, "Config BT Xvive MD1: %d", (int)ControlData.ConfigData.BTClientMvaveChocolateEnable);
     ESP_LOGI(TAG, "Config Midi enable: %d", (int)ControlData.ConfigData.MidiSerialEnable);
     ESP_LOGI(TAG, "Config Midi channel: %d", (int)ControlData.ConfigData.MidiChannel);
     ESP_LOGI(TAG, "Config Toggle bypass: %d", (int)ControlData.ConfigData.GeneralDoublePressToggleBypass);
+    ESP_LOGI(TAG, "Config Setlist mode: %d", (int)ControlData.ConfigData.GeneralSetlistMode);
+    ESP_LOGI(TAG, "Config Dedupe window: %d msec", (int)control_get_config_dedupe_window());
+    ESP_LOGI(TAG, "Config Perf overlay: %d", (int)ControlData.ConfigData.GeneralPerfOverlay);
 
     // status    
     return result;
@@ -889,11 +2536,26 @@ void control_load_config(void)
     esp_err_t ret;
 
     memset((void*)&ControlData, 0, sizeof(ControlData));
+    memset((void*)UserDataDirty, 0, sizeof(UserDataDirty));
+    memset((void*)&Setlist, 0, sizeof(Setlist));
+    memset((void*)SourceStats, 0, sizeof(SourceStats));
+    memset((void*)MacroCode, MACRO_OP_END, sizeof(MacroCode));
+    memset((void*)&MacroState, 0, sizeof(MacroState));
+    memset((void*)MidiMappings, 0, sizeof(MidiMappings));
+    MacroState.Index = MACRO_NONE;
+    ControlData.SongIndex = SETLIST_SONG_NONE;
+    ControlData.StagedSong = SETLIST_SONG_NONE;
+
+    // sparse preset table, entries are allocated on first change
+    UserDataTable = heap_caps_calloc(MAX_LOGICAL_PRESETS, sizeof(tUserData*), MALLOC_CAP_SPIRAM);
+    if (UserDataTable == NULL)
+    {
+        UserDataTable = calloc(MAX_LOGICAL_PRESETS, sizeof(tUserData*));
+    }
 
-    // this will become init from Flash mem
-    for (uint32_t loop = 0; loop < MAX_PRESETS_DEFAULT; loop++)
+    if (UserDataTable == NULL)
     {
-        sprintf(ControlData.ConfigData.UserData[loop].PresetDescription, "Description");
+        ESP_LOGE(TAG, "Failed to allocate preset table!");
     }
 
     // default config, will be overwritten or used as default
@@ -901,6 +2563,9 @@ void control_load_config(void)
     ControlData.ConfigData.BTClientMvaveChocolateEnable = 1;
     ControlData.ConfigData.BTClientXviveMD1Enable = 1;
     ControlData.ConfigData.GeneralDoublePressToggleBypass = 0;
+    ControlData.ConfigData.GeneralSetlistMode = 0;
+    ControlData.ConfigData.GeneralPerfOverlay = 0;
+    ControlData.ConfigData.InputDedupeWindow = DEDUPE_WINDOW_DEFAULT;
     ControlData.ConfigData.MidiSerialEnable = 1;
     ControlData.ConfigData.MidiChannel = 1;
 
@@ -916,8 +2581,27 @@ void control_load_config(void)
         ESP_LOGE(TAG, "Failed to init NVS");
     }
 
+    // presets have their own partition where the partition table has one
+    ret = nvs_flash_init_partition(NVS_PRESETS_PARTITION);
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) 
+    {
+        ESP_ERROR_CHECK(nvs_flash_erase_partition(NVS_PRESETS_PARTITION));
+        ret = nvs_flash_init_partition(NVS_PRESETS_PARTITION);
+    }
+    if (ret == ESP_OK)
+    {
+        PresetPartition = NVS_PRESETS_PARTITION;
+    }
+    else
+    {
+        ESP_LOGW(TAG, "No presets partition (%s), presets share the nvs partition", esp_err_to_name(ret));
+    }
+
     // load the non-volatile user data
     LoadUserData();
+
+    // Midi tasks start later, and look messages up in this
+    midi_map_set(MidiMappings, MAX_MIDI_MAPPINGS);
 }
 
 /****************************************************************************
@@ -936,5 +2620,17 @@ void control_init(void)
         ESP_LOGE(TAG, "Failed to create control input queue!");
     }
 
+    // one-shot timer for macro waits
+    const esp_timer_create_args_t macro_timer_args = 
+    {
+        .callback = &macro_timer_callback,
+        .name = "macro"
+    };
+
+    if (esp_timer_create(&macro_timer_args, &MacroTimer) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to create macro timer!");
+    }
+
     xTaskCreatePinnedToCore(control_task, "CTRL", CTRL_TASK_STACK_SIZE, NULL, CTRL_TASK_PRIORITY, NULL, 1);
 }
@@ -17,11 +17,31 @@ limitations under the License.
 
 #pragma once
 
+// preset addressing. The pedal holds a fixed number of presets, logical presets
+// are addressed as bank/preset and wrap onto the pedal presets
+#define MAX_PEDAL_PRESETS                       20
+#define PRESETS_PER_BANK                        MAX_PEDAL_PRESETS
+#define MAX_BANKS                               25
+#define MAX_LOGICAL_PRESETS                     (MAX_BANKS * PRESETS_PER_BANK)
+
+// setlist. Ordered songs, each mapped to a logical preset with optional skin and bypass
+#define MAX_SETLIST_SONGS                       32
+#define SETLIST_SONG_NAME_LENGTH                32
+
+// most skins an SD card manifest can list
+#define MAX_SD_SKINS                            64
+
 void control_init(void);
 void control_load_config(void);
 
 enum Skins
 {
+#if CONFIG_TONEX_CONTROLLER_SKINS_SD_CARD
+    // skins are listed in the SD card manifest. It may list fewer than this,
+    // see skin_store_get_count() and UI_GetSkinCount()
+    SKIN_SD_CARD_FIRST,
+    SKIN_SD_CARD_LAST = SKIN_SD_CARD_FIRST + MAX_SD_SKINS - 1,
+#else
 #if CONFIG_TONEX_CONTROLLER_SKINS_AMP    
     // Amps
     AMP_SKIN_JCM800,
@@ -77,10 +97,30 @@ enum Skins
     PEDAL_SKIN_WAMPLER,
     PEDAL_SKIN_ZVEX,
 #endif 
+#endif  //CONFIG_TONEX_CONTROLLER_SKINS_SD_CARD
 
     SKIN_MAX        // must be last
 };
 
+// sources of preset requests, in no particular order. Priority is set in control.c
+enum ControlSources
+{
+    CONTROL_SOURCE_FOOTSWITCH,
+    CONTROL_SOURCE_TOUCH,
+    CONTROL_SOURCE_MIDI_SERIAL,
+    CONTROL_SOURCE_BT_CENTRAL,
+    CONTROL_SOURCE_BT_PERIPHERAL,
+    CONTROL_SOURCE_MAX          // must be last
+};
+
+typedef struct
+{
+    uint32_t Received;
+    uint32_t Accepted;
+    uint32_t Duplicates;                // same request already handled inside the window
+    uint32_t Preempted;                 // higher priority source active inside the window
+} tControlSourceStats;
+
 enum BluetoothModes
 {
     BT_MODE_DISABLED,
@@ -89,9 +129,13 @@ enum BluetoothModes
 };
 
 // thread safe public API
-void control_request_preset_up(void);
-void control_request_preset_down(void);
-void control_request_preset_index(uint8_t index);
+void control_request_preset_up(uint8_t source);
+void control_request_preset_down(uint8_t source);
+void control_request_preset_index(uint8_t source, uint8_t index);
+void control_request_bank_step(uint8_t source, uint8_t up);
+void control_request_bypass_toggle(uint8_t source);
+void control_request_bypass(uint8_t source, uint8_t on);
+void control_request_midi_cc(uint8_t controller, uint8_t value);
 void control_set_usb_status(uint32_t status);
 void control_set_bt_status(uint32_t status);
 void control_set_amp_skin_index(uint32_t status);
@@ -100,6 +144,13 @@ void control_set_skin_previous(void);
 void control_save_user_data(uint8_t reboot);
 void control_sync_preset_details(uint16_t index, char* name);
 void control_set_user_text(char* text);
+void control_clear_setlist(void);
+void control_set_setlist_song(uint8_t index, char* text);
+void control_set_macro(uint8_t index, char* text);
+void control_request_macro(uint8_t index);
+void control_set_midi_mapping(uint8_t index, char* text);
+void control_learn_midi_mapping(uint8_t index, uint8_t inputs, uint8_t channel, uint8_t type, uint8_t number);
+void control_get_source_stats(uint8_t source, tControlSourceStats* stats);
 
 // config API
 void control_set_config_btmode(uint32_t status);
@@ -108,6 +159,9 @@ void control_set_config_xv_md1_enable(uint32_t status);
 void control_set_config_serial_midi_enable(uint32_t status);
 void control_set_config_serial_midi_channel(uint32_t status);
 void control_set_config_toggle_bypass(uint32_t status);
+void control_set_config_setlist_mode(uint32_t status);
+void control_set_config_dedupe_window(uint32_t window_ms);
+void control_set_config_perf_overlay(uint32_t status);
 
 uint8_t control_get_config_bt_mode(void);
 uint8_t control_get_config_bt_mvave_choc_enable(void);
@@ -115,3 +169,6 @@ uint8_t control_get_config_bt_xvive_md1_enable(void);
 uint8_t control_get_config_double_toggle(void);
 uint8_t control_get_config_midi_serial_enable(void);
 uint8_t control_get_config_midi_channel(void);
+uint8_t control_get_config_setlist_mode(void);
+uint32_t control_get_config_dedupe_window(void);
+uint8_t control_get_config_perf_overlay(void);
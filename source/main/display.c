@@ -53,12 +53,19 @@ limitations under the License.
 #include "control.h"
 #include "task_priorities.h"
 #include "midi_control.h"
+#include "skin_store.h"
+#include "ui_update.h"
+#include "display_profiler.h"
+#include "display_blend.h"
+#include "display_glyph_cache.h"
+#include "i2c_bus.h"
 
 #if CONFIG_TONEX_CONTROLLER_DISPLAY_WAVESHARE_800_480
 
 static const char *TAG = "app_display";
 
 #define DISPLAY_TASK_STACK_SIZE   (6 * 1024)
+#define DISPLAY_FLUSH_TASK_STACK_SIZE   (3 * 1024)
 
 // LCD panel config
 #define DISPLAY_LCD_PIXEL_CLOCK_HZ     (18 * 1000 * 1000)
@@ -97,42 +104,87 @@ static const char *TAG = "app_display";
 #define DISPLAY_LCD_NUM_FB             1
 #endif // CONFIG_DISPLAY_DOUBLE_FB
 
+#if CONFIG_DISPLAY_DOUBLE_FB && CONFIG_DISPLAY_PARTIAL_REFRESH && CONFIG_DISPLAY_FLUSH_TASK
+#define DISPLAY_REFRESH_MODE           "double buffer, partial, pipelined"
+#elif CONFIG_DISPLAY_DOUBLE_FB && CONFIG_DISPLAY_PARTIAL_REFRESH
+#define DISPLAY_REFRESH_MODE           "double buffer, partial"
+#elif CONFIG_DISPLAY_DOUBLE_FB && CONFIG_DISPLAY_FLUSH_TASK
+#define DISPLAY_REFRESH_MODE           "double buffer, full, pipelined"
+#elif CONFIG_DISPLAY_DOUBLE_FB
+#define DISPLAY_REFRESH_MODE           "double buffer, full"
+#else
+#define DISPLAY_REFRESH_MODE           "single buffer"
+#endif
+
+// longest wait for the panel to switch frame buffers, a frame is around 20 msec
+#define DISPLAY_VSYNC_TIMEOUT_MS       50
+
+// longest the renderer waits for the flush task to hand back a frame buffer
+#define DISPLAY_FLUSH_TIMEOUT_MS       (2 * DISPLAY_VSYNC_TIMEOUT_MS)
+
 #define DISPLAY_LVGL_TICK_PERIOD_MS    2
 #define DISPLAY_LVGL_TASK_MAX_DELAY_MS 500
 #define DISPLAY_LVGL_TASK_MIN_DELAY_MS 1
 
+// while touched the GT911 interrupts on every report, around 100 a second. If a press
+// goes quiet for this long the controller is read once more, so a release is never missed
+#define DISPLAY_TOUCH_RELEASE_CHECK_MS 100
+
+// longest the touch read waits for the I2C bus, behind footswitch scans
+#define DISPLAY_TOUCH_BUS_TIMEOUT_MS   10
+
+#if CONFIG_DISPLAY_PROFILER
+#define PROFILE_START(var)             int64_t var = esp_timer_get_time()
+#define PROFILE_END(stage, var)        display_profiler_record(stage, (uint32_t)(esp_timer_get_time() - var))
+#else
+#define PROFILE_START(var)
+#define PROFILE_END(stage, var)
+#endif
+
 #define BUF_SIZE (1024)
 #define I2C_MASTER_TIMEOUT_MS           1000
 
-#define MAX_UI_TEXT     130
+// text is passed through a ring of slots so queue entries stay small. A slot is only
+// used up once its entry is queued, and the ring is larger than the queue, so a slot
+// can't be reused while its entry is still queued or being read
+#define UI_UPDATE_QUEUE_LENGTH      25
+#define UI_TEXT_SLOTS               32
+#define UI_TEXT_SLOT_NONE           0xFF
 
-enum UIElements
+typedef struct
 {
-    UI_ELEMENT_USB_STATUS,
-    UI_ELEMENT_BT_STATUS,
-    UI_ELEMENT_PRESET_NAME,
-    UI_ELEMENT_AMP_SKIN,
-    UI_ELEMENT_PRESET_DESCRIPTION,
-};
-
-enum UIAction
-{
-    UI_ACTION_SET_STATE,
-    UI_ACTION_SET_LABEL_TEXT,
-    UI_ACTION_SET_ENTRY_TEXT
-};
+    esp_lcd_panel_io_handle_t IO;
+    const esp_lcd_touch_config_t* Config;
+    esp_lcd_touch_handle_t* Touch;
+} tTouchInit;
 
 typedef struct 
 {
     uint8_t ElementID;
     uint8_t Action;
+    uint8_t TextSlot;                   // UI_TEXT_SLOT_NONE if no text
     uint32_t Value;
-    char Text[MAX_UI_TEXT];
 } tUIUpdate;
 
 static SemaphoreHandle_t lvgl_mux = NULL;
 static QueueHandle_t ui_update_queue;
-static SemaphoreHandle_t I2CMutexHandle;
+static char UITextSlots[UI_TEXT_SLOTS][MAX_UI_TEXT];
+static uint8_t UITextNext = 0;
+static SemaphoreHandle_t UITextMutex;
+static uint8_t MeasureRefresh = 0;
+#if CONFIG_DISPLAY_TOUCH_INTERRUPT
+// set by the GT911 interrupt, cleared by the LVGL read callback. Between interrupts
+// LVGL is given the last state read, without using the I2C bus
+static volatile uint8_t TouchPending = 1;
+static uint8_t TouchInterruptActive = 0;
+static lv_indev_data_t TouchLastData;
+static TickType_t TouchLastReadTime = 0;
+#endif
+#if CONFIG_DISPLAY_PROFILER
+static lv_obj_t* PerfOverlayLabel = NULL;
+static uint8_t PerfOverlayPending = 0;
+static uint8_t PerfOverlayDirty = 0;
+#endif
 
 // we use two semaphores to sync the VSYNC event and the LVGL task, to avoid potential tearing effect
 #if CONFIG_DISPLAY_AVOID_TEAR_EFFECT_WITH_SEM
@@ -140,6 +192,33 @@ SemaphoreHandle_t sem_vsync_end;
 SemaphoreHandle_t sem_gui_ready;
 #endif
 
+#if CONFIG_DISPLAY_DOUBLE_FB && (CONFIG_DISPLAY_PARTIAL_REFRESH || CONFIG_DISPLAY_FLUSH_TASK)
+// given on every vsync, so the flush knows the panel has switched frame buffers
+static SemaphoreHandle_t sem_fb_switched;
+#endif
+
+#if CONFIG_DISPLAY_FLUSH_TASK
+// who may touch each frame buffer. LVGL renders, the flush task hands a finished frame
+// to the panel and gives the other buffer back to LVGL once the panel has switched
+enum FrameBufferOwners
+{
+    FB_OWNER_LVGL,                      // being rendered, or free to render into
+    FB_OWNER_FLUSH,                     // finished, waiting for the panel to switch to it
+    FB_OWNER_PANEL,                     // being scanned out
+};
+
+typedef struct
+{
+    lv_color_t* Buffer;
+    volatile uint8_t Owner;
+} tFrameBuffer;
+
+static tFrameBuffer FrameBuffers[DISPLAY_LCD_NUM_FB];
+static QueueHandle_t flush_queue;
+static SemaphoreHandle_t sem_flush_done;
+static volatile uint8_t FlushPending = 0;
+#endif
+
 /****************************************************************************
 * NAME:        
 * DESCRIPTION: 
@@ -154,10 +233,127 @@ static bool display_on_vsync_event(esp_lcd_panel_handle_t panel, const esp_lcd_r
     if (xSemaphoreTakeFromISR(sem_gui_ready, &high_task_awoken) == pdTRUE) {
         xSemaphoreGiveFromISR(sem_vsync_end, &high_task_awoken);
     }
+#endif
+#if CONFIG_DISPLAY_DOUBLE_FB && (CONFIG_DISPLAY_PARTIAL_REFRESH || CONFIG_DISPLAY_FLUSH_TASK)
+    xSemaphoreGiveFromISR(sem_fb_switched, &high_task_awoken);
 #endif
     return high_task_awoken == pdTRUE;
 }
 
+#if CONFIG_DISPLAY_FLUSH_TASK
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Frame buffer that holds a pointer
+* PARAMETERS:  
+* RETURN:      index into FrameBuffers
+* NOTES:       
+*****************************************************************************/
+static uint8_t display_get_frame_buffer_index(const lv_color_t* buffer)
+{
+    for (uint8_t loop = 0; loop < DISPLAY_LCD_NUM_FB; loop++)
+    {
+        if (FrameBuffers[loop].Buffer == buffer)
+        {
+            return loop;
+        }
+    }
+
+    ESP_LOGE(TAG, "Flush of unknown buffer %p", buffer);
+    return 0;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Hands finished frames to the panel, on the core LVGL isn't using
+* PARAMETERS:  arg: display driver
+* RETURN:      
+* NOTES:       The vsync wait happens here, so the display task can take in
+*              the next UI updates meanwhile
+*****************************************************************************/
+static void display_flush_task(void *arg)
+{
+    lv_disp_drv_t* drv = (lv_disp_drv_t*)arg;
+    esp_lcd_panel_handle_t panel_handle = (esp_lcd_panel_handle_t)drv->user_data;
+    uint8_t index;
+
+    ESP_LOGI(TAG, "Display flush task start");
+
+    while (1)
+    {
+        if (xQueueReceive(flush_queue, (void*)&index, portMAX_DELAY) == pdPASS)
+        {
+            xSemaphoreTake(sem_fb_switched, 0);
+            esp_lcd_panel_draw_bitmap(panel_handle, 0, 0, DISPLAY_LCD_H_RES, DISPLAY_LCD_V_RES, FrameBuffers[index].Buffer);
+
+            // the buffer on screen is only free to write once the panel has moved off it
+            PROFILE_START(vsync_start);
+            if (xSemaphoreTake(sem_fb_switched, pdMS_TO_TICKS(DISPLAY_VSYNC_TIMEOUT_MS)) != pdTRUE)
+            {
+                ESP_LOGW(TAG, "No vsync after flush");
+            }
+            PROFILE_END(PROFILE_STAGE_VSYNC_WAIT, vsync_start);
+
+            for (uint8_t loop = 0; loop < DISPLAY_LCD_NUM_FB; loop++)
+            {
+                if (FrameBuffers[loop].Owner == FB_OWNER_PANEL)
+                {
+                    FrameBuffers[loop].Owner = FB_OWNER_LVGL;
+                }
+            }
+            FrameBuffers[index].Owner = FB_OWNER_PANEL;
+
+            FlushPending = 0;
+            lv_disp_flush_ready(drv);
+            xSemaphoreGive(sem_flush_done);
+        }
+    }
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Wait until the flush task has given LVGL a buffer to render into
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       LVGL copies the last frame's changes into its next buffer
+*              before it checks the flush is done, so this must be called
+*              before each lv_task_handler()
+*****************************************************************************/
+static void display_wait_flush(void)
+{
+    if (!FlushPending)
+    {
+        return;
+    }
+
+    PROFILE_START(wait_start);
+
+    while (FlushPending)
+    {
+        // a give left over from a flush that finished without a waiter returns at
+        // once, then the loop waits for the real one
+        if (xSemaphoreTake(sem_flush_done, pdMS_TO_TICKS(DISPLAY_FLUSH_TIMEOUT_MS)) != pdTRUE)
+        {
+            ESP_LOGW(TAG, "Flush task timeout");
+            break;
+        }
+    }
+
+    PROFILE_END(PROFILE_STAGE_BUFFER_WAIT, wait_start);
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Called by LVGL while it waits for a flush to finish
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Blocks rather than spins, so other tasks on this core can run
+*****************************************************************************/
+static void display_lvgl_wait_cb(lv_disp_drv_t *drv)
+{
+    display_wait_flush();
+}
+#endif  // CONFIG_DISPLAY_FLUSH_TASK
+
 /****************************************************************************
 * NAME:        
 * DESCRIPTION: 
@@ -172,15 +368,76 @@ static void display_lvgl_flush_cb(lv_disp_drv_t *drv, const lv_area_t *area, lv_
     int offsetx2 = area->x2;
     int offsety1 = area->y1;
     int offsety2 = area->y2;
+    PROFILE_START(flush_start);
 #if CONFIG_DISPLAY_AVOID_TEAR_EFFECT_WITH_SEM
+    PROFILE_START(vsync_start);
     xSemaphoreGive(sem_gui_ready);
     xSemaphoreTake(sem_vsync_end, portMAX_DELAY);
+    PROFILE_END(PROFILE_STAGE_VSYNC_WAIT, vsync_start);
 #endif
+#if CONFIG_DISPLAY_FLUSH_TASK
+    // full screen buffers. In direct mode this is called per redrawn area, but the
+    // whole buffer is only shown after the last
+    if (lv_disp_flush_is_last(drv))
+    {
+        uint8_t index = display_get_frame_buffer_index(color_map);
+
+        if (FrameBuffers[index].Owner != FB_OWNER_LVGL)
+        {
+            ESP_LOGE(TAG, "Flush of frame buffer %d not owned by LVGL (%d)", (int)index, (int)FrameBuffers[index].Owner);
+        }
+
+        FrameBuffers[index].Owner = FB_OWNER_FLUSH;
+        FlushPending = 1;
+        xQueueSend(flush_queue, (void*)&index, portMAX_DELAY);
+        PROFILE_END(PROFILE_STAGE_FLUSH, flush_start);
+
+        // flush task calls lv_disp_flush_ready() once the panel has switched
+        return;
+    }
+#elif CONFIG_DISPLAY_DOUBLE_FB && CONFIG_DISPLAY_PARTIAL_REFRESH
+    // direct mode, called per redrawn area but the whole buffer is only shown after the last.
+    // LVGL copies the changed areas across to the other buffer before the next refresh
+    if (lv_disp_flush_is_last(drv))
+    {
+        xSemaphoreTake(sem_fb_switched, 0);
+        esp_lcd_panel_draw_bitmap(panel_handle, 0, 0, DISPLAY_LCD_H_RES, DISPLAY_LCD_V_RES, color_map);
+
+        // the old buffer is only free to write once the panel has moved off it
+        PROFILE_START(vsync_start);
+        xSemaphoreTake(sem_fb_switched, pdMS_TO_TICKS(DISPLAY_VSYNC_TIMEOUT_MS));
+        PROFILE_END(PROFILE_STAGE_VSYNC_WAIT, vsync_start);
+    }
+#else
     // pass the draw buffer to the driver
     esp_lcd_panel_draw_bitmap(panel_handle, offsetx1, offsety1, offsetx2 + 1, offsety2 + 1, color_map);
+#endif
+    PROFILE_END(PROFILE_STAGE_FLUSH, flush_start);
     lv_disp_flush_ready(drv);
 }
 
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Called by LVGL after each refresh
+* PARAMETERS:  time_ms: render and flush time
+*              px: pixels redrawn
+* RETURN:      
+* NOTES:       Logs the first refresh after a preset change
+*****************************************************************************/
+static void display_lvgl_monitor_cb(lv_disp_drv_t *drv, uint32_t time_ms, uint32_t px)
+{
+#if CONFIG_DISPLAY_PROFILER
+    display_profiler_record(PROFILE_STAGE_REFRESH, time_ms * 1000);
+    display_profiler_frame(px);
+#endif
+
+    if (MeasureRefresh)
+    {
+        MeasureRefresh = 0;
+        ESP_LOGI(TAG, "Preset refresh %d ms, %d px (%s)", (int)time_ms, (int)px, DISPLAY_REFRESH_MODE);
+    }
+}
+
 /****************************************************************************
 * NAME:        
 * DESCRIPTION: 
@@ -221,6 +478,32 @@ void display_lvgl_unlock(void)
     xSemaphoreGiveRecursive(lvgl_mux);
 }
 
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Read the touch controller
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Runs on the I2C bus task
+*****************************************************************************/
+static esp_err_t display_touch_read(void* arg)
+{
+    return esp_lcd_touch_read_data((esp_lcd_touch_handle_t)arg);
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Init the touch controller
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Runs on the I2C bus task
+*****************************************************************************/
+static esp_err_t display_touch_init(void* arg)
+{
+    tTouchInit* init = (tTouchInit*)arg;
+
+    return esp_lcd_touch_new_i2c_gt911(init->IO, init->Config, init->Touch);
+}
+
 /****************************************************************************
 * NAME:        
 * DESCRIPTION: 
@@ -235,19 +518,41 @@ static void display_lvgl_touch_cb(lv_indev_drv_t * drv, lv_indev_data_t * data)
     uint8_t touchpad_cnt = 0;
     bool touchpad_pressed = false;
 
-    if (xSemaphoreTake(I2CMutexHandle, (TickType_t)10) == pdTRUE)
+#if CONFIG_DISPLAY_TOUCH_INTERRUPT
+    if (TouchInterruptActive && !TouchPending)
     {
-        /* Read touch controller data */
-        esp_lcd_touch_read_data(drv->user_data);
+        if ((TouchLastData.state == LV_INDEV_STATE_REL) ||
+            ((xTaskGetTickCount() - TouchLastReadTime) < pdMS_TO_TICKS(DISPLAY_TOUCH_RELEASE_CHECK_MS)))
+        {
+            // nothing new from the controller
+            data->point = TouchLastData.point;
+            data->state = TouchLastData.state;
+            return;
+        }
+    }
 
+    // cleared before the read, so an interrupt during it isn't lost
+    TouchPending = 0;
+    TouchLastReadTime = xTaskGetTickCount();
+#endif
+
+    /* Read touch controller data */
+    if (i2c_bus_run(I2C_BUS_PRIORITY_TOUCH, display_touch_read, drv->user_data, DISPLAY_TOUCH_BUS_TIMEOUT_MS) == ESP_OK)
+    {
         /* Get coordinates */
         touchpad_pressed = esp_lcd_touch_get_coordinates(drv->user_data, touchpad_x, touchpad_y, NULL, &touchpad_cnt, 1);
-
-        xSemaphoreGive(I2CMutexHandle);
     }
     else
     {
-        ESP_LOGE(TAG, "Touch cb mutex timeout");
+        ESP_LOGE(TAG, "Touch cb read failed");
+
+#if CONFIG_DISPLAY_TOUCH_INTERRUPT
+        // try again on the next poll, keeping the last state until then
+        TouchPending = 1;
+        data->point = TouchLastData.point;
+        data->state = TouchLastData.state;
+        return;
+#endif
     }
 
     if (touchpad_pressed && touchpad_cnt > 0) 
@@ -260,8 +565,27 @@ static void display_lvgl_touch_cb(lv_indev_drv_t * drv, lv_indev_data_t * data)
     {
         data->state = LV_INDEV_STATE_REL;
     }
+
+#if CONFIG_DISPLAY_TOUCH_INTERRUPT
+    TouchLastData.point = data->point;
+    TouchLastData.state = data->state;
+#endif
 }
 
+#if CONFIG_DISPLAY_TOUCH_INTERRUPT
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: GT911 interrupt, new touch data is ready
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Read in the LVGL touch callback, on its next poll
+*****************************************************************************/
+static void IRAM_ATTR display_touch_isr(void* arg)
+{
+    TouchPending = 1;
+}
+#endif
+
 /****************************************************************************
 * NAME:        
 * DESCRIPTION: 
@@ -274,7 +598,7 @@ void PreviousClicked(lv_event_t * e)
     // called from LVGL 
     ESP_LOGI(TAG, "UI Previous Clicked");      
 
-    control_request_preset_down();      
+    control_request_preset_down(CONTROL_SOURCE_TOUCH);      
 }
 
 /****************************************************************************
@@ -289,7 +613,7 @@ void NextClicked(lv_event_t * e)
     // called from LVGL 
     ESP_LOGI(TAG, "UI Next Clicked");    
 
-    control_request_preset_up();        
+    control_request_preset_up(CONTROL_SOURCE_TOUCH);        
 }
 
 /****************************************************************************
@@ -357,25 +681,48 @@ void PresetDescriptionChanged(lv_event_t * e)
 
 /****************************************************************************
 * NAME:        
-* DESCRIPTION: 
-* PARAMETERS:  
+* DESCRIPTION: Queue an update for the display task
+* PARAMETERS:  text: copied into the next free text slot, or NULL if none
 * RETURN:      
-* NOTES:       
+* NOTES:       Safe to call from any task, not from an ISR
 *****************************************************************************/
-void UI_SetUSBStatus(uint8_t state)
+static void ui_post_update(uint8_t element, uint8_t action, uint32_t value, const char* text)
 {
     tUIUpdate ui_update;
 
     // build command
-    ui_update.ElementID = UI_ELEMENT_USB_STATUS;
-    ui_update.Action = UI_ACTION_SET_STATE;
-    ui_update.Value = state;
+    ui_update.ElementID = element;
+    ui_update.Action = action;
+    ui_update.Value = value;
+    ui_update.TextSlot = UI_TEXT_SLOT_NONE;
+
+    if (text == NULL)
+    {
+        // send to queue
+        if (xQueueSend(ui_update_queue, (void*)&ui_update, 0) != pdPASS)
+        {
+            ESP_LOGE(TAG, "UI Update queue send failed!");            
+        }
+        return;
+    }
+
+    // hold the next slot from other senders until the entry is queued
+    xSemaphoreTake(UITextMutex, portMAX_DELAY);
 
-    // send to queue
-    if (xQueueSend(ui_update_queue, (void*)&ui_update, 0) != pdPASS)
+    ui_update.TextSlot = UITextNext;
+    strlcpy(UITextSlots[ui_update.TextSlot], text, MAX_UI_TEXT);
+
+    // send to queue. The slot is only used up if it was queued
+    if (xQueueSend(ui_update_queue, (void*)&ui_update, 0) == pdPASS)
+    {
+        UITextNext = (UITextNext + 1) % UI_TEXT_SLOTS;
+    }
+    else
     {
         ESP_LOGE(TAG, "UI Update queue send failed!");            
     }
+
+    xSemaphoreGive(UITextMutex);
 }
 
 /****************************************************************************
@@ -385,20 +732,21 @@ void UI_SetUSBStatus(uint8_t state)
 * RETURN:      
 * NOTES:       
 *****************************************************************************/
-void UI_SetBTStatus(uint8_t state)
+void UI_SetUSBStatus(uint8_t state)
 {
-    tUIUpdate ui_update;
-
-    // build command
-    ui_update.ElementID = UI_ELEMENT_BT_STATUS;
-    ui_update.Action = UI_ACTION_SET_STATE;
-    ui_update.Value = state;
+    ui_post_update(UI_ELEMENT_USB_STATUS, UI_ACTION_SET_STATE, state, NULL);
+}
 
-    // send to queue
-    if (xQueueSend(ui_update_queue, (void*)&ui_update, 0) != pdPASS)
-    {
-        ESP_LOGE(TAG, "UI Update queue send failed!");            
-    }
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void UI_SetBTStatus(uint8_t state)
+{
+    ui_post_update(UI_ELEMENT_BT_STATUS, UI_ACTION_SET_STATE, state, NULL);
 }
 
 /****************************************************************************
@@ -410,18 +758,7 @@ void UI_SetBTStatus(uint8_t state)
 *****************************************************************************/
 void UI_SetPresetLabel(char* text)
 {
-    tUIUpdate ui_update;
-
-    // build command
-    ui_update.ElementID = UI_ELEMENT_PRESET_NAME;
-    ui_update.Action = UI_ACTION_SET_LABEL_TEXT;
-    strncpy(ui_update.Text, text, MAX_UI_TEXT - 1);
-
-    // send to queue
-    if (xQueueSend(ui_update_queue, (void*)&ui_update, 0) != pdPASS)
-    {
-        ESP_LOGE(TAG, "UI Update queue send failed!");            
-    }
+    ui_post_update(UI_ELEMENT_PRESET_NAME, UI_ACTION_SET_LABEL_TEXT, 0, text);
 }
 
 /****************************************************************************
@@ -433,18 +770,7 @@ void UI_SetPresetLabel(char* text)
 *****************************************************************************/
 void UI_SetAmpSkin(uint16_t index)
 {
-    tUIUpdate ui_update;
-
-    // build commands
-    ui_update.ElementID = UI_ELEMENT_AMP_SKIN;
-    ui_update.Action = UI_ACTION_SET_STATE;
-    ui_update.Value = index;
-
-    // send to queue
-    if (xQueueSend(ui_update_queue, (void*)&ui_update, 0) != pdPASS)
-    {
-        ESP_LOGE(TAG, "UI Update queue send failed!");            
-    }
+    ui_post_update(UI_ELEMENT_AMP_SKIN, UI_ACTION_SET_STATE, index, NULL);
 }
 
 /****************************************************************************
@@ -456,393 +782,213 @@ void UI_SetAmpSkin(uint16_t index)
 *****************************************************************************/
 void UI_SetPresetDescription(char* text)
 {
-    tUIUpdate ui_update;
+    ui_post_update(UI_ELEMENT_PRESET_DESCRIPTION, UI_ACTION_SET_ENTRY_TEXT, 0, text);
+}
 
-    // build command
-    ui_update.ElementID = UI_ELEMENT_PRESET_DESCRIPTION;
-    ui_update.Action = UI_ACTION_SET_ENTRY_TEXT;
-    strncpy(ui_update.Text, text, MAX_UI_TEXT - 1);
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Show or hide the display performance overlay
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Does nothing unless the display profiler is enabled
+*****************************************************************************/
+void UI_SetPerfOverlay(uint8_t state)
+{
+#if CONFIG_DISPLAY_PROFILER
+    ui_post_update(UI_ELEMENT_PERF_OVERLAY, UI_ACTION_SET_STATE, state, NULL);
+#endif
+}
 
-    // send to queue
-    if (xQueueSend(ui_update_queue, (void*)&ui_update, 0) != pdPASS)
-    {
-        ESP_LOGE(TAG, "UI Update queue send failed!");            
-    }
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Show a message box over the current screen
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       For errors the user needs to know about. Closed by its button
+*****************************************************************************/
+void UI_ShowMessage(char* text)
+{
+    ui_post_update(UI_ELEMENT_MESSAGE, UI_ACTION_SET_LABEL_TEXT, 0, text);
 }
 
 /****************************************************************************
 * NAME:        
 * DESCRIPTION: 
 * PARAMETERS:  
-* RETURN:      
+* RETURN:      number of skins available
 * NOTES:       
 *****************************************************************************/
-static lv_obj_t* ui_get_skin_image(uint16_t index)
+uint16_t UI_GetSkinCount(void)
 {
-    lv_obj_t* result;
-
-    switch (index)
-    {
-#if CONFIG_TONEX_CONTROLLER_SKINS_AMP        
-        // amps
-        case AMP_SKIN_JCM800:
-        {
-            result = (lv_obj_t*)&ui_img_skin_jcm800_png;            
-        } break;
-
-        case AMP_SKIN_TWIN_REVERB:
-        {
-            result = (lv_obj_t*)&ui_img_skin_twinreverb_png;
-        } break;
-
-        case AMP_SKIN_2001RB:
-        {
-            result = (lv_obj_t*)&ui_img_skin_2001rb_png;
-        } break;
-
-        case AMP_SKIN_5150:
-        {
-            result = (lv_obj_t*)&ui_img_skin_5150_png;
-        } break;
-
-        case AMP_SKIN_B18N:
-        {
-            result = (lv_obj_t*)&ui_img_skin_b18n_png;
-        } break;
-
-        case AMP_SKIN_BLUES_DELUXE:
-        {
-            result = (lv_obj_t*)&ui_img_skin_bluesdeluxe_png;
-        } break;
-
-        case AMP_SKIN_DEVILLE:
-        {
-            result = (lv_obj_t*)&ui_img_skin_deville_png;
-        } break;
-
-        case AMP_SKIN_DUAL_RECTIFIER:
-        {
-            result = (lv_obj_t*)&ui_img_skin_dualrectifier_png;
-        } break;
-
-        case AMP_SKIN_GOLD_FINGER:
-        {
-            result = (lv_obj_t*)&ui_img_skin_goldfinger_png;
-        } break;
-
-        case AMP_SKIN_INVADER:
-        {
-            result = (lv_obj_t*)&ui_img_skin_invader_png;
-        } break;
-
-        case AMP_SKIN_JAZZ_CHORUS:
-        {
-            result = (lv_obj_t*)&ui_img_skin_jazzchorus_png;
-        } break;
-
-        case AMP_SKIN_OR_50:
-        {
-            result = (lv_obj_t*)&ui_img_skin_or50_png;
-        } break;
-
-        case AMP_SKIN_POWERBALL:
-        {
-            result = (lv_obj_t*)&ui_img_skin_powerball_png;
-        } break;
-
-        case AMP_SKIN_PRINCETON:
-        {
-            result = (lv_obj_t*)&ui_img_skin_princeton_png;
-        } break;
-
-        case AMP_SKIN_SVTCL:
-        {
-            result = (lv_obj_t*)&ui_img_skin_svtcl_png;
-        } break;
-
-        case AMP_SKIN_MAVERICK:
-        {
-            result = (lv_obj_t*)&ui_img_skin_maverick_png;
-        } break;
-
-        case AMP_SKIN_MK3:
-        {
-            result = (lv_obj_t*)&ui_img_skin_mk3_png;
-        } break;
-
-        case AMP_SKIN_SUPERBASS:
-        {
-            result = (lv_obj_t*)&ui_img_skin_superbass_png;
-        } break;
-
-        case AMP_SKIN_DUMBLE:
-        {
-            result = (lv_obj_t*)&ui_img_skin_dumble_png;
-        } break;
-
-        case AMP_SKIN_JETCITY:
-        {
-            result = (lv_obj_t*)&ui_img_skin_jetcity_png;
-        } break;
-
-        case AMP_SKIN_AC30:
-        {
-            result = (lv_obj_t*)&ui_img_skin_ac30_png;
-        } break;
-
-        case AMP_SKIN_EVH5150:
-        {
-            result = (lv_obj_t*)&ui_img_skin_evh5150_png;
-        } break;
-
-        case AMP_SKIN_2020:
-        {
-            result = (lv_obj_t*)&ui_img_skin_2020_png;
-        } break;
-
-        case AMP_SKIN_PINK_TACO:
-        {
-            result = (lv_obj_t*)&ui_img_skin_pinktaco_png;
-        } break;
-
-        case AMP_SKIN_SUPRO_50:
-        {
-            result = (lv_obj_t*)&ui_img_skin_supro50_png;
-        } break;
-
-        case AMP_SKIN_DIEZEL:
-        {
-            result = (lv_obj_t*)&ui_img_skin_diezel_png;
-        } break;
-#endif  //CONFIG_TONEX_CONTROLLER_SKINS_AMP
-
-#if CONFIG_TONEX_CONTROLLER_SKINS_PEDAL
-        // pedals
-        case PEDAL_SKIN_ARION:
-        {
-            result = (lv_obj_t*)&ui_img_pskin_arion_png;
-        } break;
-
-        case PEDAL_SKIN_BIGMUFF:
-        {
-            result = (lv_obj_t*)&ui_img_pskin_bigmuff_png;
-        } break;
-
-        case PEDAL_SKIN_DARKGLASS:
-        {
-            result = (lv_obj_t*)&ui_img_pskin_darkglass_png;
-        } break;
-
-        case PEDAL_SKIN_DOD:
-        {
-            result = (lv_obj_t*)&ui_img_pskin_dod_png;
-        } break;
-
-        case PEDAL_SKIN_EHX:
-        {
-            result = (lv_obj_t*)&ui_img_pskin_ehx_png;
-        } break;
-
-        case PEDAL_SKIN_FENDER:
-        {
-            result = (lv_obj_t*)&ui_img_pskin_fender_png;
-        } break;
-
-        case PEDAL_SKIN_FULLTONE:
-        {
-            result = (lv_obj_t*)&ui_img_pskin_fulltone_png;
-        } break;
-
-        case PEDAL_SKIN_FZS:
-        {
-            result = (lv_obj_t*)&ui_img_pskin_fzs_png;
-        } break;
-
-        case PEDAL_SKIN_JHS:
-        {
-            result = (lv_obj_t*)&ui_img_pskin_jhs_png;
-        } break;
-
-        case PEDAL_SKIN_KLON:
-        {
-            result = (lv_obj_t*)&ui_img_pskin_klon_png;
-        } break;
-
-        case PEDAL_SKIN_LANDGRAF:
-        {
-            result = (lv_obj_t*)&ui_img_pskin_landgraf_png;
-        } break;
-
-        case PEDAL_SKIN_MXR:
-        {
-            result = (lv_obj_t*)&ui_img_pskin_mxr_png;
-        } break;
-
-        case PEDAL_SKIN_MXR2:
-        {
-            result = (lv_obj_t*)&ui_img_pskin_mxr2_png;
-        } break;
-
-        case PEDAL_SKIN_OD1:
-        {
-            result = (lv_obj_t*)&ui_img_pskin_od1_png;
-        } break;
-
-        case PEDAL_SKIN_PLIMSOUL:
-        {
-            result = (lv_obj_t*)&ui_img_pskin_plimsoul_png;
-        } break;
-
-        case PEDAL_SKIN_ROGERMAYER:
-        {
-            result = (lv_obj_t*)&ui_img_pskin_rogermayer_png;
-        } break;
+#if CONFIG_TONEX_CONTROLLER_SKINS_COMPRESSED || CONFIG_TONEX_CONTROLLER_SKINS_SD_CARD
+    return skin_store_get_count();
+#else
+    return SKIN_MAX;
+#endif
+}
 
-        case PEDAL_SKIN_SEYMOUR:
-        {
-            result = (lv_obj_t*)&ui_img_pskin_seymour_png;
-        } break;
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Hint that a skin is likely to be shown soon
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Loaded in the background when skins are compressed or on SD card,
+*              otherwise they are always available and this does nothing
+*****************************************************************************/
+void UI_PrefetchSkin(uint16_t index)
+{
+#if CONFIG_TONEX_CONTROLLER_SKINS_COMPRESSED || CONFIG_TONEX_CONTROLLER_SKINS_SD_CARD
+    skin_store_prefetch(index);
+#endif
+}
 
-        case PEDAL_SKIN_STRYMON:
-        {
-            result = (lv_obj_t*)&ui_img_pskin_strymon_png;
-        } break;
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Prepare the next song's skin and text without showing them
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void UI_StageSong(uint16_t skin_index, char* label, char* description)
+{
+    ui_post_update(UI_ELEMENT_STAGED_SONG, UI_ACTION_STAGE_STATE, skin_index, NULL);
+    ui_post_update(UI_ELEMENT_STAGED_SONG, UI_ACTION_STAGE_LABEL_TEXT, 0, label);
+    ui_post_update(UI_ELEMENT_STAGED_SONG, UI_ACTION_STAGE_ENTRY_TEXT, 0, description);
+}
 
-        case PEDAL_SKIN_TREX:
-        {
-            result = (lv_obj_t*)&ui_img_pskin_trex_png;
-        } break;
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Show the staged song
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void UI_CommitStagedSong(void)
+{
+    ui_post_update(UI_ELEMENT_STAGED_SONG, UI_ACTION_COMMIT_STAGED, 0, NULL);
+}
 
-        case PEDAL_SKIN_TUBESCREAMER:
-        {
-            result = (lv_obj_t*)&ui_img_pskin_tubescreamer_png;
-        } break;
+#if CONFIG_DISPLAY_PROFILER
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Show or hide the performance overlay
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Called with the LVGL lock held. Drawn on the top layer so it
+*              stays above the screen content
+*****************************************************************************/
+static void display_show_perf_overlay(uint8_t state)
+{
+    if (state)
+    {
+        if (PerfOverlayLabel == NULL)
+        {
+            PerfOverlayLabel = lv_label_create(lv_layer_top());
+            lv_obj_set_style_bg_color(PerfOverlayLabel, lv_color_black(), LV_PART_MAIN | LV_STATE_DEFAULT);
+            lv_obj_set_style_bg_opa(PerfOverlayLabel, LV_OPA_70, LV_PART_MAIN | LV_STATE_DEFAULT);
+            lv_obj_set_style_text_color(PerfOverlayLabel, lv_color_white(), LV_PART_MAIN | LV_STATE_DEFAULT);
+            lv_obj_set_style_pad_all(PerfOverlayLabel, 4, LV_PART_MAIN | LV_STATE_DEFAULT);
+            lv_obj_align(PerfOverlayLabel, LV_ALIGN_BOTTOM_LEFT, 0, 0);
+            lv_label_set_text(PerfOverlayLabel, "");
+        }
 
-        case PEDAL_SKIN_WAMPLER:
-        {
-            result = (lv_obj_t*)&ui_img_pskin_wampler_png;
-        } break;
+        lv_obj_clear_flag(PerfOverlayLabel, LV_OBJ_FLAG_HIDDEN);
+    }
+    else if (PerfOverlayLabel != NULL)
+    {
+        lv_obj_add_flag(PerfOverlayLabel, LV_OBJ_FLAG_HIDDEN);
+    }
+}
 
-        case PEDAL_SKIN_ZVEX:
-        {
-            result = (lv_obj_t*)&ui_img_pskin_zvex_png;
-        } break;
-#endif //CONFIG_TONEX_CONTROLLER_SKINS_PEDAL
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Refresh the overlay with the last second's figures
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Called with the LVGL lock held. The overlay's own redraw is
+*              included in the figures
+*****************************************************************************/
+static void display_update_perf_overlay(void)
+{
+    char text[PROFILE_OVERLAY_TEXT_LENGTH];
 
-        default:
-        {
-            result = (lv_obj_t*)&ui_img_skin_jcm800_png;            
-        } break;
+    if ((PerfOverlayLabel == NULL) || lv_obj_has_flag(PerfOverlayLabel, LV_OBJ_FLAG_HIDDEN))
+    {
+        return;
     }
 
-    return result;
+    display_profiler_format_overlay(text, sizeof(text));
+    lv_label_set_text(PerfOverlayLabel, text);
 }
 
 /****************************************************************************
 * NAME:        
-* DESCRIPTION: 
+* DESCRIPTION: Long press on the USB status icon toggles the overlay
 * PARAMETERS:  
 * RETURN:      
-* NOTES:       
+* NOTES:       Runs inside lv_task_handler, so the LVGL lock is already held
 *****************************************************************************/
-static uint8_t update_ui_element(tUIUpdate* update)
+static void display_perf_overlay_event(lv_event_t* e)
 {
-    lv_obj_t* element_1 = NULL;
-
-    switch (update->ElementID)
+    if (lv_event_get_code(e) == LV_EVENT_LONG_PRESSED)
     {
-        case UI_ELEMENT_USB_STATUS:
-        {
-            element_1 = ui_USBStatusFail;
-        } break;
+        display_show_perf_overlay((PerfOverlayLabel == NULL) || lv_obj_has_flag(PerfOverlayLabel, LV_OBJ_FLAG_HIDDEN));
+        display_update_perf_overlay();
+    }
+}
+#endif  //CONFIG_DISPLAY_PROFILER
 
-        case UI_ELEMENT_BT_STATUS:
-        {
-            element_1 = ui_BTStatusConn;
-        } break;
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Copy an update's text out of its slot
+* PARAMETERS:  text: buffer of MAX_UI_TEXT
+* RETURN:      text, or NULL if the update has none
+* NOTES:       No lock, senders don't write a slot again until it has been
+*              dequeued and the ring has wrapped
+*****************************************************************************/
+static const char* ui_get_update_text(tUIUpdate* update, char* text)
+{
+    if (update->TextSlot >= UI_TEXT_SLOTS)
+    {
+        return NULL;
+    }
 
-        case UI_ELEMENT_PRESET_NAME:
-        {
-            element_1 = ui_PresetHeadingLabel;
-        } break;
+    strlcpy(text, UITextSlots[update->TextSlot], MAX_UI_TEXT);
 
-        case UI_ELEMENT_AMP_SKIN:
-        {
-            element_1 = ui_SkinImage;
-        } break;
+    return text;
+}
 
-        case UI_ELEMENT_PRESET_DESCRIPTION:
-        {
-            element_1 = ui_PresetDetailsTextArea;
-        } break;
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Hand an update to the pending screen state
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static void display_process_update(tUIUpdate* update)
+{
+    char text[MAX_UI_TEXT];
 
-        default:
-        {
-            ESP_LOGE(TAG, "Unknown display elment %d", update->ElementID);     
-            return 0;        
-        } break;
-    }
-    
-    // check the action
-    switch (update->Action)
+#if CONFIG_DISPLAY_PROFILER
+    if (update->ElementID == UI_ELEMENT_PERF_OVERLAY)
     {
-        case UI_ACTION_SET_STATE:
-        {
-            // check the element
-            if (element_1 == ui_USBStatusFail)
-            {
-                if (update->Value == 0)
-                {
-                    // show the USB disconnected image
-                    lv_obj_add_flag(ui_USBStatusOK, LV_OBJ_FLAG_HIDDEN);
-                    lv_obj_clear_flag(ui_USBStatusFail, LV_OBJ_FLAG_HIDDEN);
-                }
-                else
-                {
-                    // show the USB connected image
-                    lv_obj_add_flag(ui_USBStatusFail, LV_OBJ_FLAG_HIDDEN);
-                    lv_obj_clear_flag(ui_USBStatusOK, LV_OBJ_FLAG_HIDDEN);
-                }
-            }
-            else if (element_1 == ui_BTStatusConn)
-            {
-                if (update->Value == 0)
-                {
-                    // show the BT disconnected image
-                    lv_obj_add_flag(ui_BTStatusConn, LV_OBJ_FLAG_HIDDEN);
-                    lv_obj_clear_flag(ui_BTStatusDisconn, LV_OBJ_FLAG_HIDDEN);
-                }
-                else
-                {
-                    // show the BT connected image
-                    lv_obj_add_flag(ui_BTStatusDisconn, LV_OBJ_FLAG_HIDDEN);
-                    lv_obj_clear_flag(ui_BTStatusConn, LV_OBJ_FLAG_HIDDEN);
-                }
-            }
-            else if (element_1 == ui_SkinImage)
-            {
-                // set skin
-                lv_img_set_src(ui_SkinImage, ui_get_skin_image(update->Value));
-            }
-        } break;
-
-        case UI_ACTION_SET_LABEL_TEXT:
-        {
-            lv_label_set_text(element_1, update->Text);
-        } break;
-
-        case UI_ACTION_SET_ENTRY_TEXT:
-        {
-            lv_textarea_set_text(element_1, update->Text);
-        } break;
+        PerfOverlayPending = update->Value;
+        PerfOverlayDirty = 1;
+        return;
+    }
+#endif
 
-        default:
+    if (update->ElementID == UI_ELEMENT_MESSAGE)
+    {
+        if (ui_get_update_text(update, text) != NULL)
         {
-            ESP_LOGE(TAG, "Unknown display action");
-        } break;
+            lv_obj_t* message_box = lv_msgbox_create(NULL, NULL, text, NULL, true);
+            lv_obj_center(message_box);
+        }
+        return;
     }
 
-    return 1;
+    ui_update_record(update->ElementID, update->Action, update->Value, ui_get_update_text(update, text));
 }
 
 /****************************************************************************
@@ -862,14 +1008,41 @@ void display_task(void *arg)
         // Lock the mutex due to the LVGL APIs are not thread-safe
         if (display_lvgl_lock(-1)) 
         {
+            // drain all UI update messages, last write to each element wins
+            while (xQueueReceive(ui_update_queue, (void*)&ui_update, 0) == pdPASS)
+            {
+                display_process_update(&ui_update);
+            }
+
+            if (ui_update_render())
+            {
+                MeasureRefresh = 1;
+            }
+
+#if CONFIG_DISPLAY_PROFILER
+            if (PerfOverlayDirty)
+            {
+                PerfOverlayDirty = 0;
+                display_show_perf_overlay(PerfOverlayPending);
+                display_update_perf_overlay();
+            }
+#endif
+
+#if CONFIG_DISPLAY_FLUSH_TASK
+            // updates above overlap the vsync wait of the last frame, rendering can't
+            display_wait_flush();
+#endif
+
+            PROFILE_START(handler_start);
             lv_task_handler();
+            PROFILE_END(PROFILE_STAGE_TASK_HANDLER, handler_start);
 
-            // check for any UI update messages
-            if (xQueueReceive(ui_update_queue, (void*)&ui_update, 0) == pdPASS)
+#if CONFIG_DISPLAY_PROFILER
+            if (display_profiler_tick())
             {
-                // process it
-                update_ui_element(&ui_update);
+                display_update_perf_overlay();
             }
+#endif
 
             // Release the mutex
             display_lvgl_unlock();
@@ -886,7 +1059,7 @@ void display_task(void *arg)
 * RETURN:      
 * NOTES:       
 *****************************************************************************/
-void display_init(i2c_port_t I2CNum, SemaphoreHandle_t I2CMutex)
+void display_init(i2c_port_t I2CNum)
 {
     esp_err_t ret = ESP_OK;
     static lv_disp_draw_buf_t disp_buf; // contains internal graphic buffer(s) called draw buffer(s)
@@ -894,15 +1067,16 @@ void display_init(i2c_port_t I2CNum, SemaphoreHandle_t I2CMutex)
     uint8_t touch_ok = 0;
     gpio_config_t gpio_config_struct;
 
-    I2CMutexHandle = I2CMutex;
-
     // create queue for UI updates from other threads
-    ui_update_queue = xQueueCreate(25, sizeof(tUIUpdate));
+    ui_update_queue = xQueueCreate(UI_UPDATE_QUEUE_LENGTH, sizeof(tUIUpdate));
     if (ui_update_queue == NULL)
     {
         ESP_LOGE(TAG, "Failed to create UI update queue!");
     }
 
+    UITextMutex = xSemaphoreCreateMutex();
+    assert(UITextMutex);
+
 #if CONFIG_DISPLAY_AVOID_TEAR_EFFECT_WITH_SEM
     ESP_LOGI(TAG, "Create semaphores");
     sem_vsync_end = xSemaphoreCreateBinary();
@@ -911,6 +1085,18 @@ void display_init(i2c_port_t I2CNum, SemaphoreHandle_t I2CMutex)
     assert(sem_gui_ready);
 #endif
 
+#if CONFIG_DISPLAY_DOUBLE_FB && (CONFIG_DISPLAY_PARTIAL_REFRESH || CONFIG_DISPLAY_FLUSH_TASK)
+    sem_fb_switched = xSemaphoreCreateBinary();
+    assert(sem_fb_switched);
+#endif
+
+#if CONFIG_DISPLAY_FLUSH_TASK
+    flush_queue = xQueueCreate(DISPLAY_LCD_NUM_FB, sizeof(uint8_t));
+    assert(flush_queue);
+    sem_flush_done = xSemaphoreCreateBinary();
+    assert(sem_flush_done);
+#endif
+
 #if DISPLAY_PIN_NUM_BK_LIGHT >= 0
     ESP_LOGI(TAG, "Turn off LCD backlight");
     gpio_config_t bk_gpio_config = {
@@ -1035,21 +1221,16 @@ void display_init(i2c_port_t I2CNum, SemaphoreHandle_t I2CMutex)
     /* Initialize touch */
     ESP_LOGI(TAG, "Initialize touch controller GT911");
 
+    tTouchInit touch_init = {
+            .IO = tp_io_handle,
+            .Config = &tp_cfg,
+            .Touch = &tp,
+        };
+
     // try a few times
     for (int loop = 0; loop < 5; loop++)
     {
-        ret = ESP_FAIL;
-
-        if (xSemaphoreTake(I2CMutexHandle, (TickType_t)10000) == pdTRUE)
-        {
-            ret = (esp_lcd_touch_new_i2c_gt911(tp_io_handle, &tp_cfg, &tp));
-
-            xSemaphoreGive(I2CMutexHandle);
-        }
-        else
-        {
-            ESP_LOGE(TAG, "Initialize touch loop mutex timeout");
-        }
+        ret = i2c_bus_run(I2C_BUS_PRIORITY_HOUSEKEEPING, display_touch_init, &touch_init, 10000);
         
         if (ret == ESP_OK)
         {
@@ -1062,7 +1243,7 @@ void display_init(i2c_port_t I2CNum, SemaphoreHandle_t I2CMutex)
             ESP_LOGI(TAG, "Touch controller init retry %s", esp_err_to_name(ret));
 
             // reset I2C bus
-            i2c_master_reset();
+            i2c_bus_reset();
         }
            
         vTaskDelay(pdMS_TO_TICKS(25));    
@@ -1073,6 +1254,36 @@ void display_init(i2c_port_t I2CNum, SemaphoreHandle_t I2CMutex)
         ESP_LOGE(TAG, "Failed to init touch screen");
     }
 
+#if CONFIG_DISPLAY_TOUCH_INTERRUPT
+    if (touch_ok)
+    {
+        // the GT911 pulses Int for each report. The pulse polarity depends on the
+        // controller config, so take either edge
+        gpio_config_struct.intr_type = GPIO_INTR_ANYEDGE;
+        gpio_config(&gpio_config_struct);
+
+        // service may already be installed by another driver
+        ret = gpio_install_isr_service(0);
+        if ((ret == ESP_OK) || (ret == ESP_ERR_INVALID_STATE))
+        {
+            ret = gpio_isr_handler_add(TOUCH_INT, display_touch_isr, NULL);
+        }
+
+        if (ret != ESP_OK)
+        {
+            // touch would never be read, poll instead
+            ESP_LOGE(TAG, "Touch interrupt failed %s, polling", esp_err_to_name(ret));
+            gpio_config_struct.intr_type = GPIO_INTR_DISABLE;
+            gpio_config(&gpio_config_struct);
+        }
+        else
+        {
+            ESP_LOGI(TAG, "Touch interrupt enabled");
+            TouchInterruptActive = 1;
+        }
+    }
+#endif
+
     ESP_LOGI(TAG, "Initialize LVGL library");
     lv_init();
     //??? lv_fs_if_init();
@@ -1084,6 +1295,15 @@ void display_init(i2c_port_t I2CNum, SemaphoreHandle_t I2CMutex)
     ESP_ERROR_CHECK(esp_lcd_rgb_panel_get_frame_buffer(panel_handle, 2, &buf1, &buf2));
     // initialize LVGL draw buffers
     lv_disp_draw_buf_init(&disp_buf, buf1, buf2, DISPLAY_LCD_H_RES * DISPLAY_LCD_V_RES);
+
+#if CONFIG_DISPLAY_FLUSH_TASK
+    // LVGL draws the first frame into the buffer the panel starts on, as without the
+    // flush task. Ownership applies from the first flush
+    FrameBuffers[0].Buffer = buf1;
+    FrameBuffers[0].Owner = FB_OWNER_LVGL;
+    FrameBuffers[1].Buffer = buf2;
+    FrameBuffers[1].Owner = FB_OWNER_LVGL;
+#endif
 #else
     ESP_LOGI(TAG, "Allocate separate LVGL draw buffers from PSRAM");
     buf1 = heap_caps_malloc(DISPLAY_LCD_H_RES * 100 * sizeof(lv_color_t), MALLOC_CAP_SPIRAM);
@@ -1100,7 +1320,14 @@ void display_init(i2c_port_t I2CNum, SemaphoreHandle_t I2CMutex)
     disp_drv.flush_cb = display_lvgl_flush_cb;
     disp_drv.draw_buf = &disp_buf;
     disp_drv.user_data = panel_handle;
-#if CONFIG_DISPLAY_DOUBLE_FB
+    disp_drv.monitor_cb = display_lvgl_monitor_cb;
+    disp_drv.draw_ctx_init = display_blend_ctx_init; // software renderer, with our own blend kernels
+#if CONFIG_DISPLAY_FLUSH_TASK
+    disp_drv.wait_cb = display_lvgl_wait_cb;
+#endif
+#if CONFIG_DISPLAY_DOUBLE_FB && CONFIG_DISPLAY_PARTIAL_REFRESH
+    disp_drv.direct_mode = true; // draw straight into the frame buffers, only the invalidated areas. LVGL keeps the two in sync
+#elif CONFIG_DISPLAY_DOUBLE_FB
     disp_drv.full_refresh = true; // the full_refresh mode can maintain the synchronization between the two frame buffers
 #endif
     lv_disp_t *disp = lv_disp_drv_register(&disp_drv);
@@ -1138,8 +1365,39 @@ void display_init(i2c_port_t I2CNum, SemaphoreHandle_t I2CMutex)
     ESP_LOGI(TAG, "Init scene");
     ui_init();
 
+#if CONFIG_DISPLAY_GLYPH_CACHE
+    // the preset name heading, the largest text on screen
+    display_glyph_cache_init();
+    lv_obj_set_style_text_font(ui_PresetHeadingLabel, display_glyph_cache_font(lv_obj_get_style_text_font(ui_PresetHeadingLabel, LV_PART_MAIN)),
+                               LV_PART_MAIN | LV_STATE_DEFAULT);
+#endif
+
+#if CONFIG_TONEX_CONTROLLER_SKINS_COMPRESSED || CONFIG_TONEX_CONTROLLER_SKINS_SD_CARD
+    skin_store_init();
+#endif
+
+#if CONFIG_DISPLAY_PROFILER
+    display_profiler_init();
+
+    // hidden toggle for the overlay
+    lv_obj_add_flag(ui_USBStatusOK, LV_OBJ_FLAG_CLICKABLE);
+    lv_obj_add_flag(ui_USBStatusFail, LV_OBJ_FLAG_CLICKABLE);
+    lv_obj_add_event_cb(ui_USBStatusOK, display_perf_overlay_event, LV_EVENT_LONG_PRESSED, NULL);
+    lv_obj_add_event_cb(ui_USBStatusFail, display_perf_overlay_event, LV_EVENT_LONG_PRESSED, NULL);
+
+    if (control_get_config_perf_overlay())
+    {
+        display_show_perf_overlay(1);
+    }
+#endif
+
     // create display task
     xTaskCreatePinnedToCore(display_task, "Dsp", DISPLAY_TASK_STACK_SIZE, NULL, DISPLAY_TASK_PRIORITY, NULL, 1);
+
+#if CONFIG_DISPLAY_FLUSH_TASK
+    // flush on the other core, rendering stays on core 1
+    xTaskCreatePinnedToCore(display_flush_task, "DspF", DISPLAY_FLUSH_TASK_STACK_SIZE, (void*)&disp_drv, DISPLAY_FLUSH_TASK_PRIORITY, NULL, 0);
+#endif
 }
 
 #endif  //CONFIG_TONEX_CONTROLLER_DISPLAY_WAVESHARE_800_480
\ No newline at end of file
@@ -23,14 +23,20 @@ limitations under the License.
 extern "C" {
 #endif
 
-void display_init(i2c_port_t I2CNum, SemaphoreHandle_t I2CMutex);
+void display_init(i2c_port_t I2CNum);
 
 // thread-safe API for other tasks to update the UI
 void UI_SetUSBStatus(uint8_t state);
 void UI_SetBTStatus(uint8_t state);
 void UI_SetPresetLabel(char* text);
 void UI_SetAmpSkin(uint16_t index);
+void UI_PrefetchSkin(uint16_t index);
+uint16_t UI_GetSkinCount(void);
 void UI_SetPresetDescription(char* text);
+void UI_StageSong(uint16_t skin_index, char* label, char* description);
+void UI_CommitStagedSong(void);
+void UI_SetPerfOverlay(uint8_t state);
+void UI_ShowMessage(char* text);
 
 #ifdef __cplusplus
 } /*extern "C"*/
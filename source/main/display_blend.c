@@ -0,0 +1,536 @@
+/*
+ Copyright (C) 2024  Greg Smith
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+ 
+*/
+
+
+#include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "lvgl.h"
+#include "src/draw/sw/lv_draw_sw.h"
+#include "display_blend.h"
+
+#if CONFIG_TONEX_CONTROLLER_DISPLAY_WAVESHARE_800_480
+
+// the word kernels repeat lv_color_mix() for RGB565 two pixels per 32 bit word, so they
+// only exist where lv_color_mix() uses its 16 bit shortcut
+#if (LV_COLOR_DEPTH == 16) && (LV_COLOR_16_SWAP == 0) && (LV_COLOR_MIX_ROUND_OFS == 0)
+#define BLEND_WORD_SUPPORTED                1
+#else
+#define BLEND_WORD_SUPPORTED                0
+#endif
+
+// RGB565 with green moved to the top half, leaving room for the products of the mix
+#define BLEND_SPREAD_MASK                   0x07E0F81F
+#define BLEND_SPREAD(c)                     ((((uint32_t)(c)) | ((uint32_t)(c) << 16)) & BLEND_SPREAD_MASK)
+
+static const char *TAG = "app_blend";
+
+static const char* KernelName[BLEND_KERNELS_MAX] =
+{
+    [BLEND_KERNELS_LVGL] = "lvgl",
+    [BLEND_KERNELS_REFERENCE] = "reference",
+    [BLEND_KERNELS_WORD] = "word",
+};
+
+#if CONFIG_DISPLAY_BLEND_KERNELS_WORD
+static uint8_t KernelSelect = BLEND_KERNELS_WORD;
+#elif CONFIG_DISPLAY_BLEND_KERNELS_REFERENCE
+static uint8_t KernelSelect = BLEND_KERNELS_REFERENCE;
+#else
+static uint8_t KernelSelect = BLEND_KERNELS_LVGL;
+#endif
+static const tBlendKernels* Kernels;
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Reference kernels, one pixel at a time with lv_color_mix()
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Results match lv_draw_sw_blend_basic() exactly
+*****************************************************************************/
+static void LV_ATTRIBUTE_FAST_MEM blend_reference_fill(lv_color_t* dest, int32_t dest_stride, int32_t width, int32_t height, lv_color_t color)
+{
+    for (int32_t y = 0; y < height; y++)
+    {
+        for (int32_t x = 0; x < width; x++)
+        {
+            dest[x] = color;
+        }
+
+        dest += dest_stride;
+    }
+}
+
+static void LV_ATTRIBUTE_FAST_MEM blend_reference_fill_mask(lv_color_t* dest, int32_t dest_stride, int32_t width, int32_t height, lv_color_t color,
+                                                            const lv_opa_t* mask, int32_t mask_stride)
+{
+    for (int32_t y = 0; y < height; y++)
+    {
+        for (int32_t x = 0; x < width; x++)
+        {
+            if (mask[x] == LV_OPA_COVER)
+            {
+                dest[x] = color;
+            }
+            else if (mask[x] != LV_OPA_TRANSP)
+            {
+                dest[x] = lv_color_mix(color, dest[x], mask[x]);
+            }
+        }
+
+        dest += dest_stride;
+        mask += mask_stride;
+    }
+}
+
+static void LV_ATTRIBUTE_FAST_MEM blend_reference_map_mask(lv_color_t* dest, int32_t dest_stride, const lv_color_t* src, int32_t src_stride,
+                                                           int32_t width, int32_t height, const lv_opa_t* mask, int32_t mask_stride)
+{
+    for (int32_t y = 0; y < height; y++)
+    {
+        for (int32_t x = 0; x < width; x++)
+        {
+            if (mask[x] == LV_OPA_COVER)
+            {
+                dest[x] = src[x];
+            }
+            else if (mask[x] != LV_OPA_TRANSP)
+            {
+                dest[x] = lv_color_mix(src[x], dest[x], mask[x]);
+            }
+        }
+
+        dest += dest_stride;
+        src += src_stride;
+        mask += mask_stride;
+    }
+}
+
+static const tBlendKernels ReferenceKernels =
+{
+    .Fill = blend_reference_fill,
+    .FillMask = blend_reference_fill_mask,
+    .MapMask = blend_reference_map_mask,
+};
+
+#if BLEND_WORD_SUPPORTED
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Mix a pre-spread foreground colour over a pixel
+* PARAMETERS:  fg: BLEND_SPREAD() of the foreground colour
+* RETURN:      
+* NOTES:       Same arithmetic as lv_color_mix() for 16 bit colour
+*****************************************************************************/
+static inline uint16_t LV_ATTRIBUTE_FAST_MEM blend_word_mix(uint32_t fg, uint16_t bg_colour, lv_opa_t opa)
+{
+    uint32_t bg = BLEND_SPREAD(bg_colour);
+    uint32_t mix = ((uint32_t)opa + 4) >> 3;
+    uint32_t result = ((((fg - bg) * mix) >> 5) + bg) & BLEND_SPREAD_MASK;
+
+    return (uint16_t)((result >> 16) | result);
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Word kernels. Pixels are stored in pairs and the mask is read
+*              four bytes at a time, so runs of fully clear or fully set
+*              mask (most of a glyph box) cost one test per four pixels
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Loops are plain C that GCC keeps in registers on the S3.
+*              Results match the reference kernels exactly
+*****************************************************************************/
+static void LV_ATTRIBUTE_FAST_MEM blend_word_fill(lv_color_t* dest, int32_t dest_stride, int32_t width, int32_t height, lv_color_t color)
+{
+    uint32_t pair = (uint32_t)color.full | ((uint32_t)color.full << 16);
+
+    for (int32_t y = 0; y < height; y++)
+    {
+        uint16_t* out = &dest[0].full;
+        int32_t remaining = width;
+
+        if (((uintptr_t)out & 0x03) && (remaining > 0))
+        {
+            *out++ = color.full;
+            remaining--;
+        }
+
+        // counted loop, a zero overhead loop on the S3 and vectorised on the host
+        uint32_t* out32 = (uint32_t*)out;
+        int32_t pairs = remaining >> 1;
+
+        for (int32_t loop = 0; loop < pairs; loop++)
+        {
+            out32[loop] = pair;
+        }
+
+        if (remaining & 0x01)
+        {
+            out[remaining - 1] = color.full;
+        }
+
+        dest += dest_stride;
+    }
+}
+
+static void LV_ATTRIBUTE_FAST_MEM blend_word_fill_mask(lv_color_t* dest, int32_t dest_stride, int32_t width, int32_t height, lv_color_t color,
+                                                       const lv_opa_t* mask, int32_t mask_stride)
+{
+    uint32_t fg = BLEND_SPREAD(color.full);
+    uint32_t pair = (uint32_t)color.full | ((uint32_t)color.full << 16);
+
+    for (int32_t y = 0; y < height; y++)
+    {
+        uint16_t* out = &dest[0].full;
+        const lv_opa_t* mask_x = mask;
+        int32_t x = 0;
+
+        // up to the first word aligned mask byte
+        for (; (x < width) && ((uintptr_t)mask_x & 0x03); x++, mask_x++)
+        {
+            if (*mask_x == LV_OPA_COVER)
+            {
+                out[x] = color.full;
+            }
+            else if (*mask_x != LV_OPA_TRANSP)
+            {
+                out[x] = blend_word_mix(fg, out[x], *mask_x);
+            }
+        }
+
+        for (; x <= (width - 4); x += 4, mask_x += 4)
+        {
+            uint32_t mask32 = *(const uint32_t*)mask_x;
+
+            if (mask32 == 0)
+            {
+                continue;
+            }
+
+            if (mask32 == 0xFFFFFFFF)
+            {
+                if ((uintptr_t)&out[x] & 0x03)
+                {
+                    out[x] = color.full;
+                    *(uint32_t*)&out[x + 1] = pair;
+                    out[x + 3] = color.full;
+                }
+                else
+                {
+                    *(uint32_t*)&out[x] = pair;
+                    *(uint32_t*)&out[x + 2] = pair;
+                }
+                continue;
+            }
+
+            // partly covered, mix all four. No per pixel tests, a mask of 0 or 255 gives
+            // back exactly the background or the colour
+            out[x] = blend_word_mix(fg, out[x], mask_x[0]);
+            out[x + 1] = blend_word_mix(fg, out[x + 1], mask_x[1]);
+            out[x + 2] = blend_word_mix(fg, out[x + 2], mask_x[2]);
+            out[x + 3] = blend_word_mix(fg, out[x + 3], mask_x[3]);
+        }
+
+        for (; x < width; x++, mask_x++)
+        {
+            if (*mask_x == LV_OPA_COVER)
+            {
+                out[x] = color.full;
+            }
+            else if (*mask_x != LV_OPA_TRANSP)
+            {
+                out[x] = blend_word_mix(fg, out[x], *mask_x);
+            }
+        }
+
+        dest += dest_stride;
+        mask += mask_stride;
+    }
+}
+
+static void LV_ATTRIBUTE_FAST_MEM blend_word_map_mask(lv_color_t* dest, int32_t dest_stride, const lv_color_t* src, int32_t src_stride,
+                                                      int32_t width, int32_t height, const lv_opa_t* mask, int32_t mask_stride)
+{
+    for (int32_t y = 0; y < height; y++)
+    {
+        uint16_t* out = &dest[0].full;
+        const uint16_t* in = &src[0].full;
+        const lv_opa_t* mask_x = mask;
+        int32_t x = 0;
+
+        // up to the first word aligned mask byte
+        for (; (x < width) && ((uintptr_t)mask_x & 0x03); x++, mask_x++)
+        {
+            if (*mask_x == LV_OPA_COVER)
+            {
+                out[x] = in[x];
+            }
+            else if (*mask_x != LV_OPA_TRANSP)
+            {
+                out[x] = blend_word_mix(BLEND_SPREAD(in[x]), out[x], *mask_x);
+            }
+        }
+
+        for (; x <= (width - 4); x += 4, mask_x += 4)
+        {
+            uint32_t mask32 = *(const uint32_t*)mask_x;
+
+            if (mask32 == 0)
+            {
+                continue;
+            }
+
+            if (mask32 == 0xFFFFFFFF)
+            {
+                // word copies when source and destination are both word aligned
+                if ((((uintptr_t)&out[x] | (uintptr_t)&in[x]) & 0x03) == 0)
+                {
+                    *(uint32_t*)&out[x] = *(const uint32_t*)&in[x];
+                    *(uint32_t*)&out[x + 2] = *(const uint32_t*)&in[x + 2];
+                }
+                else
+                {
+                    out[x] = in[x];
+                    out[x + 1] = in[x + 1];
+                    out[x + 2] = in[x + 2];
+                    out[x + 3] = in[x + 3];
+                }
+                continue;
+            }
+
+            // partly covered, mix all four. No per pixel tests, a mask of 0 or 255 gives
+            // back exactly the background or the source
+            out[x] = blend_word_mix(BLEND_SPREAD(in[x]), out[x], mask_x[0]);
+            out[x + 1] = blend_word_mix(BLEND_SPREAD(in[x + 1]), out[x + 1], mask_x[1]);
+            out[x + 2] = blend_word_mix(BLEND_SPREAD(in[x + 2]), out[x + 2], mask_x[2]);
+            out[x + 3] = blend_word_mix(BLEND_SPREAD(in[x + 3]), out[x + 3], mask_x[3]);
+        }
+
+        for (; x < width; x++, mask_x++)
+        {
+            if (*mask_x == LV_OPA_COVER)
+            {
+                out[x] = in[x];
+            }
+            else if (*mask_x != LV_OPA_TRANSP)
+            {
+                out[x] = blend_word_mix(BLEND_SPREAD(in[x]), out[x], *mask_x);
+            }
+        }
+
+        dest += dest_stride;
+        src += src_stride;
+        mask += mask_stride;
+    }
+}
+
+static const tBlendKernels WordKernels =
+{
+    .Fill = blend_word_fill,
+    .FillMask = blend_word_fill_mask,
+    .MapMask = blend_word_map_mask,
+};
+#endif  // BLEND_WORD_SUPPORTED
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Blend callback of the draw context
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Handles normal blending at full opacity into a plain frame
+*              buffer, the same cases as lv_draw_sw_blend_basic() handles
+*              with opacity ignored. Everything else goes to LVGL
+*****************************************************************************/
+static void LV_ATTRIBUTE_FAST_MEM display_blend_cb(lv_draw_ctx_t* draw_ctx, const lv_draw_sw_blend_dsc_t* dsc)
+{
+    const tBlendKernels* kernels = Kernels;
+    lv_disp_t* disp = _lv_refr_get_disp_refreshing();
+    const lv_opa_t* mask = NULL;
+    lv_area_t blend_area;
+
+    if ((kernels == NULL) || (dsc->blend_mode != LV_BLEND_MODE_NORMAL) || (disp->driver->set_px_cb != NULL) ||
+        disp->driver->screen_transp || (dsc->opa < LV_OPA_MAX))
+    {
+        lv_draw_sw_blend_basic(draw_ctx, dsc);
+        return;
+    }
+
+    if (dsc->mask_buf != NULL)
+    {
+        if (dsc->mask_res == LV_DRAW_MASK_RES_TRANSP)
+        {
+            return;
+        }
+
+        if (dsc->mask_res != LV_DRAW_MASK_RES_FULL_COVER)
+        {
+            // LVGL rounds the mask in place when anti-aliasing is off, and still applies
+            // the opacity of a masked image at exactly LV_OPA_MAX
+            if ((disp->driver->antialiasing == 0) || ((dsc->src_buf != NULL) && (dsc->opa <= LV_OPA_MAX)))
+            {
+                lv_draw_sw_blend_basic(draw_ctx, dsc);
+                return;
+            }
+
+            mask = dsc->mask_buf;
+        }
+    }
+
+    // opaque images are a memcpy per line in LVGL already
+    if ((dsc->src_buf != NULL) && (mask == NULL))
+    {
+        lv_draw_sw_blend_basic(draw_ctx, dsc);
+        return;
+    }
+
+    if (!_lv_area_intersect(&blend_area, dsc->blend_area, draw_ctx->clip_area))
+    {
+        return;
+    }
+
+    int32_t dest_stride = lv_area_get_width(draw_ctx->buf_area);
+    int32_t width = lv_area_get_width(&blend_area);
+    int32_t height = lv_area_get_height(&blend_area);
+    lv_color_t* dest = (lv_color_t*)draw_ctx->buf + (dest_stride * (blend_area.y1 - draw_ctx->buf_area->y1)) + (blend_area.x1 - draw_ctx->buf_area->x1);
+
+    if (mask == NULL)
+    {
+        kernels->Fill(dest, dest_stride, width, height, dsc->color);
+        return;
+    }
+
+    int32_t mask_stride = lv_area_get_width(dsc->mask_area);
+    mask += (mask_stride * (blend_area.y1 - dsc->mask_area->y1)) + (blend_area.x1 - dsc->mask_area->x1);
+
+    if (dsc->src_buf == NULL)
+    {
+        kernels->FillMask(dest, dest_stride, width, height, dsc->color, mask, mask_stride);
+    }
+    else
+    {
+        int32_t src_stride = lv_area_get_width(dsc->blend_area);
+        const lv_color_t* src = dsc->src_buf + (src_stride * (blend_area.y1 - dsc->blend_area->y1)) + (blend_area.x1 - dsc->blend_area->x1);
+
+        kernels->MapMask(dest, dest_stride, src, src_stride, width, height, mask, mask_stride);
+    }
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Kernels of a set
+* PARAMETERS:  
+* RETURN:      NULL for BLEND_KERNELS_LVGL, or a set not supported by the colour format
+* NOTES:       
+*****************************************************************************/
+const tBlendKernels* display_blend_get_kernel_table(uint8_t kernels)
+{
+    switch (kernels)
+    {
+        case BLEND_KERNELS_REFERENCE:
+        {
+            return &ReferenceKernels;
+        }
+
+#if BLEND_WORD_SUPPORTED
+        case BLEND_KERNELS_WORD:
+        {
+            return &WordKernels;
+        }
+#endif
+
+        default:
+        {
+            return NULL;
+        }
+    }
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+const char* display_blend_get_name(uint8_t kernels)
+{
+    if (kernels >= BLEND_KERNELS_MAX)
+    {
+        return "?";
+    }
+
+    return KernelName[kernels];
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Select the blend kernels
+* PARAMETERS:  
+* RETURN:      kernels now in use. Word kernels fall back to the reference
+*              ones if the colour format isn't supported
+* NOTES:       Call from the LVGL task, or before drawing starts
+*****************************************************************************/
+uint8_t display_blend_set_kernels(uint8_t kernels)
+{
+    if (kernels >= BLEND_KERNELS_MAX)
+    {
+        kernels = BLEND_KERNELS_LVGL;
+    }
+
+    if ((kernels == BLEND_KERNELS_WORD) && (display_blend_get_kernel_table(kernels) == NULL))
+    {
+        ESP_LOGW(TAG, "Word blend kernels need 16 bit colour without byte swap, using reference");
+        kernels = BLEND_KERNELS_REFERENCE;
+    }
+
+    KernelSelect = kernels;
+    Kernels = display_blend_get_kernel_table(kernels);
+
+    return kernels;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+uint8_t display_blend_get_kernels(void)
+{
+    return KernelSelect;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Draw context init, set as lv_disp_drv_t draw_ctx_init
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Software renderer with the blend step replaced
+*****************************************************************************/
+void display_blend_ctx_init(lv_disp_drv_t* drv, lv_draw_ctx_t* draw_ctx)
+{
+    lv_draw_sw_init_ctx(drv, draw_ctx);
+    ((lv_draw_sw_ctx_t*)draw_ctx)->blend = display_blend_cb;
+
+    ESP_LOGI(TAG, "Blend kernels: %s", display_blend_get_name(display_blend_set_kernels(KernelSelect)));
+}
+
+#endif  // CONFIG_TONEX_CONTROLLER_DISPLAY_WAVESHARE_800_480
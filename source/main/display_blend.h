@@ -0,0 +1,60 @@
+/*
+ Copyright (C) 2024  Greg Smith
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+ 
+*/
+
+
+#ifndef _DISPLAY_BLEND_H
+#define _DISPLAY_BLEND_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// blend kernel sets. LVGL uses its own lv_draw_sw_blend_basic() for everything
+enum BlendKernels
+{
+    BLEND_KERNELS_LVGL,
+    BLEND_KERNELS_REFERENCE,            // portable, one pixel at a time
+    BLEND_KERNELS_WORD,                 // 32 bit loads and stores, 16 bit colour only
+    BLEND_KERNELS_MAX                   // must be last
+};
+
+// the operations this UI spends its draw time on, all at full opacity. Strides in pixels
+typedef struct
+{
+    // solid fill: backgrounds, panels
+    void (*Fill)(lv_color_t* dest, int32_t dest_stride, int32_t width, int32_t height, lv_color_t color);
+
+    // colour through an A8 mask: font glyphs, anti-aliased edges
+    void (*FillMask)(lv_color_t* dest, int32_t dest_stride, int32_t width, int32_t height, lv_color_t color,
+                     const lv_opa_t* mask, int32_t mask_stride);
+
+    // image through an A8 mask: RGB565 plus alpha images such as icons and buttons
+    void (*MapMask)(lv_color_t* dest, int32_t dest_stride, const lv_color_t* src, int32_t src_stride,
+                    int32_t width, int32_t height, const lv_opa_t* mask, int32_t mask_stride);
+} tBlendKernels;
+
+void display_blend_ctx_init(lv_disp_drv_t* drv, lv_draw_ctx_t* draw_ctx);
+uint8_t display_blend_set_kernels(uint8_t kernels);
+uint8_t display_blend_get_kernels(void);
+const tBlendKernels* display_blend_get_kernel_table(uint8_t kernels);
+const char* display_blend_get_name(uint8_t kernels);
+
+#ifdef __cplusplus
+} /*extern "C"*/
+#endif
+
+#endif
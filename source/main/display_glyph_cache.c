@@ -0,0 +1,268 @@
+/*
+ Copyright (C) 2024  Greg Smith
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+ 
+*/
+
+
+#include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "lvgl.h"
+#include "display_glyph_cache.h"
+
+#if CONFIG_TONEX_CONTROLLER_DISPLAY_WAVESHARE_800_480
+
+// Glyphs of the wrapped fonts are expanded to 8 bits per pixel the first time LVGL asks
+// for them, into one PSRAM block that is never freed. A compressed font is then only
+// decompressed once per glyph rather than on every draw, and LVGL draws the glyph
+// without unpacking bits. Nothing is evicted: when the block is full, further glyphs
+// come straight from the font as before
+
+#define GLYPH_CACHE_MAX_FONTS               4
+#define GLYPH_CACHE_FIRST_LETTER            0x20
+#define GLYPH_CACHE_LETTERS                 0x100       // Latin-1, other letters pass through
+#define GLYPH_CACHE_BPP                     8
+
+typedef struct
+{
+    lv_font_t Font;                                 // handed to LVGL in place of Base
+    const lv_font_t* Base;
+    uint8_t* Bitmaps[GLYPH_CACHE_LETTERS];          // NULL until rasterised
+} tGlyphCacheFont;
+
+static const char *TAG = "app_glyph";
+
+static tGlyphCacheFont CacheFonts[GLYPH_CACHE_MAX_FONTS];
+static uint8_t CacheFontCount;
+static uint8_t* CacheMemory;
+static uint32_t CacheSize;
+static uint32_t CacheUsed;
+static tGlyphCacheStats CacheStats;
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Expand a glyph to one byte per pixel
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Same values as LVGL's _lv_bppN_opa_table, so the cached glyph
+*              draws identically
+*****************************************************************************/
+static void glyph_cache_expand(const uint8_t* src, uint8_t* dest, uint32_t pixels, uint8_t bpp)
+{
+    uint8_t scale = (bpp == 1) ? 255 : (bpp == 2) ? 85 : 17;
+    uint8_t mask = (1 << bpp) - 1;
+    uint32_t bit = 0;
+
+    if (bpp == GLYPH_CACHE_BPP)
+    {
+        memcpy(dest, src, pixels);
+        return;
+    }
+
+    for (uint32_t px = 0; px < pixels; px++)
+    {
+        dest[px] = ((src[bit >> 3] >> (8 - bpp - (bit & 0x07))) & mask) * scale;
+        bit += bpp;
+    }
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Find a glyph in the cache, rasterising it on first use
+* PARAMETERS:  
+* RETURN:      8 bpp bitmap, or NULL to draw from the base font
+* NOTES:       
+*****************************************************************************/
+static const uint8_t* glyph_cache_lookup(tGlyphCacheFont* cache_font, uint32_t letter, const lv_font_glyph_dsc_t* dsc)
+{
+    uint32_t pixels;
+    const uint8_t* src;
+
+    if ((letter < GLYPH_CACHE_FIRST_LETTER) || (letter >= GLYPH_CACHE_LETTERS))
+    {
+        return NULL;
+    }
+
+    if (cache_font->Bitmaps[letter] != NULL)
+    {
+        CacheStats.Hits++;
+        return cache_font->Bitmaps[letter];
+    }
+
+    // blank glyphs, and anything that isn't a plain 1/2/4/8 bpp bitmap
+    pixels = (uint32_t)dsc->box_w * dsc->box_h;
+    if ((pixels == 0) || ((dsc->bpp != 1) && (dsc->bpp != 2) && (dsc->bpp != 4) && (dsc->bpp != 8)))
+    {
+        return NULL;
+    }
+
+    if ((CacheUsed + pixels) > CacheSize)
+    {
+        CacheStats.Overflows++;
+        return NULL;
+    }
+
+    src = cache_font->Base->get_glyph_bitmap(cache_font->Base, letter);
+    if (src == NULL)
+    {
+        return NULL;
+    }
+
+    cache_font->Bitmaps[letter] = &CacheMemory[CacheUsed];
+    glyph_cache_expand(src, cache_font->Bitmaps[letter], pixels, dsc->bpp);
+    CacheUsed += pixels;
+
+    CacheStats.Misses++;
+    CacheStats.Glyphs++;
+    CacheStats.BytesUsed = CacheUsed;
+
+    return cache_font->Bitmaps[letter];
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: lv_font_t get_glyph_dsc for a wrapped font
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       LVGL asks for the descriptor before the bitmap, so the glyph is
+*              rasterised here and the bpp reported to match
+*****************************************************************************/
+static bool glyph_cache_get_glyph_dsc(const lv_font_t* font, lv_font_glyph_dsc_t* dsc_out, uint32_t letter, uint32_t letter_next)
+{
+    tGlyphCacheFont* cache_font = (tGlyphCacheFont*)font->dsc;
+
+    if (!cache_font->Base->get_glyph_dsc(cache_font->Base, dsc_out, letter, letter_next))
+    {
+        return false;
+    }
+
+    if (glyph_cache_lookup(cache_font, letter, dsc_out) != NULL)
+    {
+        dsc_out->bpp = GLYPH_CACHE_BPP;
+    }
+
+    return true;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: lv_font_t get_glyph_bitmap for a wrapped font
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static const uint8_t* glyph_cache_get_glyph_bitmap(const lv_font_t* font, uint32_t letter)
+{
+    tGlyphCacheFont* cache_font = (tGlyphCacheFont*)font->dsc;
+
+    if ((letter >= GLYPH_CACHE_FIRST_LETTER) && (letter < GLYPH_CACHE_LETTERS) && (cache_font->Bitmaps[letter] != NULL))
+    {
+        return cache_font->Bitmaps[letter];
+    }
+
+    return cache_font->Base->get_glyph_bitmap(cache_font->Base, letter);
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Allocate the cache
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Fonts wrapped before this, or when the allocation fails, pass
+*              straight through to the base font
+*****************************************************************************/
+void display_glyph_cache_init(void)
+{
+#if CONFIG_DISPLAY_GLYPH_CACHE
+    if (CacheMemory != NULL)
+    {
+        return;
+    }
+
+    CacheMemory = heap_caps_malloc(CONFIG_DISPLAY_GLYPH_CACHE_KB * 1024, MALLOC_CAP_SPIRAM);
+    if (CacheMemory == NULL)
+    {
+        ESP_LOGE(TAG, "Glyph cache allocation failed");
+        return;
+    }
+
+    CacheSize = CONFIG_DISPLAY_GLYPH_CACHE_KB * 1024;
+    CacheStats.BytesTotal = CacheSize;
+
+    ESP_LOGI(TAG, "Glyph cache %d KB", (int)CONFIG_DISPLAY_GLYPH_CACHE_KB);
+#endif
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Get a cached version of a font
+* PARAMETERS:  font: font to wrap
+* RETURN:      font to give LVGL in place of the one passed
+* NOTES:       Returns the font unchanged if the cache is off or out of slots.
+*              Wrapping the same font again returns the same cached font
+*****************************************************************************/
+const lv_font_t* display_glyph_cache_font(const lv_font_t* font)
+{
+    tGlyphCacheFont* cache_font;
+
+    if ((font == NULL) || (CacheMemory == NULL) || (font->subpx != LV_FONT_SUBPX_NONE))
+    {
+        return font;
+    }
+
+    for (uint8_t loop = 0; loop < CacheFontCount; loop++)
+    {
+        if ((CacheFonts[loop].Base == font) || (&CacheFonts[loop].Font == font))
+        {
+            return &CacheFonts[loop].Font;
+        }
+    }
+
+    if (CacheFontCount >= GLYPH_CACHE_MAX_FONTS)
+    {
+        ESP_LOGW(TAG, "No glyph cache slot for font");
+        return font;
+    }
+
+    cache_font = &CacheFonts[CacheFontCount++];
+    memset(cache_font, 0, sizeof(tGlyphCacheFont));
+    cache_font->Base = font;
+
+    // same metrics as the base font, only the glyph lookups change
+    cache_font->Font = *font;
+    cache_font->Font.get_glyph_dsc = glyph_cache_get_glyph_dsc;
+    cache_font->Font.get_glyph_bitmap = glyph_cache_get_glyph_bitmap;
+    cache_font->Font.dsc = cache_font;
+
+    return &cache_font->Font;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void display_glyph_cache_get_stats(tGlyphCacheStats* stats)
+{
+    memcpy((void*)stats, (void*)&CacheStats, sizeof(tGlyphCacheStats));
+}
+
+#endif  //CONFIG_TONEX_CONTROLLER_DISPLAY_WAVESHARE_800_480
@@ -0,0 +1,44 @@
+/*
+ Copyright (C) 2024  Greg Smith
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+ 
+*/
+
+
+#ifndef _DISPLAY_GLYPH_CACHE_H
+#define _DISPLAY_GLYPH_CACHE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct
+{
+    uint32_t Hits;
+    uint32_t Misses;                    // glyphs rasterised into the cache
+    uint32_t Overflows;                 // glyphs drawn uncached, cache full
+    uint32_t Glyphs;
+    uint32_t BytesUsed;
+    uint32_t BytesTotal;
+} tGlyphCacheStats;
+
+void display_glyph_cache_init(void);
+const lv_font_t* display_glyph_cache_font(const lv_font_t* font);
+void display_glyph_cache_get_stats(tGlyphCacheStats* stats);
+
+#ifdef __cplusplus
+} /*extern "C"*/
+#endif
+
+#endif
@@ -0,0 +1,306 @@
+/*
+ Copyright (C) 2024  Greg Smith
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+ 
+*/
+
+
+#include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "sys/param.h"
+#include "display_profiler.h"
+
+#if CONFIG_DISPLAY_PROFILER
+
+// overlay figures cover the last complete window, histograms everything since the last log
+#define PROFILE_WINDOW_US                   (1000 * 1000)
+#define PROFILE_LOG_PERIOD_US               ((int64_t)CONFIG_DISPLAY_PROFILER_LOG_PERIOD * 1000 * 1000)
+#define PROFILE_LOG_LINE_LENGTH             200
+
+static const char *TAG = "app_profiler";
+
+static const uint32_t BucketLimit[PROFILE_HISTOGRAM_BUCKETS] =
+{
+    250, 500, 1000, 2000, 4000, 8000, 16000, 32000, 64000, UINT32_MAX
+};
+
+static const char* StageName[PROFILE_STAGE_MAX] =
+{
+    [PROFILE_STAGE_TASK_HANDLER] = "handler",
+    [PROFILE_STAGE_FLUSH] = "flush",
+    [PROFILE_STAGE_VSYNC_WAIT] = "vsync",
+    [PROFILE_STAGE_REFRESH] = "refresh",
+    [PROFILE_STAGE_BUFFER_WAIT] = "buffer",
+};
+
+static tProfileStageStats Stats[PROFILE_STAGE_MAX];
+static tProfileStageStats Window[PROFILE_STAGE_MAX];
+static tProfileStageStats LastWindow[PROFILE_STAGE_MAX];
+static uint32_t WindowFrames;
+static uint32_t WindowPixels;
+static uint16_t FramesPerSecond;
+static uint32_t PixelsPerSecond;
+static int64_t WindowStart;
+static int64_t LastLog;
+static portMUX_TYPE ProfileLock = portMUX_INITIALIZER_UNLOCKED;
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Record how long a stage took
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Cheap enough to call per flush
+*****************************************************************************/
+void display_profiler_record(uint8_t stage, uint32_t time_us)
+{
+    uint8_t bucket = 0;
+
+    if (stage >= PROFILE_STAGE_MAX)
+    {
+        return;
+    }
+
+    while (time_us >= BucketLimit[bucket])
+    {
+        bucket++;
+    }
+
+    taskENTER_CRITICAL(&ProfileLock);
+    Stats[stage].Count++;
+    Stats[stage].Last = time_us;
+    Stats[stage].Max = MAX(Stats[stage].Max, time_us);
+    Stats[stage].Total += time_us;
+    Stats[stage].Histogram[bucket]++;
+
+    Window[stage].Count++;
+    Window[stage].Last = time_us;
+    Window[stage].Max = MAX(Window[stage].Max, time_us);
+    Window[stage].Total += time_us;
+    taskEXIT_CRITICAL(&ProfileLock);
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Count a frame sent to the panel
+* PARAMETERS:  px: pixels redrawn
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void display_profiler_frame(uint32_t px)
+{
+    taskENTER_CRITICAL(&ProfileLock);
+    WindowFrames++;
+    WindowPixels += px;
+    taskEXIT_CRITICAL(&ProfileLock);
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Close the measurement window once a second
+* PARAMETERS:  
+* RETURN:      1 if a new window completed, so the overlay should be redrawn
+* NOTES:       Called every pass of the display task
+*****************************************************************************/
+uint8_t display_profiler_tick(void)
+{
+    int64_t now = esp_timer_get_time();
+    int64_t elapsed = now - WindowStart;
+
+    if (elapsed < PROFILE_WINDOW_US)
+    {
+        return 0;
+    }
+
+    taskENTER_CRITICAL(&ProfileLock);
+    memcpy((void*)LastWindow, (void*)Window, sizeof(LastWindow));
+    memset((void*)Window, 0, sizeof(Window));
+    FramesPerSecond = (uint16_t)(((int64_t)WindowFrames * 1000 * 1000) / elapsed);
+    PixelsPerSecond = (uint32_t)(((int64_t)WindowPixels * 1000 * 1000) / elapsed);
+    WindowFrames = 0;
+    WindowPixels = 0;
+    taskEXIT_CRITICAL(&ProfileLock);
+
+    WindowStart = now;
+
+    if ((now - LastLog) >= PROFILE_LOG_PERIOD_US)
+    {
+        display_profiler_log();
+        display_profiler_reset();
+        LastLog = now;
+    }
+
+    return 1;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      frames sent to the panel in the last second
+* NOTES:       
+*****************************************************************************/
+uint16_t display_profiler_get_fps(void)
+{
+    return FramesPerSecond;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Totals and histogram since the last log
+*****************************************************************************/
+void display_profiler_get_stats(uint8_t stage, tProfileStageStats* stats)
+{
+    if (stage >= PROFILE_STAGE_MAX)
+    {
+        memset((void*)stats, 0, sizeof(tProfileStageStats));
+        return;
+    }
+
+    taskENTER_CRITICAL(&ProfileLock);
+    memcpy((void*)stats, (void*)&Stats[stage], sizeof(tProfileStageStats));
+    taskEXIT_CRITICAL(&ProfileLock);
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Build the text for the on-screen overlay
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Average and max per stage over the last second, in msec
+*****************************************************************************/
+void display_profiler_format_overlay(char* text, uint16_t length)
+{
+    tProfileStageStats window[PROFILE_STAGE_MAX];
+    uint32_t avg[PROFILE_STAGE_MAX];
+    int used;
+
+    taskENTER_CRITICAL(&ProfileLock);
+    memcpy((void*)window, (void*)LastWindow, sizeof(window));
+    taskEXIT_CRITICAL(&ProfileLock);
+
+    for (uint8_t loop = 0; loop < PROFILE_STAGE_MAX; loop++)
+    {
+        avg[loop] = 0;
+
+        if (window[loop].Count > 0)
+        {
+            avg[loop] = (uint32_t)(window[loop].Total / window[loop].Count);
+        }
+    }
+
+    used = snprintf(text, length, "%d fps  %d Kpx/s\n", (int)FramesPerSecond, (int)(PixelsPerSecond / 1000));
+
+    for (uint8_t loop = 0; (loop < PROFILE_STAGE_MAX) && (used > 0) && (used < length); loop++)
+    {
+        used += snprintf(&text[used], length - used, "%s %d.%d / %d.%d ms\n", StageName[loop], 
+                        (int)(avg[loop] / 1000), (int)((avg[loop] % 1000) / 100),
+                        (int)(window[loop].Max / 1000), (int)((window[loop].Max % 1000) / 100));
+    }
+
+    if ((used > 0) && (used < length))
+    {
+        snprintf(&text[used], length - used, "heap %dK int, %dK psram",
+                (int)(heap_caps_get_free_size(MALLOC_CAP_INTERNAL) / 1024),
+                (int)(heap_caps_get_free_size(MALLOC_CAP_SPIRAM) / 1024));
+    }
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Log the histograms for each stage
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void display_profiler_log(void)
+{
+    tProfileStageStats stats;
+    char line[PROFILE_LOG_LINE_LENGTH];
+    int used;
+
+    for (uint8_t stage = 0; stage < PROFILE_STAGE_MAX; stage++)
+    {
+        display_profiler_get_stats(stage, &stats);
+
+        if (stats.Count == 0)
+        {
+            continue;
+        }
+
+        used = snprintf(line, sizeof(line), "%s n=%d avg=%dus max=%dus |", StageName[stage], (int)stats.Count,
+                        (int)(stats.Total / stats.Count), (int)stats.Max);
+
+        for (uint8_t bucket = 0; (bucket < PROFILE_HISTOGRAM_BUCKETS) && (used > 0) && (used < sizeof(line)); bucket++)
+        {
+            used += snprintf(&line[used], sizeof(line) - used, " %d", (int)stats.Histogram[bucket]);
+        }
+
+        ESP_LOGI(TAG, "%s", line);
+    }
+
+    ESP_LOGI(TAG, "Histogram buckets (usec) <250 <500 <1000 <2000 <4000 <8000 <16000 <32000 <64000 longer");
+    ESP_LOGI(TAG, "%d fps, heap free %d internal (largest %d), %d PSRAM", (int)FramesPerSecond,
+            (int)heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
+            (int)heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL),
+            (int)heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void display_profiler_reset(void)
+{
+    taskENTER_CRITICAL(&ProfileLock);
+    memset((void*)Stats, 0, sizeof(Stats));
+    taskEXIT_CRITICAL(&ProfileLock);
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void display_profiler_init(void)
+{
+    memset((void*)Stats, 0, sizeof(Stats));
+    memset((void*)Window, 0, sizeof(Window));
+    memset((void*)LastWindow, 0, sizeof(LastWindow));
+    WindowFrames = 0;
+    WindowPixels = 0;
+    FramesPerSecond = 0;
+    PixelsPerSecond = 0;
+    WindowStart = esp_timer_get_time();
+    LastLog = WindowStart;
+
+    ESP_LOGI(TAG, "Display profiler enabled, logging every %d sec", CONFIG_DISPLAY_PROFILER_LOG_PERIOD);
+}
+
+#endif  //CONFIG_DISPLAY_PROFILER
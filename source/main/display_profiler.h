@@ -0,0 +1,64 @@
+/*
+ Copyright (C) 2024  Greg Smith
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+ 
+*/
+
+
+#ifndef _DISPLAY_PROFILER_H
+#define _DISPLAY_PROFILER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// upper limits of the histogram buckets, usec. The last bucket holds everything longer
+#define PROFILE_HISTOGRAM_BUCKETS           10
+#define PROFILE_OVERLAY_TEXT_LENGTH         192
+
+// timed stages of the display path
+enum ProfileStages
+{
+    PROFILE_STAGE_TASK_HANDLER,         // lv_task_handler(), render and flush
+    PROFILE_STAGE_FLUSH,                // display_lvgl_flush_cb()
+    PROFILE_STAGE_VSYNC_WAIT,           // part of the flush spent waiting for the panel
+    PROFILE_STAGE_REFRESH,              // LVGL refresh of one frame, as reported to the monitor callback
+    PROFILE_STAGE_BUFFER_WAIT,          // render held until the flush task frees a frame buffer
+    PROFILE_STAGE_MAX                   // must be last
+};
+
+typedef struct
+{
+    uint32_t Count;
+    uint32_t Last;                      // usec
+    uint32_t Max;                       // usec
+    uint64_t Total;                     // usec
+    uint32_t Histogram[PROFILE_HISTOGRAM_BUCKETS];
+} tProfileStageStats;
+
+void display_profiler_init(void);
+void display_profiler_record(uint8_t stage, uint32_t time_us);
+void display_profiler_frame(uint32_t px);
+uint8_t display_profiler_tick(void);
+uint16_t display_profiler_get_fps(void);
+void display_profiler_get_stats(uint8_t stage, tProfileStageStats* stats);
+void display_profiler_format_overlay(char* text, uint16_t length);
+void display_profiler_log(void);
+void display_profiler_reset(void);
+
+#ifdef __cplusplus
+} /*extern "C"*/
+#endif
+
+#endif
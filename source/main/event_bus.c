@@ -0,0 +1,275 @@
+/*
+ Copyright (C) 2024  Greg Smith
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+ 
+*/
+
+
+#include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "event_bus.h"
+
+// text payloads are copied once into a pooled block and shared by all subscribers
+#define EVENT_BUS_TEXT_BLOCKS               8
+
+typedef struct
+{
+    uint8_t RefCount;
+    char Text[EVENT_BUS_MAX_TEXT];
+} tEventBusBlock;
+
+typedef struct
+{
+    const char* Name;
+    uint32_t TopicMask;
+    QueueHandle_t Queue;
+    uint32_t Dropped;
+} tEventBusSubscriber;
+
+static const char *TAG = "app_event_bus";
+static tEventBusSubscriber Subscribers[EVENT_BUS_MAX_SUBSCRIBERS];
+static uint8_t SubscriberCount = 0;
+static tEventBusBlock TextBlocks[EVENT_BUS_TEXT_BLOCKS];
+static portMUX_TYPE EventBusLock = portMUX_INITIALIZER_UNLOCKED;
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Must be called with the lock held
+*****************************************************************************/
+static tEventBusBlock* event_bus_alloc_block(void)
+{
+    for (uint8_t loop = 0; loop < EVENT_BUS_TEXT_BLOCKS; loop++)
+    {
+        if (TextBlocks[loop].RefCount == 0)
+        {
+            return &TextBlocks[loop];
+        }
+    }
+
+    return NULL;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void event_bus_publish(uint8_t topic, uint32_t value, const char* text)
+{
+    tEventBusMessage message;
+    tEventBusBlock* block = NULL;
+    uint8_t count = 0;
+
+    if (topic >= EVENT_BUS_TOPIC_MAX)
+    {
+        return;
+    }
+
+    message.Topic = topic;
+    message.Value = value;
+    message.Text = NULL;
+    message.Block = NULL;
+
+    taskENTER_CRITICAL(&EventBusLock);
+
+    for (uint8_t loop = 0; loop < SubscriberCount; loop++)
+    {
+        if (Subscribers[loop].TopicMask & EVENT_BUS_TOPIC_MASK(topic))
+        {
+            count++;
+        }
+    }
+
+    if ((count > 0) && (text != NULL))
+    {
+        // hold one reference per subscriber, released as each one is done with it
+        block = event_bus_alloc_block();
+        if (block != NULL)
+        {
+            block->RefCount = count;
+        }
+    }
+
+    taskEXIT_CRITICAL(&EventBusLock);
+
+    if (count == 0)
+    {
+        // nobody listening
+        return;
+    }
+
+    if (block != NULL)
+    {
+        strncpy(block->Text, text, EVENT_BUS_MAX_TEXT - 1);
+        block->Text[EVENT_BUS_MAX_TEXT - 1] = 0;
+        message.Text = block->Text;
+        message.Block = (void*)block;
+    }
+    else if (text != NULL)
+    {
+        ESP_LOGW(TAG, "No free text block for topic %d", (int)topic);
+    }
+
+    for (uint8_t loop = 0; loop < SubscriberCount; loop++)
+    {
+        if ((Subscribers[loop].TopicMask & EVENT_BUS_TOPIC_MASK(topic)) == 0)
+        {
+            continue;
+        }
+
+        // never wait, a slow subscriber must not hold up the publisher
+        if (xQueueSend(Subscribers[loop].Queue, (void*)&message, 0) != pdPASS)
+        {
+            tEventBusMessage missed = message;
+
+            Subscribers[loop].Dropped++;
+            event_bus_release(&missed);
+        }
+    }
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  topic_mask: EVENT_BUS_TOPIC_MASK() of the topics wanted
+*              depth: queue size
+* RETURN:      subscriber id, or EVENT_BUS_SUBSCRIBER_INVALID
+* NOTES:       
+*****************************************************************************/
+int8_t event_bus_subscribe(const char* name, uint32_t topic_mask, uint8_t depth)
+{
+    QueueHandle_t queue;
+    int8_t result = EVENT_BUS_SUBSCRIBER_INVALID;
+
+    queue = xQueueCreate(depth, sizeof(tEventBusMessage));
+    if (queue == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to create queue for %s", name);
+        return EVENT_BUS_SUBSCRIBER_INVALID;
+    }
+
+    taskENTER_CRITICAL(&EventBusLock);
+
+    if (SubscriberCount < EVENT_BUS_MAX_SUBSCRIBERS)
+    {
+        Subscribers[SubscriberCount].Name = name;
+        Subscribers[SubscriberCount].TopicMask = topic_mask;
+        Subscribers[SubscriberCount].Queue = queue;
+        Subscribers[SubscriberCount].Dropped = 0;
+        result = SubscriberCount;
+        SubscriberCount++;
+    }
+
+    taskEXIT_CRITICAL(&EventBusLock);
+
+    if (result == EVENT_BUS_SUBSCRIBER_INVALID)
+    {
+        ESP_LOGE(TAG, "Too many subscribers, %s not added", name);
+        vQueueDelete(queue);
+    }
+    else
+    {
+        ESP_LOGI(TAG, "Subscriber %d: %s", (int)result, name);
+    }
+
+    return result;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      1 if a message was received
+* NOTES:       call event_bus_release() when done with the message
+*****************************************************************************/
+uint8_t event_bus_receive(int8_t subscriber, tEventBusMessage* message, TickType_t wait)
+{
+    if ((subscriber < 0) || (subscriber >= SubscriberCount))
+    {
+        return 0;
+    }
+
+    return xQueueReceive(Subscribers[subscriber].Queue, (void*)message, wait) == pdPASS;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void event_bus_release(tEventBusMessage* message)
+{
+    tEventBusBlock* block = (tEventBusBlock*)message->Block;
+
+    if (block == NULL)
+    {
+        return;
+    }
+
+    taskENTER_CRITICAL(&EventBusLock);
+
+    if (block->RefCount > 0)
+    {
+        block->RefCount--;
+    }
+
+    taskEXIT_CRITICAL(&EventBusLock);
+
+    message->Block = NULL;
+    message->Text = NULL;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      number of events missed due to a full queue
+* NOTES:       
+*****************************************************************************/
+uint32_t event_bus_get_dropped(int8_t subscriber)
+{
+    if ((subscriber < 0) || (subscriber >= SubscriberCount))
+    {
+        return 0;
+    }
+
+    return Subscribers[subscriber].Dropped;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void event_bus_init(void)
+{
+    memset((void*)Subscribers, 0, sizeof(Subscribers));
+    memset((void*)TextBlocks, 0, sizeof(TextBlocks));
+    SubscriberCount = 0;
+}
@@ -0,0 +1,65 @@
+/*
+ Copyright (C) 2024  Greg Smith
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+ 
+*/
+
+
+#ifndef _EVENT_BUS_H
+#define _EVENT_BUS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EVENT_BUS_MAX_SUBSCRIBERS           6
+#define EVENT_BUS_MAX_TEXT                  128
+#define EVENT_BUS_SUBSCRIBER_INVALID        -1
+
+enum EventBusTopics
+{
+    EVENT_BUS_TOPIC_PRESET_CHANGED,         // Value: logical preset, Text: preset name
+    EVENT_BUS_TOPIC_USB_STATUS,             // Value: connected status
+    EVENT_BUS_TOPIC_BT_STATUS,              // Value: connected status
+    EVENT_BUS_TOPIC_CONFIG_CHANGED,         // Value: unused
+    EVENT_BUS_TOPIC_MAX                     // must be last
+};
+
+#define EVENT_BUS_TOPIC_MASK(topic)         (1UL << (topic))
+#define EVENT_BUS_TOPIC_MASK_ALL            ((1UL << EVENT_BUS_TOPIC_MAX) - 1)
+
+typedef struct
+{
+    uint8_t Topic;
+    uint32_t Value;
+    const char* Text;                       // shared between subscribers, NULL if none. Valid until released
+    void* Block;                            // internal, owner of Text
+} tEventBusMessage;
+
+void event_bus_init(void);
+
+// publish is non-blocking. A subscriber with a full queue misses the event
+void event_bus_publish(uint8_t topic, uint32_t value, const char* text);
+
+// subscribers register at init time, before events are published
+int8_t event_bus_subscribe(const char* name, uint32_t topic_mask, uint8_t depth);
+uint8_t event_bus_receive(int8_t subscriber, tEventBusMessage* message, TickType_t wait);
+void event_bus_release(tEventBusMessage* message);
+uint32_t event_bus_get_dropped(int8_t subscriber);
+
+#ifdef __cplusplus
+} /*extern "C"*/
+#endif
+
+#endif
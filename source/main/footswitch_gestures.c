@@ -0,0 +1,384 @@
+/*
+ Copyright (C) 2024  Greg Smith
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+ 
+*/
+
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "sdkconfig.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "control.h"
+#include "footswitch_gestures.h"
+
+// Gestures are decided from the press and release times the input layer reports, so
+// the debounce or scan rate only delays when a gesture is seen, never what it is. A
+// switch with nothing but a tap (and hold repeat) mapped acts on the press itself.
+// Otherwise the tap waits until it can't be anything else: the release, the end of
+// the double tap window, or the end of the combo window
+
+#define GESTURE_LONG_PRESS_US               ((int64_t)CONFIG_FOOTSWITCH_LONG_PRESS_MS * 1000)
+#define GESTURE_DOUBLE_TAP_US               ((int64_t)CONFIG_FOOTSWITCH_DOUBLE_TAP_MS * 1000)
+#define GESTURE_REPEAT_US                   ((int64_t)CONFIG_FOOTSWITCH_REPEAT_MS * 1000)
+#define GESTURE_COMBO_US                    ((int64_t)CONFIG_FOOTSWITCH_COMBO_MS * 1000)
+#define GESTURE_COUNT                       (FOOTSWITCH_GESTURE_COMBO + 1)
+#define GESTURE_NONE                        -1
+
+enum GestureStates
+{
+    GESTURE_STATE_IDLE,
+    GESTURE_STATE_DOWN,                     // pressed, gesture not decided yet
+    GESTURE_STATE_WAIT_SECOND,              // released, waiting for a double tap
+    GESTURE_STATE_DONE,                     // gesture done, ignore the rest of this press
+};
+
+typedef struct
+{
+    uint8_t State;
+    uint8_t Pressed;
+    uint8_t TapOnPress;                     // tap can't be anything else
+    int64_t PressTime;                      // usec
+    int64_t Deadline;                       // usec, 0 for none
+    int64_t NextRepeat;                     // usec, 0 for none
+} tGestureSwitch;
+
+static const char *TAG = "app_gestures";
+
+static const tFootswitchGesture* Gestures;
+static int8_t GestureLookup[FOOTSWITCH_MAX][GESTURE_COUNT];     // table entry, or GESTURE_NONE
+static int8_t ComboLookup[FOOTSWITCH_MAX][FOOTSWITCH_MAX];
+static tGestureSwitch GestureSwitch[FOOTSWITCH_MAX];
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Run the action mapped to a gesture
+* PARAMETERS:  entry: table entry, time: usec the gesture was decided
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static void gesture_run(int8_t entry, int64_t time)
+{
+    const tFootswitchGesture* gesture;
+
+    if (entry == GESTURE_NONE)
+    {
+        return;
+    }
+
+    gesture = &Gestures[entry];
+
+    switch (gesture->Action)
+    {
+        case FOOTSWITCH_ACTION_PRESET_DOWN:
+        {
+            control_request_preset_down(CONTROL_SOURCE_FOOTSWITCH);
+        } break;
+
+        case FOOTSWITCH_ACTION_PRESET_UP:
+        {
+            control_request_preset_up(CONTROL_SOURCE_FOOTSWITCH);
+        } break;
+
+        case FOOTSWITCH_ACTION_PRESET_INDEX:
+        {
+            control_request_preset_index(CONTROL_SOURCE_FOOTSWITCH, gesture->Value);
+        } break;
+
+        case FOOTSWITCH_ACTION_BANK_DOWN:
+        {
+            control_request_bank_step(CONTROL_SOURCE_FOOTSWITCH, 0);
+        } break;
+
+        case FOOTSWITCH_ACTION_BANK_UP:
+        {
+            control_request_bank_step(CONTROL_SOURCE_FOOTSWITCH, 1);
+        } break;
+
+        case FOOTSWITCH_ACTION_BYPASS_TOGGLE:
+        {
+            control_request_bypass_toggle(CONTROL_SOURCE_FOOTSWITCH);
+        } break;
+
+        case FOOTSWITCH_ACTION_MACRO:
+        {
+            control_request_macro(gesture->Value);
+        } break;
+    }
+
+    ESP_LOGI(TAG, "Footswitch %d gesture %d, %"PRIi64" usec", (int)gesture->Switch + 1, (int)gesture->Gesture, esp_timer_get_time() - time);
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: A switch has been pressed
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static void gesture_press(uint8_t index, int64_t time)
+{
+    tGestureSwitch* sw = &GestureSwitch[index];
+
+    if (sw->State == GESTURE_STATE_WAIT_SECOND)
+    {
+        sw->State = GESTURE_STATE_DONE;
+        sw->Deadline = 0;
+        gesture_run(GestureLookup[index][FOOTSWITCH_GESTURE_DOUBLE_TAP], time);
+        return;
+    }
+
+    // another switch pressed just before this one
+    for (uint8_t other = 0; other < FOOTSWITCH_MAX; other++)
+    {
+        if ((ComboLookup[index][other] != GESTURE_NONE) && (GestureSwitch[other].State == GESTURE_STATE_DOWN) &&
+            ((time - GestureSwitch[other].PressTime) <= GESTURE_COMBO_US))
+        {
+            sw->State = GESTURE_STATE_DONE;
+            GestureSwitch[other].State = GESTURE_STATE_DONE;
+            GestureSwitch[other].Deadline = 0;
+            GestureSwitch[other].NextRepeat = 0;
+            gesture_run(ComboLookup[index][other], time);
+            return;
+        }
+    }
+
+    sw->PressTime = time;
+    sw->Deadline = 0;
+    sw->NextRepeat = 0;
+
+    if (GestureLookup[index][FOOTSWITCH_GESTURE_HOLD_REPEAT] != GESTURE_NONE)
+    {
+        sw->NextRepeat = time + GESTURE_LONG_PRESS_US;
+    }
+
+    if (sw->TapOnPress)
+    {
+        sw->State = GESTURE_STATE_DONE;
+        gesture_run(GestureLookup[index][FOOTSWITCH_GESTURE_TAP], time);
+        return;
+    }
+
+    sw->State = GESTURE_STATE_DOWN;
+
+    if (GestureLookup[index][FOOTSWITCH_GESTURE_LONG_PRESS] != GESTURE_NONE)
+    {
+        sw->Deadline = time + GESTURE_LONG_PRESS_US;
+    }
+    else if (GestureLookup[index][FOOTSWITCH_GESTURE_DOUBLE_TAP] == GESTURE_NONE)
+    {
+        // only waiting to see if it is a combo
+        sw->Deadline = time + GESTURE_COMBO_US;
+    }
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: A switch has been released
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static void gesture_release(uint8_t index, int64_t time)
+{
+    tGestureSwitch* sw = &GestureSwitch[index];
+
+    sw->NextRepeat = 0;
+
+    if (sw->State != GESTURE_STATE_DOWN)
+    {
+        sw->State = GESTURE_STATE_IDLE;
+        sw->Deadline = 0;
+        return;
+    }
+
+    if ((GestureLookup[index][FOOTSWITCH_GESTURE_LONG_PRESS] != GESTURE_NONE) && ((time - sw->PressTime) >= GESTURE_LONG_PRESS_US))
+    {
+        // held long enough, released before the deadline was processed
+        sw->State = GESTURE_STATE_IDLE;
+        sw->Deadline = 0;
+        gesture_run(GestureLookup[index][FOOTSWITCH_GESTURE_LONG_PRESS], time);
+    }
+    else if (GestureLookup[index][FOOTSWITCH_GESTURE_DOUBLE_TAP] != GESTURE_NONE)
+    {
+        sw->State = GESTURE_STATE_WAIT_SECOND;
+        sw->Deadline = time + GESTURE_DOUBLE_TAP_US;
+    }
+    else
+    {
+        sw->State = GESTURE_STATE_IDLE;
+        sw->Deadline = 0;
+        gesture_run(GestureLookup[index][FOOTSWITCH_GESTURE_TAP], time);
+    }
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Build the lookups for a gesture table
+* PARAMETERS:  gestures: table, kept by reference
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void footswitch_gestures_init(const tFootswitchGesture* gestures, uint8_t count)
+{
+    memset((void*)GestureLookup, GESTURE_NONE, sizeof(GestureLookup));
+    memset((void*)ComboLookup, GESTURE_NONE, sizeof(ComboLookup));
+    memset((void*)GestureSwitch, 0, sizeof(GestureSwitch));
+
+    Gestures = gestures;
+
+    for (uint8_t loop = 0; loop < count; loop++)
+    {
+        const tFootswitchGesture* gesture = &gestures[loop];
+
+        if ((gesture->Switch >= FOOTSWITCH_MAX) || (gesture->Gesture >= GESTURE_COUNT) ||
+            ((gesture->Gesture == FOOTSWITCH_GESTURE_COMBO) && ((gesture->Other >= FOOTSWITCH_MAX) || (gesture->Other == gesture->Switch))))
+        {
+            ESP_LOGW(TAG, "Gesture %d invalid", (int)loop);
+            continue;
+        }
+
+        if (gesture->Gesture == FOOTSWITCH_GESTURE_COMBO)
+        {
+            // either switch may be pressed first
+            ComboLookup[gesture->Switch][gesture->Other] = loop;
+            ComboLookup[gesture->Other][gesture->Switch] = loop;
+        }
+        else
+        {
+            GestureLookup[gesture->Switch][gesture->Gesture] = loop;
+        }
+    }
+
+    for (uint8_t sw = 0; sw < FOOTSWITCH_MAX; sw++)
+    {
+        uint8_t combo = 0;
+
+        if ((GestureLookup[sw][FOOTSWITCH_GESTURE_LONG_PRESS] != GESTURE_NONE) && (GestureLookup[sw][FOOTSWITCH_GESTURE_HOLD_REPEAT] != GESTURE_NONE))
+        {
+            ESP_LOGW(TAG, "Footswitch %d has long press and hold repeat, repeat ignored", (int)sw + 1);
+            GestureLookup[sw][FOOTSWITCH_GESTURE_HOLD_REPEAT] = GESTURE_NONE;
+        }
+
+        for (uint8_t other = 0; other < FOOTSWITCH_MAX; other++)
+        {
+            if (ComboLookup[sw][other] != GESTURE_NONE)
+            {
+                combo = 1;
+            }
+        }
+
+        GestureSwitch[sw].TapOnPress = !combo && (GestureLookup[sw][FOOTSWITCH_GESTURE_DOUBLE_TAP] == GESTURE_NONE) &&
+                                       (GestureLookup[sw][FOOTSWITCH_GESTURE_LONG_PRESS] == GESTURE_NONE);
+    }
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: A switch has been pressed or released
+* PARAMETERS:  time: usec the change was seen
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void footswitch_gestures_input(uint8_t index, uint8_t pressed, int64_t time)
+{
+    if ((index >= FOOTSWITCH_MAX) || (pressed == GestureSwitch[index].Pressed))
+    {
+        return;
+    }
+
+    GestureSwitch[index].Pressed = pressed;
+
+    if (pressed)
+    {
+        gesture_press(index, time);
+    }
+    else
+    {
+        gesture_release(index, time);
+    }
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Run the gestures whose time is up
+* PARAMETERS:  now: usec
+* RETURN:      usec of the next deadline, 0 if none
+* NOTES:       
+*****************************************************************************/
+int64_t footswitch_gestures_process(int64_t now)
+{
+    int64_t next = 0;
+
+    for (uint8_t index = 0; index < FOOTSWITCH_MAX; index++)
+    {
+        tGestureSwitch* sw = &GestureSwitch[index];
+
+        if ((sw->Deadline != 0) && (now >= sw->Deadline))
+        {
+            sw->Deadline = 0;
+
+            if (sw->State == GESTURE_STATE_DOWN)
+            {
+                if (GestureLookup[index][FOOTSWITCH_GESTURE_LONG_PRESS] != GESTURE_NONE)
+                {
+                    sw->State = GESTURE_STATE_DONE;
+                    gesture_run(GestureLookup[index][FOOTSWITCH_GESTURE_LONG_PRESS], now);
+                }
+                else
+                {
+                    // combo window over, still held
+                    sw->State = GESTURE_STATE_DONE;
+                    gesture_run(GestureLookup[index][FOOTSWITCH_GESTURE_TAP], now);
+                }
+            }
+            else if (sw->State == GESTURE_STATE_WAIT_SECOND)
+            {
+                // no second tap
+                sw->State = GESTURE_STATE_IDLE;
+                gesture_run(GestureLookup[index][FOOTSWITCH_GESTURE_TAP], now);
+            }
+        }
+
+        if (sw->Pressed && (sw->NextRepeat != 0) && (now >= sw->NextRepeat))
+        {
+            // a held switch is done with tap, double tap and combo
+            sw->State = GESTURE_STATE_DONE;
+            sw->Deadline = 0;
+
+            sw->NextRepeat += GESTURE_REPEAT_US;
+            if (sw->NextRepeat <= now)
+            {
+                // fell behind, don't burst to catch up
+                sw->NextRepeat = now + GESTURE_REPEAT_US;
+            }
+
+            gesture_run(GestureLookup[index][FOOTSWITCH_GESTURE_HOLD_REPEAT], now);
+        }
+
+        if ((sw->Deadline != 0) && ((next == 0) || (sw->Deadline < next)))
+        {
+            next = sw->Deadline;
+        }
+
+        if ((sw->NextRepeat != 0) && ((next == 0) || (sw->NextRepeat < next)))
+        {
+            next = sw->NextRepeat;
+        }
+    }
+
+    return next;
+}
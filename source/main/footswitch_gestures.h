@@ -0,0 +1,69 @@
+/*
+ Copyright (C) 2024  Greg Smith
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+ 
+*/
+
+
+#ifndef _FOOTSWITCH_GESTURES_H
+#define _FOOTSWITCH_GESTURES_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FOOTSWITCH_MAX                      8
+
+enum FootswitchGestures
+{
+    FOOTSWITCH_GESTURE_TAP,
+    FOOTSWITCH_GESTURE_DOUBLE_TAP,
+    FOOTSWITCH_GESTURE_LONG_PRESS,          // once, when held for the long press time
+    FOOTSWITCH_GESTURE_HOLD_REPEAT,         // when held for the long press time, then at the repeat rate
+    FOOTSWITCH_GESTURE_COMBO,               // Switch and Other pressed together
+};
+
+enum FootswitchActions
+{
+    FOOTSWITCH_ACTION_PRESET_DOWN,
+    FOOTSWITCH_ACTION_PRESET_UP,
+    FOOTSWITCH_ACTION_PRESET_INDEX,         // Value: preset in the current bank
+    FOOTSWITCH_ACTION_BANK_DOWN,
+    FOOTSWITCH_ACTION_BANK_UP,
+    FOOTSWITCH_ACTION_BYPASS_TOGGLE,
+    FOOTSWITCH_ACTION_MACRO,                // Value: 0-based macro
+};
+
+typedef struct
+{
+    uint8_t Switch;                         // 0-based
+    uint8_t Other;                          // second switch of a combo
+    uint8_t Gesture;
+    uint8_t Action;
+    uint16_t Value;
+} tFootswitchGesture;
+
+void footswitch_gestures_init(const tFootswitchGesture* gestures, uint8_t count);
+
+// time: usec the change was seen, from the input layer
+void footswitch_gestures_input(uint8_t index, uint8_t pressed, int64_t time);
+
+// runs gestures whose time is up. Returns the next time to call it, 0 if nothing is pending
+int64_t footswitch_gestures_process(int64_t now);
+
+#ifdef __cplusplus
+} /*extern "C"*/
+#endif
+
+#endif
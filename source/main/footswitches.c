@@ -17,10 +17,12 @@ limitations under the License.
 
 #include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
 #include "sdkconfig.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
+#include "freertos/queue.h"
 #include "esp_timer.h"
 #include "driver/gpio.h"
 #include "esp_err.h"
@@ -35,58 +37,263 @@ limitations under the License.
 #include "main.h"
 #include "CH422G.h"
 #include "control.h"
+#include "footswitch_gestures.h"
 #include "task_priorities.h"
 
 #define FOOTSWITCH_TASK_STACK_SIZE          (3 * 1024)
-#define FOOTSWITCH_SAMPLE_COUNT             5       // 20 msec per sample
+#define FOOTSWITCH_EVENT_QUEUE_LENGTH       16
+#define FOOTSWITCH_POLL_MS                  20      // IO expander inputs, no interrupt
+#define FOOTSWITCH_DEBOUNCE_US              (CONFIG_FOOTSWITCH_DEBOUNCE_MS * 1000)
 
-enum FootswitchStates
+// Each switch reports a change of state as soon as it sees one, then ignores the switch
+// for its debounce time. On direct GPIO the first edge interrupts, the interrupt is
+// disabled for the debounce time and a timer checks the level once it has settled.
+// Inputs on the IO expander are polled, with the same debounce between changes.
+// Changes go to the gesture engine with the time they were seen, and a timer (or the
+// next poll) runs gestures that are decided by time, such as long press
+
+enum FootswitchInputEvents
 {
-    FOOTSWITCH_IDLE,
-    FOOTSWITCH_WAIT_RELEASE_1,
-    FOOTSWITCH_WAIT_RELEASE_2
+    FOOTSWITCH_INPUT_EDGE,                  // interrupt, first edge of a change
+    FOOTSWITCH_INPUT_SETTLED,               // debounce time over
+    FOOTSWITCH_INPUT_GESTURE,               // gesture deadline
 };
 
-static const char *TAG = "app_footswitches";
+typedef struct
+{
+    uint8_t Pin;                            // GPIO, or IO expander pin on the display board
+    uint8_t ActiveLevel;                    // level when pressed
+    uint32_t DebounceUs;
+} tFootswitchConfig;
 
 typedef struct
 {
-    uint8_t state;
-    uint32_t sample_counter;
-} tFootswitchControl;
+    uint8_t Type;
+    uint8_t Index;
+    uint8_t Level;
+    int64_t Time;                           // usec, esp_timer
+} tFootswitchInputEvent;
+
+typedef struct
+{
+    uint8_t Pressed;
+    int64_t LastChange;                     // usec
+    esp_timer_handle_t DebounceTimer;
+} tFootswitchState;
+
+static const char *TAG = "app_footswitches";
+
+// up to FOOTSWITCH_MAX switches, GPIO or IO expander pins to suit the board
+static const tFootswitchConfig FootswitchConfig[] = 
+{
+    {FOOTSWITCH_1, 0, FOOTSWITCH_DEBOUNCE_US},
+    {FOOTSWITCH_2, 0, FOOTSWITCH_DEBOUNCE_US},
+};
+
+#define FOOTSWITCH_COUNT                    (sizeof(FootswitchConfig) / sizeof(FootswitchConfig[0]))
+
+// Switch, Other (combos only), Gesture, Action, Value (preset or macro). For example
+//  {0, 0, FOOTSWITCH_GESTURE_LONG_PRESS, FOOTSWITCH_ACTION_BANK_DOWN, 0}
+//  {0, 1, FOOTSWITCH_GESTURE_COMBO, FOOTSWITCH_ACTION_BYPASS_TOGGLE, 0}
+// A long press, double tap or combo on a switch makes its tap wait until it is released
+static const tFootswitchGesture FootswitchGestures[] = 
+{
+    {0, 0, FOOTSWITCH_GESTURE_TAP, FOOTSWITCH_ACTION_PRESET_DOWN, 0},
+    {0, 0, FOOTSWITCH_GESTURE_HOLD_REPEAT, FOOTSWITCH_ACTION_PRESET_DOWN, 0},
+    {1, 0, FOOTSWITCH_GESTURE_TAP, FOOTSWITCH_ACTION_PRESET_UP, 0},
+    {1, 0, FOOTSWITCH_GESTURE_HOLD_REPEAT, FOOTSWITCH_ACTION_PRESET_UP, 0},
+};
+
+static tFootswitchState FootswitchState[FOOTSWITCH_COUNT];
+#if CONFIG_TONEX_CONTROLLER_DISPLAY_NONE
+static QueueHandle_t FootswitchInputQueue;
+static esp_timer_handle_t GestureTimer;
+#endif
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: A footswitch has been pressed or released
+* PARAMETERS:  time: usec the change was seen
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static void footswitch_changed(uint8_t index, uint8_t pressed, int64_t time)
+{
+    FootswitchState[index].Pressed = pressed;
+    FootswitchState[index].LastChange = time;
 
-static tFootswitchControl FootswitchControl;
+    footswitch_gestures_input(index, pressed, time);
+}
 
+#if CONFIG_TONEX_CONTROLLER_DISPLAY_WAVESHARE_800_480
 /****************************************************************************
 * NAME:        
-* DESCRIPTION: 
+* DESCRIPTION: Scan the footswitches on the IO expander
 * PARAMETERS:  
 * RETURN:      
 * NOTES:       
 *****************************************************************************/
-static uint8_t read_footswitch_input(uint8_t number, uint8_t* switch_state)
+static void footswitch_poll(void)
 {
-    uint8_t result = false;
+    uint8_t inputs;
+    uint8_t pressed;
+    int64_t now;
 
-#if CONFIG_TONEX_CONTROLLER_DISPLAY_WAVESHARE_800_480
-    // display board uses I2C IO expander
-    uint8_t value;
+    // display board uses I2C IO expander, all its inputs are read at once
+    if (CH422G_read_inputs(&inputs) != ESP_OK)
+    {
+        return;
+    }
 
-    if (CH422G_read_input(number, &value) == ESP_OK)
+    now = esp_timer_get_time();
+
+    for (uint8_t loop = 0; loop < FOOTSWITCH_COUNT; loop++)
     {
-        result = true;
-        *switch_state = value;
+        pressed = (((inputs >> FootswitchConfig[loop].Pin) & 0x01) == FootswitchConfig[loop].ActiveLevel);
+
+        if ((pressed != FootswitchState[loop].Pressed) && ((now - FootswitchState[loop].LastChange) >= FootswitchConfig[loop].DebounceUs))
+        {
+            footswitch_changed(loop, pressed, now);
+        }
     }
+
+    // deadlines are checked at each scan
+    footswitch_gestures_process(esp_timer_get_time());
+}
 #else
-    // other boards can use direct IO pin
-    *switch_state = gpio_get_level(number);
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Footswitch GPIO edge
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Disabled until the switch has settled
+*****************************************************************************/
+static void IRAM_ATTR footswitch_isr(void* arg)
+{
+    BaseType_t high_task_awoken = pdFALSE;
+    uint8_t index = (uint8_t)(uint32_t)arg;
+    tFootswitchInputEvent event;
 
-    result = true;
-#endif
+    event.Type = FOOTSWITCH_INPUT_EDGE;
+    event.Index = index;
+    event.Time = esp_timer_get_time();
+    event.Level = gpio_get_level(FootswitchConfig[index].Pin);
+
+    gpio_intr_disable(FootswitchConfig[index].Pin);
+    xQueueSendFromISR(FootswitchInputQueue, &event, &high_task_awoken);
+
+    if (high_task_awoken == pdTRUE)
+    {
+        portYIELD_FROM_ISR();
+    }
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Debounce time over
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Runs on the esp_timer task
+*****************************************************************************/
+static void footswitch_debounce_timer_cb(void* arg)
+{
+    uint8_t index = (uint8_t)(uint32_t)arg;
+    tFootswitchInputEvent event;
+
+    event.Type = FOOTSWITCH_INPUT_SETTLED;
+    event.Index = index;
+    event.Time = esp_timer_get_time();
+    event.Level = gpio_get_level(FootswitchConfig[index].Pin);
+
+    // queued before the interrupt is enabled, so it arrives ahead of any new edge
+    xQueueSend(FootswitchInputQueue, &event, 0);
+    gpio_intr_enable(FootswitchConfig[index].Pin);
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Gesture deadline
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Runs on the esp_timer task
+*****************************************************************************/
+static void footswitch_gesture_timer_cb(void* arg)
+{
+    tFootswitchInputEvent event;
+
+    event.Type = FOOTSWITCH_INPUT_GESTURE;
+    event.Index = 0;
+    event.Level = 0;
+    event.Time = esp_timer_get_time();
 
-    return result;
+    xQueueSend(FootswitchInputQueue, &event, 0);
 }
 
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Run the gestures that are due and time the next one
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static void footswitch_run_gestures(void)
+{
+    int64_t now = esp_timer_get_time();
+    int64_t next = footswitch_gestures_process(now);
+
+    // not an error if it isn't running
+    esp_timer_stop(GestureTimer);
+
+    if (next != 0)
+    {
+        esp_timer_start_once(GestureTimer, MAX(next - now, 1));
+    }
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Handle an edge or settled level from a GPIO footswitch
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static void footswitch_handle_input(tFootswitchInputEvent* event)
+{
+    tFootswitchState* state = &FootswitchState[event->Index];
+    uint8_t pressed = (event->Level == FootswitchConfig[event->Index].ActiveLevel);
+
+    switch (event->Type)
+    {
+        case FOOTSWITCH_INPUT_EDGE:
+        {
+            if (pressed != state->Pressed)
+            {
+                // act on the first edge, the bounces after it are ignored
+                footswitch_changed(event->Index, pressed, event->Time);
+            }
+
+            esp_timer_start_once(state->DebounceTimer, FootswitchConfig[event->Index].DebounceUs);
+        } break;
+
+        case FOOTSWITCH_INPUT_SETTLED:
+        {
+            if (pressed != state->Pressed)
+            {
+                // changed again while settling, with no edge to report it
+                footswitch_changed(event->Index, pressed, event->Time);
+            }
+        } break;
+
+        case FOOTSWITCH_INPUT_GESTURE:
+        {
+            // handled below
+        } break;
+    }
+
+    footswitch_run_gestures();
+}
+#endif
+
 /****************************************************************************
 * NAME:        
 * DESCRIPTION: 
@@ -96,102 +303,39 @@ static uint8_t read_footswitch_input(uint8_t number, uint8_t* switch_state)
 *****************************************************************************/
 void footswitch_task(void *arg)
 {
-    uint8_t value;   
- 
     ESP_LOGI(TAG, "Footswitch task start");
 
-    // let things settle
-    vTaskDelay(1000);
+#if CONFIG_TONEX_CONTROLLER_DISPLAY_WAVESHARE_800_480
+    TickType_t last_poll;
+    uint8_t inputs;
 
-    while (1)
+    // a switch held at power up isn't a press
+    if (CH422G_read_inputs(&inputs) == ESP_OK)
     {
-        switch (FootswitchControl.state)
+        for (uint8_t loop = 0; loop < FOOTSWITCH_COUNT; loop++)
         {
-            case FOOTSWITCH_IDLE:
-            default:
-            {
-                // read footswitches
-                if (read_footswitch_input(FOOTSWITCH_1, &value)) 
-                {
-                    if (value == 0)
-                    {
-                        ESP_LOGI(TAG, "Footswitch 1 pressed");
-
-                        // foot switch 1 pressed
-                        control_request_preset_down();
-
-                        // wait release	
-                        FootswitchControl.sample_counter = 0;
-                        FootswitchControl.state = FOOTSWITCH_WAIT_RELEASE_1;
-                    }
-                }
-
-                if (FootswitchControl.state == FOOTSWITCH_IDLE)
-                {
-                    if (read_footswitch_input(FOOTSWITCH_2, &value))
-                    {
-                        if (value == 0)
-                        {
-                            ESP_LOGI(TAG, "Footswitch 2 pressed");
-
-                            // foot switch 2 pressed, send event
-                            control_request_preset_up();
-
-                            // wait release	
-                            FootswitchControl.sample_counter = 0;
-                            FootswitchControl.state = FOOTSWITCH_WAIT_RELEASE_2;
-                        }
-                    }
-                }
-            } break;
-
-            case FOOTSWITCH_WAIT_RELEASE_1:
-            {
-                // read footswitch 1
-                if (read_footswitch_input(FOOTSWITCH_1, &value))
-                {
-                    if (value != 0)
-                    {
-                        FootswitchControl.sample_counter++;
-                        if (FootswitchControl.sample_counter == FOOTSWITCH_SAMPLE_COUNT)
-                        {
-                            // foot switch released
-                            FootswitchControl.state = FOOTSWITCH_IDLE;		
-                        }
-                    }
-                    else
-                    {
-                        // reset counter
-                        FootswitchControl.sample_counter = 0;
-                    }
-                }
-            } break;
-
-            case FOOTSWITCH_WAIT_RELEASE_2:
-            {
-                // read footswitch 2
-                if (read_footswitch_input(FOOTSWITCH_2, &value))
-                {
-                    if (value != 0)
-                    {
-                        FootswitchControl.sample_counter++;
-                        if (FootswitchControl.sample_counter == FOOTSWITCH_SAMPLE_COUNT)
-                        {
-                            // foot switch released
-                            FootswitchControl.state = FOOTSWITCH_IDLE;
-                        }                 
-                    }
-                    else
-                    {
-                        // reset counter
-                        FootswitchControl.sample_counter = 0;
-                    }
-                }
-            } break;
+            FootswitchState[loop].Pressed = (((inputs >> FootswitchConfig[loop].Pin) & 0x01) == FootswitchConfig[loop].ActiveLevel);
         }
+    }
+
+    last_poll = xTaskGetTickCount();
 
-        vTaskDelay(pdMS_TO_TICKS(20));
+    while (1)
+    {
+        footswitch_poll();
+        vTaskDelayUntil(&last_poll, pdMS_TO_TICKS(FOOTSWITCH_POLL_MS));
     }
+#else
+    tFootswitchInputEvent event;
+
+    while (1)
+    {
+        if (xQueueReceive(FootswitchInputQueue, &event, portMAX_DELAY) == pdTRUE)
+        {
+            footswitch_handle_input(&event);
+        }
+    }
+#endif
 }
 
 /****************************************************************************
@@ -203,19 +347,59 @@ void footswitch_task(void *arg)
 *****************************************************************************/
 void footswitches_init(void)
 {	
-    memset((void*)&FootswitchControl, 0, sizeof(FootswitchControl));
-    FootswitchControl.state = FOOTSWITCH_IDLE;
+    memset((void*)FootswitchState, 0, sizeof(FootswitchState));
+    footswitch_gestures_init(FootswitchGestures, sizeof(FootswitchGestures) / sizeof(FootswitchGestures[0]));
 
 #if CONFIG_TONEX_CONTROLLER_DISPLAY_NONE
-    // init GPIO
+    esp_err_t res;
     gpio_config_t gpio_config_struct;
 
-    gpio_config_struct.pin_bit_mask = (((uint64_t)1 << FOOTSWITCH_1) | ((uint64_t)1 << FOOTSWITCH_2));
-    gpio_config_struct.mode = GPIO_MODE_INPUT;
-    gpio_config_struct.pull_up_en = GPIO_PULLUP_ENABLE;
-    gpio_config_struct.pull_down_en = GPIO_PULLDOWN_DISABLE;
-    gpio_config_struct.intr_type = GPIO_INTR_DISABLE;
-    gpio_config(&gpio_config_struct);
+    FootswitchInputQueue = xQueueCreate(FOOTSWITCH_EVENT_QUEUE_LENGTH, sizeof(tFootswitchInputEvent));
+    if (FootswitchInputQueue == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to create footswitch queue!");
+        return;
+    }
+
+    // service may already be installed by another driver
+    res = gpio_install_isr_service(0);
+    if ((res != ESP_OK) && (res != ESP_ERR_INVALID_STATE))
+    {
+        ESP_LOGE(TAG, "GPIO ISR service failed %s", esp_err_to_name(res));
+        return;
+    }
+
+    const esp_timer_create_args_t gesture_timer_args = {
+        .callback = &footswitch_gesture_timer_cb,
+        .arg = NULL,
+        .name = "foot_gesture"
+    };
+
+    ESP_ERROR_CHECK(esp_timer_create(&gesture_timer_args, &GestureTimer));
+
+    for (uint8_t loop = 0; loop < FOOTSWITCH_COUNT; loop++)
+    {
+        const esp_timer_create_args_t timer_args = {
+            .callback = &footswitch_debounce_timer_cb,
+            .arg = (void*)(uint32_t)loop,
+            .name = "foot_debounce"
+        };
+
+        ESP_ERROR_CHECK(esp_timer_create(&timer_args, &FootswitchState[loop].DebounceTimer));
+
+        // init GPIO, interrupt on both edges
+        gpio_config_struct.pin_bit_mask = (uint64_t)1 << FootswitchConfig[loop].Pin;
+        gpio_config_struct.mode = GPIO_MODE_INPUT;
+        gpio_config_struct.pull_up_en = GPIO_PULLUP_ENABLE;
+        gpio_config_struct.pull_down_en = GPIO_PULLDOWN_DISABLE;
+        gpio_config_struct.intr_type = GPIO_INTR_ANYEDGE;
+        gpio_config(&gpio_config_struct);
+
+        // a switch held at power up isn't a press
+        FootswitchState[loop].Pressed = (gpio_get_level(FootswitchConfig[loop].Pin) == FootswitchConfig[loop].ActiveLevel);
+
+        gpio_isr_handler_add(FootswitchConfig[loop].Pin, footswitch_isr, (void*)(uint32_t)loop);
+    }
 #endif
 
     // create task
@@ -0,0 +1,840 @@
+/*
+ Copyright (C) 2024  Greg Smith
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+ 
+*/
+
+
+#include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "esp_err.h"
+#include "driver/gpio.h"
+#include "driver/i2c.h"
+#include "esp_private/periph_ctrl.h"
+#include "task_priorities.h"
+#include "i2c_bus.h"
+
+#if CONFIG_TONEX_CONTROLLER_DISPLAY_WAVESHARE_800_480
+
+// One task owns the I2C bus and runs transactions queued by the other tasks, highest
+// priority first. Callers block until their transaction is done, so their buffers can
+// live on the stack. Plain read/write transactions waiting behind each other are sent
+// as one command with repeated starts, saving a stop, start and driver call each
+
+#define I2C_BUS_SCL_IO                  9
+#define I2C_BUS_SDA_IO                  8
+#define I2C_BUS_FREQ_HZ                 400000
+
+#define I2C_CLR_BUS_SCL_NUM             (9)
+#define I2C_CLR_BUS_HALF_PERIOD_US      (5)
+
+#define I2C_BUS_TASK_STACK_SIZE         (3 * 1024)
+
+// transactions queued at once, across all priorities
+#define I2C_BUS_MAX_REQUESTS            8
+
+// most operations sent as one command
+#define I2C_BUS_MAX_MERGE_OPS           12
+
+// longest each command may take on the bus
+#define I2C_BUS_COMMAND_TIMEOUT_MS      10
+
+#define I2C_BUS_STATS_WINDOW_US         (1000 * 1000)
+#define I2C_BUS_NO_REQUEST              0xFF
+
+enum I2CBusRequestStates
+{
+    I2C_BUS_REQUEST_FREE,
+    I2C_BUS_REQUEST_QUEUED,
+    I2C_BUS_REQUEST_ACTIVE,             // running, the caller's buffers are in use
+    I2C_BUS_REQUEST_DONE,
+    I2C_BUS_REQUEST_CANCELLED,          // caller gave up before it started, freed when dequeued
+};
+
+typedef struct
+{
+    tI2CBusOp Ops[I2C_BUS_MAX_OPS];
+    uint8_t Count;
+    tI2CBusFunction Function;           // instead of Ops
+    void* Arg;
+    uint8_t Priority;
+    volatile uint8_t State;
+    esp_err_t Result;
+    int64_t QueuedTime;
+    SemaphoreHandle_t Done;
+} tI2CBusRequest;
+
+static const char *TAG = "app_i2c_bus";
+
+static i2c_port_t I2CNum;
+static tI2CBusRequest Requests[I2C_BUS_MAX_REQUESTS];
+static QueueHandle_t RequestQueues[I2C_BUS_PRIORITY_MAX];
+static SemaphoreHandle_t RequestSignal;
+static SemaphoreHandle_t BusOwner;
+static portMUX_TYPE I2CBusLock = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t CommandBuffer[I2C_LINK_RECOMMENDED_SIZE(2 * I2C_BUS_MAX_MERGE_OPS)];
+
+static tI2CBusStats Stats;
+static uint64_t LatencyTotal[I2C_BUS_PRIORITY_MAX];
+static uint32_t LatencyCount[I2C_BUS_PRIORITY_MAX];
+static int64_t BusyTime;
+static int64_t WindowStart;
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static esp_err_t i2c_bus_master_init(void)
+{
+    i2c_config_t conf = {
+        .mode = I2C_MODE_MASTER,
+        .sda_io_num = I2C_BUS_SDA_IO,
+        .scl_io_num = I2C_BUS_SCL_IO,
+        .sda_pullup_en = GPIO_PULLUP_ENABLE,
+        .scl_pullup_en = GPIO_PULLUP_ENABLE,
+        .master.clk_speed = I2C_BUS_FREQ_HZ,
+    };
+
+    i2c_param_config(I2CNum, &conf);
+
+    return i2c_driver_install(I2CNum, conf.mode, 0, 0, 0);
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Reset the I2C controller and free a stuck bus
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Runs on the bus task
+*****************************************************************************/
+static esp_err_t i2c_bus_master_reset(void* arg)
+{
+    int sda_io = I2C_BUS_SDA_IO;
+    int scl_io = I2C_BUS_SCL_IO;
+    const int scl_half_period = I2C_CLR_BUS_HALF_PERIOD_US; // use standard 100kHz data rate
+    int i = 0;
+
+    ESP_LOGI(TAG, "I2C bus reset");
+
+    taskENTER_CRITICAL(&I2CBusLock);
+    Stats.Resets++;
+    taskEXIT_CRITICAL(&I2CBusLock);
+
+    // nuke it
+    i2c_reset_tx_fifo(I2CNum);
+    i2c_reset_rx_fifo(I2CNum);
+    periph_module_disable(PERIPH_I2C0_MODULE);
+    periph_module_enable(PERIPH_I2C0_MODULE);
+    i2c_driver_delete(I2CNum);
+
+    // manually clock the bus if SDA is stuck
+    gpio_set_direction(scl_io, GPIO_MODE_OUTPUT_OD);
+    gpio_set_direction(sda_io, GPIO_MODE_INPUT_OUTPUT_OD);
+
+    // If a SLAVE device was in a read operation when the bus was interrupted, the SLAVE device is controlling SDA.
+    // The only bit during the 9 clock cycles of a READ byte the MASTER(ESP32) is guaranteed control over is during the ACK bit
+    // period. If the slave is sending a stream of ZERO bytes, it will only release SDA during the ACK bit period.
+    // So, this reset code needs to synchronize the bit stream with, Either, the ACK bit, Or a 1 bit to correctly generate
+    // a STOP condition.
+    gpio_set_level(scl_io, 0);
+    gpio_set_level(sda_io, 1);
+    esp_rom_delay_us(scl_half_period);
+
+    if (!gpio_get_level(sda_io))
+    {
+        ESP_LOGI(TAG, "I2C bus clearing stuck SDA");
+    }
+
+    while (!gpio_get_level(sda_io) && (i++ < I2C_CLR_BUS_SCL_NUM))
+    {
+        gpio_set_level(scl_io, 1);
+        esp_rom_delay_us(scl_half_period);
+        gpio_set_level(scl_io, 0);
+        esp_rom_delay_us(scl_half_period);
+    }
+
+    gpio_set_level(sda_io, 0); // setup for STOP
+    gpio_set_level(scl_io, 1);
+    esp_rom_delay_us(scl_half_period);
+    gpio_set_level(sda_io, 1); // STOP, SDA low -> high while SCL is HIGH
+
+    // init again
+    return i2c_bus_master_init();
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Send reads and writes as one command
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       No delays. Each op starts with a (repeated) start
+*****************************************************************************/
+static esp_err_t i2c_bus_send(const tI2CBusOp* ops, uint8_t count)
+{
+    i2c_cmd_handle_t cmd;
+    esp_err_t res = ESP_OK;
+
+    if (count == 0)
+    {
+        return ESP_OK;
+    }
+
+    cmd = i2c_cmd_link_create_static(CommandBuffer, sizeof(CommandBuffer));
+    if (cmd == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (uint8_t loop = 0; (loop < count) && (res == ESP_OK); loop++)
+    {
+        res = i2c_master_start(cmd);
+
+        if (ops[loop].Type == I2C_BUS_OP_READ)
+        {
+            if (res == ESP_OK)
+            {
+                res = i2c_master_write_byte(cmd, (ops[loop].Address << 1) | I2C_MASTER_READ, true);
+            }
+
+            if (res == ESP_OK)
+            {
+                res = i2c_master_read(cmd, ops[loop].Data, ops[loop].Length, I2C_MASTER_LAST_NACK);
+            }
+        }
+        else
+        {
+            if (res == ESP_OK)
+            {
+                res = i2c_master_write_byte(cmd, (ops[loop].Address << 1) | I2C_MASTER_WRITE, true);
+            }
+
+            if ((res == ESP_OK) && (ops[loop].Length > 0))
+            {
+                res = i2c_master_write(cmd, ops[loop].Data, ops[loop].Length, true);
+            }
+        }
+    }
+
+    if (res == ESP_OK)
+    {
+        res = i2c_master_stop(cmd);
+    }
+
+    if (res == ESP_OK)
+    {
+        res = i2c_master_cmd_begin(I2CNum, cmd, pdMS_TO_TICKS(I2C_BUS_COMMAND_TIMEOUT_MS));
+    }
+
+    i2c_cmd_link_delete_static(cmd);
+
+    if (res != ESP_OK)
+    {
+        taskENTER_CRITICAL(&I2CBusLock);
+        Stats.Errors++;
+        taskEXIT_CRITICAL(&I2CBusLock);
+
+        if ((res == ESP_ERR_TIMEOUT) || (res == ESP_ERR_INVALID_STATE))
+        {
+            // bus is stuck or the controller is confused, a missing ack is left alone
+            i2c_bus_master_reset(NULL);
+        }
+    }
+
+    return res;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Run one transaction
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Ops between delays are sent together. Stops at the first error
+*****************************************************************************/
+static esp_err_t i2c_bus_execute(tI2CBusRequest* request)
+{
+    esp_err_t res = ESP_OK;
+    uint8_t start = 0;
+
+    if (request->Function != NULL)
+    {
+        return request->Function(request->Arg);
+    }
+
+    for (uint8_t loop = 0; loop < request->Count; loop++)
+    {
+        if (request->Ops[loop].Type == I2C_BUS_OP_DELAY)
+        {
+            res = i2c_bus_send(&request->Ops[start], loop - start);
+            if (res != ESP_OK)
+            {
+                return res;
+            }
+
+            esp_rom_delay_us(request->Ops[loop].DelayUs);
+            start = loop + 1;
+        }
+    }
+
+    return i2c_bus_send(&request->Ops[start], request->Count - start);
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Check if a transaction can be sent with others
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static uint8_t i2c_bus_can_merge(const tI2CBusRequest* request)
+{
+#if CONFIG_I2C_BUS_MERGE
+    if (request->Function != NULL)
+    {
+        return 0;
+    }
+
+    for (uint8_t loop = 0; loop < request->Count; loop++)
+    {
+        if (request->Ops[loop].Type == I2C_BUS_OP_DELAY)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Take the next transaction off a queue
+* PARAMETERS:  peek: only take it if it can be merged, within total_ops
+* RETURN:      request index, or I2C_BUS_NO_REQUEST
+* NOTES:       Transactions cancelled while queued are freed here. Only called
+*              with the bus owned, as a request is running once it is ACTIVE
+*****************************************************************************/
+static uint8_t i2c_bus_dequeue(uint8_t priority, uint8_t peek, uint8_t total_ops)
+{
+    uint8_t index;
+
+    while (xQueuePeek(RequestQueues[priority], &index, 0) == pdTRUE)
+    {
+        taskENTER_CRITICAL(&I2CBusLock);
+
+        if (Requests[index].State == I2C_BUS_REQUEST_CANCELLED)
+        {
+            Requests[index].State = I2C_BUS_REQUEST_FREE;
+            taskEXIT_CRITICAL(&I2CBusLock);
+
+            xQueueReceive(RequestQueues[priority], &index, 0);
+            continue;
+        }
+
+        if (peek && (!i2c_bus_can_merge(&Requests[index]) || ((total_ops + Requests[index].Count) > I2C_BUS_MAX_MERGE_OPS)))
+        {
+            taskEXIT_CRITICAL(&I2CBusLock);
+            return I2C_BUS_NO_REQUEST;
+        }
+
+        Requests[index].State = I2C_BUS_REQUEST_ACTIVE;
+        taskEXIT_CRITICAL(&I2CBusLock);
+
+        xQueueReceive(RequestQueues[priority], &index, 0);
+        return index;
+    }
+
+    return I2C_BUS_NO_REQUEST;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Hand a finished transaction back to its caller
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static void i2c_bus_complete(tI2CBusRequest* request, esp_err_t result)
+{
+    uint32_t latency = (uint32_t)(esp_timer_get_time() - request->QueuedTime);
+
+    taskENTER_CRITICAL(&I2CBusLock);
+
+    Stats.Transactions++;
+    LatencyTotal[request->Priority] += latency;
+    LatencyCount[request->Priority]++;
+    if (latency > Stats.LatencyMax[request->Priority])
+    {
+        Stats.LatencyMax[request->Priority] = latency;
+    }
+
+    request->Result = result;
+    request->State = I2C_BUS_REQUEST_DONE;
+
+    taskEXIT_CRITICAL(&I2CBusLock);
+
+    xSemaphoreGive(request->Done);
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Update the bus utilisation once a second
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static void i2c_bus_update_utilisation(void)
+{
+    int64_t now = esp_timer_get_time();
+    int64_t elapsed = now - WindowStart;
+    uint8_t percent;
+
+    if (elapsed < I2C_BUS_STATS_WINDOW_US)
+    {
+        return;
+    }
+
+    percent = (uint8_t)((BusyTime * 100) / elapsed);
+
+    taskENTER_CRITICAL(&I2CBusLock);
+    Stats.Utilisation = percent;
+    if (percent > Stats.UtilisationMax)
+    {
+        Stats.UtilisationMax = percent;
+    }
+    taskEXIT_CRITICAL(&I2CBusLock);
+
+    BusyTime = 0;
+    WindowStart = now;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Owns the I2C bus
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static void i2c_bus_task(void *arg)
+{
+    uint8_t batch[I2C_BUS_MAX_REQUESTS];
+    tI2CBusOp merged_ops[I2C_BUS_MAX_MERGE_OPS];
+    uint8_t batch_count;
+    uint8_t op_count;
+    uint8_t index;
+    esp_err_t res;
+    int64_t start;
+#if CONFIG_I2C_BUS_LOG_PERIOD > 0
+    int64_t last_log = esp_timer_get_time();
+#endif
+
+    ESP_LOGI(TAG, "I2C bus task start");
+
+    WindowStart = esp_timer_get_time();
+
+    while (1)
+    {
+        // given once per queued transaction, the timeout keeps the statistics ticking over
+        xSemaphoreTake(RequestSignal, pdMS_TO_TICKS(1000));
+
+        i2c_bus_update_utilisation();
+
+#if CONFIG_I2C_BUS_LOG_PERIOD > 0
+        if ((esp_timer_get_time() - last_log) >= ((int64_t)CONFIG_I2C_BUS_LOG_PERIOD * 1000 * 1000))
+        {
+            i2c_bus_log_stats();
+            last_log = esp_timer_get_time();
+        }
+#endif
+
+        // own the bus before taking anything off the queues. While it is locked (SD card)
+        // requests stay queued, so their callers can still time out
+        xSemaphoreTake(BusOwner, portMAX_DELAY);
+
+        index = I2C_BUS_NO_REQUEST;
+        for (uint8_t priority = 0; (priority < I2C_BUS_PRIORITY_MAX) && (index == I2C_BUS_NO_REQUEST); priority++)
+        {
+            index = i2c_bus_dequeue(priority, 0, 0);
+        }
+
+        if (index == I2C_BUS_NO_REQUEST)
+        {
+            // cancelled, or already sent with another
+            xSemaphoreGive(BusOwner);
+            continue;
+        }
+
+        batch[0] = index;
+        batch_count = 1;
+        op_count = Requests[index].Count;
+
+        if (i2c_bus_can_merge(&Requests[index]))
+        {
+            // pick up anything else waiting that can go in the same command, at this priority or above
+            for (uint8_t priority = 0; priority <= Requests[batch[0]].Priority; priority++)
+            {
+                while (batch_count < I2C_BUS_MAX_REQUESTS)
+                {
+                    index = i2c_bus_dequeue(priority, 1, op_count);
+                    if (index == I2C_BUS_NO_REQUEST)
+                    {
+                        break;
+                    }
+
+                    batch[batch_count++] = index;
+                    op_count += Requests[index].Count;
+                }
+            }
+        }
+
+        start = esp_timer_get_time();
+
+        if (batch_count == 1)
+        {
+            res = i2c_bus_execute(&Requests[batch[0]]);
+            i2c_bus_complete(&Requests[batch[0]], res);
+        }
+        else
+        {
+            op_count = 0;
+            for (uint8_t loop = 0; loop < batch_count; loop++)
+            {
+                memcpy(&merged_ops[op_count], Requests[batch[loop]].Ops, Requests[batch[loop]].Count * sizeof(tI2CBusOp));
+                op_count += Requests[batch[loop]].Count;
+            }
+
+            res = i2c_bus_send(merged_ops, op_count);
+
+            taskENTER_CRITICAL(&I2CBusLock);
+            Stats.Merged += batch_count - 1;
+            taskEXIT_CRITICAL(&I2CBusLock);
+
+            for (uint8_t loop = 0; loop < batch_count; loop++)
+            {
+                if (res != ESP_OK)
+                {
+                    // send them one at a time, so each caller gets its own result.
+                    // Repeating reads and writes is harmless on the devices that can be merged
+                    i2c_bus_complete(&Requests[batch[loop]], i2c_bus_execute(&Requests[batch[loop]]));
+                }
+                else
+                {
+                    i2c_bus_complete(&Requests[batch[loop]], ESP_OK);
+                }
+            }
+        }
+
+        BusyTime += esp_timer_get_time() - start;
+        xSemaphoreGive(BusOwner);
+    }
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Queue a transaction and wait for it
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static esp_err_t i2c_bus_submit(uint8_t priority, const tI2CBusOp* ops, uint8_t count, tI2CBusFunction function, void* arg, uint32_t timeout_ms)
+{
+    TickType_t start_tick = xTaskGetTickCount();
+    TickType_t timeout = pdMS_TO_TICKS(timeout_ms);
+    TickType_t elapsed;
+    tI2CBusRequest* request = NULL;
+    uint8_t index = I2C_BUS_NO_REQUEST;
+    uint8_t queued = 0;
+    esp_err_t res;
+
+    if ((priority >= I2C_BUS_PRIORITY_MAX) || (count > I2C_BUS_MAX_OPS) || (RequestSignal == NULL))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // find a free request
+    while (1)
+    {
+        taskENTER_CRITICAL(&I2CBusLock);
+
+        for (uint8_t loop = 0; loop < I2C_BUS_MAX_REQUESTS; loop++)
+        {
+            if (Requests[loop].State == I2C_BUS_REQUEST_FREE)
+            {
+                Requests[loop].State = I2C_BUS_REQUEST_QUEUED;
+                index = loop;
+                break;
+            }
+        }
+
+        taskEXIT_CRITICAL(&I2CBusLock);
+
+        if (index != I2C_BUS_NO_REQUEST)
+        {
+            break;
+        }
+
+        if ((xTaskGetTickCount() - start_tick) >= timeout)
+        {
+            taskENTER_CRITICAL(&I2CBusLock);
+            Stats.Timeouts++;
+            taskEXIT_CRITICAL(&I2CBusLock);
+            return ESP_ERR_TIMEOUT;
+        }
+
+        vTaskDelay(1);
+    }
+
+    request = &Requests[index];
+    memcpy(request->Ops, ops, count * sizeof(tI2CBusOp));
+    request->Count = count;
+    request->Function = function;
+    request->Arg = arg;
+    request->Priority = priority;
+    request->QueuedTime = esp_timer_get_time();
+
+    xQueueSend(RequestQueues[priority], &index, 0);
+    xSemaphoreGive(RequestSignal);
+
+    for (uint8_t loop = 0; loop < I2C_BUS_PRIORITY_MAX; loop++)
+    {
+        queued += uxQueueMessagesWaiting(RequestQueues[loop]);
+    }
+
+    taskENTER_CRITICAL(&I2CBusLock);
+    if (queued > Stats.QueueMax)
+    {
+        Stats.QueueMax = queued;
+    }
+    taskEXIT_CRITICAL(&I2CBusLock);
+
+    elapsed = xTaskGetTickCount() - start_tick;
+    if (xSemaphoreTake(request->Done, (elapsed < timeout) ? (timeout - elapsed) : 0) != pdTRUE)
+    {
+        taskENTER_CRITICAL(&I2CBusLock);
+
+        Stats.Timeouts++;
+        if (request->State == I2C_BUS_REQUEST_QUEUED)
+        {
+            // not started, the bus task frees it
+            request->State = I2C_BUS_REQUEST_CANCELLED;
+            taskEXIT_CRITICAL(&I2CBusLock);
+            return ESP_ERR_TIMEOUT;
+        }
+
+        taskEXIT_CRITICAL(&I2CBusLock);
+
+        // running, the bus task is using our buffers until it's done
+        xSemaphoreTake(request->Done, portMAX_DELAY);
+    }
+
+    res = request->Result;
+
+    taskENTER_CRITICAL(&I2CBusLock);
+    request->State = I2C_BUS_REQUEST_FREE;
+    taskEXIT_CRITICAL(&I2CBusLock);
+
+    return res;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Run a transaction on the bus
+* PARAMETERS:  priority: I2C_BUS_PRIORITY_x
+*              ops: reads, writes and delays, in order
+*              timeout_ms: longest to wait for the transaction to start
+* RETURN:      
+* NOTES:       Stops at the first failed op. Don't call with the bus locked
+*****************************************************************************/
+esp_err_t i2c_bus_transaction(uint8_t priority, const tI2CBusOp* ops, uint8_t count, uint32_t timeout_ms)
+{
+    return i2c_bus_submit(priority, ops, count, NULL, NULL, timeout_ms);
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Run a function on the bus task, with the bus to itself
+* PARAMETERS:  
+* RETURN:      result of the function
+* NOTES:       For drivers that make their own I2C calls, like the touch controller
+*****************************************************************************/
+esp_err_t i2c_bus_run(uint8_t priority, tI2CBusFunction function, void* arg, uint32_t timeout_ms)
+{
+    if (function == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return i2c_bus_submit(priority, NULL, 0, function, arg, timeout_ms);
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Reset the I2C controller and free a stuck bus
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       The bus task also does this itself when a command times out
+*****************************************************************************/
+esp_err_t i2c_bus_reset(void)
+{
+    return i2c_bus_run(I2C_BUS_PRIORITY_HOUSEKEEPING, i2c_bus_master_reset, NULL, 1000);
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Hold the bus
+* PARAMETERS:  
+* RETURN:      1 if locked
+* NOTES:       Waits for the current transaction, queued ones wait for the unlock
+*****************************************************************************/
+uint8_t i2c_bus_lock(uint32_t timeout_ms)
+{
+    if (BusOwner == NULL)
+    {
+        return 0;
+    }
+
+    return xSemaphoreTake(BusOwner, pdMS_TO_TICKS(timeout_ms)) == pdTRUE;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void i2c_bus_unlock(void)
+{
+    xSemaphoreGive(BusOwner);
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void i2c_bus_get_stats(tI2CBusStats* stats)
+{
+    taskENTER_CRITICAL(&I2CBusLock);
+
+    memcpy((void*)stats, (void*)&Stats, sizeof(tI2CBusStats));
+
+    for (uint8_t loop = 0; loop < I2C_BUS_PRIORITY_MAX; loop++)
+    {
+        stats->LatencyAvg[loop] = (LatencyCount[loop] > 0) ? (uint32_t)(LatencyTotal[loop] / LatencyCount[loop]) : 0;
+    }
+
+    taskEXIT_CRITICAL(&I2CBusLock);
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void i2c_bus_log_stats(void)
+{
+    tI2CBusStats stats;
+    static const char* names[I2C_BUS_PRIORITY_MAX] = {"footswitch", "touch", "housekeeping"};
+
+    i2c_bus_get_stats(&stats);
+
+    ESP_LOGI(TAG, "Transactions %"PRIu32" merged %"PRIu32" errors %"PRIu32" resets %"PRIu32" timeouts %"PRIu32,
+             stats.Transactions, stats.Merged, stats.Errors, stats.Resets, stats.Timeouts);
+    ESP_LOGI(TAG, "Bus busy %d%% (max %d%%), queue max %d", (int)stats.Utilisation, (int)stats.UtilisationMax, (int)stats.QueueMax);
+
+    for (uint8_t loop = 0; loop < I2C_BUS_PRIORITY_MAX; loop++)
+    {
+        ESP_LOGI(TAG, "  %-12s latency avg %"PRIu32" max %"PRIu32" usec", names[loop], stats.LatencyAvg[loop], stats.LatencyMax[loop]);
+    }
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Init the I2C master and start the bus task
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+esp_err_t i2c_bus_init(i2c_port_t i2c_num)
+{
+    esp_err_t res;
+
+    I2CNum = i2c_num;
+    memset((void*)&Stats, 0, sizeof(Stats));
+
+    for (uint8_t loop = 0; loop < I2C_BUS_MAX_REQUESTS; loop++)
+    {
+        Requests[loop].State = I2C_BUS_REQUEST_FREE;
+        Requests[loop].Done = xSemaphoreCreateBinary();
+        if (Requests[loop].Done == NULL)
+        {
+            ESP_LOGE(TAG, "I2C bus semaphore create failed!");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    for (uint8_t loop = 0; loop < I2C_BUS_PRIORITY_MAX; loop++)
+    {
+        RequestQueues[loop] = xQueueCreate(I2C_BUS_MAX_REQUESTS, sizeof(uint8_t));
+        if (RequestQueues[loop] == NULL)
+        {
+            ESP_LOGE(TAG, "I2C bus queue create failed!");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    BusOwner = xSemaphoreCreateMutex();
+    if (BusOwner == NULL)
+    {
+        ESP_LOGE(TAG, "I2C bus mutex create failed!");
+        return ESP_ERR_NO_MEM;
+    }
+
+    res = i2c_bus_master_init();
+    if (res != ESP_OK)
+    {
+        return res;
+    }
+
+    // created last, transactions are refused until now
+    RequestSignal = xSemaphoreCreateCounting(0xFFFF, 0);
+    if (RequestSignal == NULL)
+    {
+        ESP_LOGE(TAG, "I2C bus signal create failed!");
+        return ESP_ERR_NO_MEM;
+    }
+
+    xTaskCreatePinnedToCore(i2c_bus_task, "I2C", I2C_BUS_TASK_STACK_SIZE, NULL, I2C_BUS_TASK_PRIORITY, NULL, 0);
+
+    return ESP_OK;
+}
+
+#endif  //CONFIG_TONEX_CONTROLLER_DISPLAY_WAVESHARE_800_480
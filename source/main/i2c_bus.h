@@ -0,0 +1,93 @@
+/*
+ Copyright (C) 2024  Greg Smith
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+ 
+*/
+
+
+#ifndef _I2C_BUS_H
+#define _I2C_BUS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// most operations in one transaction
+#define I2C_BUS_MAX_OPS                     6
+
+// transactions are run highest priority first, in order within a priority
+enum I2CBusPriorities
+{
+    I2C_BUS_PRIORITY_FOOTSWITCH,        // input scans
+    I2C_BUS_PRIORITY_TOUCH,             // touch screen reads
+    I2C_BUS_PRIORITY_HOUSEKEEPING,      // outputs, init and everything else
+    I2C_BUS_PRIORITY_MAX                // must be last
+};
+
+enum I2CBusOpTypes
+{
+    I2C_BUS_OP_WRITE,
+    I2C_BUS_OP_READ,
+    I2C_BUS_OP_DELAY,                   // bus held idle for DelayUs
+};
+
+typedef struct
+{
+    uint8_t Type;
+    uint8_t Address;                    // 7 bit
+    uint8_t Length;
+    uint8_t* Data;                      // written from, or read into
+    uint32_t DelayUs;
+} tI2CBusOp;
+
+#define I2C_BUS_WRITE(address, data, length)    { .Type = I2C_BUS_OP_WRITE, .Address = (address), .Length = (length), .Data = (data) }
+#define I2C_BUS_READ(address, data, length)     { .Type = I2C_BUS_OP_READ, .Address = (address), .Length = (length), .Data = (data) }
+#define I2C_BUS_DELAY(us)                       { .Type = I2C_BUS_OP_DELAY, .DelayUs = (us) }
+
+// runs on the bus task with the bus to itself, for drivers that do their own I2C calls
+typedef esp_err_t (*tI2CBusFunction)(void* arg);
+
+typedef struct
+{
+    uint32_t Transactions;
+    uint32_t Merged;                    // transactions sent along with an earlier one
+    uint32_t Errors;
+    uint32_t Resets;
+    uint32_t Timeouts;                  // callers that gave up waiting
+    uint8_t Utilisation;                // percent of the last second the bus was busy
+    uint8_t UtilisationMax;
+    uint8_t QueueMax;
+    uint32_t LatencyAvg[I2C_BUS_PRIORITY_MAX];      // usec, queued to done
+    uint32_t LatencyMax[I2C_BUS_PRIORITY_MAX];
+} tI2CBusStats;
+
+esp_err_t i2c_bus_init(i2c_port_t i2c_num);
+
+// blocking. The transaction is dropped if it hasn't started within timeout_ms
+esp_err_t i2c_bus_transaction(uint8_t priority, const tI2CBusOp* ops, uint8_t count, uint32_t timeout_ms);
+esp_err_t i2c_bus_run(uint8_t priority, tI2CBusFunction function, void* arg, uint32_t timeout_ms);
+esp_err_t i2c_bus_reset(void);
+
+// hold the bus between transactions, for users of the IO expander outputs that mustn't change
+uint8_t i2c_bus_lock(uint32_t timeout_ms);
+void i2c_bus_unlock(void);
+
+void i2c_bus_get_stats(tI2CBusStats* stats);
+void i2c_bus_log_stats(void);
+
+#ifdef __cplusplus
+} /*extern "C"*/
+#endif
+
+#endif
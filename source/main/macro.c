@@ -0,0 +1,209 @@
+/*
+ Copyright (C) 2024  Greg Smith
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+ 
+*/
+
+
+#include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "usb/usb_host.h"
+#include "control.h"
+#include "usb_comms.h"
+#include "macro.h"
+
+#define MACRO_MAX_WAIT_MS                   10000
+#define MACRO_MAX_TEXT                      128
+
+static const char *TAG = "app_macro";
+
+// operand size for each opcode
+static const uint8_t OperandSize[MACRO_OP_MAX] =
+{
+    [MACRO_OP_END] = 0,
+    [MACRO_OP_PRESET] = 2,
+    [MACRO_OP_BYPASS] = 1,
+    [MACRO_OP_SKIN] = 1,
+    [MACRO_OP_WAIT] = 2,
+    [MACRO_OP_MIDI_PC] = 1,
+};
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Append one instruction
+* PARAMETERS:  
+* RETURN:      1 if it fitted
+* NOTES:       Always leaves room for the terminating MACRO_OP_END
+*****************************************************************************/
+static uint8_t macro_emit(uint8_t* code, uint8_t* length, uint8_t code_size, uint8_t opcode, uint16_t operand)
+{
+    if ((*length + 1 + OperandSize[opcode] + 1) > code_size)
+    {
+        return 0;
+    }
+
+    code[(*length)++] = opcode;
+
+    if (OperandSize[opcode] >= 1)
+    {
+        code[(*length)++] = operand & 0xFF;
+    }
+
+    if (OperandSize[opcode] >= 2)
+    {
+        code[(*length)++] = (operand >> 8) & 0xFF;
+    }
+
+    return 1;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Compile a macro definition to bytecode
+* PARAMETERS:  text: steps separated by commas, e.g.
+*                    "preset 5, bypass toggle, skin 3, wait 200, preset 7, midipc 10"
+*                    presets, skins and programs are 1-based, waits in msec
+* RETURN:      compiled length including MACRO_OP_END, 0 on error
+* NOTES:       
+*****************************************************************************/
+uint8_t macro_compile(const char* text, uint8_t* code, uint8_t code_size)
+{
+    char buffer[MACRO_MAX_TEXT];
+    char* save_ptr = NULL;
+    char* step;
+    uint8_t length = 0;
+
+    strncpy(buffer, text, sizeof(buffer) - 1);
+    buffer[sizeof(buffer) - 1] = 0;
+
+    step = strtok_r(buffer, ",;", &save_ptr);
+
+    while (step != NULL)
+    {
+        char name[12] = {0};
+        char arg[12] = {0};
+        uint8_t ok = 0;
+
+        if (sscanf(step, " %11s %11s", name, arg) >= 1)
+        {
+            for (char* ptr = name; *ptr; ptr++)
+            {
+                *ptr = tolower((int)*ptr);
+            }
+
+            if (strcmp(name, "preset") == 0)
+            {
+                int value = atoi(arg);
+
+                if ((value >= 1) && (value <= MAX_LOGICAL_PRESETS))
+                {
+                    ok = macro_emit(code, &length, code_size, MACRO_OP_PRESET, value - 1);
+                }
+            }
+            else if (strcmp(name, "bypass") == 0)
+            {
+                if (strcmp(arg, "on") == 0)
+                {
+                    ok = macro_emit(code, &length, code_size, MACRO_OP_BYPASS, USB_BYPASS_ON);
+                }
+                else if (strcmp(arg, "off") == 0)
+                {
+                    ok = macro_emit(code, &length, code_size, MACRO_OP_BYPASS, USB_BYPASS_OFF);
+                }
+                else if (strcmp(arg, "toggle") == 0)
+                {
+                    ok = macro_emit(code, &length, code_size, MACRO_OP_BYPASS, USB_BYPASS_TOGGLE);
+                }
+            }
+            else if (strcmp(name, "skin") == 0)
+            {
+                int value = atoi(arg);
+
+                if ((value >= 1) && (value <= SKIN_MAX))
+                {
+                    ok = macro_emit(code, &length, code_size, MACRO_OP_SKIN, value - 1);
+                }
+            }
+            else if (strcmp(name, "wait") == 0)
+            {
+                int value = atoi(arg);
+
+                if ((value > 0) && (value <= MACRO_MAX_WAIT_MS))
+                {
+                    ok = macro_emit(code, &length, code_size, MACRO_OP_WAIT, value);
+                }
+            }
+            else if (strcmp(name, "midipc") == 0)
+            {
+                int value = atoi(arg);
+
+                if ((value >= 1) && (value <= 128))
+                {
+                    ok = macro_emit(code, &length, code_size, MACRO_OP_MIDI_PC, value - 1);
+                }
+            }
+        }
+
+        if (!ok)
+        {
+            ESP_LOGW(TAG, "Macro step invalid or too long: %s", step);
+            return 0;
+        }
+
+        step = strtok_r(NULL, ",;", &save_ptr);
+    }
+
+    code[length++] = MACRO_OP_END;
+
+    return length;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Decode the instruction at pc and advance pc
+* PARAMETERS:  
+* RETURN:      0 at the end of the code
+* NOTES:       
+*****************************************************************************/
+uint8_t macro_decode(const uint8_t* code, uint8_t* pc, tMacroOp* op)
+{
+    if ((*pc >= MACRO_MAX_CODE) || (code[*pc] == MACRO_OP_END) || (code[*pc] >= MACRO_OP_MAX) ||
+        ((*pc + 1 + OperandSize[code[*pc]]) > MACRO_MAX_CODE))
+    {
+        op->Opcode = MACRO_OP_END;
+        op->Operand = 0;
+        return 0;
+    }
+
+    op->Opcode = code[(*pc)++];
+    op->Operand = 0;
+
+    if (OperandSize[op->Opcode] >= 1)
+    {
+        op->Operand = code[(*pc)++];
+    }
+
+    if (OperandSize[op->Opcode] >= 2)
+    {
+        op->Operand |= (uint16_t)code[(*pc)++] << 8;
+    }
+
+    return 1;
+}
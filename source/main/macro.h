@@ -0,0 +1,54 @@
+/*
+ Copyright (C) 2024  Greg Smith
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+ 
+*/
+
+
+#ifndef _MACRO_H
+#define _MACRO_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MAX_MACROS                          8
+#define MACRO_MAX_CODE                      32          // bytes of compiled code per macro
+
+// bytecode. Each opcode is followed by its operand, little endian
+enum MacroOpcodes
+{
+    MACRO_OP_END,                   // no operand
+    MACRO_OP_PRESET,                // uint16 logical preset, 0-based
+    MACRO_OP_BYPASS,                // uint8 enum USB_Bypass
+    MACRO_OP_SKIN,                  // uint8 skin index, 0-based
+    MACRO_OP_WAIT,                  // uint16 msec
+    MACRO_OP_MIDI_PC,               // uint8 program, 0-based, sent on serial Midi Out
+    MACRO_OP_MAX                    // must be last
+};
+
+typedef struct
+{
+    uint8_t Opcode;
+    uint16_t Operand;
+} tMacroOp;
+
+uint8_t macro_compile(const char* text, uint8_t* code, uint8_t code_size);
+uint8_t macro_decode(const uint8_t* code, uint8_t* pc, tMacroOp* op);
+
+#ifdef __cplusplus
+} /*extern "C"*/
+#endif
+
+#endif
@@ -44,8 +44,6 @@ extern "C" {
 
 #endif
 
-esp_err_t i2c_master_reset(void);
-
 #ifdef __cplusplus
 } /*extern "C"*/
 #endif
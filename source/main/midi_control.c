@@ -46,6 +46,7 @@ limitations under the License.
 #include "control.h"
 #include "task_priorities.h"
 #include "midi_control.h"
+#include "midi_parser.h"
 
 static const char *TAG = "MidiBT";
 #define GATTC_TAG        "GATTC_CLIENT"
@@ -140,6 +141,10 @@ static char test_device_name[] = "TnxBT";
 static uint8_t char1_str[20] = {0x00,0x00,0x00};
 static esp_gatt_char_prop_t a_property = 0;
 
+// one per connection role, running status carries between packets
+static tMidiParser CentralMidiParser;
+static tMidiParser PeripheralMidiParser;
+
 static esp_attr_value_t gatts_demo_char1_val =
 {
     .attr_max_len = GATTS_DEMO_CHAR_VAL_LEN_MAX,
@@ -583,20 +588,8 @@ static void gatts_profile_a_event_handler(esp_gatts_cb_event_t event, esp_gatt_i
             ESP_LOGI(GATTS_TAG, "value len %d, value ", param->write.len);
             ESP_LOG_BUFFER_HEX(GATTS_TAG, param->write.value, param->write.len);
 
-            // check Midi data. Program change Should be ?? ?? 0xC0 XX (XX = preset index, 0-based)
-            // first 2 bytes are header/timestamp bytes, values depend on host. Ignoring them here
-            if (param->write.len >= 4)
-            {
-                if (param->write.value[2] == 0xC0) 
-                {
-                    // set preset
-                    control_request_preset_index(param->write.value[3]);
-                }
-                else if (param->write.value[2] == 0xB0) 
-                {
-                    // bank change, not needed
-                }
-            }
+            // Midi packet, Bluetooth Midi uses channel 1
+            midi_parser_ble_packet(&PeripheralMidiParser, param->write.value, param->write.len, CONTROL_SOURCE_BT_PERIPHERAL, 0);
 
             if (gls_profile_tab[PROFILE_A_APP_ID].descr_handle == param->write.handle && param->write.len == 2)
             {
@@ -1084,20 +1077,8 @@ static void __attribute__((unused)) gattc_profile_a_event_handler(esp_gattc_cb_e
             //ESP_LOGI(GATTC_TAG, "ESP_GATTC_NOTIFY_EVT, Receive notify value:");
             //esp_log_buffer_hex(GATTC_TAG, p_data->notify.value, p_data->notify.value_len);
 
-            // check Midi data. Program change Should be ?? ?? 0xC0 XX (XX = preset index, 0-based)
-            // first 2 bytes are header/timestamp bytes, values depend on host. Ignoring them here
-            if (p_data->notify.value_len >= 4)
-            {
-                if (p_data->notify.value[2] == 0xC0) 
-                {
-                    // set preset
-                    control_request_preset_index(p_data->notify.value[3]);
-                }
-                else if (p_data->notify.value[2] == 0xB0) 
-                {
-                    // bank change
-                }
-            }
+            // Midi packet, Bluetooth Midi uses channel 1
+            midi_parser_ble_packet(&CentralMidiParser, p_data->notify.value, p_data->notify.value_len, CONTROL_SOURCE_BT_CENTRAL, 0);
             break;
 
         case ESP_GATTC_WRITE_DESCR_EVT:
@@ -1626,5 +1607,8 @@ void midi_delete_bluetooth_bonds(void)
 *****************************************************************************/
 void midi_init(void)
 {
+    midi_parser_init(&CentralMidiParser);
+    midi_parser_init(&PeripheralMidiParser);
+
     init_BLE();
 }
@@ -0,0 +1,548 @@
+/*
+ Copyright (C) 2024  Greg Smith
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+ 
+*/
+
+#include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "control.h"
+#include "macro.h"
+#include "midi_parser.h"
+#include "midi_map.h"
+
+// Midi mapping table. Each incoming CC or note on is looked up in a dense table,
+// indexed by input, type and number, so the cost per message doesn't grow with the
+// number of mappings. The control task replaces the table, the Midi tasks read it
+
+#define MIDI_MAP_INPUTS                     3
+#define MIDI_MAP_LOOKUP_TYPES               2           // CC and note
+#define MIDI_MAP_LOOKUP_CHANNELS            17          // 16 channels then omni
+#define MIDI_MAP_LOOKUP_OMNI                16
+#define MIDI_MAP_MAX_TEXT                   128
+#define MIDI_MAP_MIDI_VALUES                128
+#define MIDI_MAP_SWITCH_ON_THRESHOLD        64
+
+static const char *TAG = "app_midi_map";
+
+static tMidiMapping Mappings[MAX_MIDI_MAPPINGS];
+static uint8_t Lookup[MIDI_MAP_INPUTS][MIDI_MAP_LOOKUP_TYPES][MIDI_MAP_LOOKUP_CHANNELS][MIDI_MAP_MIDI_VALUES];    // mapping index + 1, 0 for none
+static uint8_t LearnEntry;                                                              // mapping index + 1, 0 for none
+static portMUX_TYPE MapLock = portMUX_INITIALIZER_UNLOCKED;
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      0-based lookup input, or MIDI_MAP_INPUTS if not a Midi source
+* NOTES:       
+*****************************************************************************/
+static uint8_t midi_map_source_input(uint8_t source)
+{
+    switch (source)
+    {
+        case CONTROL_SOURCE_MIDI_SERIAL:
+        {
+            return 0;
+        } break;
+
+        case CONTROL_SOURCE_BT_CENTRAL:
+        {
+            return 1;
+        } break;
+
+        case CONTROL_SOURCE_BT_PERIPHERAL:
+        {
+            return 2;
+        } break;
+
+        default:
+        {
+            return MIDI_MAP_INPUTS;
+        } break;
+    }
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Parse the action half of a mapping
+* PARAMETERS:  text: action name and optional value, e.g. "preset 3" or "skin"
+* RETURN:      1 if valid
+* NOTES:       Preset, macro and skin numbers are 1-based
+*****************************************************************************/
+static uint8_t midi_map_compile_action(const char* text, tMidiMapping* mapping)
+{
+    char name[16] = {0};
+    char arg[12] = {0};
+    int count = sscanf(text, " %15s %11s", name, arg);
+    int value = atoi(arg);
+
+    if (count < 1)
+    {
+        return 0;
+    }
+
+    for (char* ptr = name; *ptr; ptr++)
+    {
+        *ptr = tolower((int)*ptr);
+    }
+
+    mapping->Scaled = 0;
+    mapping->Value = 0;
+
+    if ((strcmp(name, "preset") == 0) || (strcmp(name, "skin") == 0))
+    {
+        uint16_t max = (name[0] == 'p') ? PRESETS_PER_BANK : SKIN_MAX;
+
+        mapping->Action = (name[0] == 'p') ? MIDI_MAP_ACTION_PRESET : MIDI_MAP_ACTION_SKIN;
+
+        if (count == 1)
+        {
+            mapping->Scaled = 1;
+            return 1;
+        }
+
+        if ((value < 1) || (value > max))
+        {
+            return 0;
+        }
+
+        mapping->Value = value - 1;
+        return 1;
+    }
+    else if (strcmp(name, "macro") == 0)
+    {
+        if ((value < 1) || (value > MAX_MACROS))
+        {
+            return 0;
+        }
+
+        mapping->Action = MIDI_MAP_ACTION_MACRO;
+        mapping->Value = value - 1;
+        return 1;
+    }
+    else if (count > 1)
+    {
+        // the rest take no value
+        return 0;
+    }
+    else if (strcmp(name, "presetdown") == 0)
+    {
+        mapping->Action = MIDI_MAP_ACTION_PRESET_DOWN;
+    }
+    else if (strcmp(name, "presetup") == 0)
+    {
+        mapping->Action = MIDI_MAP_ACTION_PRESET_UP;
+    }
+    else if (strcmp(name, "bankdown") == 0)
+    {
+        mapping->Action = MIDI_MAP_ACTION_BANK_DOWN;
+    }
+    else if (strcmp(name, "bankup") == 0)
+    {
+        mapping->Action = MIDI_MAP_ACTION_BANK_UP;
+    }
+    else if (strcmp(name, "bypass") == 0)
+    {
+        mapping->Action = MIDI_MAP_ACTION_BYPASS;
+    }
+    else if (strcmp(name, "bypasstoggle") == 0)
+    {
+        mapping->Action = MIDI_MAP_ACTION_BYPASS_TOGGLE;
+    }
+    else
+    {
+        return 0;
+    }
+
+    return 1;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Compile a mapping definition
+* PARAMETERS:  text: "input channel type number = action [value]", e.g.
+*                    "serial 1 cc 20 = bypass"
+*                    "any omni note 60 = preset 3"
+*                    "bt 2 cc 7 = skin"
+*                    "learn = bankup"
+*                    input: serial, btcentral, btperipheral, bt (both) or any
+*                    channel: 1 to 16, or omni
+*                    type: cc or note
+*                    learn waits for the next CC or note on, and maps it
+* RETURN:      1 if valid. Blank text gives an unused mapping
+* NOTES:       
+*****************************************************************************/
+uint8_t midi_map_compile(const char* text, tMidiMapping* mapping)
+{
+    char buffer[MIDI_MAP_MAX_TEXT];
+    char input[16] = {0};
+    char channel[8] = {0};
+    char type[8] = {0};
+    int number = -1;
+    char* action;
+    int count;
+
+    memset((void*)mapping, 0, sizeof(tMidiMapping));
+
+    strncpy(buffer, text, sizeof(buffer) - 1);
+    buffer[sizeof(buffer) - 1] = 0;
+
+    for (char* ptr = buffer; *ptr; ptr++)
+    {
+        *ptr = tolower((int)*ptr);
+    }
+
+    action = strchr(buffer, '=');
+    if (action == NULL)
+    {
+        // blank clears the mapping
+        if (sscanf(buffer, " %15s", input) < 1)
+        {
+            return 1;
+        }
+
+        ESP_LOGW(TAG, "Midi mapping has no action: %s", text);
+        return 0;
+    }
+
+    *action = 0;
+    action++;
+
+    count = sscanf(buffer, " %15s %7s %7s %d", input, channel, type, &number);
+
+    if ((count == 1) && (strcmp(input, "learn") == 0))
+    {
+        mapping->Inputs = MIDI_MAP_INPUT_ANY;
+        mapping->Channel = MIDI_CHANNEL_OMNI;
+        mapping->Type = MIDI_MAP_TYPE_LEARN;
+    }
+    else if (count == 4)
+    {
+        int channel_value = atoi(channel);
+
+        if (strcmp(input, "serial") == 0)
+        {
+            mapping->Inputs = MIDI_MAP_INPUT_SERIAL;
+        }
+        else if (strcmp(input, "btcentral") == 0)
+        {
+            mapping->Inputs = MIDI_MAP_INPUT_BT_CENTRAL;
+        }
+        else if (strcmp(input, "btperipheral") == 0)
+        {
+            mapping->Inputs = MIDI_MAP_INPUT_BT_PERIPHERAL;
+        }
+        else if (strcmp(input, "bt") == 0)
+        {
+            mapping->Inputs = MIDI_MAP_INPUT_BT_CENTRAL | MIDI_MAP_INPUT_BT_PERIPHERAL;
+        }
+        else if (strcmp(input, "any") == 0)
+        {
+            mapping->Inputs = MIDI_MAP_INPUT_ANY;
+        }
+
+        if (strcmp(channel, "omni") == 0)
+        {
+            mapping->Channel = MIDI_CHANNEL_OMNI;
+        }
+        else if ((channel_value >= 1) && (channel_value <= 16))
+        {
+            mapping->Channel = channel_value - 1;
+        }
+        else
+        {
+            mapping->Inputs = 0;
+        }
+
+        if (strcmp(type, "cc") == 0)
+        {
+            mapping->Type = MIDI_MAP_TYPE_CC;
+        }
+        else if (strcmp(type, "note") == 0)
+        {
+            mapping->Type = MIDI_MAP_TYPE_NOTE;
+        }
+        else
+        {
+            mapping->Inputs = 0;
+        }
+
+        if ((number < 0) || (number >= MIDI_MAP_MIDI_VALUES))
+        {
+            mapping->Inputs = 0;
+        }
+
+        mapping->Number = number;
+    }
+
+    if ((mapping->Inputs == 0) || !midi_map_compile_action(action, mapping))
+    {
+        ESP_LOGW(TAG, "Midi mapping invalid: %s", text);
+        memset((void*)mapping, 0, sizeof(tMidiMapping));
+        return 0;
+    }
+
+    return 1;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Replace the mappings in use and rebuild the lookup
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Where two mappings take the same message, the first one wins.
+*              This holds between omni and single channel mappings too, see
+*              midi_map_handle(). The first learn entry waits for the next message
+*****************************************************************************/
+void midi_map_set(const tMidiMapping* mappings, uint8_t count)
+{
+    if (count > MAX_MIDI_MAPPINGS)
+    {
+        count = MAX_MIDI_MAPPINGS;
+    }
+
+    taskENTER_CRITICAL(&MapLock);
+
+    memset((void*)Mappings, 0, sizeof(Mappings));
+    memcpy((void*)Mappings, (void*)mappings, count * sizeof(tMidiMapping));
+    memset((void*)Lookup, 0, sizeof(Lookup));
+    LearnEntry = 0;
+
+    for (int16_t loop = count - 1; loop >= 0; loop--)
+    {
+        const tMidiMapping* mapping = &Mappings[loop];
+
+        if (mapping->Inputs == 0)
+        {
+            continue;
+        }
+
+        if (mapping->Type == MIDI_MAP_TYPE_LEARN)
+        {
+            LearnEntry = loop + 1;
+            continue;
+        }
+
+        uint8_t channel = (mapping->Channel == MIDI_CHANNEL_OMNI) ? MIDI_MAP_LOOKUP_OMNI : mapping->Channel;
+
+        if ((mapping->Type >= MIDI_MAP_LOOKUP_TYPES) || (mapping->Number >= MIDI_MAP_MIDI_VALUES) || (channel >= MIDI_MAP_LOOKUP_CHANNELS))
+        {
+            continue;
+        }
+
+        for (uint8_t input = 0; input < MIDI_MAP_INPUTS; input++)
+        {
+            if (mapping->Inputs & (1 << input))
+            {
+                Lookup[input][mapping->Type][channel][mapping->Number] = loop + 1;
+            }
+        }
+    }
+
+    taskEXIT_CRITICAL(&MapLock);
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Run a mapped action
+* PARAMETERS:  value: CC value or note velocity
+* RETURN:      
+* NOTES:       Actions that are steps or triggers run on a CC of 64 and above,
+*              like a switch being pressed, and on every note on
+*****************************************************************************/
+static void midi_map_run(uint8_t source, const tMidiMapping* mapping, uint8_t type, uint8_t value)
+{
+    uint8_t pressed = (type == MIDI_MAP_TYPE_NOTE) || (value >= MIDI_MAP_SWITCH_ON_THRESHOLD);
+
+    switch (mapping->Action)
+    {
+        case MIDI_MAP_ACTION_PRESET:
+        {
+            if (mapping->Scaled)
+            {
+                control_request_preset_index(source, (value * PRESETS_PER_BANK) / MIDI_MAP_MIDI_VALUES);
+            }
+            else if (pressed)
+            {
+                control_request_preset_index(source, mapping->Value);
+            }
+        } break;
+
+        case MIDI_MAP_ACTION_PRESET_DOWN:
+        {
+            if (pressed)
+            {
+                control_request_preset_down(source);
+            }
+        } break;
+
+        case MIDI_MAP_ACTION_PRESET_UP:
+        {
+            if (pressed)
+            {
+                control_request_preset_up(source);
+            }
+        } break;
+
+        case MIDI_MAP_ACTION_BANK_DOWN:
+        case MIDI_MAP_ACTION_BANK_UP:
+        {
+            if (pressed)
+            {
+                control_request_bank_step(source, mapping->Action == MIDI_MAP_ACTION_BANK_UP);
+            }
+        } break;
+
+        case MIDI_MAP_ACTION_BYPASS:
+        {
+            if (type == MIDI_MAP_TYPE_NOTE)
+            {
+                control_request_bypass_toggle(source);
+            }
+            else
+            {
+                control_request_bypass(source, value >= MIDI_MAP_SWITCH_ON_THRESHOLD);
+            }
+        } break;
+
+        case MIDI_MAP_ACTION_BYPASS_TOGGLE:
+        {
+            if (pressed)
+            {
+                control_request_bypass_toggle(source);
+            }
+        } break;
+
+        case MIDI_MAP_ACTION_MACRO:
+        {
+            if (pressed)
+            {
+                control_request_macro(mapping->Value);
+            }
+        } break;
+
+        case MIDI_MAP_ACTION_SKIN:
+        {
+            if (mapping->Scaled)
+            {
+                control_set_amp_skin_index((value * SKIN_MAX) / MIDI_MAP_MIDI_VALUES);
+            }
+            else if (pressed)
+            {
+                control_set_amp_skin_index(mapping->Value);
+            }
+        } break;
+
+        default:
+        {
+            // not used
+        } break;
+    }
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Look up a complete message and act on its mapping
+* PARAMETERS:  source: CONTROL_SOURCE_x
+* RETURN:      1 if it was mapped or learned
+* NOTES:       Called on the Midi hot path, from the serial and Bluetooth tasks
+*****************************************************************************/
+uint8_t midi_map_handle(uint8_t source, const tMidiMessage* message)
+{
+    uint8_t input = midi_map_source_input(source);
+    uint8_t channel = message->Status & 0x0F;
+    uint8_t learn;
+    uint8_t entry = 0;
+    uint8_t omni;
+    uint8_t type;
+    tMidiMapping mapping;
+
+    if (input >= MIDI_MAP_INPUTS)
+    {
+        return 0;
+    }
+
+    switch (message->Status & 0xF0)
+    {
+        case MIDI_CONTROL_CHANGE:
+        {
+            type = MIDI_MAP_TYPE_CC;
+        } break;
+
+        case MIDI_NOTE_ON:
+        {
+            if (message->Data[1] == 0)
+            {
+                // note off
+                return 0;
+            }
+
+            type = MIDI_MAP_TYPE_NOTE;
+        } break;
+
+        default:
+        {
+            return 0;
+        } break;
+    }
+
+    taskENTER_CRITICAL(&MapLock);
+
+    learn = LearnEntry;
+    if (learn != 0)
+    {
+        // only the first message is learned, until the control task sets the mappings again
+        LearnEntry = 0;
+    }
+    else
+    {
+        entry = Lookup[input][type][channel][message->Data[0]];
+        omni = Lookup[input][type][MIDI_MAP_LOOKUP_OMNI][message->Data[0]];
+
+        // both take this message, the first mapping wins
+        if ((omni != 0) && ((entry == 0) || (omni < entry)))
+        {
+            entry = omni;
+        }
+
+        if (entry != 0)
+        {
+            mapping = Mappings[entry - 1];
+        }
+    }
+
+    taskEXIT_CRITICAL(&MapLock);
+
+    if (learn != 0)
+    {
+        ESP_LOGI(TAG, "Learned mapping %d: input %d channel %d type %d number %d", (int)learn, (int)input, (int)channel + 1, (int)type, (int)message->Data[0]);
+        control_learn_midi_mapping(learn - 1, 1 << input, channel, type, message->Data[0]);
+        return 1;
+    }
+
+    if (entry == 0)
+    {
+        return 0;
+    }
+
+    midi_map_run(source, &mapping, type, message->Data[1]);
+
+    return 1;
+}
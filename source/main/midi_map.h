@@ -0,0 +1,77 @@
+/*
+ Copyright (C) 2024  Greg Smith
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+ 
+*/
+
+
+#ifndef _MIDI_MAP_H
+#define _MIDI_MAP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MAX_MIDI_MAPPINGS                   32
+
+// Midi inputs a mapping listens to, bitmask
+#define MIDI_MAP_INPUT_SERIAL               0x01
+#define MIDI_MAP_INPUT_BT_CENTRAL           0x02
+#define MIDI_MAP_INPUT_BT_PERIPHERAL        0x04
+#define MIDI_MAP_INPUT_ANY                  (MIDI_MAP_INPUT_SERIAL | MIDI_MAP_INPUT_BT_CENTRAL | MIDI_MAP_INPUT_BT_PERIPHERAL)
+
+enum MidiMapTypes
+{
+    MIDI_MAP_TYPE_CC,
+    MIDI_MAP_TYPE_NOTE,                 // note on, velocity 0 is taken as note off
+    MIDI_MAP_TYPE_LEARN,                // waiting for the next message to fill in the rest
+};
+
+enum MidiMapActions
+{
+    MIDI_MAP_ACTION_PRESET,             // Value: preset in the current bank, or scaled from the Midi value
+    MIDI_MAP_ACTION_PRESET_DOWN,
+    MIDI_MAP_ACTION_PRESET_UP,
+    MIDI_MAP_ACTION_BANK_DOWN,
+    MIDI_MAP_ACTION_BANK_UP,
+    MIDI_MAP_ACTION_BYPASS,             // CC 64 and above is on, below is off. Notes toggle
+    MIDI_MAP_ACTION_BYPASS_TOGGLE,
+    MIDI_MAP_ACTION_MACRO,              // Value: 0-based macro
+    MIDI_MAP_ACTION_SKIN,               // Value: 0-based skin, or scaled from the Midi value
+};
+
+typedef struct __attribute__ ((packed))
+{
+    uint8_t Inputs;                     // MIDI_MAP_INPUT_x, 0 for an unused entry
+    uint8_t Channel;                    // 0-based, or MIDI_CHANNEL_OMNI
+    uint8_t Type;                       // enum MidiMapTypes
+    uint8_t Number;                     // CC or note number
+    uint8_t Action;                     // enum MidiMapActions
+    uint8_t Scaled;                     // Midi value 0 to 127 is spread over the action's range, Value unused
+    uint16_t Value;
+} tMidiMapping;
+
+uint8_t midi_map_compile(const char* text, tMidiMapping* mapping);
+
+// replaces the mappings in use. Called from the control task
+void midi_map_set(const tMidiMapping* mappings, uint8_t count);
+
+// returns 1 if the message was mapped (or learned) and should not be handled further
+uint8_t midi_map_handle(uint8_t source, const tMidiMessage* message);
+
+#ifdef __cplusplus
+} /*extern "C"*/
+#endif
+
+#endif
@@ -0,0 +1,260 @@
+/*
+ Copyright (C) 2024  Greg Smith
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+ 
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include "control.h"
+#include "midi_parser.h"
+#include "midi_map.h"
+
+// Byte at a time Midi 1.0 parser, shared by the serial and Bluetooth inputs. Nothing
+// here depends on the ESP-IDF, tools/midi_check builds it on the host to check it
+// against test streams and time it
+
+// data bytes after each channel status, by high nibble
+static const uint8_t ChannelDataLength[8] =
+{
+    2,      // note off
+    2,      // note on
+    2,      // poly pressure
+    2,      // control change
+    1,      // program change
+    1,      // channel pressure
+    2,      // pitch bend
+    0,      // system, see below
+};
+
+// data bytes after each system common status, 0xF0 to 0xF7
+static const uint8_t SystemDataLength[8] =
+{
+    0,      // sysex start, handled separately
+    1,      // time code quarter frame
+    2,      // song position
+    1,      // song select
+    0,      // undefined
+    0,      // undefined
+    0,      // tune request
+    0,      // sysex end
+};
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void midi_parser_init(tMidiParser* parser)
+{
+    memset((void*)parser, 0, sizeof(tMidiParser));
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Add a received byte
+* PARAMETERS:  message: filled in when a message is complete
+* RETURN:      1 if a message is complete
+* NOTES:       SysEx is skipped. A message cut short by a new status is dropped
+*****************************************************************************/
+uint8_t midi_parser_byte(tMidiParser* parser, uint8_t byte, tMidiMessage* message)
+{
+    if (byte < 0x80)
+    {
+        // data byte
+        if (parser->InSysEx || (parser->Status == 0))
+        {
+            return 0;
+        }
+
+        parser->Data[parser->Count++] = byte;
+
+        if (parser->Count < parser->Expected)
+        {
+            parser->Partial = 1;
+            return 0;
+        }
+
+        message->Status = parser->Status;
+        message->Data[0] = parser->Data[0];
+        message->Data[1] = parser->Data[1];
+        message->Length = parser->Expected + 1;
+
+        parser->Count = 0;
+        parser->Partial = 0;
+        if (!parser->Running)
+        {
+            // system common messages aren't repeated
+            parser->Status = 0;
+        }
+
+        return 1;
+    }
+
+    if (byte >= MIDI_REALTIME_FIRST)
+    {
+        // may arrive anywhere, even inside another message
+        message->Status = byte;
+        message->Length = 1;
+        return 1;
+    }
+
+    parser->Count = 0;
+    parser->InSysEx = 0;
+    parser->Partial = 0;
+
+    if (byte < MIDI_SYSEX_START)
+    {
+        parser->Status = byte;
+        parser->Running = 1;
+        parser->Partial = 1;
+        parser->Expected = ChannelDataLength[(byte >> 4) & 0x07];
+        return 0;
+    }
+
+    // system common clears running status
+    parser->Status = 0;
+    parser->Running = 0;
+
+    switch (byte)
+    {
+        case MIDI_SYSEX_START:
+        {
+            parser->InSysEx = 1;
+        } break;
+
+        case MIDI_SYSEX_END:
+        {
+            // end of a SysEx already skipped
+        } break;
+
+        default:
+        {
+            parser->Expected = SystemDataLength[byte & 0x07];
+
+            if (parser->Expected == 0)
+            {
+                if (byte == MIDI_TUNE_REQUEST)
+                {
+                    message->Status = byte;
+                    message->Length = 1;
+                    return 1;
+                }
+
+                // undefined
+                return 0;
+            }
+
+            parser->Status = byte;
+            parser->Partial = 1;
+        } break;
+    }
+
+    return 0;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      1 if a message has started and isn't complete
+* NOTES:       Realtime bytes don't count, they may go anywhere
+*****************************************************************************/
+uint8_t midi_parser_in_message(const tMidiParser* parser)
+{
+    return parser->InSysEx || parser->Partial;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Act on a complete message
+* PARAMETERS:  source: CONTROL_SOURCE_x, channel: 0-based or MIDI_CHANNEL_OMNI
+* RETURN:      
+* NOTES:       Mappings have their own channel, and take the message ahead of
+*              the built in program change and CC handling
+*****************************************************************************/
+void midi_parser_dispatch(uint8_t source, uint8_t channel, const tMidiMessage* message)
+{
+    if ((message->Status >= MIDI_SYSEX_START) || midi_map_handle(source, message))
+    {
+        return;
+    }
+
+    if ((channel != MIDI_CHANNEL_OMNI) && ((message->Status & 0x0F) != channel))
+    {
+        return;
+    }
+
+    switch (message->Status & 0xF0)
+    {
+        case MIDI_PROGRAM_CHANGE:
+        {
+            // change to this preset
+            control_request_preset_index(source, message->Data[0]);
+        } break;
+
+        case MIDI_CONTROL_CHANGE:
+        {
+            // bank select or macro trigger
+            control_request_midi_cc(message->Data[0], message->Data[1]);
+        } break;
+
+        default:
+        {
+            // not used
+        } break;
+    }
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Parse and dispatch a Bluetooth LE Midi packet
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       The packet starts with a header byte, and each status byte has
+*              a timestamp byte before it. Both have the top bit set. Messages
+*              in running status may follow without a timestamp
+*****************************************************************************/
+void midi_parser_ble_packet(tMidiParser* parser, const uint8_t* data, uint16_t length, uint8_t source, uint8_t channel)
+{
+    tMidiMessage message;
+    uint16_t index = 1;
+
+    if ((length < 2) || !(data[0] & 0x80))
+    {
+        return;
+    }
+
+    while (index < length)
+    {
+        if (data[index] & 0x80)
+        {
+            // timestamp, then a status byte, or data bytes in running status
+            index++;
+            if (index >= length)
+            {
+                break;
+            }
+        }
+
+        if (midi_parser_byte(parser, data[index], &message))
+        {
+            midi_parser_dispatch(source, channel, &message);
+        }
+
+        index++;
+    }
+}
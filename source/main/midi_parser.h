@@ -0,0 +1,83 @@
+/*
+ Copyright (C) 2024  Greg Smith
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+ 
+*/
+
+#ifndef _MIDI_PARSER_H
+#define _MIDI_PARSER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// channel voice messages, low nibble is the channel
+#define MIDI_NOTE_OFF                           0x80
+#define MIDI_NOTE_ON                            0x90
+#define MIDI_POLY_PRESSURE                      0xA0
+#define MIDI_CONTROL_CHANGE                     0xB0
+#define MIDI_PROGRAM_CHANGE                     0xC0
+#define MIDI_CHANNEL_PRESSURE                   0xD0
+#define MIDI_PITCH_BEND                         0xE0
+
+// system messages
+#define MIDI_SYSEX_START                        0xF0
+#define MIDI_TIME_CODE                          0xF1
+#define MIDI_SONG_POSITION                      0xF2
+#define MIDI_SONG_SELECT                        0xF3
+#define MIDI_TUNE_REQUEST                       0xF6
+#define MIDI_SYSEX_END                          0xF7
+#define MIDI_REALTIME_FIRST                     0xF8        // clock, start, stop and so on, single byte
+
+#define MIDI_CHANNEL_OMNI                       0xFF        // dispatch on any channel
+
+typedef struct
+{
+    uint8_t Status;                     // including the channel
+    uint8_t Data[2];
+    uint8_t Length;                     // bytes including the status
+} tMidiMessage;
+
+typedef struct
+{
+    uint8_t Status;                     // message being received, 0 for none
+    uint8_t Running;                    // Status may be repeated by data alone
+    uint8_t InSysEx;
+    uint8_t Partial;                    // status or data received, message not complete
+    uint8_t Expected;                   // data bytes
+    uint8_t Count;
+    uint8_t Data[2];
+} tMidiParser;
+
+void midi_parser_init(tMidiParser* parser);
+
+// returns 1 when byte completes a message. Realtime bytes come out as they arrive,
+// without upsetting a message they interrupt
+uint8_t midi_parser_byte(tMidiParser* parser, uint8_t byte, tMidiMessage* message);
+
+// 1 between the first and last byte of a message, SysEx included. Another message
+// can be sent between two that are complete without breaking either
+uint8_t midi_parser_in_message(const tMidiParser* parser);
+
+// act on a complete message from one of the Midi inputs
+void midi_parser_dispatch(uint8_t source, uint8_t channel, const tMidiMessage* message);
+
+// a Bluetooth LE Midi packet, header and timestamps included
+void midi_parser_ble_packet(tMidiParser* parser, const uint8_t* data, uint16_t length, uint8_t source, uint8_t channel);
+
+#ifdef __cplusplus
+} /*extern "C"*/
+#endif
+
+#endif
@@ -17,10 +17,12 @@ limitations under the License.
 
 #include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
 #include "sdkconfig.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
+#include "freertos/queue.h"
 #include "esp_timer.h"
 #include "driver/uart.h"
 #include "driver/gpio.h"
@@ -34,11 +36,26 @@ limitations under the License.
 #include "esp_log.h"
 #include "driver/i2c.h"
 #include "midi_serial.h"
+#include "midi_parser.h"
 #include "control.h"
+#include "event_bus.h"
 #include "task_priorities.h"
 
 #define MIDI_SERIAL_TASK_STACK_SIZE             (3 * 1024)
 #define MIDI_SERIAL_BUFFER_SIZE                 128
+#define MIDI_SERIAL_EVENT_QUEUE_LENGTH          20
+#define MIDI_SERIAL_RX_FULL_THRESHOLD           1       // bytes, interrupt on every byte
+#define MIDI_SERIAL_RX_TIMEOUT                  1       // byte times of idle line before the FIFO is read
+#define MIDI_SERIAL_ECHO_TASK_STACK_SIZE        (2 * 1024)
+#define MIDI_SERIAL_OUT_QUEUE_LENGTH            8
+#define MIDI_SERIAL_TX_BUFFER_SIZE              ((MIDI_SERIAL_BUFFER_SIZE * 2) + (MIDI_SERIAL_OUT_QUEUE_LENGTH * 3))
+#define MIDI_SERIAL_EVENT_SEND                  UART_EVENT_MAX      // our own event in the UART queue, messages waiting to be sent
+#define MIDI_SERIAL_VALUE_UNKNOWN               0xFF
+
+// Midi Out: our preset changes, Midi In forwarded (Thru), or both merged
+#define MIDI_SERIAL_OUT                         (CONFIG_MIDI_SERIAL_OUT_ECHO || CONFIG_MIDI_SERIAL_OUT_THRU || CONFIG_MIDI_SERIAL_OUT_MERGE)
+#define MIDI_SERIAL_ECHO                        (CONFIG_MIDI_SERIAL_OUT_ECHO || CONFIG_MIDI_SERIAL_OUT_MERGE)
+#define MIDI_SERIAL_THRU                        (CONFIG_MIDI_SERIAL_OUT_THRU || CONFIG_MIDI_SERIAL_OUT_MERGE)
 
 #if CONFIG_TONEX_CONTROLLER_DISPLAY_WAVESHARE_800_480
     #define UART_PORT_NUM                           UART_NUM_1
@@ -47,9 +64,11 @@ limitations under the License.
 
     // Waveshare 7" using ADC port - development use
     #define UART_RX_PIN                           GPIO_NUM_6 
+    #define UART_TX_PIN                             GPIO_NUM_44
 #else
     #define UART_PORT_NUM                           UART_NUM_1
     #define UART_RX_PIN                             GPIO_NUM_5
+    #define UART_TX_PIN                             GPIO_NUM_7
 #endif
 
 static const char *TAG = "app_midi_serial";
@@ -58,6 +77,248 @@ static const char *TAG = "app_midi_serial";
 
 static uint8_t midi_serial_buffer[MIDI_SERIAL_BUFFER_SIZE];
 static uint8_t midi_serial_channel = 0;
+static tMidiParser midi_serial_parser;
+static QueueHandle_t midi_serial_uart_queue;
+#if CONFIG_MIDI_SERIAL_LATENCY_LOG
+static volatile int64_t midi_serial_edge_time;
+#endif
+#if MIDI_SERIAL_OUT
+static uint8_t midi_serial_tx[MIDI_SERIAL_TX_BUFFER_SIZE];
+static uint16_t midi_serial_tx_length;
+static uint8_t midi_serial_tx_status;                  // running status on the output, 0 for none
+static uint8_t midi_serial_tx_program;                 // last on our channel, sent or forwarded
+static uint8_t midi_serial_tx_bank_msb;
+static uint8_t midi_serial_tx_bank_lsb;
+static QueueHandle_t midi_serial_out_queue;
+#endif
+#if MIDI_SERIAL_THRU
+static uint8_t midi_serial_thru_resync;                // Midi In message was cut by a merge timeout, drop the rest of it
+#endif
+#if MIDI_SERIAL_ECHO
+static int8_t midi_serial_subscriber = EVENT_BUS_SUBSCRIBER_INVALID;
+#endif
+
+#if CONFIG_MIDI_SERIAL_LATENCY_LOG
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: First start bit of a burst of Midi bytes
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Disabled until the bytes have been handled, so it only fires once
+*              per burst rather than on every falling edge
+*****************************************************************************/
+static void IRAM_ATTR midi_serial_edge_isr(void* arg)
+{
+    midi_serial_edge_time = esp_timer_get_time();
+    gpio_intr_disable(UART_RX_PIN);
+}
+#endif
+
+#if MIDI_SERIAL_OUT
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Note what the output has told the devices after us
+* PARAMETERS:  
+* RETURN:      1 if the message changes nothing for them and can be left out
+* NOTES:       Only program change and bank select on our channel are tracked
+*****************************************************************************/
+static uint8_t midi_serial_track_output(const tMidiMessage* message)
+{
+    uint8_t* last = NULL;
+    uint8_t value = message->Data[0];
+
+    if (message->Status == (MIDI_PROGRAM_CHANGE | midi_serial_channel))
+    {
+        last = &midi_serial_tx_program;
+    }
+    else if (message->Status == (MIDI_CONTROL_CHANGE | midi_serial_channel))
+    {
+        value = message->Data[1];
+
+        if (message->Data[0] == 0)
+        {
+            last = &midi_serial_tx_bank_msb;
+        }
+        else if (message->Data[0] == 32)
+        {
+            last = &midi_serial_tx_bank_lsb;
+        }
+    }
+
+    if (last == NULL)
+    {
+        return 0;
+    }
+
+    if (*last == value)
+    {
+        return 1;
+    }
+
+    *last = value;
+    return 0;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Add our own waiting messages to the output
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Only called between Midi In messages. Repeats of the last preset
+*              sent, or forwarded from Midi In, are dropped
+*****************************************************************************/
+static void midi_serial_add_pending(void)
+{
+    tMidiMessage message;
+
+    while (((midi_serial_tx_length + 3) <= MIDI_SERIAL_TX_BUFFER_SIZE) && (xQueueReceive(midi_serial_out_queue, (void*)&message, 0) == pdTRUE))
+    {
+        if (midi_serial_track_output(&message))
+        {
+            continue;
+        }
+
+        midi_serial_tx[midi_serial_tx_length++] = message.Status;
+        for (uint8_t loop = 1; loop < message.Length; loop++)
+        {
+            midi_serial_tx[midi_serial_tx_length++] = message.Data[loop - 1];
+        }
+
+        // running status on the output is now ours
+        midi_serial_tx_status = (message.Status < MIDI_SYSEX_START) ? message.Status : 0;
+    }
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Send the output built up so far
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       No TX ring buffer is installed, so the bytes go straight into
+*              the UART FIFO without waiting
+*****************************************************************************/
+static void midi_serial_flush_output(void)
+{
+    if (midi_serial_tx_length > 0)
+    {
+        uart_write_bytes(UART_PORT_NUM, (const char*)midi_serial_tx, midi_serial_tx_length);
+        midi_serial_tx_length = 0;
+    }
+}
+#endif
+
+#if MIDI_SERIAL_THRU
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Forward a Midi In byte
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Called before the parser sees the byte. Midi In may be relying
+*              on running status, so if one of our messages has gone out since
+*              its status byte, the status is sent again first. Sends what is
+*              built up so far if there is no room for both
+*****************************************************************************/
+static void midi_serial_thru_byte(uint8_t byte)
+{
+    if ((midi_serial_tx_length + 2) > MIDI_SERIAL_TX_BUFFER_SIZE)
+    {
+        midi_serial_flush_output();
+    }
+
+    if (byte < 0x80)
+    {
+        if (midi_serial_thru_resync)
+        {
+            return;
+        }
+
+        if ((midi_serial_parser.Status != 0) && (midi_serial_parser.Status < MIDI_SYSEX_START) && !midi_serial_parser.InSysEx &&
+            (midi_serial_parser.Count == 0) && (midi_serial_tx_status != midi_serial_parser.Status))
+        {
+            midi_serial_tx[midi_serial_tx_length++] = midi_serial_parser.Status;
+            midi_serial_tx_status = midi_serial_parser.Status;
+        }
+    }
+    else if (byte < MIDI_REALTIME_FIRST)
+    {
+        midi_serial_thru_resync = 0;
+        midi_serial_tx_status = (byte < MIDI_SYSEX_START) ? byte : 0;
+    }
+
+    midi_serial_tx[midi_serial_tx_length++] = byte;
+}
+#endif
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Parse and act on received bytes
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       With Thru, each read is forwarded as soon as it has been parsed.
+*              Reads are usually a single byte, so this adds about a byte time
+*****************************************************************************/
+static void midi_serial_handle_data(size_t length)
+{
+    tMidiMessage message;
+    int rx_length;
+
+    while (length > 0)
+    {
+        rx_length = uart_read_bytes(UART_PORT_NUM, midi_serial_buffer, MIN(length, MIDI_SERIAL_BUFFER_SIZE), 0);
+        if (rx_length <= 0)
+        {
+            break;
+        }
+
+        ESP_LOGD(TAG, "Midi Serial Got %d bytes", rx_length);
+
+        // messages may be split across reads, the parser carries them over
+        for (int i = 0; i < rx_length; i++)
+        {
+#if MIDI_SERIAL_THRU
+            midi_serial_thru_byte(midi_serial_buffer[i]);
+#endif
+
+            if (midi_parser_byte(&midi_serial_parser, midi_serial_buffer[i], &message))
+            {
+#if MIDI_SERIAL_THRU
+                if (message.Length > 1)
+                {
+                    midi_serial_thru_resync = 0;
+                    midi_serial_track_output(&message);
+                }
+#endif
+
+                midi_parser_dispatch(CONTROL_SOURCE_MIDI_SERIAL, midi_serial_channel, &message);
+
+#if CONFIG_MIDI_SERIAL_LATENCY_LOG
+                if ((message.Status & 0xF0) == MIDI_PROGRAM_CHANGE)
+                {
+                    // includes the time on the wire, 320 usec a byte
+                    ESP_LOGI(TAG, "Program change %d, %"PRIi64" usec from first start bit", (int)message.Data[0], esp_timer_get_time() - midi_serial_edge_time);
+                }
+#endif
+            }
+
+#if CONFIG_MIDI_SERIAL_OUT_MERGE
+            if (!midi_parser_in_message(&midi_serial_parser))
+            {
+                midi_serial_add_pending();
+            }
+#endif
+        }
+
+#if MIDI_SERIAL_THRU
+        midi_serial_flush_output();
+#endif
+
+        length -= rx_length;
+    }
+
+#if CONFIG_MIDI_SERIAL_LATENCY_LOG
+    gpio_intr_enable(UART_RX_PIN);
+#endif
+}
 
 /****************************************************************************
 * NAME:        
@@ -68,7 +329,9 @@ static uint8_t midi_serial_channel = 0;
 *****************************************************************************/
 static void midi_serial_task(void *arg)
 {
-    int rx_length;
+    uart_event_t event;
+    TickType_t wait = portMAX_DELAY;
+    int tx_pin = UART_PIN_NO_CHANGE;
 
     ESP_LOGI(TAG, "Midi Serial task start");
 
@@ -83,76 +346,188 @@ static void midi_serial_task(void *arg)
     };
     
     int intr_alloc_flags = 0;
-    ESP_ERROR_CHECK(uart_driver_install(UART_PORT_NUM, MIDI_SERIAL_BUFFER_SIZE * 2, 0, 0, NULL, intr_alloc_flags));
+    ESP_ERROR_CHECK(uart_driver_install(UART_PORT_NUM, MIDI_SERIAL_BUFFER_SIZE * 2, 0, MIDI_SERIAL_EVENT_QUEUE_LENGTH, &midi_serial_uart_queue, intr_alloc_flags));
     ESP_ERROR_CHECK(uart_param_config(UART_PORT_NUM, &uart_config));
-    ESP_ERROR_CHECK(uart_set_pin(UART_PORT_NUM, UART_PIN_NO_CHANGE, UART_RX_PIN, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
+#if MIDI_SERIAL_OUT
+    tx_pin = UART_TX_PIN;
+#endif
+    ESP_ERROR_CHECK(uart_set_pin(UART_PORT_NUM, tx_pin, UART_RX_PIN, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
+
+    // the driver defaults wait for 120 bytes or 10 idle byte times before handing data
+    // over. Take each byte as it arrives instead, Midi is slow enough
+    ESP_ERROR_CHECK(uart_set_rx_full_threshold(UART_PORT_NUM, MIDI_SERIAL_RX_FULL_THRESHOLD));
+    ESP_ERROR_CHECK(uart_set_rx_timeout(UART_PORT_NUM, MIDI_SERIAL_RX_TIMEOUT));
+
+#if CONFIG_MIDI_SERIAL_LATENCY_LOG
+    esp_err_t res = gpio_install_isr_service(0);
+
+    // service may already be installed by another driver
+    if ((res == ESP_OK) || (res == ESP_ERR_INVALID_STATE))
+    {
+        // the pad stays with the UART, this only watches it
+        gpio_set_intr_type(UART_RX_PIN, GPIO_INTR_NEGEDGE);
+        gpio_isr_handler_add(UART_RX_PIN, midi_serial_edge_isr, NULL);
+        gpio_intr_enable(UART_RX_PIN);
+    }
+#endif
 
     while (1) 
     {
-        // try to read data from UART
-        rx_length = uart_read_bytes(UART_PORT_NUM, midi_serial_buffer, (MIDI_SERIAL_BUFFER_SIZE - 1), pdMS_TO_TICKS(20));
-        
-        if (rx_length != 0)
+        if (xQueueReceive(midi_serial_uart_queue, (void*)&event, wait) != pdTRUE)
         {
-            // ESP_LOG_BUFFER_HEXDUMP(TAG, data, rx_length, ESP_LOG_INFO);
-            ESP_LOGI(TAG, "Midi Serial Got %d bytes", rx_length);
+#if CONFIG_MIDI_SERIAL_OUT_MERGE
+            // Midi In stopped part way through a message. Send ours anyway, and drop
+            // the rest of it rather than let it follow our status byte
+            ESP_LOGW(TAG, "Midi Serial merge timeout");
+            midi_serial_thru_resync = 1;
+            midi_serial_add_pending();
+            midi_serial_flush_output();
+            wait = portMAX_DELAY;
+#endif
+            continue;
+        }
 
-            for (size_t i = 0; i < rx_length; i++)
+        switch (event.type)
+        {
+            case UART_DATA:
             {
-                // Skip real-time messages (status bytes 0xF8 to 0xFF)
-                if (midi_serial_buffer[i] >= 0xF8)
-                {
-                    continue;
-                }
+                midi_serial_handle_data(event.size);
+            } break;
 
-                // Check if this byte is a status byte for Program Change
-                if ((midi_serial_buffer[i] & 0xF0) == 0xC0)
-                {
-                    // Program Change status byte found
-                    uint8_t channel = midi_serial_buffer[i] & 0x0F;
-
-                    // Ensure there's a data byte following the status byte
-                    if ((i + 1) < MIDI_SERIAL_BUFFER_SIZE)
-                    {
-                        uint8_t programNumber = midi_serial_buffer[i + 1];
-
-                        if (channel == midi_serial_channel)
-                        {
-                            ESP_LOGI(TAG, "Change to preset %d", programNumber);
-
-                            // change to this preset
-                            control_request_preset_index(programNumber);
-                        }
-                        
-                        // Skip the data byte
-                        i++;
-                    }
-                    else
-                    {
-                        ESP_LOGW(TAG, "Warning: Incomplete Program Change message at end of buffer");
-                        break;
-                    }
-                }
-                else if (midi_serial_buffer[i] & 0x80)
+#if MIDI_SERIAL_OUT
+            case MIDI_SERIAL_EVENT_SEND:
+            {
+#if CONFIG_MIDI_SERIAL_OUT_MERGE
+                if (midi_parser_in_message(&midi_serial_parser))
                 {
-                    // This is a status byte for a different type of message
-                    // Skip this message by finding the next status byte or end of buffer
-                    while ((++i < MIDI_SERIAL_BUFFER_SIZE) && !(midi_serial_buffer[i] & 0x80))
-                    {
-                    }
-                    i--; // Decrement i because the for loop will increment it again
+                    // sent when the Midi In message is complete
+                    break;
                 }
-                
-                // If it's not a status byte, it's a data byte of a message we're not interested in
-                // The loop will automatically move to the next byte
-            }
+#endif
+                midi_serial_add_pending();
+                midi_serial_flush_output();
+            } break;
+#endif
+
+            case UART_FIFO_OVF:
+            case UART_BUFFER_FULL:
+            {
+                // bytes were lost, start again from the next status byte
+                ESP_LOGW(TAG, "Midi Serial overflow");
+                uart_flush_input(UART_PORT_NUM);
+                xQueueReset(midi_serial_uart_queue);
+                midi_parser_init(&midi_serial_parser);
+            } break;
 
-            // don't hog the CPU
-            vTaskDelay(pdMS_TO_TICKS(2));
+            case UART_FRAME_ERR:
+            case UART_PARITY_ERR:
+            {
+                ESP_LOGW(TAG, "Midi Serial receive error %d", (int)event.type);
+            } break;
+
+            default:
+            {
+            } break;
         }
+
+#if CONFIG_MIDI_SERIAL_OUT_MERGE
+        // our messages waiting on a Midi In message that may never finish
+        if ((uxQueueMessagesWaiting(midi_serial_out_queue) > 0) && midi_parser_in_message(&midi_serial_parser))
+        {
+            wait = pdMS_TO_TICKS(CONFIG_MIDI_SERIAL_MERGE_TIMEOUT_MS);
+        }
+        else
+        {
+            wait = portMAX_DELAY;
+        }
+#endif
     }
 }
 
+#if MIDI_SERIAL_ECHO
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Queue one of our own messages for Midi Out
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Only the Midi serial task writes to the UART, so our messages
+*              can't land in the middle of one being forwarded
+*****************************************************************************/
+static void midi_serial_send(uint8_t status, uint8_t data1, uint8_t data2)
+{
+    tMidiMessage message;
+    uart_event_t event;
+
+    message.Status = status;
+    message.Data[0] = data1;
+    message.Data[1] = data2;
+    message.Length = ((status & 0xF0) == MIDI_PROGRAM_CHANGE) || ((status & 0xF0) == MIDI_CHANNEL_PRESSURE) ? 2 : 3;
+
+    if ((midi_serial_out_queue == NULL) || (midi_serial_uart_queue == NULL))
+    {
+        // UART not started yet
+        return;
+    }
+
+    if (xQueueSend(midi_serial_out_queue, (void*)&message, 0) != pdPASS)
+    {
+        ESP_LOGW(TAG, "Midi Serial out queue full");
+        return;
+    }
+
+    memset((void*)&event, 0, sizeof(event));
+    event.type = MIDI_SERIAL_EVENT_SEND;
+    xQueueSend(midi_serial_uart_queue, (void*)&event, 0);
+}
+#endif
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Send a program change on Midi Out
+* PARAMETERS:  program: 0-based
+* RETURN:      
+* NOTES:       On the serial Midi channel. Does nothing unless Midi Out sends
+*              our own messages
+*****************************************************************************/
+void midi_serial_send_program(uint8_t program)
+{
+#if MIDI_SERIAL_ECHO
+    midi_serial_send(MIDI_PROGRAM_CHANGE | midi_serial_channel, program & 0x7F, 0);
+#else
+    ESP_LOGD(TAG, "Midi Out disabled, program change %d not sent", (int)program);
+#endif
+}
+
+#if MIDI_SERIAL_ECHO
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Send preset changes to Midi Out
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       As bank select and program change, the same way Midi In selects
+*              a preset
+*****************************************************************************/
+static void midi_serial_echo_task(void *arg)
+{
+    tEventBusMessage event;
+
+    while (1)
+    {
+        if (event_bus_receive(midi_serial_subscriber, &event, portMAX_DELAY))
+        {
+            uint32_t bank = event.Value / PRESETS_PER_BANK;
+            uint8_t program = event.Value % PRESETS_PER_BANK;
+
+            event_bus_release(&event);
+
+            midi_serial_send(MIDI_CONTROL_CHANGE | midi_serial_channel, 0, (bank >> 7) & 0x7F);
+            midi_serial_send(MIDI_CONTROL_CHANGE | midi_serial_channel, 32, bank & 0x7F);
+            midi_serial_send(MIDI_PROGRAM_CHANGE | midi_serial_channel, program, 0);
+        }
+    }
+}
+#endif
+
 /****************************************************************************
 * NAME:        
 * DESCRIPTION: 
@@ -163,6 +538,7 @@ static void midi_serial_task(void *arg)
 void midi_serial_init(void)
 {	
     memset((void*)midi_serial_buffer, 0, sizeof(midi_serial_buffer));
+    midi_parser_init(&midi_serial_parser);
 
     // get the channel to use
     midi_serial_channel = control_get_config_midi_channel();
@@ -173,5 +549,31 @@ void midi_serial_init(void)
         midi_serial_channel--;
     }
 
+#if MIDI_SERIAL_OUT
+    midi_serial_tx_length = 0;
+    midi_serial_tx_status = 0;
+    midi_serial_tx_program = MIDI_SERIAL_VALUE_UNKNOWN;
+    midi_serial_tx_bank_msb = MIDI_SERIAL_VALUE_UNKNOWN;
+    midi_serial_tx_bank_lsb = MIDI_SERIAL_VALUE_UNKNOWN;
+
+    midi_serial_out_queue = xQueueCreate(MIDI_SERIAL_OUT_QUEUE_LENGTH, sizeof(tMidiMessage));
+    if (midi_serial_out_queue == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to create Midi Serial out queue!");
+    }
+#endif
+
     xTaskCreatePinnedToCore(midi_serial_task, "MIDIS", MIDI_SERIAL_TASK_STACK_SIZE, NULL, MIDI_SERIAL_TASK_PRIORITY, NULL, 1);
+
+#if MIDI_SERIAL_ECHO
+    midi_serial_subscriber = event_bus_subscribe("midi_serial", EVENT_BUS_TOPIC_MASK(EVENT_BUS_TOPIC_PRESET_CHANGED), 4);
+    if (midi_serial_subscriber != EVENT_BUS_SUBSCRIBER_INVALID)
+    {
+        xTaskCreatePinnedToCore(midi_serial_echo_task, "MIDIO", MIDI_SERIAL_ECHO_TASK_STACK_SIZE, NULL, MIDI_SERIAL_TASK_PRIORITY, NULL, 1);
+    }
+    else
+    {
+        ESP_LOGE(TAG, "Midi Serial echo subscribe failed");
+    }
+#endif
 }
@@ -23,6 +23,7 @@ extern "C" {
 #endif
 
 void midi_serial_init(void);
+void midi_serial_send_program(uint8_t program);
 
 #ifdef __cplusplus
 } /*extern "C"*/
@@ -0,0 +1,143 @@
+/*
+ Copyright (C) 2024  Greg Smith
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+ 
+*/
+
+
+#include <stdio.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_vfs_fat.h"
+#include "sdmmc_cmd.h"
+#include "driver/i2c.h"
+#include "main.h"
+#include "CH422G.h"
+#include "sd_card.h"
+#include "i2c_bus.h"
+
+#if CONFIG_TONEX_CONTROLLER_DISPLAY_WAVESHARE_800_480
+
+// Pin assignments for SD Card
+#define PIN_NUM_MISO        13
+#define PIN_NUM_MOSI        11
+#define PIN_NUM_CLK         12
+#define PIN_NUM_CS          -1          // on the IO expander
+
+#define SD_CARD_LOCK_TIMEOUT_MS             500
+
+static const char *TAG = "app_sd_card";
+static sdmmc_card_t* Card = NULL;
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      1 if locked
+* NOTES:       
+*****************************************************************************/
+uint8_t sd_card_lock(void)
+{
+    if (Card == NULL)
+    {
+        return 0;
+    }
+
+    return i2c_bus_lock(SD_CARD_LOCK_TIMEOUT_MS);
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void sd_card_unlock(void)
+{
+    i2c_bus_unlock();
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Mount the SD card
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       The card stays mounted and selected. Nothing else shares the SPI bus
+*****************************************************************************/
+esp_err_t sd_card_init(void)
+{
+    esp_err_t ret;
+
+    // Set CS pin low
+    CH422G_write_direction(SD_CS, IO_EXPANDER_OUTPUT);
+    CH422G_write_output(SD_CS, 0);
+
+    esp_vfs_fat_sdmmc_mount_config_t mount_config = {
+        .format_if_mount_failed = false,
+        .max_files = 5,
+        .allocation_unit_size = 16 * 1024
+    };
+
+    ESP_LOGI(TAG, "Initializing SD card");
+    sdmmc_host_t host = SDSPI_HOST_DEFAULT();
+
+    spi_bus_config_t bus_cfg = {
+        .mosi_io_num = PIN_NUM_MOSI,
+        .miso_io_num = PIN_NUM_MISO,
+        .sclk_io_num = PIN_NUM_CLK,
+        .quadwp_io_num = -1,
+        .quadhd_io_num = -1,
+        .max_transfer_sz = 4000,
+    };
+    
+    ret = spi_bus_initialize(host.slot, &bus_cfg, SDSPI_DEFAULT_DMA);
+    if (ret != ESP_OK) 
+    {
+        ESP_LOGE(TAG, "Failed to initialize SPI bus %s", esp_err_to_name(ret));
+        return ret;
+    }
+    
+    // This initializes the slot without card detect (CD) and write protect (WP) signals.
+    sdspi_device_config_t slot_config = SDSPI_DEVICE_CONFIG_DEFAULT();
+    slot_config.gpio_cs = PIN_NUM_CS;
+    slot_config.host_id = host.slot;
+
+    ret = esp_vfs_fat_sdspi_mount(SD_MOUNT_POINT, &host, &slot_config, &mount_config, &Card);
+
+    if (ret != ESP_OK) 
+    {      
+        ESP_LOGI(TAG, "Failed to init SD card %s", esp_err_to_name(ret));
+        Card = NULL;
+
+        // deselect CS
+        CH422G_write_output(SD_CS, 1);
+        spi_bus_free(host.slot);
+        return ret;
+    }
+    
+    ESP_LOGI(TAG, "SD Card mounted");
+
+    // Card has been initialized, print its properties
+    sdmmc_card_print_info(stdout, Card);
+
+    return ESP_OK;
+}
+
+#endif  //CONFIG_TONEX_CONTROLLER_DISPLAY_WAVESHARE_800_480
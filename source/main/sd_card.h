@@ -0,0 +1,39 @@
+/*
+ Copyright (C) 2024  Greg Smith
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+ 
+*/
+
+
+#ifndef _SD_CARD_H
+#define _SD_CARD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SD_MOUNT_POINT                      "/sdcard"
+
+esp_err_t sd_card_init(void);
+
+// SD chip select is on the IO expander, which drops all its outputs while reading
+// inputs. Hold the I2C bus around SD transfers so that can't happen part way through
+uint8_t sd_card_lock(void);
+void sd_card_unlock(void);
+
+#ifdef __cplusplus
+} /*extern "C"*/
+#endif
+
+#endif
@@ -0,0 +1,993 @@
+/*
+ Copyright (C) 2024  Greg Smith
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+ 
+*/
+
+
+#include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "sys/param.h"
+#include "lvgl.h"
+#include "task_priorities.h"
+#include "control.h"
+#include "sd_card.h"
+#include "skin_store.h"
+
+#if CONFIG_TONEX_CONTROLLER_SKINS_COMPRESSED || CONFIG_TONEX_CONTROLLER_SKINS_SD_CARD
+
+#if CONFIG_TONEX_CONTROLLER_SKINS_COMPRESSED
+// bundle built by tools/skin_pack.py, see there for the layout
+#define SKIN_BUNDLE_MAGIC               "SKN1"
+#define SKIN_BUNDLE_HEADER_SIZE         8
+#define SKIN_BUNDLE_ENTRY_SIZE          16
+#define SKIN_RLE_RUN_FLAG               0x80
+#endif
+
+#if CONFIG_TONEX_CONTROLLER_SKINS_SD_CARD
+// manifest lists one skin per line, "name,file". Line order is the skin index.
+// Files are LVGL binary images, a 4 byte lv_img_header_t then the pixels
+#define SKIN_SD_DIRECTORY               SD_MOUNT_POINT "/skins"
+#define SKIN_SD_MANIFEST                SKIN_SD_DIRECTORY "/manifest.txt"
+#define SKIN_SD_FILE_LENGTH             16          // 8.3 names
+#define SKIN_SD_READ_CHUNK              (8 * 1024)
+#endif
+
+// decoded skins are kept in PSRAM, least recently used is evicted when over budget
+#define SKIN_CACHE_MAX_ENTRIES          16
+#define SKIN_CACHE_BUDGET               (CONFIG_TONEX_CONTROLLER_SKIN_CACHE_KB * 1024)
+
+// the skins most recently requested by the display are never evicted. These are
+// the one on screen and the staged one
+#define SKIN_CACHE_PROTECTED            2
+
+#define SKIN_PREFETCH_QUEUE_SIZE        4
+#define SKIN_PREFETCH_TASK_STACK_SIZE   (3 * 1024)
+
+enum SkinCacheStates
+{
+    SKIN_CACHE_FREE,
+    SKIN_CACHE_LOADING,
+    SKIN_CACHE_READY
+};
+
+typedef struct
+{
+    uint16_t Width;
+    uint16_t Height;
+    uint8_t ColourFormat;
+    uint32_t RawSize;
+} tSkinInfo;
+
+typedef struct
+{
+    uint8_t State;
+    uint16_t Index;
+    uint32_t LastUsed;
+    uint32_t Size;
+    uint8_t* Data;
+    lv_img_dsc_t Image;
+} tSkinCacheEntry;
+
+#if CONFIG_TONEX_CONTROLLER_SKINS_COMPRESSED
+typedef struct
+{
+    uint16_t Width;
+    uint16_t Height;
+    uint32_t Offset;
+    uint32_t PackedSize;
+    uint32_t RawSize;
+} tSkinEntry;
+#endif
+
+#if CONFIG_TONEX_CONTROLLER_SKINS_SD_CARD
+typedef struct
+{
+    char Name[SKIN_NAME_LENGTH];
+    char File[SKIN_SD_FILE_LENGTH];
+} tSkinFile;
+#endif
+
+static const char *TAG = "app_skin_store";
+
+#if CONFIG_TONEX_CONTROLLER_SKINS_COMPRESSED
+extern const uint8_t skins_bin_start[] asm("_binary_skins_bin_start");
+extern const uint8_t skins_bin_end[] asm("_binary_skins_bin_end");
+
+static uint16_t BundleBytesPerPixel = 0;
+static uint8_t BundleColourFormat = LV_IMG_CF_TRUE_COLOR_ALPHA;
+static uint32_t MaxRawSize = 0;
+#endif
+
+#if CONFIG_TONEX_CONTROLLER_SKINS_SD_CARD
+static tSkinFile* SkinFiles = NULL;
+#endif
+
+static uint16_t SkinCount = 0;
+static tSkinCacheEntry SkinCache[SKIN_CACHE_MAX_ENTRIES];
+static uint32_t CacheBudget = 0;
+static uint32_t CacheUsed = 0;
+static uint32_t CacheClock = 0;
+static int32_t RecentIndex[SKIN_CACHE_PROTECTED];
+static tSkinStoreStats Stats;
+static SemaphoreHandle_t CacheMutex = NULL;
+static QueueHandle_t PrefetchQueue = NULL;
+
+#if CONFIG_TONEX_CONTROLLER_SKINS_COMPRESSED
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static void skin_store_read_entry(uint16_t index, tSkinEntry* entry)
+{
+    const uint8_t* ptr = skins_bin_start + SKIN_BUNDLE_HEADER_SIZE + (index * SKIN_BUNDLE_ENTRY_SIZE);
+
+    entry->Width = ptr[0] | (ptr[1] << 8);
+    entry->Height = ptr[2] | (ptr[3] << 8);
+    entry->Offset = ptr[4] | (ptr[5] << 8) | (ptr[6] << 16) | ((uint32_t)ptr[7] << 24);
+    entry->PackedSize = ptr[8] | (ptr[9] << 8) | (ptr[10] << 16) | ((uint32_t)ptr[11] << 24);
+    entry->RawSize = ptr[12] | (ptr[13] << 8) | (ptr[14] << 16) | ((uint32_t)ptr[15] << 24);
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Inflate one RLE stream
+* PARAMETERS:  
+* RETURN:      bytes written
+* NOTES:       
+*****************************************************************************/
+static uint32_t skin_store_decode(const uint8_t* src, uint32_t src_size, uint8_t* dest, uint32_t dest_size)
+{
+    const uint8_t* src_end = src + src_size;
+    uint8_t* dest_start = dest;
+    uint8_t* dest_end = dest + dest_size;
+
+    while (src < src_end)
+    {
+        uint8_t control = *src++;
+
+        if (control & SKIN_RLE_RUN_FLAG)
+        {
+            // run of one pixel
+            uint32_t count = (control - SKIN_RLE_RUN_FLAG) + 2;
+
+            if (((src + BundleBytesPerPixel) > src_end) || ((dest + (count * BundleBytesPerPixel)) > dest_end))
+            {
+                break;
+            }
+
+            for (uint32_t loop = 0; loop < count; loop++)
+            {
+                memcpy(dest, src, BundleBytesPerPixel);
+                dest += BundleBytesPerPixel;
+            }
+
+            src += BundleBytesPerPixel;
+        }
+        else
+        {
+            // literal pixels
+            uint32_t length = (control + 1) * BundleBytesPerPixel;
+
+            if (((src + length) > src_end) || ((dest + length) > dest_end))
+            {
+                break;
+            }
+
+            memcpy(dest, src, length);
+            src += length;
+            dest += length;
+        }
+    }
+
+    return dest - dest_start;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Read the bundle header
+* PARAMETERS:  
+* RETURN:      1 if valid
+* NOTES:       
+*****************************************************************************/
+static uint8_t skin_source_init(void)
+{
+    tSkinEntry entry;
+    uint8_t* buffer;
+    int64_t start_time;
+    int64_t read_time;
+
+    if (((skins_bin_end - skins_bin_start) < SKIN_BUNDLE_HEADER_SIZE) || (memcmp(skins_bin_start, SKIN_BUNDLE_MAGIC, 4) != 0))
+    {
+        ESP_LOGE(TAG, "Skin bundle invalid");
+        return 0;
+    }
+
+    SkinCount = skins_bin_start[4] | (skins_bin_start[5] << 8);
+    BundleBytesPerPixel = skins_bin_start[6] | (skins_bin_start[7] << 8);
+
+    if (BundleBytesPerPixel == LV_IMG_PX_SIZE_ALPHA_BYTE)
+    {
+        BundleColourFormat = LV_IMG_CF_TRUE_COLOR_ALPHA;
+    }
+    else if (BundleBytesPerPixel == sizeof(lv_color_t))
+    {
+        // pre-blended against the screen background, drawn without blending
+        BundleColourFormat = LV_IMG_CF_TRUE_COLOR;
+    }
+    else
+    {
+        ESP_LOGE(TAG, "Skin bundle pixel size %d not supported", (int)BundleBytesPerPixel);
+        SkinCount = 0;
+        return 0;
+    }
+
+    for (uint16_t loop = 0; loop < SkinCount; loop++)
+    {
+        skin_store_read_entry(loop, &entry);
+        MaxRawSize = MAX(MaxRawSize, entry.RawSize);
+    }
+
+    // needs room for the protected skins plus the one being decoded
+    if (CacheBudget < ((SKIN_CACHE_PROTECTED + 1) * MaxRawSize))
+    {
+        CacheBudget = (SKIN_CACHE_PROTECTED + 1) * MaxRawSize;
+        ESP_LOGW(TAG, "Skin cache budget too small, using %d bytes", (int)CacheBudget);
+    }
+
+    ESP_LOGI(TAG, "Skin bundle: %d skins, %d bytes", (int)SkinCount, (int)(skins_bin_end - skins_bin_start));
+
+    // benchmark once, time to copy an uncompressed skin's worth of bytes out of flash.
+    // Compare with the load times logged per skin
+    buffer = heap_caps_malloc(MaxRawSize, MALLOC_CAP_SPIRAM);
+    if (buffer != NULL)
+    {
+        start_time = esp_timer_get_time();
+        memcpy((void*)buffer, (void*)skins_bin_start, MIN(MaxRawSize, (uint32_t)(skins_bin_end - skins_bin_start)));
+        read_time = esp_timer_get_time() - start_time;
+        heap_caps_free(buffer);
+
+        ESP_LOGI(TAG, "Skin flash copy of %d bytes: %d us", (int)MaxRawSize, (int)read_time);
+    }
+
+    return 1;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      1 if valid
+* NOTES:       
+*****************************************************************************/
+static uint8_t skin_source_get_info(uint16_t index, tSkinInfo* info)
+{
+    tSkinEntry entry;
+
+    skin_store_read_entry(index, &entry);
+
+    if ((entry.RawSize > MaxRawSize) || ((skins_bin_start + entry.Offset + entry.PackedSize) > skins_bin_end))
+    {
+        ESP_LOGE(TAG, "Skin %d entry invalid", (int)index);
+        return 0;
+    }
+
+    info->Width = entry.Width;
+    info->Height = entry.Height;
+    info->ColourFormat = BundleColourFormat;
+    info->RawSize = entry.RawSize;
+
+    return 1;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Decode a skin from the bundle
+* PARAMETERS:  
+* RETURN:      1 on success
+* NOTES:       
+*****************************************************************************/
+static uint8_t skin_source_read(uint16_t index, uint8_t* dest, uint32_t size)
+{
+    tSkinEntry entry;
+
+    skin_store_read_entry(index, &entry);
+
+    return skin_store_decode(skins_bin_start + entry.Offset, entry.PackedSize, dest, size) == size;
+}
+#endif  //CONFIG_TONEX_CONTROLLER_SKINS_COMPRESSED
+
+#if CONFIG_TONEX_CONTROLLER_SKINS_SD_CARD
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static char* skin_source_trim(char* text)
+{
+    char* end;
+
+    while (isspace((int)*text))
+    {
+        text++;
+    }
+
+    end = text + strlen(text);
+    while ((end > text) && isspace((int)*(end - 1)))
+    {
+        end--;
+    }
+    *end = 0;
+
+    return text;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Read the manifest from the SD card
+* PARAMETERS:  
+* RETURN:      1 if at least one skin listed
+* NOTES:       Only the manifest is read here, images are read on first use
+*****************************************************************************/
+static uint8_t skin_source_init(void)
+{
+    FILE* file;
+    char line[SKIN_NAME_LENGTH + SKIN_SD_FILE_LENGTH + 8];
+
+    SkinFiles = heap_caps_calloc(MAX_SD_SKINS, sizeof(tSkinFile), MALLOC_CAP_SPIRAM);
+    if (SkinFiles == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to allocate skin list");
+        return 0;
+    }
+
+    if (!sd_card_lock())
+    {
+        ESP_LOGE(TAG, "SD card not available");
+        return 0;
+    }
+
+    file = fopen(SKIN_SD_MANIFEST, "r");
+    if (file != NULL)
+    {
+        while ((SkinCount < MAX_SD_SKINS) && (fgets(line, sizeof(line), file) != NULL))
+        {
+            char* name;
+            char* file_name;
+            char* save_ptr = NULL;
+
+            name = strtok_r(line, ",", &save_ptr);
+            file_name = strtok_r(NULL, ",", &save_ptr);
+
+            if ((name == NULL) || (file_name == NULL) || (line[0] == '#'))
+            {
+                // blank, comment or malformed
+                continue;
+            }
+
+            name = skin_source_trim(name);
+            file_name = skin_source_trim(file_name);
+
+            strncpy(SkinFiles[SkinCount].Name, name, SKIN_NAME_LENGTH - 1);
+            strncpy(SkinFiles[SkinCount].File, file_name, SKIN_SD_FILE_LENGTH - 1);
+            SkinCount++;
+        }
+
+        fclose(file);
+    }
+
+    sd_card_unlock();
+
+    if (file == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to open %s", SKIN_SD_MANIFEST);
+        return 0;
+    }
+
+    ESP_LOGI(TAG, "SD card skins: %d listed", (int)SkinCount);
+
+    return SkinCount > 0;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Read the image header of a skin
+* PARAMETERS:  
+* RETURN:      1 if valid
+* NOTES:       
+*****************************************************************************/
+static uint8_t skin_source_get_info(uint16_t index, tSkinInfo* info)
+{
+    char path[sizeof(SKIN_SD_DIRECTORY) + SKIN_SD_FILE_LENGTH + 1];
+    FILE* file;
+    uint8_t header[sizeof(lv_img_header_t)];
+    uint32_t header_value;
+    uint8_t bytes_per_pixel;
+    size_t length = 0;
+
+    snprintf(path, sizeof(path), "%s/%s", SKIN_SD_DIRECTORY, SkinFiles[index].File);
+
+    if (!sd_card_lock())
+    {
+        return 0;
+    }
+
+    file = fopen(path, "rb");
+    if (file != NULL)
+    {
+        length = fread((void*)header, 1, sizeof(header), file);
+        fclose(file);
+    }
+
+    sd_card_unlock();
+
+    if (length != sizeof(header))
+    {
+        ESP_LOGE(TAG, "Failed to read %s", path);
+        return 0;
+    }
+
+    // lv_img_header_t: cf 5 bits, always zero 3, reserved 2, width 11, height 11
+    header_value = header[0] | (header[1] << 8) | (header[2] << 16) | ((uint32_t)header[3] << 24);
+    info->ColourFormat = header_value & 0x1F;
+    info->Width = (header_value >> 10) & 0x7FF;
+    info->Height = (header_value >> 21) & 0x7FF;
+
+    if (info->ColourFormat == LV_IMG_CF_TRUE_COLOR_ALPHA)
+    {
+        bytes_per_pixel = LV_IMG_PX_SIZE_ALPHA_BYTE;
+    }
+    else if (info->ColourFormat == LV_IMG_CF_TRUE_COLOR)
+    {
+        bytes_per_pixel = sizeof(lv_color_t);
+    }
+    else
+    {
+        ESP_LOGE(TAG, "%s colour format %d not supported", path, (int)info->ColourFormat);
+        return 0;
+    }
+
+    info->RawSize = (uint32_t)info->Width * info->Height * bytes_per_pixel;
+
+    if ((info->RawSize == 0) || (info->RawSize > CacheBudget))
+    {
+        ESP_LOGE(TAG, "%s size invalid", path);
+        return 0;
+    }
+
+    return 1;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Stream a skin from the SD card
+* PARAMETERS:  
+* RETURN:      1 on success
+* NOTES:       Read in chunks so other users of the I2C bus aren't held up
+*****************************************************************************/
+static uint8_t skin_source_read(uint16_t index, uint8_t* dest, uint32_t size)
+{
+    char path[sizeof(SKIN_SD_DIRECTORY) + SKIN_SD_FILE_LENGTH + 1];
+    FILE* file = NULL;
+    uint32_t total = 0;
+
+    snprintf(path, sizeof(path), "%s/%s", SKIN_SD_DIRECTORY, SkinFiles[index].File);
+
+    if (!sd_card_lock())
+    {
+        return 0;
+    }
+
+    file = fopen(path, "rb");
+    if ((file != NULL) && (fseek(file, sizeof(lv_img_header_t), SEEK_SET) != 0))
+    {
+        fclose(file);
+        file = NULL;
+    }
+
+    sd_card_unlock();
+
+    if (file == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to open %s", path);
+        return 0;
+    }
+
+    // the card is only guaranteed selected while locked. Each chunk is a complete
+    // set of transfers, so the chip select can change between them
+    while (total < size)
+    {
+        uint32_t chunk = MIN(size - total, SKIN_SD_READ_CHUNK);
+        size_t length;
+
+        if (!sd_card_lock())
+        {
+            break;
+        }
+
+        length = fread((void*)(dest + total), 1, chunk, file);
+
+        sd_card_unlock();
+
+        if (length != chunk)
+        {
+            break;
+        }
+
+        total += chunk;
+    }
+
+    if (sd_card_lock())
+    {
+        fclose(file);
+        sd_card_unlock();
+    }
+
+    if (total != size)
+    {
+        ESP_LOGE(TAG, "Failed to read %s", path);
+        return 0;
+    }
+
+    return 1;
+}
+#endif  //CONFIG_TONEX_CONTROLLER_SKINS_SD_CARD
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Must be called with the cache mutex held
+*****************************************************************************/
+static tSkinCacheEntry* skin_store_find(uint16_t index)
+{
+    for (uint8_t loop = 0; loop < SKIN_CACHE_MAX_ENTRIES; loop++)
+    {
+        if ((SkinCache[loop].State != SKIN_CACHE_FREE) && (SkinCache[loop].Index == index))
+        {
+            return &SkinCache[loop];
+        }
+    }
+
+    return NULL;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Free the least recently used skin that isn't protected
+* PARAMETERS:  
+* RETURN:      1 if one was freed
+* NOTES:       Must be called with the cache mutex held
+*****************************************************************************/
+static uint8_t skin_store_evict(void)
+{
+    tSkinCacheEntry* oldest = NULL;
+
+    for (uint8_t loop = 0; loop < SKIN_CACHE_MAX_ENTRIES; loop++)
+    {
+        tSkinCacheEntry* entry = &SkinCache[loop];
+        uint8_t is_protected = 0;
+
+        if (entry->State != SKIN_CACHE_READY)
+        {
+            continue;
+        }
+
+        for (uint8_t recent = 0; recent < SKIN_CACHE_PROTECTED; recent++)
+        {
+            if (RecentIndex[recent] == entry->Index)
+            {
+                is_protected = 1;
+            }
+        }
+
+        if (!is_protected && ((oldest == NULL) || (entry->LastUsed < oldest->LastUsed)))
+        {
+            oldest = entry;
+        }
+    }
+
+    if (oldest == NULL)
+    {
+        return 0;
+    }
+
+    heap_caps_free(oldest->Data);
+    CacheUsed -= oldest->Size;
+    memset((void*)oldest, 0, sizeof(tSkinCacheEntry));
+    Stats.Evictions++;
+
+    return 1;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Claim a cache entry and its buffer, evicting as needed
+* PARAMETERS:  
+* RETURN:      entry in loading state, or NULL
+* NOTES:       Must be called with the cache mutex held
+*****************************************************************************/
+static tSkinCacheEntry* skin_store_reserve(uint16_t index, uint32_t size)
+{
+    tSkinCacheEntry* result = NULL;
+
+    while ((CacheUsed + size) > CacheBudget)
+    {
+        if (!skin_store_evict())
+        {
+            return NULL;
+        }
+    }
+
+    for (uint8_t loop = 0; loop < SKIN_CACHE_MAX_ENTRIES; loop++)
+    {
+        if (SkinCache[loop].State == SKIN_CACHE_FREE)
+        {
+            result = &SkinCache[loop];
+            break;
+        }
+    }
+
+    if ((result == NULL) && skin_store_evict())
+    {
+        // all entries in use, the evicted one is free now
+        for (uint8_t loop = 0; loop < SKIN_CACHE_MAX_ENTRIES; loop++)
+        {
+            if (SkinCache[loop].State == SKIN_CACHE_FREE)
+            {
+                result = &SkinCache[loop];
+                break;
+            }
+        }
+    }
+
+    if (result == NULL)
+    {
+        return NULL;
+    }
+
+    result->Data = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    if (result->Data == NULL)
+    {
+        return NULL;
+    }
+
+    result->State = SKIN_CACHE_LOADING;
+    result->Index = index;
+    result->Size = size;
+    result->LastUsed = ++CacheClock;
+    CacheUsed += size;
+
+    return result;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Give back an entry that failed to load
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Must be called with the cache mutex held
+*****************************************************************************/
+static void skin_store_release(tSkinCacheEntry* entry)
+{
+    heap_caps_free(entry->Data);
+    CacheUsed -= entry->Size;
+    memset((void*)entry, 0, sizeof(tSkinCacheEntry));
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Load a skin into the cache
+* PARAMETERS:  
+* RETURN:      ready entry, or NULL on failure
+* NOTES:       Waits if the other task is already loading the same skin
+*****************************************************************************/
+static tSkinCacheEntry* skin_store_load(uint16_t index)
+{
+    tSkinInfo info;
+    tSkinCacheEntry* cache_entry;
+    uint8_t have_info = 0;
+    int64_t start_time;
+    uint32_t load_time;
+
+    while (1)
+    {
+        xSemaphoreTake(CacheMutex, portMAX_DELAY);
+
+        cache_entry = skin_store_find(index);
+        if ((cache_entry != NULL) && (cache_entry->State == SKIN_CACHE_READY))
+        {
+            xSemaphoreGive(CacheMutex);
+            return cache_entry;
+        }
+        else if ((cache_entry == NULL) && have_info)
+        {
+            cache_entry = skin_store_reserve(index, info.RawSize);
+            xSemaphoreGive(CacheMutex);
+            break;
+        }
+
+        xSemaphoreGive(CacheMutex);
+
+        if (cache_entry == NULL)
+        {
+            // size isn't known until the source has been asked
+            if (!skin_source_get_info(index, &info))
+            {
+                return NULL;
+            }
+
+            have_info = 1;
+        }
+        else
+        {
+            // being loaded by the other task
+            vTaskDelay(1);
+        }
+    }
+
+    if (cache_entry == NULL)
+    {
+        ESP_LOGE(TAG, "No cache space for skin %d", (int)index);
+        return NULL;
+    }
+
+    start_time = esp_timer_get_time();
+
+    if (!skin_source_read(index, cache_entry->Data, info.RawSize))
+    {
+        xSemaphoreTake(CacheMutex, portMAX_DELAY);
+        skin_store_release(cache_entry);
+        xSemaphoreGive(CacheMutex);
+        return NULL;
+    }
+
+    load_time = (uint32_t)(esp_timer_get_time() - start_time);
+
+    ESP_LOGI(TAG, "Skin %d loaded, %d bytes in %d us", (int)index, (int)info.RawSize, (int)load_time);
+
+    xSemaphoreTake(CacheMutex, portMAX_DELAY);
+
+    memset((void*)&cache_entry->Image, 0, sizeof(cache_entry->Image));
+    cache_entry->Image.header.always_zero = 0;
+    cache_entry->Image.header.w = info.Width;
+    cache_entry->Image.header.h = info.Height;
+    cache_entry->Image.header.cf = info.ColourFormat;
+    cache_entry->Image.data_size = info.RawSize;
+    cache_entry->Image.data = cache_entry->Data;
+    cache_entry->State = SKIN_CACHE_READY;
+
+    Stats.Decodes++;
+    Stats.LastDecodeTime = load_time;
+    Stats.MaxDecodeTime = MAX(Stats.MaxDecodeTime, load_time);
+    Stats.TotalDecodeTime += load_time;
+
+    xSemaphoreGive(CacheMutex);
+
+    return cache_entry;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Loads skins requested by skin_store_prefetch() in the background
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static void skin_store_prefetch_task(void *arg)
+{
+    uint16_t index;
+    tSkinCacheEntry* entry;
+
+    while (1)
+    {
+        if (xQueueReceive(PrefetchQueue, (void*)&index, portMAX_DELAY) == pdPASS)
+        {
+            xSemaphoreTake(CacheMutex, portMAX_DELAY);
+            entry = skin_store_find(index);
+            xSemaphoreGive(CacheMutex);
+
+            if (entry == NULL)
+            {
+                if (skin_store_load(index) != NULL)
+                {
+                    xSemaphoreTake(CacheMutex, portMAX_DELAY);
+                    Stats.Prefetches++;
+                    xSemaphoreGive(CacheMutex);
+                }
+            }
+        }
+    }
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+uint16_t skin_store_get_count(void)
+{
+    return SkinCount;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      skin name, or NULL if not known
+* NOTES:       Names only come from the SD card manifest
+*****************************************************************************/
+const char* skin_store_get_name(uint16_t index)
+{
+#if CONFIG_TONEX_CONTROLLER_SKINS_SD_CARD
+    if (index < SkinCount)
+    {
+        return SkinFiles[index].Name;
+    }
+#endif
+
+    return NULL;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Get a skin, loading it into PSRAM if needed
+* PARAMETERS:  
+* RETURN:      image, or NULL if not available
+* NOTES:       
+*****************************************************************************/
+const lv_img_dsc_t* skin_store_get(uint16_t index)
+{
+    tSkinCacheEntry* entry;
+
+    if ((index >= SkinCount) || (CacheMutex == NULL))
+    {
+        return NULL;
+    }
+
+    xSemaphoreTake(CacheMutex, portMAX_DELAY);
+
+    // protect this one from eviction while it's in use
+    if (RecentIndex[0] != index)
+    {
+        memmove((void*)&RecentIndex[1], (void*)&RecentIndex[0], (SKIN_CACHE_PROTECTED - 1) * sizeof(RecentIndex[0]));
+        RecentIndex[0] = index;
+    }
+
+    entry = skin_store_find(index);
+    if ((entry != NULL) && (entry->State == SKIN_CACHE_READY))
+    {
+        Stats.Hits++;
+    }
+    else
+    {
+        Stats.Misses++;
+    }
+
+    xSemaphoreGive(CacheMutex);
+
+    entry = skin_store_load(index);
+    if (entry == NULL)
+    {
+        return NULL;
+    }
+
+    xSemaphoreTake(CacheMutex, portMAX_DELAY);
+    entry->LastUsed = ++CacheClock;
+    xSemaphoreGive(CacheMutex);
+
+    return &entry->Image;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Queue a skin to be loaded in the background
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Thread-safe, never waits. Skins already cached are ignored
+*****************************************************************************/
+void skin_store_prefetch(uint16_t index)
+{
+    if ((index >= SkinCount) || (PrefetchQueue == NULL))
+    {
+        return;
+    }
+
+    xQueueSend(PrefetchQueue, (void*)&index, 0);
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void skin_store_get_stats(tSkinStoreStats* stats)
+{
+    if (CacheMutex == NULL)
+    {
+        memset((void*)stats, 0, sizeof(tSkinStoreStats));
+        return;
+    }
+
+    xSemaphoreTake(CacheMutex, portMAX_DELAY);
+    memcpy((void*)stats, (void*)&Stats, sizeof(tSkinStoreStats));
+    stats->CacheUsed = CacheUsed;
+    stats->CacheBudget = CacheBudget;
+    xSemaphoreGive(CacheMutex);
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Only reads the skin index, skins are loaded on first use
+*****************************************************************************/
+void skin_store_init(void)
+{
+    memset((void*)SkinCache, 0, sizeof(SkinCache));
+    memset((void*)&Stats, 0, sizeof(Stats));
+
+    for (uint8_t loop = 0; loop < SKIN_CACHE_PROTECTED; loop++)
+    {
+        RecentIndex[loop] = -1;
+    }
+
+    CacheBudget = SKIN_CACHE_BUDGET;
+
+    if (!skin_source_init())
+    {
+        SkinCount = 0;
+        return;
+    }
+
+    CacheMutex = xSemaphoreCreateMutex();
+    PrefetchQueue = xQueueCreate(SKIN_PREFETCH_QUEUE_SIZE, sizeof(uint16_t));
+
+    if ((CacheMutex == NULL) || (PrefetchQueue == NULL))
+    {
+        ESP_LOGE(TAG, "Failed to create skin cache");
+        SkinCount = 0;
+        return;
+    }
+
+    // load on the other core to the display
+    xTaskCreatePinnedToCore(skin_store_prefetch_task, "SKIN", SKIN_PREFETCH_TASK_STACK_SIZE, NULL, SKIN_PREFETCH_TASK_PRIORITY, NULL, 0);
+
+    ESP_LOGI(TAG, "Skin cache %d bytes", (int)CacheBudget);
+}
+
+#endif  //CONFIG_TONEX_CONTROLLER_SKINS_COMPRESSED || CONFIG_TONEX_CONTROLLER_SKINS_SD_CARD
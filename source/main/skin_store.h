@@ -0,0 +1,55 @@
+/*
+ Copyright (C) 2024  Greg Smith
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+ 
+*/
+
+
+#ifndef _SKIN_STORE_H
+#define _SKIN_STORE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SKIN_NAME_LENGTH                    24
+
+typedef struct
+{
+    uint32_t Hits;
+    uint32_t Misses;
+    uint32_t Prefetches;                // skins loaded in the background
+    uint32_t Evictions;
+    uint32_t Decodes;                   // decoded from the bundle or read from SD card
+    uint32_t LastDecodeTime;            // usec
+    uint32_t MaxDecodeTime;             // usec
+    uint64_t TotalDecodeTime;           // usec
+    uint32_t CacheUsed;                 // bytes
+    uint32_t CacheBudget;               // bytes
+} tSkinStoreStats;
+
+void skin_store_init(void);
+uint16_t skin_store_get_count(void);
+const char* skin_store_get_name(uint16_t index);
+
+// display task only. Returned image stays valid until two other skins have been requested
+const lv_img_dsc_t* skin_store_get(uint16_t index);
+void skin_store_prefetch(uint16_t index);
+void skin_store_get_stats(tSkinStoreStats* stats);
+
+#ifdef __cplusplus
+} /*extern "C"*/
+#endif
+
+#endif
@@ -26,10 +26,13 @@ extern "C" {
 #define USB_DAEMON_TASK_PRIORITY        (tskIDLE_PRIORITY + 4)
 #define USB_CLASS_TASK_PRIORITY         (tskIDLE_PRIORITY + 4)
 #define DISPLAY_TASK_PRIORITY           (tskIDLE_PRIORITY + 2)
+#define DISPLAY_FLUSH_TASK_PRIORITY     (tskIDLE_PRIORITY + 3)
 #define CTRL_TASK_PRIORITY              (tskIDLE_PRIORITY + 3)
+#define I2C_BUS_TASK_PRIORITY           (tskIDLE_PRIORITY + 3)
 #define MIDI_SERIAL_TASK_PRIORITY       (tskIDLE_PRIORITY + 2)
-#define FOOTSWITCH_TASK_PRIORITY        (tskIDLE_PRIORITY + 1)
+#define FOOTSWITCH_TASK_PRIORITY        (tskIDLE_PRIORITY + 3)
 #define WIFI_TASK_PRIORITY              (tskIDLE_PRIORITY + 1)
+#define SKIN_PREFETCH_TASK_PRIORITY     (tskIDLE_PRIORITY + 1)
 
 #ifdef __cplusplus
 } /*extern "C"*/
@@ -0,0 +1,529 @@
+/*
+ Copyright (C) 2024  Greg Smith
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+ 
+*/
+
+
+#include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "lvgl.h"
+#include "ui.h"
+#include "control.h"
+#include "skin_store.h"
+#include "ui_update.h"
+
+#if CONFIG_TONEX_CONTROLLER_DISPLAY_WAVESHARE_800_480
+
+// No FreeRTOS or hardware here, so the host renderer in tools/host_render can run
+// the same update logic as the display task
+
+static const char *TAG = "app_ui_update";
+
+// next song, prepared ahead of time by the display task so the switch is just a swap
+typedef struct
+{
+    const void* SkinSource;
+    char Label[MAX_UI_TEXT];
+    char Description[MAX_UI_TEXT];
+} tStagedSong;
+
+// what the screen should show once all queued updates are applied.
+// Only the last write to each element is drawn
+enum UIDirtyFlags
+{
+    UI_DIRTY_USB_STATUS     = 0x01,
+    UI_DIRTY_BT_STATUS      = 0x02,
+    UI_DIRTY_PRESET_NAME    = 0x04,
+    UI_DIRTY_DESCRIPTION    = 0x08,
+    UI_DIRTY_SKIN_INDEX     = 0x10,         // skin still to be resolved
+    UI_DIRTY_SKIN_SOURCE    = 0x20,         // skin already resolved, from a staged song
+};
+
+typedef struct
+{
+    uint8_t Dirty;
+    uint8_t USBStatus;
+    uint8_t BTStatus;
+    uint16_t SkinIndex;
+    const void* SkinSource;
+    char PresetName[MAX_UI_TEXT];
+    char Description[MAX_UI_TEXT];
+} tUIPending;
+
+static tStagedSong StagedSong;
+static tUIPending UIPending;
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static lv_obj_t* ui_get_skin_image(uint16_t index)
+{
+    lv_obj_t* result;
+
+#if CONFIG_TONEX_CONTROLLER_SKINS_COMPRESSED || CONFIG_TONEX_CONTROLLER_SKINS_SD_CARD
+    result = (lv_obj_t*)skin_store_get(index);
+
+    if (result == NULL)
+    {
+        // fall back to the first skin
+        result = (lv_obj_t*)skin_store_get(0);
+    }
+#else
+    switch (index)
+    {
+#if CONFIG_TONEX_CONTROLLER_SKINS_AMP        
+        // amps
+        case AMP_SKIN_JCM800:
+        {
+            result = (lv_obj_t*)&ui_img_skin_jcm800_png;            
+        } break;
+
+        case AMP_SKIN_TWIN_REVERB:
+        {
+            result = (lv_obj_t*)&ui_img_skin_twinreverb_png;
+        } break;
+
+        case AMP_SKIN_2001RB:
+        {
+            result = (lv_obj_t*)&ui_img_skin_2001rb_png;
+        } break;
+
+        case AMP_SKIN_5150:
+        {
+            result = (lv_obj_t*)&ui_img_skin_5150_png;
+        } break;
+
+        case AMP_SKIN_B18N:
+        {
+            result = (lv_obj_t*)&ui_img_skin_b18n_png;
+        } break;
+
+        case AMP_SKIN_BLUES_DELUXE:
+        {
+            result = (lv_obj_t*)&ui_img_skin_bluesdeluxe_png;
+        } break;
+
+        case AMP_SKIN_DEVILLE:
+        {
+            result = (lv_obj_t*)&ui_img_skin_deville_png;
+        } break;
+
+        case AMP_SKIN_DUAL_RECTIFIER:
+        {
+            result = (lv_obj_t*)&ui_img_skin_dualrectifier_png;
+        } break;
+
+        case AMP_SKIN_GOLD_FINGER:
+        {
+            result = (lv_obj_t*)&ui_img_skin_goldfinger_png;
+        } break;
+
+        case AMP_SKIN_INVADER:
+        {
+            result = (lv_obj_t*)&ui_img_skin_invader_png;
+        } break;
+
+        case AMP_SKIN_JAZZ_CHORUS:
+        {
+            result = (lv_obj_t*)&ui_img_skin_jazzchorus_png;
+        } break;
+
+        case AMP_SKIN_OR_50:
+        {
+            result = (lv_obj_t*)&ui_img_skin_or50_png;
+        } break;
+
+        case AMP_SKIN_POWERBALL:
+        {
+            result = (lv_obj_t*)&ui_img_skin_powerball_png;
+        } break;
+
+        case AMP_SKIN_PRINCETON:
+        {
+            result = (lv_obj_t*)&ui_img_skin_princeton_png;
+        } break;
+
+        case AMP_SKIN_SVTCL:
+        {
+            result = (lv_obj_t*)&ui_img_skin_svtcl_png;
+        } break;
+
+        case AMP_SKIN_MAVERICK:
+        {
+            result = (lv_obj_t*)&ui_img_skin_maverick_png;
+        } break;
+
+        case AMP_SKIN_MK3:
+        {
+            result = (lv_obj_t*)&ui_img_skin_mk3_png;
+        } break;
+
+        case AMP_SKIN_SUPERBASS:
+        {
+            result = (lv_obj_t*)&ui_img_skin_superbass_png;
+        } break;
+
+        case AMP_SKIN_DUMBLE:
+        {
+            result = (lv_obj_t*)&ui_img_skin_dumble_png;
+        } break;
+
+        case AMP_SKIN_JETCITY:
+        {
+            result = (lv_obj_t*)&ui_img_skin_jetcity_png;
+        } break;
+
+        case AMP_SKIN_AC30:
+        {
+            result = (lv_obj_t*)&ui_img_skin_ac30_png;
+        } break;
+
+        case AMP_SKIN_EVH5150:
+        {
+            result = (lv_obj_t*)&ui_img_skin_evh5150_png;
+        } break;
+
+        case AMP_SKIN_2020:
+        {
+            result = (lv_obj_t*)&ui_img_skin_2020_png;
+        } break;
+
+        case AMP_SKIN_PINK_TACO:
+        {
+            result = (lv_obj_t*)&ui_img_skin_pinktaco_png;
+        } break;
+
+        case AMP_SKIN_SUPRO_50:
+        {
+            result = (lv_obj_t*)&ui_img_skin_supro50_png;
+        } break;
+
+        case AMP_SKIN_DIEZEL:
+        {
+            result = (lv_obj_t*)&ui_img_skin_diezel_png;
+        } break;
+#endif  //CONFIG_TONEX_CONTROLLER_SKINS_AMP
+
+#if CONFIG_TONEX_CONTROLLER_SKINS_PEDAL
+        // pedals
+        case PEDAL_SKIN_ARION:
+        {
+            result = (lv_obj_t*)&ui_img_pskin_arion_png;
+        } break;
+
+        case PEDAL_SKIN_BIGMUFF:
+        {
+            result = (lv_obj_t*)&ui_img_pskin_bigmuff_png;
+        } break;
+
+        case PEDAL_SKIN_DARKGLASS:
+        {
+            result = (lv_obj_t*)&ui_img_pskin_darkglass_png;
+        } break;
+
+        case PEDAL_SKIN_DOD:
+        {
+            result = (lv_obj_t*)&ui_img_pskin_dod_png;
+        } break;
+
+        case PEDAL_SKIN_EHX:
+        {
+            result = (lv_obj_t*)&ui_img_pskin_ehx_png;
+        } break;
+
+        case PEDAL_SKIN_FENDER:
+        {
+            result = (lv_obj_t*)&ui_img_pskin_fender_png;
+        } break;
+
+        case PEDAL_SKIN_FULLTONE:
+        {
+            result = (lv_obj_t*)&ui_img_pskin_fulltone_png;
+        } break;
+
+        case PEDAL_SKIN_FZS:
+        {
+            result = (lv_obj_t*)&ui_img_pskin_fzs_png;
+        } break;
+
+        case PEDAL_SKIN_JHS:
+        {
+            result = (lv_obj_t*)&ui_img_pskin_jhs_png;
+        } break;
+
+        case PEDAL_SKIN_KLON:
+        {
+            result = (lv_obj_t*)&ui_img_pskin_klon_png;
+        } break;
+
+        case PEDAL_SKIN_LANDGRAF:
+        {
+            result = (lv_obj_t*)&ui_img_pskin_landgraf_png;
+        } break;
+
+        case PEDAL_SKIN_MXR:
+        {
+            result = (lv_obj_t*)&ui_img_pskin_mxr_png;
+        } break;
+
+        case PEDAL_SKIN_MXR2:
+        {
+            result = (lv_obj_t*)&ui_img_pskin_mxr2_png;
+        } break;
+
+        case PEDAL_SKIN_OD1:
+        {
+            result = (lv_obj_t*)&ui_img_pskin_od1_png;
+        } break;
+
+        case PEDAL_SKIN_PLIMSOUL:
+        {
+            result = (lv_obj_t*)&ui_img_pskin_plimsoul_png;
+        } break;
+
+        case PEDAL_SKIN_ROGERMAYER:
+        {
+            result = (lv_obj_t*)&ui_img_pskin_rogermayer_png;
+        } break;
+
+        case PEDAL_SKIN_SEYMOUR:
+        {
+            result = (lv_obj_t*)&ui_img_pskin_seymour_png;
+        } break;
+
+        case PEDAL_SKIN_STRYMON:
+        {
+            result = (lv_obj_t*)&ui_img_pskin_strymon_png;
+        } break;
+
+        case PEDAL_SKIN_TREX:
+        {
+            result = (lv_obj_t*)&ui_img_pskin_trex_png;
+        } break;
+
+        case PEDAL_SKIN_TUBESCREAMER:
+        {
+            result = (lv_obj_t*)&ui_img_pskin_tubescreamer_png;
+        } break;
+
+        case PEDAL_SKIN_WAMPLER:
+        {
+            result = (lv_obj_t*)&ui_img_pskin_wampler_png;
+        } break;
+
+        case PEDAL_SKIN_ZVEX:
+        {
+            result = (lv_obj_t*)&ui_img_pskin_zvex_png;
+        } break;
+#endif //CONFIG_TONEX_CONTROLLER_SKINS_PEDAL
+
+        default:
+        {
+            result = (lv_obj_t*)&ui_img_skin_jcm800_png;            
+        } break;
+    }
+#endif  //CONFIG_TONEX_CONTROLLER_SKINS_COMPRESSED || CONFIG_TONEX_CONTROLLER_SKINS_SD_CARD
+
+    return result;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Missing text is taken as empty
+*****************************************************************************/
+static void ui_copy_text(char* dest, const char* text)
+{
+    if (text == NULL)
+    {
+        dest[0] = 0;
+        return;
+    }
+
+    strncpy(dest, text, MAX_UI_TEXT - 1);
+    dest[MAX_UI_TEXT - 1] = 0;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Record an update in the pending screen state
+* PARAMETERS:  text: for the text actions, NULL otherwise
+* RETURN:      1 if the update was valid
+* NOTES:       Nothing is drawn here, see ui_update_render()
+*****************************************************************************/
+uint8_t ui_update_record(uint8_t element, uint8_t action, uint32_t value, const char* text)
+{
+    switch (action)
+    {
+        case UI_ACTION_SET_STATE:
+        {
+            // check the element
+            if (element == UI_ELEMENT_USB_STATUS)
+            {
+                UIPending.USBStatus = value;
+                UIPending.Dirty |= UI_DIRTY_USB_STATUS;
+            }
+            else if (element == UI_ELEMENT_BT_STATUS)
+            {
+                UIPending.BTStatus = value;
+                UIPending.Dirty |= UI_DIRTY_BT_STATUS;
+            }
+            else if (element == UI_ELEMENT_AMP_SKIN)
+            {
+                // resolved when drawn, so skins overwritten in the same batch are never loaded
+                UIPending.SkinIndex = value;
+                UIPending.Dirty &= ~UI_DIRTY_SKIN_SOURCE;
+                UIPending.Dirty |= UI_DIRTY_SKIN_INDEX;
+            }
+            else
+            {
+                ESP_LOGE(TAG, "Unknown display elment %d", element);     
+                return 0;        
+            }
+        } break;
+
+        case UI_ACTION_SET_LABEL_TEXT:
+        {
+            ui_copy_text(UIPending.PresetName, text);
+            UIPending.Dirty |= UI_DIRTY_PRESET_NAME;
+        } break;
+
+        case UI_ACTION_SET_ENTRY_TEXT:
+        {
+            ui_copy_text(UIPending.Description, text);
+            UIPending.Dirty |= UI_DIRTY_DESCRIPTION;
+        } break;
+
+        case UI_ACTION_STAGE_STATE:
+        {
+            // resolve the skin now so the commit is only a swap
+            StagedSong.SkinSource = ui_get_skin_image(value);
+        } break;
+
+        case UI_ACTION_STAGE_LABEL_TEXT:
+        {
+            ui_copy_text(StagedSong.Label, text);
+        } break;
+
+        case UI_ACTION_STAGE_ENTRY_TEXT:
+        {
+            ui_copy_text(StagedSong.Description, text);
+        } break;
+
+        case UI_ACTION_COMMIT_STAGED:
+        {
+            if (StagedSong.SkinSource != NULL)
+            {
+                UIPending.SkinSource = StagedSong.SkinSource;
+                UIPending.Dirty &= ~UI_DIRTY_SKIN_INDEX;
+                UIPending.Dirty |= UI_DIRTY_SKIN_SOURCE;
+            }
+            memcpy((void*)UIPending.PresetName, (void*)StagedSong.Label, MAX_UI_TEXT);
+            memcpy((void*)UIPending.Description, (void*)StagedSong.Description, MAX_UI_TEXT);
+            UIPending.Dirty |= UI_DIRTY_PRESET_NAME | UI_DIRTY_DESCRIPTION;
+        } break;
+
+        default:
+        {
+            ESP_LOGE(TAG, "Unknown display action");
+            return 0;
+        } break;
+    }
+
+    return 1;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Draw the pending screen state
+* PARAMETERS:  
+* RETURN:      1 if the preset name or skin changed
+* NOTES:       Called with the LVGL lock held. Everything set here is rendered
+*              by the same lv_task_handler() pass, so a preset change shows in one frame
+*****************************************************************************/
+uint8_t ui_update_render(void)
+{
+    uint8_t preset_changed = 0;
+
+    if (UIPending.Dirty & UI_DIRTY_USB_STATUS)
+    {
+        if (UIPending.USBStatus == 0)
+        {
+            // show the USB disconnected image
+            lv_obj_add_flag(ui_USBStatusOK, LV_OBJ_FLAG_HIDDEN);
+            lv_obj_clear_flag(ui_USBStatusFail, LV_OBJ_FLAG_HIDDEN);
+        }
+        else
+        {
+            // show the USB connected image
+            lv_obj_add_flag(ui_USBStatusFail, LV_OBJ_FLAG_HIDDEN);
+            lv_obj_clear_flag(ui_USBStatusOK, LV_OBJ_FLAG_HIDDEN);
+        }
+    }
+
+    if (UIPending.Dirty & UI_DIRTY_BT_STATUS)
+    {
+        if (UIPending.BTStatus == 0)
+        {
+            // show the BT disconnected image
+            lv_obj_add_flag(ui_BTStatusConn, LV_OBJ_FLAG_HIDDEN);
+            lv_obj_clear_flag(ui_BTStatusDisconn, LV_OBJ_FLAG_HIDDEN);
+        }
+        else
+        {
+            // show the BT connected image
+            lv_obj_add_flag(ui_BTStatusDisconn, LV_OBJ_FLAG_HIDDEN);
+            lv_obj_clear_flag(ui_BTStatusConn, LV_OBJ_FLAG_HIDDEN);
+        }
+    }
+
+    if (UIPending.Dirty & UI_DIRTY_SKIN_INDEX)
+    {
+        lv_img_set_src(ui_SkinImage, ui_get_skin_image(UIPending.SkinIndex));
+        preset_changed = 1;
+    }
+    else if (UIPending.Dirty & UI_DIRTY_SKIN_SOURCE)
+    {
+        lv_img_set_src(ui_SkinImage, UIPending.SkinSource);
+        preset_changed = 1;
+    }
+
+    if (UIPending.Dirty & UI_DIRTY_PRESET_NAME)
+    {
+        lv_label_set_text(ui_PresetHeadingLabel, UIPending.PresetName);
+        preset_changed = 1;
+    }
+
+    if (UIPending.Dirty & UI_DIRTY_DESCRIPTION)
+    {
+        lv_textarea_set_text(ui_PresetDetailsTextArea, UIPending.Description);
+    }
+
+    UIPending.Dirty = 0;
+
+    return preset_changed;
+}
+
+#endif  //CONFIG_TONEX_CONTROLLER_DISPLAY_WAVESHARE_800_480
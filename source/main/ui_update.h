@@ -0,0 +1,59 @@
+/*
+ Copyright (C) 2024  Greg Smith
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+ 
+*/
+
+
+#ifndef _UI_UPDATE_H
+#define _UI_UPDATE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MAX_UI_TEXT     130
+
+enum UIElements
+{
+    UI_ELEMENT_USB_STATUS,
+    UI_ELEMENT_BT_STATUS,
+    UI_ELEMENT_PRESET_NAME,
+    UI_ELEMENT_AMP_SKIN,
+    UI_ELEMENT_PRESET_DESCRIPTION,
+    UI_ELEMENT_STAGED_SONG,
+    UI_ELEMENT_PERF_OVERLAY,
+    UI_ELEMENT_MESSAGE,
+};
+
+enum UIAction
+{
+    UI_ACTION_SET_STATE,
+    UI_ACTION_SET_LABEL_TEXT,
+    UI_ACTION_SET_ENTRY_TEXT,
+    UI_ACTION_STAGE_LABEL_TEXT,
+    UI_ACTION_STAGE_ENTRY_TEXT,
+    UI_ACTION_STAGE_STATE,
+    UI_ACTION_COMMIT_STAGED
+};
+
+// display task only, or any single thread holding the LVGL lock
+uint8_t ui_update_record(uint8_t element, uint8_t action, uint32_t value, const char* text);
+uint8_t ui_update_render(void);
+
+#ifdef __cplusplus
+} /*extern "C"*/
+#endif
+
+#endif
@@ -374,6 +374,63 @@ void usb_set_preset(uint32_t preset)
     }
 }
 
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Change preset and bypass together
+* PARAMETERS:  bypass: enum USB_Bypass
+* RETURN:      
+* NOTES:       A normal preset change, the staged preset is left alone
+*****************************************************************************/
+void usb_set_preset_bypass(uint32_t preset, uint8_t bypass)
+{
+    tUSBMessage message;
+
+    if (usb_input_queue == NULL)
+    {
+        ESP_LOGE(TAG, "usb_set_preset_bypass queue null");            
+    }
+    else
+    {
+        message.Command = USB_COMMAND_SET_PRESET;
+        message.Payload = (preset & 0xFFFF) | ((uint32_t)bypass << 16);
+
+        // send to queue
+        if (xQueueSend(usb_input_queue, (void*)&message, 0) != pdPASS)
+        {
+            ESP_LOGE(TAG, "usb_set_preset_bypass queue send failed!");            
+        }
+    }
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Set preset and bypass exactly as given, in a single write
+* PARAMETERS:  bypass: enum USB_Bypass
+* RETURN:      
+* NOTES:       No same preset twice handling, and the staged preset is left
+*              alone. Used by macros
+*****************************************************************************/
+void usb_set_preset_state(uint32_t preset, uint8_t bypass)
+{
+    tUSBMessage message;
+
+    if (usb_input_queue == NULL)
+    {
+        ESP_LOGE(TAG, "usb_set_preset_state queue null");            
+    }
+    else
+    {
+        message.Command = USB_COMMAND_SET_PRESET_STATE;
+        message.Payload = (preset & 0xFFFF) | ((uint32_t)bypass << 16);
+
+        // send to queue
+        if (xQueueSend(usb_input_queue, (void*)&message, 0) != pdPASS)
+        {
+            ESP_LOGE(TAG, "usb_set_preset_state queue send failed!");            
+        }
+    }
+}
+
 /****************************************************************************
 * NAME:        
 * DESCRIPTION: 
@@ -428,6 +485,62 @@ void usb_previous_preset(void)
     }
 }
 
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Pre-build the state change for a preset expected to be next
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void usb_stage_preset(uint32_t preset, uint8_t bypass)
+{
+    tUSBMessage message;
+
+    if (usb_input_queue == NULL)
+    {
+        ESP_LOGE(TAG, "usb_stage_preset queue null");            
+    }
+    else
+    {
+        message.Command = USB_COMMAND_STAGE_PRESET;
+        message.Payload = (preset & 0xFFFF) | ((uint32_t)bypass << 16);
+
+        // send to queue
+        if (xQueueSend(usb_input_queue, (void*)&message, 0) != pdPASS)
+        {
+            ESP_LOGE(TAG, "usb_stage_preset queue send failed!");            
+        }
+    }
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Send a previously staged preset
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       falls back to a normal preset change if the stage doesn't match
+*****************************************************************************/
+void usb_set_staged_preset(uint32_t preset, uint8_t bypass)
+{
+    tUSBMessage message;
+
+    if (usb_input_queue == NULL)
+    {
+        ESP_LOGE(TAG, "usb_set_staged_preset queue null");            
+    }
+    else
+    {
+        message.Command = USB_COMMAND_SET_STAGED_PRESET;
+        message.Payload = (preset & 0xFFFF) | ((uint32_t)bypass << 16);
+
+        // send to queue
+        if (xQueueSend(usb_input_queue, (void*)&message, 0) != pdPASS)
+        {
+            ESP_LOGE(TAG, "usb_set_staged_preset queue send failed!");            
+        }
+    }
+}
+
 /****************************************************************************
 * NAME:        
 * DESCRIPTION: 
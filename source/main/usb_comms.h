@@ -30,7 +30,19 @@ enum USB_Commands
 {
     USB_COMMAND_SET_PRESET,
     USB_COMMAND_NEXT_PRESET,
-    USB_COMMAND_PREVIOUS_PRESET
+    USB_COMMAND_PREVIOUS_PRESET,
+    USB_COMMAND_STAGE_PRESET,
+    USB_COMMAND_SET_STAGED_PRESET,
+    USB_COMMAND_SET_PRESET_STATE
+};
+
+// bypass handling for preset changes, packed into bits 16..23 of the payload
+enum USB_Bypass
+{
+    USB_BYPASS_UNCHANGED,
+    USB_BYPASS_OFF,
+    USB_BYPASS_ON,
+    USB_BYPASS_TOGGLE
 };
 
 typedef struct 
@@ -51,8 +63,12 @@ void init_usb_comms(void);
 
 // thread safe public API
 void usb_set_preset(uint32_t preset);
+void usb_set_preset_bypass(uint32_t preset, uint8_t bypass);
+void usb_set_preset_state(uint32_t preset, uint8_t bypass);
 void usb_next_preset(void);
 void usb_previous_preset(void);
+void usb_stage_preset(uint32_t preset, uint8_t bypass);
+void usb_set_staged_preset(uint32_t preset, uint8_t bypass);
 
 #ifdef __cplusplus
 } /*extern "C"*/
@@ -61,7 +61,6 @@ limitations under the License.
 
 static const char *TAG = "app_TonexOne";
 
-#define MAX_PRESETS         20
 #define MAX_TX_SIZE         64
 
 // Response from Tonex One to a preset change is about 1202, 1352, 1361 bytes with details of the preset. 
@@ -77,6 +76,18 @@ static const uint8_t ToneOnePresetByteMarker[] = {0xB9, 0x04, 0xB9, 0x02, 0xBC,
 #define TONEX_ONE_CDC_INTERFACE_INDEX               0
 #define MAX_RAW_DATA                                3072
 
+// pedal state fields. Mode is from the start, the rest are counted back from the end.
+// firmware v1.1.4: offset needed is 12
+// firmware v1.2.6: offset needed is 18
+//todo could do version check and support multiple versions
+#define TONEX_ONE_STATE_MODE                        14          // 0 = A/B mode, 1 = stomp mode
+#define TONEX_ONE_STATE_OFFSET_FROM_END             18
+#define TONEX_ONE_STATE_SLOT_A_PRESET               0
+#define TONEX_ONE_STATE_SLOT_B_PRESET               2
+#define TONEX_ONE_STATE_SLOT_C_PRESET               4
+#define TONEX_ONE_STATE_BYPASS                      6
+#define TONEX_ONE_STATE_CURRENT_SLOT                7
+
 // credit to https://github.com/vit3k/tonex_controller for some of the below details and implementation
 enum CommsState
 {
@@ -157,6 +168,15 @@ static tCDCRxQueueEntry rx_entry;
 static tCDCRxQueueEntry rx_entry_int;
 static uint8_t boot_init_needed = 0;
 
+// pre-built state frame for the next expected preset change (setlist look-ahead).
+// Rebuilt whenever the pedal reports a new state so it never goes stale
+static uint8_t StagedRawData[MAX_RAW_DATA];
+static uint8_t StagedFramedBuffer[MAX_RAW_DATA];
+static uint16_t StagedFramedLength = 0;
+static uint16_t StagedPreset = 0;
+static uint8_t StagedBypass = 0;
+static uint8_t StagedRequested = 0;
+
 /*
 ** Static function prototypes
 */
@@ -165,8 +185,13 @@ static Status removeFraming(uint8_t* input, uint16_t inlength, uint8_t* output,
 static esp_err_t usb_tonex_one_transmit(uint8_t* tx_data, uint16_t tx_len);
 static Status usb_tonex_one_parse(uint8_t* message, uint16_t inlength);
 static esp_err_t usb_tonex_one_set_active_slot(Slot newSlot);
-static esp_err_t usb_tonex_one_set_preset_in_slot(uint16_t preset, Slot newSlot, uint8_t selectSlot);
+static esp_err_t usb_tonex_one_set_preset_in_slot(uint16_t preset, Slot newSlot, uint8_t selectSlot, uint8_t bypass);
+static uint8_t usb_tonex_one_patch_state(uint8_t* raw_data, uint16_t length, uint16_t preset, Slot slot, uint8_t selectSlot, uint8_t bypass);
+static void usb_tonex_one_update_slots(void);
+static esp_err_t usb_tonex_one_send_state(uint16_t preset, Slot newSlot, uint8_t selectSlot, uint8_t bypass);
+static esp_err_t usb_tonex_one_set_preset_state(uint16_t preset, uint8_t bypass);
 static uint16_t usb_tonex_one_get_current_active_preset(void);
+static void usb_tonex_one_build_staged_frame(void);
 
 /****************************************************************************
 * NAME:        
@@ -373,6 +398,30 @@ static esp_err_t usb_tonex_one_request_state(void)
     return usb_tonex_one_transmit(FramedBuffer, outlength);
 }
 
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Wrap pedal state data with the state update header and framing
+* PARAMETERS:  
+* RETURN:      framed length
+* NOTES:       
+*****************************************************************************/
+static uint16_t usb_tonex_one_build_state_frame(uint8_t* raw_data, uint16_t raw_length, uint8_t* output)
+{
+    // Build message, length to 0 for now                    len LSB  len MSB
+    uint8_t message[] = {0xb9, 0x03, 0x81, 0x06, 0x03, 0x82, 0,       0,       0x80, 0x0b, 0x03};
+    
+    // set length 
+    message[6] = raw_length & 0xFF;
+    message[7] = (raw_length >> 8) & 0xFF;
+
+    // build total message
+    memcpy((void*)TxBuffer, (void*)message, sizeof(message));
+    memcpy((void*)&TxBuffer[sizeof(message)], (void*)raw_data, raw_length);
+
+    // add framing
+    return addFraming(TxBuffer, sizeof(message) + raw_length, output);
+}
+
 /****************************************************************************
 * NAME:        
 * DESCRIPTION: 
@@ -386,30 +435,20 @@ static esp_err_t __attribute__((unused)) usb_tonex_one_set_active_slot(Slot newS
 
     ESP_LOGI(TAG, "Setting slot %d", (int)newSlot);
 
-    // Build message, length to 0 for now                    len LSB  len MSB
-    uint8_t message[] = {0xb9, 0x03, 0x81, 0x06, 0x03, 0x82, 0,       0,       0x80, 0x0b, 0x03};
-    
-    // set length 
-    message[6] = TonexData.Message.PedalData.Length & 0xFF;
-    message[7] = (TonexData.Message.PedalData.Length >> 8) & 0xFF;
+    if (TonexData.Message.PedalData.Length < TONEX_ONE_STATE_OFFSET_FROM_END)
+    {
+        // no state from the pedal yet
+        return ESP_FAIL;
+    }
 
     // save the slot
     TonexData.Message.CurrentSlot = newSlot;
 
-    // firmware v1.1.4: offset needed is 12
-    // firmware v1.2.6: offset needed is 18
-    //todo could do version check and support multiple versions
-    uint8_t offset_from_end = 18;
-
     // modify the buffer with the new slot
-    TonexData.Message.PedalData.RawData[TonexData.Message.PedalData.Length - offset_from_end + 7] = (uint8_t)newSlot;
-
-    // build total message
-    memcpy((void*)TxBuffer, (void*)message, sizeof(message));
-    memcpy((void*)&TxBuffer[sizeof(message)], (void*)TonexData.Message.PedalData.RawData, TonexData.Message.PedalData.Length);
+    TonexData.Message.PedalData.RawData[TonexData.Message.PedalData.Length - TONEX_ONE_STATE_OFFSET_FROM_END + TONEX_ONE_STATE_CURRENT_SLOT] = (uint8_t)newSlot;
 
     // add framing
-    framed_length = addFraming(TxBuffer, sizeof(message) + TonexData.Message.PedalData.Length, FramedBuffer);
+    framed_length = usb_tonex_one_build_state_frame(TonexData.Message.PedalData.RawData, TonexData.Message.PedalData.Length, FramedBuffer);
 
     // send it
     return usb_tonex_one_transmit(FramedBuffer, framed_length);    
@@ -417,100 +456,238 @@ static esp_err_t __attribute__((unused)) usb_tonex_one_set_active_slot(Slot newS
 
 /****************************************************************************
 * NAME:        
-* DESCRIPTION: 
+* DESCRIPTION: Patch a preset change into a copy of the pedal state
+* PARAMETERS:  slot: slot the preset goes in
+*              selectSlot: 1 to make it the current slot
+*              bypass: enum USB_Bypass. Toggle is relative to the current
+*              pedal state
+* RETURN:      1 if patched, 0 if there is no state from the pedal yet
+* NOTES:       Forces stomp mode. Every state frame we send is built with this
+*****************************************************************************/
+static uint8_t usb_tonex_one_patch_state(uint8_t* raw_data, uint16_t length, uint16_t preset, Slot slot, uint8_t selectSlot, uint8_t bypass)
+{
+    static const uint8_t SlotPresetField[] = {TONEX_ONE_STATE_SLOT_A_PRESET, TONEX_ONE_STATE_SLOT_B_PRESET, TONEX_ONE_STATE_SLOT_C_PRESET};
+    uint8_t* fields;
+
+    if ((length < TONEX_ONE_STATE_OFFSET_FROM_END) || (length <= TONEX_ONE_STATE_MODE) || (slot > C))
+    {
+        return 0;
+    }
+
+    fields = &raw_data[length - TONEX_ONE_STATE_OFFSET_FROM_END];
+
+    // force pedal to Stomp mode
+    raw_data[TONEX_ONE_STATE_MODE] = 1;
+
+    // set the preset index into the slot position
+    fields[SlotPresetField[slot]] = preset;
+
+    if (selectSlot)
+    {
+        fields[TONEX_ONE_STATE_CURRENT_SLOT] = (uint8_t)slot;
+    }
+
+    switch (bypass)
+    {
+        case USB_BYPASS_OFF:
+        {
+            fields[TONEX_ONE_STATE_BYPASS] = 0;
+        } break;
+
+        case USB_BYPASS_ON:
+        {
+            fields[TONEX_ONE_STATE_BYPASS] = 1;
+        } break;
+
+        case USB_BYPASS_TOGGLE:
+        {
+            fields[TONEX_ONE_STATE_BYPASS] = !TonexData.Message.PedalData.RawData[TonexData.Message.PedalData.Length - TONEX_ONE_STATE_OFFSET_FROM_END + TONEX_ONE_STATE_BYPASS];
+        } break;
+
+        default:
+        {
+            // leave as is
+        } break;
+    }
+
+    return 1;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Read the slot presets and current slot from the pedal state
 * PARAMETERS:  
 * RETURN:      
-* NOTES:       
+* NOTES:       After the state is received or patched, so the cached copies
+*              always match what was last sent or received
 *****************************************************************************/
-static esp_err_t usb_tonex_one_set_preset_in_slot(uint16_t preset, Slot newSlot, uint8_t selectSlot)
+static void usb_tonex_one_update_slots(void)
 {
+    uint8_t* fields;
+
+    if (TonexData.Message.PedalData.Length < TONEX_ONE_STATE_OFFSET_FROM_END)
+    {
+        return;
+    }
+
+    fields = &TonexData.Message.PedalData.RawData[TonexData.Message.PedalData.Length - TONEX_ONE_STATE_OFFSET_FROM_END];
+
+    TonexData.Message.SlotAPreset = fields[TONEX_ONE_STATE_SLOT_A_PRESET];
+    TonexData.Message.SlotBPreset = fields[TONEX_ONE_STATE_SLOT_B_PRESET];
+    TonexData.Message.SlotCPreset = fields[TONEX_ONE_STATE_SLOT_C_PRESET];
+    TonexData.Message.CurrentSlot = fields[TONEX_ONE_STATE_CURRENT_SLOT];
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Patch the pedal state and send it
+* PARAMETERS:  bypass: enum USB_Bypass
+* RETURN:      
+* NOTES:       Any staged frame is rebuilt from the new state, not dropped
+*****************************************************************************/
+static esp_err_t usb_tonex_one_send_state(uint16_t preset, Slot newSlot, uint8_t selectSlot, uint8_t bypass)
+{
+    esp_err_t result;
     uint16_t framed_length;
-    
-    // firmware v1.1.4: offset needed is 12
-    // firmware v1.2.6: offset needed is 18
-    //todo could do version check and support multiple versions
-    uint8_t offset_from_end = 18;
 
-    ESP_LOGI(TAG, "Setting preset %d in slot %d", (int)preset, (int)newSlot);
+    if (!usb_tonex_one_patch_state(TonexData.Message.PedalData.RawData, TonexData.Message.PedalData.Length, preset, newSlot, selectSlot, bypass))
+    {
+        // no state from the pedal yet
+        return ESP_FAIL;
+    }
 
-    // Build message, length to 0 for now                    len LSB  len MSB
-    uint8_t message[] = {0xb9, 0x03, 0x81, 0x06, 0x03, 0x82, 0,       0,       0x80, 0x0b, 0x03};
-    
-    // set length 
-    message[6] = TonexData.Message.PedalData.Length & 0xFF;
-    message[7] = (TonexData.Message.PedalData.Length >> 8) & 0xFF;
+    usb_tonex_one_update_slots();
 
-    // force pedal to Stomp mode. 0 here = A/B mode, 1 = stomp mode
-    TonexData.Message.PedalData.RawData[14] = 1;
-    
-    // check if setting same preset twice will set bypass
-    if (control_get_config_double_toggle())
+    //ESP_LOGI(TAG, "State Data after changes");
+    //ESP_LOG_BUFFER_HEXDUMP(TAG, TonexData.Message.PedalData.RawData, TonexData.Message.PedalData.Length, ESP_LOG_INFO);
+
+    // do framing
+    framed_length = usb_tonex_one_build_state_frame(TonexData.Message.PedalData.RawData, TonexData.Message.PedalData.Length, FramedBuffer);
+
+    // send it
+    result = usb_tonex_one_transmit(FramedBuffer, framed_length);
+
+    // keep any staged frame in step with the new state
+    usb_tonex_one_build_staged_frame();
+
+    return result;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  bypass: enum USB_Bypass, USB_BYPASS_UNCHANGED for the usual
+*              same preset twice handling
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static esp_err_t usb_tonex_one_set_preset_in_slot(uint16_t preset, Slot newSlot, uint8_t selectSlot, uint8_t bypass)
+{
+    ESP_LOGI(TAG, "Setting preset %d in slot %d", (int)preset, (int)newSlot);
+
+    // an explicit bypass takes the place of the same preset twice handling
+    if ((bypass == USB_BYPASS_UNCHANGED) && control_get_config_double_toggle())
     {
+        // check if setting same preset twice will set bypass
         if (selectSlot && (TonexData.Message.CurrentSlot == newSlot) && (preset == usb_tonex_one_get_current_active_preset()))
         {
-            // are we in bypass mode?
-            if (TonexData.Message.PedalData.RawData[TonexData.Message.PedalData.Length - offset_from_end + 6] == 1)
-            {
-                ESP_LOGI(TAG, "Disabling bypass mode");
-
-                // disable bypass mode
-                TonexData.Message.PedalData.RawData[TonexData.Message.PedalData.Length - offset_from_end + 6] = 0;
-            }
-            else
-            {
-                ESP_LOGI(TAG, "Enabling bypass mode");
-
-                // enable bypass mode
-                TonexData.Message.PedalData.RawData[TonexData.Message.PedalData.Length - offset_from_end + 6] = 1;
-            }
+            ESP_LOGI(TAG, "Toggling bypass mode");
+            bypass = USB_BYPASS_TOGGLE;
         }
         else
         {
             // new preset, disable bypass mode to be sure
-            TonexData.Message.PedalData.RawData[TonexData.Message.PedalData.Length - offset_from_end + 6] = 0;
+            bypass = USB_BYPASS_OFF;
         }
     }
 
-    TonexData.Message.CurrentSlot = newSlot;
+    return usb_tonex_one_send_state(preset, newSlot, selectSlot, bypass);
+}
 
-  
-    // set the preset index into the slot position
-    switch (newSlot)
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Set preset and bypass exactly as given, in a single write
+* PARAMETERS:  bypass: enum USB_Bypass
+* RETURN:      
+* NOTES:       Slot C, same as a normal preset change. No same preset twice
+*              handling, and the staged preset is left alone
+*****************************************************************************/
+static esp_err_t usb_tonex_one_set_preset_state(uint16_t preset, uint8_t bypass)
+{
+    ESP_LOGI(TAG, "Setting preset %d bypass %d", (int)preset, (int)bypass);
+
+    return usb_tonex_one_send_state(preset, C, 1, bypass);
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Pre-build the state frame for the staged preset
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Always targets slot C, same as a normal preset change
+*****************************************************************************/
+static void usb_tonex_one_build_staged_frame(void)
+{
+    uint16_t length = TonexData.Message.PedalData.Length;
+
+    StagedFramedLength = 0;
+
+    if (!StagedRequested)
     {
-        case A:
-        {
-            TonexData.Message.PedalData.RawData[TonexData.Message.PedalData.Length - offset_from_end] = preset;
-        } break;
+        return;
+    }
 
-        case B:
-        {
-            TonexData.Message.PedalData.RawData[TonexData.Message.PedalData.Length - offset_from_end + 2] = preset;
-        } break;
+    memcpy((void*)StagedRawData, (void*)TonexData.Message.PedalData.RawData, length);
 
-        case C:
-        {
-            TonexData.Message.PedalData.RawData[TonexData.Message.PedalData.Length - offset_from_end + 4] = preset;
-        } break;
+    if (usb_tonex_one_patch_state(StagedRawData, length, StagedPreset, C, 1, StagedBypass))
+    {
+        StagedFramedLength = usb_tonex_one_build_state_frame(StagedRawData, length, StagedFramedBuffer);
     }
+}
 
-    if (selectSlot)
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Send the staged preset if it is still what was requested
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static esp_err_t usb_tonex_one_set_staged_preset(uint16_t preset, uint8_t bypass)
+{
+    esp_err_t result;
+
+    if (!StagedRequested || (StagedFramedLength == 0) || (StagedPreset != preset) || (StagedBypass != bypass))
     {
-        // modify the buffer with the new slot
-        TonexData.Message.PedalData.RawData[TonexData.Message.PedalData.Length - offset_from_end + 7] = (uint8_t)newSlot;
+        // stage doesn't match, build it now. Costs the frame build but still a single write
+        ESP_LOGW(TAG, "Staged preset miss");
+
+        StagedPreset = preset;
+        StagedBypass = bypass;
+        StagedRequested = 1;
+        usb_tonex_one_build_staged_frame();
+
+        if (StagedFramedLength == 0)
+        {
+            // no state from the pedal yet
+            StagedRequested = 0;
+            return ESP_FAIL;
+        }
     }
 
-    //ESP_LOGI(TAG, "State Data after changes");
-    //ESP_LOG_BUFFER_HEXDUMP(TAG, TonexData.Message.PedalData.RawData, TonexData.Message.PedalData.Length, ESP_LOG_INFO);
+    // single pre-built transmit
+    result = usb_tonex_one_transmit(StagedFramedBuffer, StagedFramedLength);
 
-    // build total message
-    memcpy((void*)TxBuffer, (void*)message, sizeof(message));
-    memcpy((void*)&TxBuffer[sizeof(message)], (void*)TonexData.Message.PedalData.RawData, TonexData.Message.PedalData.Length);
+    if (result == ESP_OK)
+    {
+        // staged state is now the pedal state
+        memcpy((void*)TonexData.Message.PedalData.RawData, (void*)StagedRawData, TonexData.Message.PedalData.Length);
+        usb_tonex_one_update_slots();
+    }
 
-    // do framing
-    framed_length = addFraming(TxBuffer, sizeof(message) + TonexData.Message.PedalData.Length, FramedBuffer);
+    StagedRequested = 0;
+    StagedFramedLength = 0;
 
-    // send it
-    return usb_tonex_one_transmit(FramedBuffer, framed_length);
+    return result;
 }
 
 /****************************************************************************
@@ -603,22 +780,13 @@ static Status usb_tonex_one_parse_state(uint8_t* unframed, uint16_t length, uint
     TonexData.Message.PedalData.Length = length - index;
     memcpy((void*)TonexData.Message.PedalData.RawData, (void*)&unframed[index], TonexData.Message.PedalData.Length);
 
-    // firmware v1.1.4: offset needed is 12
-    // firmware v1.2.6: offset needed is 18
-    //todo could do version check and support multiple versions
-    uint8_t offset_from_end = 18;
-
-    index += (TonexData.Message.PedalData.Length - offset_from_end);
-    TonexData.Message.SlotAPreset = unframed[index];
-    index += 2;
-    TonexData.Message.SlotBPreset = unframed[index];
-    index += 2;
-    TonexData.Message.SlotCPreset = unframed[index];
-    index += 3;
-    TonexData.Message.CurrentSlot = unframed[index];
+    usb_tonex_one_update_slots();
 
     ESP_LOGI(TAG, "Slot A: %d. Slot B:%d. Slot C:%d. Current slot: %d", (int)TonexData.Message.SlotAPreset, (int)TonexData.Message.SlotBPreset, (int)TonexData.Message.SlotCPreset, (int)TonexData.Message.CurrentSlot);
 
+    // keep any staged frame in step with the new state
+    usb_tonex_one_build_staged_frame();
+
     //ESP_LOGI(TAG, "State Data Rx: %d %d", (int)length, (int)index);
     //ESP_LOG_BUFFER_HEXDUMP(TAG, TonexData.Message.PedalData.RawData, TonexData.Message.PedalData.Length, ESP_LOG_INFO);
 
@@ -794,10 +962,10 @@ void usb_tonex_one_handle(class_driver_t* driver_obj)
                 {
                     case USB_COMMAND_SET_PRESET:
                     {
-                        if (message.Payload < MAX_PRESETS)
+                        if ((message.Payload & 0xFFFF) < MAX_PEDAL_PRESETS)
                         {
                             // always using Stomp mode C for preset setting
-                            if (usb_tonex_one_set_preset_in_slot(message.Payload, C, 1) != ESP_OK)
+                            if (usb_tonex_one_set_preset_in_slot(message.Payload & 0xFFFF, C, 1, (message.Payload >> 16) & 0xFF) != ESP_OK)
                             {
                                 // failed return to queue?
                             }
@@ -806,10 +974,43 @@ void usb_tonex_one_handle(class_driver_t* driver_obj)
 
                     case USB_COMMAND_NEXT_PRESET:
                     {
-                        if (TonexData.Message.SlotCPreset < (MAX_PRESETS - 1))
+                        if (TonexData.Message.SlotCPreset < (MAX_PEDAL_PRESETS - 1))
                         {
                             // always using Stomp mode C for preset setting
-                            if (usb_tonex_one_set_preset_in_slot(TonexData.Message.SlotCPreset + 1, C, 1) != ESP_OK)
+                            if (usb_tonex_one_set_preset_in_slot(TonexData.Message.SlotCPreset + 1, C, 1, USB_BYPASS_UNCHANGED) != ESP_OK)
+                            {
+                                // failed return to queue?
+                            }
+                        }
+                    } break;
+
+                    case USB_COMMAND_STAGE_PRESET:
+                    {
+                        if ((message.Payload & 0xFFFF) < MAX_PEDAL_PRESETS)
+                        {
+                            StagedPreset = message.Payload & 0xFFFF;
+                            StagedBypass = (message.Payload >> 16) & 0xFF;
+                            StagedRequested = 1;
+                            usb_tonex_one_build_staged_frame();
+                        }
+                    } break;
+
+                    case USB_COMMAND_SET_STAGED_PRESET:
+                    {
+                        if ((message.Payload & 0xFFFF) < MAX_PEDAL_PRESETS)
+                        {
+                            if (usb_tonex_one_set_staged_preset(message.Payload & 0xFFFF, (message.Payload >> 16) & 0xFF) != ESP_OK)
+                            {
+                                // failed return to queue?
+                            }
+                        }
+                    } break;
+
+                    case USB_COMMAND_SET_PRESET_STATE:
+                    {
+                        if ((message.Payload & 0xFFFF) < MAX_PEDAL_PRESETS)
+                        {
+                            if (usb_tonex_one_set_preset_state(message.Payload & 0xFFFF, (message.Payload >> 16) & 0xFF) != ESP_OK)
                             {
                                 // failed return to queue?
                             }
@@ -821,7 +1022,7 @@ void usb_tonex_one_handle(class_driver_t* driver_obj)
                         if (TonexData.Message.SlotCPreset > 0)
                         {
                             // always using Stomp mode C for preset setting
-                            if (usb_tonex_one_set_preset_in_slot(TonexData.Message.SlotCPreset - 1, C, 1) != ESP_OK)
+                            if (usb_tonex_one_set_preset_in_slot(TonexData.Message.SlotCPreset - 1, C, 1, USB_BYPASS_UNCHANGED) != ESP_OK)
                             {
                                 // failed return to queue?
                             }
@@ -884,7 +1085,7 @@ void usb_tonex_one_handle(class_driver_t* driver_obj)
                         {
                             uint8_t temp_preset = TonexData.Message.SlotAPreset;
 
-                            if (temp_preset < (MAX_PRESETS - 1))
+                            if (temp_preset < (MAX_PEDAL_PRESETS - 1))
                             {
                                 temp_preset++;
                             }
@@ -893,7 +1094,7 @@ void usb_tonex_one_handle(class_driver_t* driver_obj)
                                 temp_preset--;
                             }
                             
-                            usb_tonex_one_set_preset_in_slot(temp_preset, A, 0);
+                            usb_tonex_one_set_preset_in_slot(temp_preset, A, 0, USB_BYPASS_UNCHANGED);
 
                             boot_init_needed = 0;
                         }
@@ -939,6 +1140,8 @@ void usb_tonex_one_init(class_driver_t* driver_obj, QueueHandle_t comms_queue)
 
     memset((void*)&TonexData, 0, sizeof(TonexData));
     TonexData.TonexState = COMMS_STATE_IDLE;
+    StagedRequested = 0;
+    StagedFramedLength = 0;
 
     // create queue for data receive
     data_rx_queue = xQueueCreate(2, sizeof(tCDCRxQueueEntry));
@@ -41,6 +41,9 @@ limitations under the License.
 #include <esp_http_server.h>
 #include "control.h"
 #include "wifi_config.h"
+#include "macro.h"
+#include "midi_parser.h"
+#include "midi_map.h"
 #include "task_priorities.h"
 
 #define WIFI_CONFIG_TASK_STACK_SIZE   (3 * 1024)
@@ -195,6 +198,36 @@ uint8_t get_submitted_value(char* dest, char* ptr)
     return 1;
 }
 
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Decode a submitted value of any length
+* PARAMETERS:  ptr: start of the value, after the =
+* RETURN:      decoded value, caller frees. NULL if out of memory
+* NOTES:       For multi line fields, too long for get_submitted_value.
+*              The request buffer is left as is, so later fields can still
+*              be found
+****************************************************************************/
+static char* get_submitted_text(char* ptr)
+{
+    size_t length = strcspn(ptr, "&");
+    char* value;
+    char* decoded;
+
+    value = malloc(length + 1);
+    if (value == NULL)
+    {
+        return NULL;
+    }
+
+    memcpy(value, ptr, length);
+    value[length] = 0;
+
+    decoded = url_decode(value);
+    free(value);
+
+    return decoded;
+}
+
 /****************************************************************************
 * NAME:        
 * DESCRIPTION: 
@@ -285,6 +318,17 @@ static esp_err_t update_post_handler(httpd_req_t* req)
         control_set_config_serial_midi_channel(atoi(value));        
     }
     
+    // look for dedupewindow
+    ptr = strstr(buf, "dedupewindow=");    
+    if (ptr != NULL)
+    {
+        // skip up to =
+        ptr += strlen("dedupewindow=");
+        get_submitted_value(value, ptr);
+
+        control_set_config_dedupe_window(atoi(value));        
+    }
+    
     // look for togglebypass
     ptr = strstr(buf, "togglebypass=");   
     temp_val = 0;
@@ -332,6 +376,151 @@ static esp_err_t update_post_handler(httpd_req_t* req)
         }
     }
     control_set_config_xv_md1_enable(temp_val);
+
+    // look for setlistenabled
+    ptr = strstr(buf, "setlistenabled=");    
+    temp_val = 0;
+    if (ptr != NULL)
+    {
+        // skip up to =
+        ptr += strlen("setlistenabled=");
+        get_submitted_value(value, ptr);
+
+        if (strcmp(value, "on") == 0)
+        {
+            temp_val = 1;
+        }
+    }
+    control_set_config_setlist_mode(temp_val);
+
+    // look for perfoverlay
+    ptr = strstr(buf, "perfoverlay=");    
+    temp_val = 0;
+    if (ptr != NULL)
+    {
+        // skip up to =
+        ptr += strlen("perfoverlay=");
+        get_submitted_value(value, ptr);
+
+        if (strcmp(value, "on") == 0)
+        {
+            temp_val = 1;
+        }
+    }
+    control_set_config_perf_overlay(temp_val);
+
+    // look for setlist, one song per line. Left blank keeps the current setlist
+    ptr = strstr(buf, "setlist=");    
+    if (ptr != NULL)
+    {
+        // skip up to =
+        ptr += strlen("setlist=");
+
+        char* decoded = get_submitted_text(ptr);
+
+        if ((decoded != NULL) && (strlen(decoded) > 0))
+        {
+            uint8_t song = 0;
+            char* save_ptr = NULL;
+            char* line = strtok_r(decoded, "\r\n", &save_ptr);
+
+            control_clear_setlist();
+
+            while ((line != NULL) && (song < MAX_SETLIST_SONGS))
+            {
+                if (strlen(line) > 0)
+                {
+                    control_set_setlist_song(song, line);
+                    song++;
+                }
+
+                line = strtok_r(NULL, "\r\n", &save_ptr);
+            }
+        }
+
+        free(decoded);
+    }
+
+    // look for macros, one per line. Line 1 is triggered by Midi CC 102, line 2 by CC 103 and so on.
+    // Left blank keeps the current macros
+    ptr = strstr(buf, "macros=");    
+    if (ptr != NULL)
+    {
+        // skip up to =
+        ptr += strlen("macros=");
+
+        char* decoded = get_submitted_text(ptr);
+
+        if ((decoded != NULL) && (strlen(decoded) > 0))
+        {
+            char* line = decoded;
+
+            // blank lines are kept so the line number stays the macro number
+            for (uint8_t macro = 0; macro < MAX_MACROS; macro++)
+            {
+                char* next = NULL;
+
+                if (line != NULL)
+                {
+                    next = strchr(line, '\n');
+                    if (next != NULL)
+                    {
+                        *next = 0;
+                        next++;
+                    }
+
+                    char* end = strchr(line, '\r');
+                    if (end != NULL)
+                    {
+                        *end = 0;
+                    }
+                }
+
+                control_set_macro(macro, (line != NULL) ? line : "");
+                line = next;
+            }
+        }
+
+        free(decoded);
+    }
+
+    // look for Midi mappings, one per line. Left blank keeps the current mappings
+    ptr = strstr(buf, "midimap=");    
+    if (ptr != NULL)
+    {
+        // skip up to =
+        ptr += strlen("midimap=");
+
+        char* decoded = get_submitted_text(ptr);
+
+        if ((decoded != NULL) && (strlen(decoded) > 0))
+        {
+            uint8_t mapping = 0;
+            char* save_ptr = NULL;
+            char* line = strtok_r(decoded, "\r\n", &save_ptr);
+
+            while ((line != NULL) && (mapping < MAX_MIDI_MAPPINGS))
+            {
+                if (strlen(line) > 0)
+                {
+                    control_set_midi_mapping(mapping, line);
+                    mapping++;
+                }
+
+                line = strtok_r(NULL, "\r\n", &save_ptr);
+            }
+
+            // clear the rest
+            while (mapping < MAX_MIDI_MAPPINGS)
+            {
+                control_set_midi_mapping(mapping, "");
+                mapping++;
+            }
+        }
+
+        free(decoded);
+    }
+
     free(buf);
 
     // Send a simple response
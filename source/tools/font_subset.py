@@ -0,0 +1,452 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2024  Greg Smith
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#         http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# Cuts an LVGL font (lv_font_conv output, such as the Montserrat fonts shipped with
+# LVGL) down to a set of characters, so only the glyphs the UI can show are linked.
+#
+# usage: font_subset.py [--chars RANGES] [--name NAME] [--compress] output.c input.c
+#
+#        --chars     characters to keep, as comma separated code points or ranges,
+#                    e.g. 0x20-0x7E,0xA0-0xFF (default). Characters the input font
+#                    doesn't have are skipped
+#        --name      lv_font_t symbol to define (default lv_font_subset)
+#        --compress  store the bitmaps with LVGL's RLE compression and line prefilter.
+#                    Needs LV_USE_FONT_COMPRESSED, and every draw decompresses the
+#                    glyph unless it comes from the glyph cache (display_glyph_cache.c)
+#
+# The input must be uncompressed, with class based kerning (lv_font_conv
+# --no-compress --force-fast-kern-format, as the LVGL built in fonts are).
+#
+# When the name is one of LVGL's built in fonts, e.g. lv_font_montserrat_48, the output
+# is only compiled while LVGL's own copy is disabled (LV_FONT_MONTSERRAT_48 0), so the
+# two can't clash. The font then needs declaring through LV_FONT_CUSTOM_DECLARE.
+
+import os
+import re
+import sys
+
+DEFAULT_CHARS = "0x20-0x7E,0xA0-0xFF"
+DEFAULT_NAME = "lv_font_subset"
+
+LV_FONT_FMT_TXT_PLAIN = 0
+LV_FONT_FMT_TXT_COMPRESSED = 1
+
+# runs shorter than this go in the sparse character map
+MIN_DENSE_RUN = 3
+
+# RLE, as decoded by rle_next() in lv_font_fmt_txt.c
+RLE_REPEAT_BITS = 11
+RLE_COUNTER_MAX = 63
+
+# sizeof() the LVGL structures, 32 bit target, for the flash estimate
+GLYPH_DSC_SIZE = 8
+CMAP_SIZE = 20
+
+def parse_chars(text):
+    chars = set()
+
+    for part in text.split(","):
+        part = part.strip()
+        if not part:
+            continue
+
+        if "-" in part:
+            first, last = part.split("-", 1)
+            chars.update(range(int(first, 0), int(last, 0) + 1))
+        else:
+            chars.add(int(part, 0))
+
+    return chars
+
+def get_block(text, pattern, path):
+    match = re.search(pattern + r"\s*=\s*\{(.*?)\n\};", text, re.S)
+    if not match:
+        raise ValueError("%s: no %s" % (path, pattern))
+    return match.group(1)
+
+def get_int(text, field, path, default=None):
+    match = re.search(r"\." + field + r"\s*=\s*(-?\d+)", text)
+    if not match:
+        if default is not None:
+            return default
+        raise ValueError("%s: no .%s" % (path, field))
+    return int(match.group(1))
+
+def get_values(block):
+    return [int(v, 0) for v in re.findall(r"-?0x[0-9A-Fa-f]+|-?\d+", block)]
+
+def parse_font(path):
+    with open(path, "r", encoding="utf-8") as f:
+        text = f.read()
+
+    font_dsc = get_block(text, r"lv_font_fmt_txt_dsc_t font_dsc", path)
+    if get_int(font_dsc, "bitmap_format", path) != LV_FONT_FMT_TXT_PLAIN:
+        raise ValueError("%s: compressed input fonts are not supported" % path)
+    if get_int(font_dsc, "kern_classes", path) != 1:
+        raise ValueError("%s: only class based kerning is supported" % path)
+
+    font = {}
+    font["bpp"] = get_int(font_dsc, "bpp", path)
+    if font["bpp"] not in (1, 2, 4, 8):
+        raise ValueError("%s: %d bpp is not supported" % (path, font["bpp"]))
+    font["kern_scale"] = get_int(font_dsc, "kern_scale", path)
+
+    public = text[text.rindex("lv_font_t"):]
+    for field in ("line_height", "base_line", "underline_position", "underline_thickness"):
+        font[field] = get_int(public, field, path, 0)
+
+    # bitmaps, one block per glyph after its U+XXXX comment. Glyph ids follow the same order
+    bitmap_block = get_block(text, r"glyph_bitmap\[\]", path)
+    parts = re.split(r"/\* U\+([0-9A-Fa-f]+) .*?\*/", bitmap_block)
+    letters = [int(p, 16) for p in parts[1::2]]
+    bitmaps = [bytes(get_values(p)) for p in parts[2::2]]
+
+    dsc_block = get_block(text, r"lv_font_fmt_txt_glyph_dsc_t glyph_dsc\[\]", path)
+    dscs = [tuple(int(v) for v in m) for m in
+            re.findall(r"\.bitmap_index = (\d+), \.adv_w = (\d+), \.box_w = (\d+), \.box_h = (\d+), "
+                       r"\.ofs_x = (-?\d+), \.ofs_y = (-?\d+)", dsc_block)]
+
+    # first entry is the reserved glyph 0
+    if len(dscs) != len(letters) + 1:
+        raise ValueError("%s: %d glyph descriptions for %d bitmaps" % (path, len(dscs), len(letters)))
+
+    font["glyphs"] = {}
+    for gid, letter in enumerate(letters, 1):
+        bitmap_index, adv_w, box_w, box_h, ofs_x, ofs_y = dscs[gid]
+        expected = (box_w * box_h * font["bpp"] + 7) // 8
+        if len(bitmaps[gid - 1]) != expected:
+            raise ValueError("%s: U+%04X has %d bitmap bytes, expected %d" % (path, letter, len(bitmaps[gid - 1]), expected))
+
+        font["glyphs"][letter] = {"gid": gid, "adv_w": adv_w, "box_w": box_w, "box_h": box_h,
+                                  "ofs_x": ofs_x, "ofs_y": ofs_y, "bitmap": bitmaps[gid - 1]}
+
+    font["left_class"] = get_values(get_block(text, r"kern_left_class_mapping\[\]", path))
+    font["right_class"] = get_values(get_block(text, r"kern_right_class_mapping\[\]", path))
+    font["class_values"] = get_values(get_block(text, r"kern_class_values\[\]", path))
+    kern_classes = get_block(text, r"lv_font_fmt_txt_kern_classes_t kern_classes", path)
+    font["left_class_cnt"] = get_int(kern_classes, "left_class_cnt", path)
+    font["right_class_cnt"] = get_int(kern_classes, "right_class_cnt", path)
+
+    # flash taken by the input, for the summary
+    font["size"] = (sum(len(b) for b in bitmaps) + len(dscs) * GLYPH_DSC_SIZE + len(font["left_class"]) +
+                    len(font["right_class"]) + len(font["class_values"]) +
+                    len(re.findall(r"\.range_start", text)) * CMAP_SIZE)
+    for unicode_list in re.findall(r"unicode_list_\d+\[\]\s*=\s*\{(.*?)\};", text, re.S):
+        font["size"] += len(get_values(unicode_list)) * 2
+
+    return font
+
+class BitWriter:
+    def __init__(self):
+        self.out = bytearray()
+        self.bits = 0
+        self.count = 0
+
+    def write(self, value, length):
+        # most significant bit first, as get_bits() reads them
+        for shift in range(length - 1, -1, -1):
+            self.bits = (self.bits << 1) | ((value >> shift) & 1)
+            self.count += 1
+            if self.count == 8:
+                self.out.append(self.bits)
+                self.bits = 0
+                self.count = 0
+
+    def flush(self):
+        if self.count:
+            self.out.append(self.bits << (8 - self.count))
+            self.bits = 0
+            self.count = 0
+        return bytes(self.out)
+
+def unpack_pixels(bitmap, count, bpp):
+    mask = (1 << bpp) - 1
+    return [(bitmap[(i * bpp) >> 3] >> (8 - bpp - ((i * bpp) & 7))) & mask for i in range(count)]
+
+def rle_compress(bitmap, box_w, box_h, bpp):
+    pixels = unpack_pixels(bitmap, box_w * box_h, bpp)
+
+    # prefilter: each line after the first is stored XOR the line above
+    values = pixels[:box_w]
+    for i in range(box_w, len(pixels)):
+        values.append(pixels[i] ^ pixels[i - box_w])
+
+    # mirrors the decoder's states. A literal equal to the one before starts a repeat,
+    # which is then one bit per pixel (1 same, 0 literal follows) for up to 11 pixels,
+    # after which a 6 bit counter covers the rest of the run
+    writer = BitWriter()
+    repeat = False
+    count = 0
+    prev = None
+    i = 0
+
+    while i < len(values):
+        if not repeat:
+            writer.write(values[i], bpp)
+            if (prev is not None) and (values[i] == prev):
+                repeat = True
+                count = 0
+            prev = values[i]
+            i += 1
+        elif values[i] == prev:
+            writer.write(1, 1)
+            count += 1
+            i += 1
+            if count == RLE_REPEAT_BITS:
+                run = 0
+                while (i + run < len(values)) and (run < RLE_COUNTER_MAX - 1) and (values[i + run] == prev):
+                    run += 1
+
+                # counter N repeats N - 1 more pixels, then reads a literal
+                writer.write(run + 1, 6)
+                i += run
+                repeat = False
+                if i < len(values):
+                    writer.write(values[i], bpp)
+                    prev = values[i]
+                    i += 1
+        else:
+            writer.write(0, 1)
+            writer.write(values[i], bpp)
+            prev = values[i]
+            repeat = False
+            i += 1
+
+    return writer.flush()
+
+def build_cmaps(letters):
+    # runs of consecutive letters as dense ranges, the rest in one sparse list. Glyph ids
+    # are handed out in map order, so each map's glyphs are consecutive
+    runs = []
+    for letter in letters:
+        if runs and (letter == runs[-1][-1] + 1):
+            runs[-1].append(letter)
+        else:
+            runs.append([letter])
+
+    dense = [r for r in runs if len(r) >= MIN_DENSE_RUN]
+    sparse = [l for r in runs if len(r) < MIN_DENSE_RUN for l in r]
+
+    cmaps = [{"start": r[0], "length": len(r), "list": None} for r in dense]
+    if sparse:
+        if sparse[-1] - sparse[0] > 0xFFFF:
+            raise ValueError("sparse characters span more than 64K code points")
+        cmaps.append({"start": sparse[0], "length": sparse[-1] - sparse[0] + 1,
+                      "list": [l - sparse[0] for l in sparse]})
+
+    order = []
+    for cmap in cmaps:
+        cmap["gid"] = len(order) + 1
+        order += [cmap["start"] + ofs for ofs in cmap["list"]] if cmap["list"] else \
+                 list(range(cmap["start"], cmap["start"] + cmap["length"]))
+
+    return cmaps, order
+
+def compact_classes(mapping):
+    # renumber the classes still in use, 0 stays "no kerning"
+    used = sorted(set(c for c in mapping if c))
+    return {old: new for new, old in enumerate(used, 1)}
+
+def format_values(values, per_line, fmt):
+    lines = []
+    for i in range(0, len(values), per_line):
+        lines.append("    " + ", ".join(fmt % v for v in values[i:i + per_line]))
+    return ",\n".join(lines)
+
+def write_font(path, name, font, order, cmaps, compress):
+    bpp = font["bpp"]
+    bitmap = bytearray()
+    dscs = ["    {.bitmap_index = 0, .adv_w = 0, .box_w = 0, .box_h = 0, .ofs_x = 0, .ofs_y = 0} /* id = 0 reserved */"]
+    bitmap_lines = []
+
+    for letter in order:
+        glyph = font["glyphs"][letter]
+        data = glyph["bitmap"]
+        if compress and data:
+            data = rle_compress(data, glyph["box_w"], glyph["box_h"], bpp)
+
+        dscs.append("    {.bitmap_index = %d, .adv_w = %d, .box_w = %d, .box_h = %d, .ofs_x = %d, .ofs_y = %d}" %
+                    (len(bitmap), glyph["adv_w"], glyph["box_w"], glyph["box_h"], glyph["ofs_x"], glyph["ofs_y"]))
+        bitmap_lines.append("    /* U+%04X */" % letter)
+        if data:
+            bitmap_lines.append(format_values(list(data), 16, "0x%02x") + ",")
+        bitmap += data
+
+    # the decoder can read one byte past the last glyph
+    bitmap_lines.append("    0x00")
+
+    # kerning classes of the kept glyphs only
+    left = [0] + [font["left_class"][font["glyphs"][l]["gid"]] for l in order]
+    right = [0] + [font["right_class"][font["glyphs"][l]["gid"]] for l in order]
+    left_map = compact_classes(left)
+    right_map = compact_classes(right)
+    class_values = []
+    for old_left in sorted(left_map):
+        for old_right in sorted(right_map):
+            class_values.append(font["class_values"][(old_left - 1) * font["right_class_cnt"] + (old_right - 1)])
+
+    # a font without kerning still needs one class pair
+    left_cnt = max(len(left_map), 1)
+    right_cnt = max(len(right_map), 1)
+    if not class_values:
+        class_values = [0]
+
+    guard = None
+    match = re.match(r"lv_font_(montserrat_\d+)$", name)
+    if match:
+        guard = "LV_FONT_" + match.group(1).upper()
+
+    out = []
+    out.append("/*******************************************************************************")
+    out.append(" * Generated by font_subset.py from %s, do not edit" % os.path.basename(font["path"]))
+    out.append(" * Bpp: %d%s" % (bpp, ", compressed" if compress else ""))
+    out.append(" * Glyphs: %d" % len(order))
+    out.append(" ******************************************************************************/")
+    out.append("")
+    out.append("#include \"lvgl.h\"")
+    out.append("")
+    if guard:
+        out.append("// LVGL's own copy wins when it is enabled")
+        out.append("#if !%s" % guard)
+        out.append("")
+    out.append("static LV_ATTRIBUTE_LARGE_CONST const uint8_t glyph_bitmap[] = {")
+    out += bitmap_lines
+    out.append("};")
+    out.append("")
+    out.append("static const lv_font_fmt_txt_glyph_dsc_t glyph_dsc[] = {")
+    out.append(",\n".join(dscs))
+    out.append("};")
+    out.append("")
+
+    for index, cmap in enumerate(cmaps):
+        if cmap["list"]:
+            out.append("static const uint16_t unicode_list_%d[] = {" % index)
+            out.append(format_values(cmap["list"], 8, "0x%x"))
+            out.append("};")
+            out.append("")
+
+    out.append("static const lv_font_fmt_txt_cmap_t cmaps[] = {")
+    entries = []
+    for index, cmap in enumerate(cmaps):
+        if cmap["list"]:
+            entries.append("    {\n        .range_start = %d, .range_length = %d, .glyph_id_start = %d,\n"
+                           "        .unicode_list = unicode_list_%d, .glyph_id_ofs_list = NULL, .list_length = %d, "
+                           ".type = LV_FONT_FMT_TXT_CMAP_SPARSE_TINY\n    }" %
+                           (cmap["start"], cmap["length"], cmap["gid"], index, len(cmap["list"])))
+        else:
+            entries.append("    {\n        .range_start = %d, .range_length = %d, .glyph_id_start = %d,\n"
+                           "        .unicode_list = NULL, .glyph_id_ofs_list = NULL, .list_length = 0, "
+                           ".type = LV_FONT_FMT_TXT_CMAP_FORMAT0_TINY\n    }" %
+                           (cmap["start"], cmap["length"], cmap["gid"]))
+    out.append(",\n".join(entries))
+    out.append("};")
+    out.append("")
+    out.append("static const uint8_t kern_left_class_mapping[] = {")
+    out.append(format_values([left_map.get(c, 0) for c in left], 16, "%d"))
+    out.append("};")
+    out.append("")
+    out.append("static const uint8_t kern_right_class_mapping[] = {")
+    out.append(format_values([right_map.get(c, 0) for c in right], 16, "%d"))
+    out.append("};")
+    out.append("")
+    out.append("static const int8_t kern_class_values[] = {")
+    out.append(format_values(class_values, 16, "%d"))
+    out.append("};")
+    out.append("")
+    out.append("static const lv_font_fmt_txt_kern_classes_t kern_classes = {")
+    out.append("    .class_pair_values   = kern_class_values,")
+    out.append("    .left_class_mapping  = kern_left_class_mapping,")
+    out.append("    .right_class_mapping = kern_right_class_mapping,")
+    out.append("    .left_class_cnt      = %d," % left_cnt)
+    out.append("    .right_class_cnt     = %d," % right_cnt)
+    out.append("};")
+    out.append("")
+    out.append("static lv_font_fmt_txt_glyph_cache_t cache;")
+    out.append("")
+    out.append("static const lv_font_fmt_txt_dsc_t font_dsc = {")
+    out.append("    .glyph_bitmap = glyph_bitmap,")
+    out.append("    .glyph_dsc = glyph_dsc,")
+    out.append("    .cmaps = cmaps,")
+    out.append("    .kern_dsc = &kern_classes,")
+    out.append("    .kern_scale = %d," % font["kern_scale"])
+    out.append("    .cmap_num = %d," % len(cmaps))
+    out.append("    .bpp = %d," % bpp)
+    out.append("    .kern_classes = 1,")
+    out.append("    .bitmap_format = %d," % (LV_FONT_FMT_TXT_COMPRESSED if compress else LV_FONT_FMT_TXT_PLAIN))
+    out.append("    .cache = &cache")
+    out.append("};")
+    out.append("")
+    out.append("const lv_font_t %s = {" % name)
+    out.append("    .get_glyph_dsc = lv_font_get_glyph_dsc_fmt_txt,")
+    out.append("    .get_glyph_bitmap = lv_font_get_bitmap_fmt_txt,")
+    out.append("    .line_height = %d," % font["line_height"])
+    out.append("    .base_line = %d," % font["base_line"])
+    out.append("    .subpx = LV_FONT_SUBPX_NONE,")
+    out.append("    .underline_position = %d," % font["underline_position"])
+    out.append("    .underline_thickness = %d," % font["underline_thickness"])
+    out.append("    .dsc = &font_dsc")
+    out.append("};")
+    if guard:
+        out.append("")
+        out.append("#endif /*!%s*/" % guard)
+    out.append("")
+
+    with open(path, "w", encoding="utf-8") as f:
+        f.write("\n".join(out))
+
+    return (len(bitmap) + 1 + len(dscs) * GLYPH_DSC_SIZE + len(left) + len(right) + len(class_values) +
+            len(cmaps) * CMAP_SIZE + sum(len(c["list"]) * 2 for c in cmaps if c["list"]))
+
+def main():
+    args = sys.argv[1:]
+    chars = DEFAULT_CHARS
+    name = DEFAULT_NAME
+    compress = False
+
+    while args and args[0].startswith("--"):
+        if (args[0] == "--chars") and (len(args) >= 2):
+            chars = args[1]
+            args = args[2:]
+        elif (args[0] == "--name") and (len(args) >= 2):
+            name = args[1]
+            args = args[2:]
+        elif args[0] == "--compress":
+            compress = True
+            args = args[1:]
+        else:
+            break
+
+    if len(args) != 2:
+        print("usage: font_subset.py [--chars RANGES] [--name NAME] [--compress] output.c input.c")
+        return 1
+
+    font = parse_font(args[1])
+    font["path"] = args[1]
+    wanted = parse_chars(chars)
+    letters = sorted(l for l in font["glyphs"] if l in wanted)
+    if not letters:
+        print("font_subset: %s has none of the characters %s" % (args[1], chars))
+        return 1
+
+    cmaps, order = build_cmaps(letters)
+    size = write_font(args[0], name, font, order, cmaps, compress)
+
+    print("font_subset: %s, %d of %d glyphs, %d bytes (was %d)%s" %
+          (name, len(order), len(font["glyphs"]), size, font["size"], ", compressed" if compress else ""))
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
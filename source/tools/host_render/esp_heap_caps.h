@@ -0,0 +1,28 @@
+/*
+ Copyright (C) 2024  Greg Smith
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+ 
+*/
+
+// stands in for the ESP-IDF heap capabilities API. The host has one heap
+
+#pragma once
+
+#include <stdlib.h>
+
+#define MALLOC_CAP_SPIRAM               (1 << 10)
+#define MALLOC_CAP_INTERNAL             (1 << 11)
+
+#define heap_caps_malloc(size, caps)    malloc(size)
+#define heap_caps_free(ptr)             free(ptr)
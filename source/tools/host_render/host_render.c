@@ -0,0 +1,1005 @@
+/*
+ Copyright (C) 2024  Greg Smith
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+ 
+*/
+
+// Headless renderer for the display UI. Runs ui_init() and the display task's
+// update logic (ui_update.c) against an in-memory LVGL display, times each UI
+// transition and optionally writes or compares frames as PNG.
+//
+// usage: host_render [--iterations N] [--out folder] [--golden folder] [--update] [--tolerance N]
+//                    [--blend lvgl|reference|word] [--kernels] [--fonts]
+//   --out       write the final frame of each transition to folder/<name>.png
+//   --golden    compare the final frame of each transition against folder/<name>.png
+//   --update    with --golden, rewrite the golden images instead of comparing
+//   --tolerance largest per channel difference still counted as a match (default 0)
+//   --blend     blend kernels to draw with (default as sdkconfig.h)
+//   --kernels   check every blend kernel set against LVGL's own blending and time
+//               them, instead of rendering the UI
+//   --fonts     time a line of text in LVGL's full UI fonts against the subset fonts,
+//               with and without the glyph cache, instead of rendering the UI
+// Exit code is 1 if any frame differs from its golden image, any kernel from LVGL, or
+// any subset or cached font from LVGL's full font.
+
+#include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <math.h>
+#include "sdkconfig.h"
+#include "lvgl.h"
+#include "src/extra/libs/png/lodepng.h"
+#include "src/draw/sw/lv_draw_sw.h"
+#include "ui.h"
+#include "control.h"
+#include "ui_update.h"
+#include "display_blend.h"
+#include "display_glyph_cache.h"
+
+// same as the Waveshare panel
+#define HOST_LCD_H_RES                  800
+#define HOST_LCD_V_RES                  480
+
+#define HOST_DEFAULT_ITERATIONS         200
+#define HOST_SETTLE_TIME_MS             1000
+#define HOST_SETTLE_STEP_MS             5
+#define HOST_PATH_LENGTH                256
+
+// kernel check buffer. Odd width, so rows start at alternating alignment
+#define KERNEL_TEST_WIDTH               203
+#define KERNEL_TEST_HEIGHT              121
+#define KERNEL_TEST_CASES               20000
+#define KERNEL_GLYPH_WIDTH              36          // about one Montserrat 48 glyph
+#define KERNEL_GLYPH_HEIGHT             48
+#define KERNEL_IMAGE_SIZE               64          // about one status icon
+
+// font benchmark text, a preset name and every other printable ASCII character
+#define FONT_SAMPLE_TEXT                "12: Clean Twin Reverb\nABDEFGHIJKLMNOPQSUVWXYZ\nbdfghjkmopqsuvxyz\n034-56789 !\"#$%&'()*+,./:;<=>?@[\\]^_`{|}~"
+
+// one UI transition, flipped between two states each iteration
+typedef struct
+{
+    const char* Name;
+    void (*Apply)(uint8_t state);
+} tRenderScenario;
+
+typedef struct
+{
+    uint32_t Iterations;
+    const char* OutFolder;
+    const char* GoldenFolder;
+    uint8_t UpdateGolden;
+    uint8_t Tolerance;
+    uint8_t Blend;
+    uint8_t KernelTest;
+    uint8_t FontTest;
+} tRenderOptions;
+
+// one draw operation for the kernel benchmark, repeated across the screen
+typedef struct
+{
+    const char* Name;
+    lv_coord_t Width;
+    lv_coord_t Height;
+    const lv_color_t* Source;
+    lv_opa_t* Mask;
+} tKernelBenchmark;
+
+// one UI font, LVGL's full copy and the subset the firmware build makes
+typedef struct
+{
+    const char* Name;
+    const lv_font_t* Full;
+    const lv_font_t* Subset;
+} tFontBenchmark;
+
+enum FontVariants
+{
+    FONT_VARIANT_FULL,
+    FONT_VARIANT_SUBSET,
+    FONT_VARIANT_CACHED,
+    FONT_VARIANT_MAX
+};
+
+LV_FONT_DECLARE(subset_montserrat_30)
+LV_FONT_DECLARE(subset_montserrat_34)
+LV_FONT_DECLARE(subset_montserrat_48)
+
+static lv_color_t FrameBuffer[HOST_LCD_H_RES * HOST_LCD_V_RES];
+static uint32_t RefreshPixels;
+static uint32_t RandomState = 0x12345678;
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Event handlers the generated UI links against. The device
+*              versions in display.c post to the control task, not needed here
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void PreviousClicked(lv_event_t * e) {}
+void NextClicked(lv_event_t * e) {}
+void BTBondsClearRequest(lv_event_t * e) {}
+void AmpSkinPrevious(lv_event_t * e) {}
+void AmpSkinNext(lv_event_t * e) {}
+void PresetDescriptionChanged(lv_event_t * e) {}
+void SaveUserDataRequest(lv_event_t * e) {}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      monotonic time in usec
+* NOTES:       
+*****************************************************************************/
+static uint64_t host_get_time_us(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((uint64_t)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Direct mode, LVGL has already drawn into the frame buffer
+*****************************************************************************/
+static void host_flush_cb(lv_disp_drv_t *drv, const lv_area_t *area, lv_color_t *color_map)
+{
+    lv_disp_flush_ready(drv);
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static void host_monitor_cb(lv_disp_drv_t *drv, uint32_t time_ms, uint32_t px)
+{
+    RefreshPixels += px;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Run timers and animations until the screen is stable
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static void host_settle(void)
+{
+    for (uint32_t elapsed = 0; elapsed < HOST_SETTLE_TIME_MS; elapsed += HOST_SETTLE_STEP_MS)
+    {
+        lv_tick_inc(HOST_SETTLE_STEP_MS);
+        lv_timer_handler();
+    }
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: UI transitions, as posted by the control task
+* PARAMETERS:  state: 0 or 1
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static void scenario_preset_change(uint8_t state)
+{
+    if (state == 0)
+    {
+        ui_update_record(UI_ELEMENT_PRESET_NAME, UI_ACTION_SET_LABEL_TEXT, 0, "1: Clean Twin");
+        ui_update_record(UI_ELEMENT_AMP_SKIN, UI_ACTION_SET_STATE, AMP_SKIN_TWIN_REVERB, NULL);
+        ui_update_record(UI_ELEMENT_PRESET_DESCRIPTION, UI_ACTION_SET_ENTRY_TEXT, 0, "Bright clean, spring reverb");
+    }
+    else
+    {
+        ui_update_record(UI_ELEMENT_PRESET_NAME, UI_ACTION_SET_LABEL_TEXT, 0, "2: Crunch 800");
+        ui_update_record(UI_ELEMENT_AMP_SKIN, UI_ACTION_SET_STATE, AMP_SKIN_JCM800, NULL);
+        ui_update_record(UI_ELEMENT_PRESET_DESCRIPTION, UI_ACTION_SET_ENTRY_TEXT, 0, "Classic British crunch");
+    }
+}
+
+static void scenario_skin_change(uint8_t state)
+{
+    ui_update_record(UI_ELEMENT_AMP_SKIN, UI_ACTION_SET_STATE, (state == 0) ? AMP_SKIN_5150 : AMP_SKIN_AC30, NULL);
+}
+
+static void scenario_status_icons(uint8_t state)
+{
+    ui_update_record(UI_ELEMENT_USB_STATUS, UI_ACTION_SET_STATE, state, NULL);
+    ui_update_record(UI_ELEMENT_BT_STATUS, UI_ACTION_SET_STATE, state, NULL);
+}
+
+static void scenario_staged_song(uint8_t state)
+{
+    ui_update_record(UI_ELEMENT_STAGED_SONG, UI_ACTION_STAGE_STATE, (state == 0) ? AMP_SKIN_DEVILLE : AMP_SKIN_PRINCETON, NULL);
+    ui_update_record(UI_ELEMENT_STAGED_SONG, UI_ACTION_STAGE_LABEL_TEXT, 0, (state == 0) ? "Song 1: Intro" : "Song 2: Second Song");
+    ui_update_record(UI_ELEMENT_STAGED_SONG, UI_ACTION_STAGE_ENTRY_TEXT, 0, (state == 0) ? "Verse patch" : "Lead patch");
+    ui_update_record(UI_ELEMENT_STAGED_SONG, UI_ACTION_COMMIT_STAGED, 0, NULL);
+}
+
+static const tRenderScenario Scenarios[] =
+{
+    {"preset_change", scenario_preset_change},
+    {"skin_change", scenario_skin_change},
+    {"status_icons", scenario_status_icons},
+    {"staged_song", scenario_staged_song},
+};
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Convert the frame buffer to 24 bit RGB
+* PARAMETERS:  
+* RETURN:      buffer to free(), or NULL
+* NOTES:       
+*****************************************************************************/
+static uint8_t* host_get_frame_rgb(void)
+{
+    uint8_t* rgb = malloc(HOST_LCD_H_RES * HOST_LCD_V_RES * 3);
+
+    if (rgb == NULL)
+    {
+        return NULL;
+    }
+
+    for (uint32_t loop = 0; loop < (HOST_LCD_H_RES * HOST_LCD_V_RES); loop++)
+    {
+        uint32_t colour = lv_color_to32(FrameBuffer[loop]);
+
+        rgb[(loop * 3) + 0] = (colour >> 16) & 0xFF;
+        rgb[(loop * 3) + 1] = (colour >> 8) & 0xFF;
+        rgb[(loop * 3) + 2] = colour & 0xFF;
+    }
+
+    return rgb;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      1 on success
+* NOTES:       
+*****************************************************************************/
+static uint8_t host_write_png(const char* folder, const char* name, const uint8_t* rgb)
+{
+    char path[HOST_PATH_LENGTH];
+    unsigned char* png = NULL;
+    size_t png_size = 0;
+    unsigned error;
+    FILE* file;
+    uint8_t result = 0;
+
+    snprintf(path, sizeof(path), "%s/%s.png", folder, name);
+
+    // encoded in memory, lodepng's own file functions go through the LVGL file system
+    error = lodepng_encode24(&png, &png_size, rgb, HOST_LCD_H_RES, HOST_LCD_V_RES);
+    if (error)
+    {
+        printf("Failed to encode %s: %s\n", path, lodepng_error_text(error));
+        return 0;
+    }
+
+    file = fopen(path, "wb");
+    if (file != NULL)
+    {
+        result = (fwrite(png, 1, png_size, file) == png_size);
+        fclose(file);
+    }
+
+    if (!result)
+    {
+        printf("Failed to write %s\n", path);
+    }
+
+    lv_mem_free(png);
+
+    return result;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Compare a frame with its golden image
+* PARAMETERS:  
+* RETURN:      pixels that differ by more than the tolerance, or -1 on error
+* NOTES:       
+*****************************************************************************/
+static int32_t host_compare_png(const char* folder, const char* name, const uint8_t* rgb, uint8_t tolerance)
+{
+    char path[HOST_PATH_LENGTH];
+    unsigned char* golden = NULL;
+    unsigned char* png;
+    long png_size;
+    FILE* file;
+    unsigned width;
+    unsigned height;
+    unsigned error;
+    int32_t different = 0;
+
+    snprintf(path, sizeof(path), "%s/%s.png", folder, name);
+
+    file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        printf("Failed to open %s\n", path);
+        return -1;
+    }
+
+    fseek(file, 0, SEEK_END);
+    png_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    png = malloc(png_size);
+    if ((png == NULL) || (fread(png, 1, png_size, file) != png_size))
+    {
+        printf("Failed to read %s\n", path);
+        fclose(file);
+        free(png);
+        return -1;
+    }
+    fclose(file);
+
+    error = lodepng_decode24(&golden, &width, &height, png, png_size);
+    free(png);
+
+    if (error)
+    {
+        printf("Failed to decode %s: %s\n", path, lodepng_error_text(error));
+        return -1;
+    }
+
+    if ((width != HOST_LCD_H_RES) || (height != HOST_LCD_V_RES))
+    {
+        printf("%s is %ux%u, expected %ux%u\n", path, width, height, HOST_LCD_H_RES, HOST_LCD_V_RES);
+        lv_mem_free(golden);
+        return -1;
+    }
+
+    for (uint32_t loop = 0; loop < (HOST_LCD_H_RES * HOST_LCD_V_RES); loop++)
+    {
+        for (uint8_t channel = 0; channel < 3; channel++)
+        {
+            if (abs((int)rgb[(loop * 3) + channel] - (int)golden[(loop * 3) + channel]) > tolerance)
+            {
+                different++;
+                break;
+            }
+        }
+    }
+
+    lv_mem_free(golden);
+
+    return different;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Time one transition and check its final frame
+* PARAMETERS:  
+* RETURN:      1 if the frame matched, or there was nothing to compare
+* NOTES:       Each timed render covers ui_update_render() plus the LVGL
+*              redraw, the same work as one display task pass on the device
+*****************************************************************************/
+static uint8_t host_run_scenario(const tRenderScenario* scenario, const tRenderOptions* options)
+{
+    uint64_t total = 0;
+    uint64_t min = UINT64_MAX;
+    uint64_t max = 0;
+    uint64_t start;
+    uint64_t time;
+    uint8_t result = 1;
+    uint8_t* rgb;
+
+    RefreshPixels = 0;
+
+    for (uint32_t loop = 0; loop < options->Iterations; loop++)
+    {
+        scenario->Apply(loop & 1);
+
+        start = host_get_time_us();
+        ui_update_render();
+        lv_refr_now(NULL);
+        time = host_get_time_us() - start;
+
+        total += time;
+        min = (time < min) ? time : min;
+        max = (time > max) ? time : max;
+    }
+
+    printf("%-16s %8u %10.1f %10.1f %10.1f %10u\n", scenario->Name, (unsigned)options->Iterations,
+           (double)total / options->Iterations, (double)min, (double)max,
+           (unsigned)(RefreshPixels / options->Iterations));
+
+    // frames are checked in state 0
+    scenario->Apply(0);
+    ui_update_render();
+    lv_refr_now(NULL);
+
+    if ((options->OutFolder == NULL) && (options->GoldenFolder == NULL))
+    {
+        return 1;
+    }
+
+    rgb = host_get_frame_rgb();
+    if (rgb == NULL)
+    {
+        return 0;
+    }
+
+    if (options->OutFolder != NULL)
+    {
+        host_write_png(options->OutFolder, scenario->Name, rgb);
+    }
+
+    if (options->GoldenFolder != NULL)
+    {
+        if (options->UpdateGolden)
+        {
+            result = host_write_png(options->GoldenFolder, scenario->Name, rgb);
+        }
+        else
+        {
+            int32_t different = host_compare_png(options->GoldenFolder, scenario->Name, rgb, options->Tolerance);
+
+            if (different != 0)
+            {
+                if (different > 0)
+                {
+                    printf("%s: %d pixels differ from the golden image\n", scenario->Name, (int)different);
+                }
+                result = 0;
+            }
+        }
+    }
+
+    free(rgb);
+
+    return result;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      pseudo random number, repeatable between runs
+* NOTES:       xorshift32
+*****************************************************************************/
+static uint32_t host_random(void)
+{
+    RandomState ^= RandomState << 13;
+    RandomState ^= RandomState >> 17;
+    RandomState ^= RandomState << 5;
+
+    return RandomState;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Random area, clamped to the given bounds
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static void host_random_area(lv_area_t* area, lv_coord_t max_width, lv_coord_t max_height)
+{
+    area->x1 = host_random() % max_width;
+    area->y1 = host_random() % max_height;
+    area->x2 = area->x1 + (host_random() % (max_width - area->x1));
+    area->y2 = area->y1 + (host_random() % (max_height - area->y1));
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Random A8 mask shaped like glyph coverage, runs of clear and
+*              set with anti-aliased values in between
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static void host_random_mask(lv_opa_t* mask, uint32_t size)
+{
+    uint32_t loop = 0;
+
+    while (loop < size)
+    {
+        uint32_t run = 1 + (host_random() % 12);
+        uint32_t type = host_random() % 3;
+
+        for (; (run > 0) && (loop < size); run--, loop++)
+        {
+            mask[loop] = (type == 0) ? LV_OPA_TRANSP : (type == 1) ? LV_OPA_COVER : (lv_opa_t)host_random();
+        }
+    }
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Point the display's draw context at a buffer
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static void host_set_draw_buffer(lv_draw_ctx_t* draw_ctx, lv_color_t* buffer, lv_area_t* buffer_area, const lv_area_t* clip_area)
+{
+    draw_ctx->buf = buffer;
+    draw_ctx->buf_area = buffer_area;
+    draw_ctx->clip_area = clip_area;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Check every kernel set against LVGL's own blending
+* PARAMETERS:  
+* RETURN:      1 if all matched
+* NOTES:       Random fills, glyph style masks and masked images, with random
+*              clipping, opacity and mask results. Runs through the blend
+*              callback, so the fallbacks and offsets are covered too
+*****************************************************************************/
+static uint8_t host_check_kernels(lv_draw_ctx_t* draw_ctx)
+{
+    static lv_color_t background[KERNEL_TEST_WIDTH * KERNEL_TEST_HEIGHT];
+    static lv_color_t result[BLEND_KERNELS_MAX][KERNEL_TEST_WIDTH * KERNEL_TEST_HEIGHT];
+    static lv_color_t source[KERNEL_TEST_WIDTH * KERNEL_TEST_HEIGHT];
+    static lv_opa_t mask[KERNEL_TEST_WIDTH * KERNEL_TEST_HEIGHT];
+    static const lv_opa_t opacities[] = {LV_OPA_COVER, 254, LV_OPA_MAX, 200, LV_OPA_50};
+    static const lv_draw_mask_res_t mask_results[] = {LV_DRAW_MASK_RES_CHANGED, LV_DRAW_MASK_RES_CHANGED, LV_DRAW_MASK_RES_FULL_COVER, LV_DRAW_MASK_RES_TRANSP};
+    lv_area_t buffer_area = {0, 0, KERNEL_TEST_WIDTH - 1, KERNEL_TEST_HEIGHT - 1};
+    uint32_t failed[BLEND_KERNELS_MAX] = {0};
+    uint8_t passed = 1;
+
+    for (uint32_t loop = 0; loop < (KERNEL_TEST_WIDTH * KERNEL_TEST_HEIGHT); loop++)
+    {
+        background[loop].full = (uint16_t)host_random();
+        source[loop].full = (uint16_t)host_random();
+    }
+
+    for (uint32_t test = 0; test < KERNEL_TEST_CASES; test++)
+    {
+        lv_draw_sw_blend_dsc_t dsc;
+        lv_area_t blend_area;
+        lv_area_t mask_area;
+        lv_area_t clip_area;
+        uint32_t type = host_random() % 3;
+
+        // mask area covers the blend area, as LVGL's draw functions set it up
+        host_random_area(&blend_area, KERNEL_TEST_WIDTH, KERNEL_TEST_HEIGHT);
+        host_random_area(&clip_area, KERNEL_TEST_WIDTH, KERNEL_TEST_HEIGHT);
+        mask_area = blend_area;
+        mask_area.x1 -= (mask_area.x1 > 0) ? (host_random() % 2) : 0;
+        host_random_mask(mask, lv_area_get_size(&mask_area));
+
+        lv_memset_00(&dsc, sizeof(dsc));
+        dsc.blend_area = &blend_area;
+        dsc.color.full = (uint16_t)host_random();
+        dsc.opa = opacities[host_random() % (sizeof(opacities) / sizeof(opacities[0]))];
+        dsc.blend_mode = ((host_random() % 16) == 0) ? LV_BLEND_MODE_ADDITIVE : LV_BLEND_MODE_NORMAL;
+        dsc.src_buf = (type == 2) ? source : NULL;
+
+        if (type != 0)
+        {
+            dsc.mask_buf = mask;
+            dsc.mask_area = &mask_area;
+            dsc.mask_res = mask_results[host_random() % (sizeof(mask_results) / sizeof(mask_results[0]))];
+        }
+
+        for (uint8_t kernels = 0; kernels < BLEND_KERNELS_MAX; kernels++)
+        {
+            memcpy(result[kernels], background, sizeof(background));
+            display_blend_set_kernels(kernels);
+            host_set_draw_buffer(draw_ctx, result[kernels], &buffer_area, &clip_area);
+            lv_draw_sw_blend(draw_ctx, &dsc);
+
+            if ((kernels != BLEND_KERNELS_LVGL) && (memcmp(result[kernels], result[BLEND_KERNELS_LVGL], sizeof(background)) != 0))
+            {
+                if (failed[kernels] == 0)
+                {
+                    printf("%s: case %u differs from lvgl, type %u opa %u mask res %u blend (%d,%d)-(%d,%d) clip (%d,%d)-(%d,%d)\n",
+                           display_blend_get_name(kernels), (unsigned)test, (unsigned)type, dsc.opa, dsc.mask_res,
+                           blend_area.x1, blend_area.y1, blend_area.x2, blend_area.y2,
+                           clip_area.x1, clip_area.y1, clip_area.x2, clip_area.y2);
+                }
+                failed[kernels]++;
+                passed = 0;
+            }
+        }
+    }
+
+    for (uint8_t kernels = BLEND_KERNELS_REFERENCE; kernels < BLEND_KERNELS_MAX; kernels++)
+    {
+        printf("%-10s %u of %u cases match lvgl\n", display_blend_get_name(kernels),
+               (unsigned)(KERNEL_TEST_CASES - failed[kernels]), (unsigned)KERNEL_TEST_CASES);
+    }
+
+    return passed;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Time each kernel set on the operations the UI draws
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Each pass draws the operation tiled over the whole frame
+*              buffer, at every horizontal alignment
+*****************************************************************************/
+static void host_benchmark_kernels(lv_draw_ctx_t* draw_ctx, uint32_t iterations)
+{
+    static lv_opa_t glyph[KERNEL_GLYPH_WIDTH * KERNEL_GLYPH_HEIGHT];
+    static lv_color_t image[KERNEL_IMAGE_SIZE * KERNEL_IMAGE_SIZE];
+    static lv_opa_t image_alpha[KERNEL_IMAGE_SIZE * KERNEL_IMAGE_SIZE];
+    lv_area_t screen_area = {0, 0, HOST_LCD_H_RES - 1, HOST_LCD_V_RES - 1};
+    const tKernelBenchmark benchmarks[] =
+    {
+        {"fill", HOST_LCD_H_RES, HOST_LCD_V_RES, NULL, NULL},
+        {"glyph", KERNEL_GLYPH_WIDTH, KERNEL_GLYPH_HEIGHT, NULL, glyph},
+        {"alpha image", KERNEL_IMAGE_SIZE, KERNEL_IMAGE_SIZE, image, image_alpha},
+    };
+
+    // a ring for the glyph and a soft edged disc for the image, each with solid
+    // and clear areas and an anti-aliased edge
+    for (int32_t y = 0; y < KERNEL_GLYPH_HEIGHT; y++)
+    {
+        for (int32_t x = 0; x < KERNEL_GLYPH_WIDTH; x++)
+        {
+            int32_t dx = (2 * x) - KERNEL_GLYPH_WIDTH;
+            int32_t dy = (2 * y) - KERNEL_GLYPH_HEIGHT;
+            int32_t distance = abs((int32_t)sqrt((dx * dx) + (dy * dy)) - ((KERNEL_GLYPH_WIDTH * 3) / 4));
+            int32_t coverage = 255 - ((distance - 6) * 64);
+
+            glyph[(y * KERNEL_GLYPH_WIDTH) + x] = (coverage > 255) ? 255 : (coverage < 0) ? 0 : coverage;
+        }
+    }
+
+    for (int32_t y = 0; y < KERNEL_IMAGE_SIZE; y++)
+    {
+        for (int32_t x = 0; x < KERNEL_IMAGE_SIZE; x++)
+        {
+            int32_t dx = (2 * x) - KERNEL_IMAGE_SIZE;
+            int32_t dy = (2 * y) - KERNEL_IMAGE_SIZE;
+            int32_t coverage = (KERNEL_IMAGE_SIZE - (int32_t)sqrt((dx * dx) + (dy * dy))) * 32;
+
+            image[(y * KERNEL_IMAGE_SIZE) + x] = lv_color_make(x * 4, y * 4, 128);
+            image_alpha[(y * KERNEL_IMAGE_SIZE) + x] = (coverage > 255) ? 255 : (coverage < 0) ? 0 : coverage;
+        }
+    }
+
+    printf("\n%-12s %-10s %10s %10s %10s\n", "operation", "kernels", "avg us", "min us", "Mpx/s");
+
+    for (uint8_t bench = 0; bench < (sizeof(benchmarks) / sizeof(benchmarks[0])); bench++)
+    {
+        const tKernelBenchmark* benchmark = &benchmarks[bench];
+        uint64_t total[BLEND_KERNELS_MAX] = {0};
+        uint64_t min[BLEND_KERNELS_MAX];
+        uint32_t pixels = 0;
+
+        for (uint8_t kernels = 0; kernels < BLEND_KERNELS_MAX; kernels++)
+        {
+            min[kernels] = UINT64_MAX;
+        }
+
+        // kernel sets take turns each pass, so they see the same host load
+        for (uint32_t loop = 0; loop < iterations; loop++)
+        {
+            for (uint8_t kernels = 0; kernels < BLEND_KERNELS_MAX; kernels++)
+            {
+                uint64_t start;
+                uint64_t time;
+
+                // the UI draws text and icons over solid panels
+                for (uint32_t px = 0; px < (HOST_LCD_H_RES * HOST_LCD_V_RES); px++)
+                {
+                    FrameBuffer[px] = lv_color_make(0x20, 0x30, 0x40);
+                }
+
+                display_blend_set_kernels(kernels);
+                host_set_draw_buffer(draw_ctx, FrameBuffer, &screen_area, &screen_area);
+                pixels = 0;
+
+                start = host_get_time_us();
+
+                // step by one extra pixel per row of tiles, covering every alignment
+                for (lv_coord_t y = 0; (y + benchmark->Height) <= HOST_LCD_V_RES; y += benchmark->Height)
+                {
+                    for (lv_coord_t x = (y / benchmark->Height) & 0x03; (x + benchmark->Width) <= HOST_LCD_H_RES; x += benchmark->Width)
+                    {
+                        lv_area_t area = {x, y, x + benchmark->Width - 1, y + benchmark->Height - 1};
+                        lv_draw_sw_blend_dsc_t dsc;
+
+                        lv_memset_00(&dsc, sizeof(dsc));
+                        dsc.blend_area = &area;
+                        dsc.color = lv_color_make(0xE0, 0xE0, 0xE0);
+                        dsc.opa = LV_OPA_COVER;
+                        dsc.blend_mode = LV_BLEND_MODE_NORMAL;
+                        dsc.src_buf = benchmark->Source;
+                        dsc.mask_buf = benchmark->Mask;
+                        dsc.mask_area = &area;
+                        dsc.mask_res = (benchmark->Mask != NULL) ? LV_DRAW_MASK_RES_CHANGED : LV_DRAW_MASK_RES_FULL_COVER;
+
+                        lv_draw_sw_blend(draw_ctx, &dsc);
+                        pixels += lv_area_get_size(&area);
+                    }
+                }
+
+                time = host_get_time_us() - start;
+                total[kernels] += time;
+                min[kernels] = (time < min[kernels]) ? time : min[kernels];
+            }
+        }
+
+        // throughput from the best pass, the least disturbed by the host
+        for (uint8_t kernels = 0; kernels < BLEND_KERNELS_MAX; kernels++)
+        {
+            printf("%-12s %-10s %10.1f %10.1f %10.1f\n", benchmark->Name, display_blend_get_name(kernels),
+                   (double)total[kernels] / iterations, (double)min[kernels],
+                   (min[kernels] > 0) ? (double)pixels / min[kernels] : 0.0);
+        }
+    }
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Check and time the blend kernels
+* PARAMETERS:  
+* RETURN:      1 if all kernels matched LVGL
+* NOTES:       Borrows the display's draw context outside a refresh
+*****************************************************************************/
+static uint8_t host_run_kernels(lv_disp_t* disp, uint32_t iterations)
+{
+    lv_draw_ctx_t* draw_ctx = disp->driver->draw_ctx;
+    lv_draw_ctx_t saved = *draw_ctx;
+    uint8_t blend = display_blend_get_kernels();
+    uint8_t passed;
+
+    _lv_refr_set_disp_refreshing(disp);
+
+    passed = host_check_kernels(draw_ctx);
+    host_benchmark_kernels(draw_ctx, iterations);
+
+    _lv_refr_set_disp_refreshing(NULL);
+    *draw_ctx = saved;
+    display_blend_set_kernels(blend);
+
+    return passed;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Time each UI font drawing a few lines of text, as LVGL's full
+*              font, the subset and the subset through the glyph cache
+* PARAMETERS:  
+* RETURN:      1 if every variant drew the same pixels as the full font
+* NOTES:       Variants take turns each pass, as the kernel benchmark. The
+*              first draw through the cache rasterises the glyphs, and is not
+*              timed
+*****************************************************************************/
+static uint8_t host_run_fonts(uint32_t iterations)
+{
+    static lv_color_t reference[HOST_LCD_H_RES * HOST_LCD_V_RES];
+    const tFontBenchmark fonts[] =
+    {
+        {"montserrat_30", &lv_font_montserrat_30, &subset_montserrat_30},
+        {"montserrat_34", &lv_font_montserrat_34, &subset_montserrat_34},
+        {"montserrat_48", &lv_font_montserrat_48, &subset_montserrat_48},
+    };
+    const char* variant_names[FONT_VARIANT_MAX] = {"full", "subset", "cached"};
+    tGlyphCacheStats stats;
+    lv_obj_t* screen = lv_obj_create(NULL);
+    lv_obj_t* label = lv_label_create(screen);
+    uint8_t passed = 1;
+
+    lv_obj_set_style_bg_color(screen, lv_color_make(0x20, 0x30, 0x40), LV_PART_MAIN | LV_STATE_DEFAULT);
+    lv_obj_set_style_text_color(label, lv_color_make(0xE0, 0xE0, 0xE0), LV_PART_MAIN | LV_STATE_DEFAULT);
+    lv_obj_set_width(label, HOST_LCD_H_RES - 20);
+    lv_obj_set_pos(label, 10, 10);
+    lv_label_set_long_mode(label, LV_LABEL_LONG_WRAP);
+    lv_label_set_text(label, FONT_SAMPLE_TEXT);
+    lv_scr_load(screen);
+
+    printf("%-14s %-8s %10s %10s %8s\n", "font", "variant", "avg us", "min us", "match");
+
+    for (uint8_t loop = 0; loop < (sizeof(fonts) / sizeof(fonts[0])); loop++)
+    {
+        const lv_font_t* variants[FONT_VARIANT_MAX] =
+        {
+            fonts[loop].Full,
+            fonts[loop].Subset,
+            display_glyph_cache_font(fonts[loop].Subset)
+        };
+        uint64_t total[FONT_VARIANT_MAX] = {0};
+        uint64_t min[FONT_VARIANT_MAX];
+        uint8_t match[FONT_VARIANT_MAX];
+
+        for (uint8_t variant = 0; variant < FONT_VARIANT_MAX; variant++)
+        {
+            // untimed draw, fills the glyph cache and checks the pixels
+            lv_obj_set_style_text_font(label, variants[variant], LV_PART_MAIN | LV_STATE_DEFAULT);
+            lv_obj_invalidate(screen);
+            lv_refr_now(NULL);
+
+            if (variant == FONT_VARIANT_FULL)
+            {
+                memcpy(reference, FrameBuffer, sizeof(reference));
+            }
+
+            match[variant] = (memcmp(reference, FrameBuffer, sizeof(reference)) == 0);
+            passed &= match[variant];
+            min[variant] = UINT64_MAX;
+        }
+
+        for (uint32_t pass = 0; pass < iterations; pass++)
+        {
+            for (uint8_t variant = 0; variant < FONT_VARIANT_MAX; variant++)
+            {
+                uint64_t start;
+                uint64_t time;
+
+                lv_obj_set_style_text_font(label, variants[variant], LV_PART_MAIN | LV_STATE_DEFAULT);
+                lv_obj_invalidate(label);
+
+                start = host_get_time_us();
+                lv_refr_now(NULL);
+                time = host_get_time_us() - start;
+
+                total[variant] += time;
+                min[variant] = (time < min[variant]) ? time : min[variant];
+            }
+        }
+
+        for (uint8_t variant = 0; variant < FONT_VARIANT_MAX; variant++)
+        {
+            printf("%-14s %-8s %10.1f %10.1f %8s\n", fonts[loop].Name, variant_names[variant],
+                   (double)total[variant] / iterations, (double)min[variant], match[variant] ? "yes" : "NO");
+        }
+    }
+
+    display_glyph_cache_get_stats(&stats);
+    printf("\nglyph cache: %" PRIu32 " glyphs, %" PRIu32 " of %" PRIu32 " bytes, %" PRIu32 " hits, %" PRIu32 " overflows\n",
+           stats.Glyphs, stats.BytesUsed, stats.BytesTotal, stats.Hits, stats.Overflows);
+
+    return passed;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+int main(int argc, char** argv)
+{
+    static lv_disp_draw_buf_t disp_buf;
+    static lv_disp_drv_t disp_drv;
+    tRenderOptions options = {HOST_DEFAULT_ITERATIONS, NULL, NULL, 0, 0, BLEND_KERNELS_MAX, 0, 0};
+    lv_disp_t* disp;
+    uint8_t passed = 1;
+
+    for (int arg = 1; arg < argc; arg++)
+    {
+        if ((strcmp(argv[arg], "--iterations") == 0) && ((arg + 1) < argc))
+        {
+            options.Iterations = (uint32_t)atoi(argv[++arg]);
+        }
+        else if ((strcmp(argv[arg], "--out") == 0) && ((arg + 1) < argc))
+        {
+            options.OutFolder = argv[++arg];
+        }
+        else if ((strcmp(argv[arg], "--golden") == 0) && ((arg + 1) < argc))
+        {
+            options.GoldenFolder = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--update") == 0)
+        {
+            options.UpdateGolden = 1;
+        }
+        else if ((strcmp(argv[arg], "--tolerance") == 0) && ((arg + 1) < argc))
+        {
+            options.Tolerance = (uint8_t)atoi(argv[++arg]);
+        }
+        else if ((strcmp(argv[arg], "--blend") == 0) && ((arg + 1) < argc))
+        {
+            arg++;
+            for (options.Blend = 0; options.Blend < BLEND_KERNELS_MAX; options.Blend++)
+            {
+                if (strcmp(argv[arg], display_blend_get_name(options.Blend)) == 0)
+                {
+                    break;
+                }
+            }
+
+            if (options.Blend == BLEND_KERNELS_MAX)
+            {
+                printf("Unknown blend kernels %s\n", argv[arg]);
+                return 2;
+            }
+        }
+        else if (strcmp(argv[arg], "--kernels") == 0)
+        {
+            options.KernelTest = 1;
+        }
+        else if (strcmp(argv[arg], "--fonts") == 0)
+        {
+            options.FontTest = 1;
+        }
+        else
+        {
+            printf("usage: %s [--iterations N] [--out folder] [--golden folder] [--update] [--tolerance N]\n"
+                   "       [--blend lvgl|reference|word] [--kernels] [--fonts]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (options.Iterations == 0)
+    {
+        options.Iterations = 1;
+    }
+
+    lv_init();
+
+    // whole screen buffer in direct mode, as the device does with partial refresh
+    lv_disp_draw_buf_init(&disp_buf, FrameBuffer, NULL, HOST_LCD_H_RES * HOST_LCD_V_RES);
+    lv_disp_drv_init(&disp_drv);
+    disp_drv.hor_res = HOST_LCD_H_RES;
+    disp_drv.ver_res = HOST_LCD_V_RES;
+    disp_drv.flush_cb = host_flush_cb;
+    disp_drv.monitor_cb = host_monitor_cb;
+    disp_drv.draw_buf = &disp_buf;
+    disp_drv.direct_mode = 1;
+    disp_drv.draw_ctx_init = display_blend_ctx_init;
+
+    if (options.Blend != BLEND_KERNELS_MAX)
+    {
+        display_blend_set_kernels(options.Blend);
+    }
+
+    disp = lv_disp_drv_register(&disp_drv);
+
+    if (options.KernelTest)
+    {
+        return host_run_kernels(disp, options.Iterations) ? 0 : 1;
+    }
+
+    display_glyph_cache_init();
+
+    if (options.FontTest)
+    {
+        return host_run_fonts(options.Iterations) ? 0 : 1;
+    }
+
+    ui_init();
+
+    // as display.c
+    lv_obj_set_style_text_font(ui_PresetHeadingLabel, display_glyph_cache_font(lv_obj_get_style_text_font(ui_PresetHeadingLabel, LV_PART_MAIN)),
+                               LV_PART_MAIN | LV_STATE_DEFAULT);
+    host_settle();
+
+    printf("blend kernels: %s\n", display_blend_get_name(display_blend_get_kernels()));
+    printf("%-16s %8s %10s %10s %10s %10s\n", "transition", "frames", "avg us", "min us", "max us", "px/frame");
+
+    for (uint8_t loop = 0; loop < (sizeof(Scenarios) / sizeof(Scenarios[0])); loop++)
+    {
+        if (!host_run_scenario(&Scenarios[loop], &options))
+        {
+            passed = 0;
+        }
+    }
+
+    return passed ? 0 : 1;
+}
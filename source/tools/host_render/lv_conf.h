@@ -0,0 +1,55 @@
+/*
+ Copyright (C) 2024  Greg Smith
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+ 
+*/
+
+// LVGL config for the host renderer. Mirrors the LVGL entries in sdkconfig.defaults
+// so frames match the Waveshare board, anything not set here takes the LVGL default
+
+#ifndef LV_CONF_H
+#define LV_CONF_H
+
+#define LV_COLOR_DEPTH                  16
+#define LV_COLOR_16_SWAP                0
+
+#define LV_MEM_CUSTOM                   1
+#define LV_MEMCPY_MEMSET_STD            1
+
+#define LV_TICK_CUSTOM                  0
+#define LV_USE_LOG                      0
+#define LV_USE_ASSERT_STYLE             1
+
+#define LV_FONT_MONTSERRAT_14           1
+#define LV_FONT_MONTSERRAT_20           1
+#define LV_FONT_MONTSERRAT_30           1
+#define LV_FONT_MONTSERRAT_34           1
+#define LV_FONT_MONTSERRAT_36           1
+#define LV_FONT_MONTSERRAT_40           1
+#define LV_FONT_MONTSERRAT_42           1
+#define LV_FONT_MONTSERRAT_48           1
+
+// the subset fonts build the heading compressed, as the device does
+#define LV_USE_FONT_COMPRESSED          1
+
+#define LV_USE_CALENDAR                 0
+#define LV_USE_CHART                    0
+#define LV_USE_COLORWHEEL               0
+#define LV_THEME_DEFAULT_GROW           0
+#define LV_THEME_DEFAULT_TRANSITION_TIME 5
+
+// used here for writing and comparing frames
+#define LV_USE_PNG                      1
+
+#endif
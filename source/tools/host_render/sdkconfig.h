@@ -0,0 +1,27 @@
+/*
+ Copyright (C) 2024  Greg Smith
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+ 
+*/
+
+// stands in for the ESP-IDF generated sdkconfig.h. Built in amp skins, as the default config
+
+#pragma once
+
+#define CONFIG_TONEX_CONTROLLER_DISPLAY_WAVESHARE_800_480   1
+#define CONFIG_TONEX_CONTROLLER_SKINS_AMP                   1
+#define CONFIG_TONEX_CONTROLLER_SKINS_BUILT_IN              1
+#define CONFIG_DISPLAY_BLEND_KERNELS_LVGL                   1
+#define CONFIG_DISPLAY_GLYPH_CACHE                          1
+#define CONFIG_DISPLAY_GLYPH_CACHE_KB                       256         // room for all three --fonts fonts
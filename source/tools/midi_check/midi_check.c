@@ -0,0 +1,772 @@
+/*
+ Copyright (C) 2024  Greg Smith
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+        http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+ 
+*/
+
+// Checks the Midi parser (main/midi_parser.c) against byte streams with known
+// messages, including running status, realtime bytes inside messages, SysEx and
+// messages split across reads. The dispatch to control.c, and the Midi mapping
+// table (main/midi_map.c) with learn, are checked against stand in control_request
+// functions.
+//
+// usage: midi_check [--bench] [--bytes N]
+//   --bench     also time the parser on a random stream
+//   --bytes     length of the benchmark stream (default 16M)
+// Exit code is 1 if any check fails.
+
+#include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include "control.h"
+#include "macro.h"
+#include "midi_parser.h"
+#include "midi_map.h"
+
+#define CHECK_MAX_MESSAGES              16
+#define CHECK_MAX_CALLS                 8
+#define BENCH_MAP_MESSAGES              (1024 * 1024)
+#define BENCH_DEFAULT_BYTES             (16 * 1024 * 1024)
+#define MIDI_WIRE_BYTES_PER_SEC         3125        // 31250 baud, 10 bits a byte
+
+typedef struct
+{
+    const char* Name;
+    const uint8_t* Stream;
+    uint16_t Length;
+    const tMidiMessage* Expected;
+    uint8_t ExpectedCount;
+} tParserCheck;
+
+typedef struct
+{
+    uint8_t Function;                   // 'P' preset index, 'C' control change, see the stand ins for the rest
+    uint8_t Source;
+    uint8_t Value1;
+    uint8_t Value2;
+    uint8_t Value3;
+    uint8_t Value4;
+} tControlCall;
+
+typedef struct
+{
+    const char* Name;
+    uint8_t Source;
+    tMidiMessage Message;
+    tControlCall Expected;              // Function 0 for no call
+} tMappingCheck;
+
+static tControlCall ControlCalls[CHECK_MAX_CALLS];
+static uint8_t ControlCallCount;
+static uint32_t RandomState = 0x4D494449;
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Record a call to a stand in control function
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+static void check_add_call(tControlCall call)
+{
+    if (ControlCallCount < CHECK_MAX_CALLS)
+    {
+        ControlCalls[ControlCallCount++] = call;
+    }
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Stand in for control.c
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void control_request_preset_index(uint8_t source, uint8_t index)
+{
+    check_add_call((tControlCall){'P', source, index});
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Stand in for control.c
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void control_request_midi_cc(uint8_t controller, uint8_t value)
+{
+    check_add_call((tControlCall){'C', 0, controller, value});
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Stand in for control.c
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void control_request_preset_down(uint8_t source)
+{
+    check_add_call((tControlCall){'D', source});
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Stand in for control.c
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void control_request_preset_up(uint8_t source)
+{
+    check_add_call((tControlCall){'U', source});
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Stand in for control.c
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void control_request_bank_step(uint8_t source, uint8_t up)
+{
+    check_add_call((tControlCall){'K', source, up});
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Stand in for control.c
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void control_request_bypass_toggle(uint8_t source)
+{
+    check_add_call((tControlCall){'T', source});
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Stand in for control.c
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void control_request_bypass(uint8_t source, uint8_t on)
+{
+    check_add_call((tControlCall){'B', source, on});
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Stand in for control.c
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void control_request_macro(uint8_t index)
+{
+    check_add_call((tControlCall){'M', 0, index});
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Stand in for control.c
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void control_set_amp_skin_index(uint32_t status)
+{
+    check_add_call((tControlCall){'S', 0, (uint8_t)status});
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Stand in for control.c
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+void control_learn_midi_mapping(uint8_t index, uint8_t inputs, uint8_t channel, uint8_t type, uint8_t number)
+{
+    check_add_call((tControlCall){'L', inputs, index, channel, type, number});
+}
+
+#define MSG1(s)             {(s), {0, 0}, 1}
+#define MSG2(s, d0)         {(s), {(d0), 0}, 2}
+#define MSG3(s, d0, d1)     {(s), {(d0), (d1)}, 3}
+
+static const uint8_t StreamProgram[] = {0xC0, 0x05};
+static const tMidiMessage ExpectProgram[] = {MSG2(0xC0, 0x05)};
+
+static const uint8_t StreamRunning[] = {0xC3, 0x05, 0x06, 0x07, 0x90, 0x3C, 0x7F, 0x3E, 0x00};
+static const tMidiMessage ExpectRunning[] = {MSG2(0xC3, 0x05), MSG2(0xC3, 0x06), MSG2(0xC3, 0x07), MSG3(0x90, 0x3C, 0x7F), MSG3(0x90, 0x3E, 0x00)};
+
+static const uint8_t StreamRealtime[] = {0xB0, 0xF8, 0x07, 0xFE, 0x64, 0xF8, 0x08, 0xFA, 0x10};
+static const tMidiMessage ExpectRealtime[] = {MSG1(0xF8), MSG1(0xFE), MSG3(0xB0, 0x07, 0x64), MSG1(0xF8), MSG1(0xFA), MSG3(0xB0, 0x08, 0x10)};
+
+static const uint8_t StreamSysEx[] = {0xF0, 0x43, 0x12, 0xF8, 0x00, 0x7F, 0xF7, 0x01, 0xC1, 0x02};
+static const tMidiMessage ExpectSysEx[] = {MSG1(0xF8), MSG2(0xC1, 0x02)};
+
+static const uint8_t StreamSysExCut[] = {0xF0, 0x01, 0x02, 0xC0, 0x03, 0x04};
+static const tMidiMessage ExpectSysExCut[] = {MSG2(0xC0, 0x03), MSG2(0xC0, 0x04)};
+
+static const uint8_t StreamChannel[] = {0x80, 0x3C, 0x40, 0x91, 0x3C, 0x7F, 0xA2, 0x3C, 0x20, 0xB3, 0x01, 0x7F,
+                                        0xC4, 0x10, 0xD5, 0x40, 0xE6, 0x00, 0x40};
+static const tMidiMessage ExpectChannel[] = {MSG3(0x80, 0x3C, 0x40), MSG3(0x91, 0x3C, 0x7F), MSG3(0xA2, 0x3C, 0x20), MSG3(0xB3, 0x01, 0x7F),
+                                             MSG2(0xC4, 0x10), MSG2(0xD5, 0x40), MSG3(0xE6, 0x00, 0x40)};
+
+static const uint8_t StreamSystem[] = {0xC0, 0x05, 0xF3, 0x01, 0x06, 0xF1, 0x23, 0xF2, 0x10, 0x20, 0xF6, 0xF4, 0x01, 0xF5};
+static const tMidiMessage ExpectSystem[] = {MSG2(0xC0, 0x05), MSG2(0xF3, 0x01), MSG2(0xF1, 0x23), MSG3(0xF2, 0x10, 0x20), MSG1(0xF6)};
+
+static const uint8_t StreamNoStatus[] = {0x05, 0x06, 0xB0, 0x07, 0xC0, 0x01};
+static const tMidiMessage ExpectNoStatus[] = {MSG2(0xC0, 0x01)};
+
+// where another message could be sent between them, for the serial Midi merge.
+// In message after each byte, realtime bytes don't change it
+static const uint8_t StreamBoundary[] = {0xB0, 0x07, 0xF8, 0x64, 0x08, 0x10, 0xF0, 0x01, 0xF7, 0xF3, 0x01, 0xF6};
+static const uint8_t ExpectBoundary[] = {1, 1, 1, 0, 1, 0, 1, 1, 0, 1, 0, 0};
+
+static const tParserCheck ParserChecks[] =
+{
+    {"program change", StreamProgram, sizeof(StreamProgram), ExpectProgram, sizeof(ExpectProgram) / sizeof(tMidiMessage)},
+    {"running status", StreamRunning, sizeof(StreamRunning), ExpectRunning, sizeof(ExpectRunning) / sizeof(tMidiMessage)},
+    {"realtime", StreamRealtime, sizeof(StreamRealtime), ExpectRealtime, sizeof(ExpectRealtime) / sizeof(tMidiMessage)},
+    {"sysex", StreamSysEx, sizeof(StreamSysEx), ExpectSysEx, sizeof(ExpectSysEx) / sizeof(tMidiMessage)},
+    {"sysex cut short", StreamSysExCut, sizeof(StreamSysExCut), ExpectSysExCut, sizeof(ExpectSysExCut) / sizeof(tMidiMessage)},
+    {"channel messages", StreamChannel, sizeof(StreamChannel), ExpectChannel, sizeof(ExpectChannel) / sizeof(tMidiMessage)},
+    {"system common", StreamSystem, sizeof(StreamSystem), ExpectSystem, sizeof(ExpectSystem) / sizeof(tMidiMessage)},
+    {"no status", StreamNoStatus, sizeof(StreamNoStatus), ExpectNoStatus, sizeof(ExpectNoStatus) / sizeof(tMidiMessage)},
+};
+
+static const char* MappingText[] =
+{
+    "serial 1 cc 20 = bypass",
+    "any omni note 60 = preset 3",
+    "bt 1 cc 7 = preset",
+    "any 16 cc 21 = skin",
+    "serial 1 cc 20 = bankup",              // same message as the first, which wins
+    "Serial 2 CC 22 = Macro 2",
+    "any omni note 61 = presetup",
+    "",
+    "serial 2 cc 20 = presetup",            // same number as the first, other channel
+    "any omni cc 23 = presetdown",          // omni first, wins over the next
+    "serial 3 cc 23 = bankup",
+    "serial 4 cc 24 = bankdown",            // single channel first, wins over the next on its channel
+    "any omni cc 24 = presetdown",
+};
+
+static const char* MappingInvalid[] =
+{
+    "serial 17 cc 20 = bypass",
+    "serial 1 pc 20 = bypass",
+    "serial 1 cc 128 = bypass",
+    "serial 1 cc 20 = preset 99",
+    "serial 1 cc 20",
+    "serial 1 cc 20 = bypass 2",
+    "usb 1 cc 20 = bypass",
+    "learn = fly",
+};
+
+#define SERIAL              CONTROL_SOURCE_MIDI_SERIAL
+#define CENTRAL             CONTROL_SOURCE_BT_CENTRAL
+#define PERIPHERAL          CONTROL_SOURCE_BT_PERIPHERAL
+
+static const tMappingCheck MappingChecks[] =
+{
+    {"cc bypass on", SERIAL, MSG3(0xB0, 20, 127), {'B', SERIAL, 1}},
+    {"cc bypass off", SERIAL, MSG3(0xB0, 20, 0), {'B', SERIAL, 0}},
+    {"cc other input", CENTRAL, MSG3(0xB0, 20, 127), {'C', 0, 20, 127}},
+    {"cc other channel", SERIAL, MSG3(0xB5, 20, 127), {'C', 0, 20, 127}},
+    {"cc same number channel 2", SERIAL, MSG3(0xB1, 20, 127), {'U', SERIAL}},
+    {"cc omni before channel", SERIAL, MSG3(0xB2, 23, 127), {'D', SERIAL}},
+    {"cc channel before omni", SERIAL, MSG3(0xB3, 24, 127), {'K', SERIAL, 0}},
+    {"cc omni after channel", SERIAL, MSG3(0xB4, 24, 127), {'D', SERIAL}},
+    {"note preset", PERIPHERAL, MSG3(0x9A, 60, 64), {'P', PERIPHERAL, 2}},
+    {"note off", PERIPHERAL, MSG3(0x9A, 60, 0), {0}},
+    {"scaled preset top", CENTRAL, MSG3(0xB0, 7, 127), {'P', CENTRAL, PRESETS_PER_BANK - 1}},
+    {"scaled preset bottom", CENTRAL, MSG3(0xB0, 7, 0), {'P', CENTRAL, 0}},
+    {"scaled skin", SERIAL, MSG3(0xBF, 21, 127), {'S', 0, SKIN_MAX - 1}},
+    {"macro", SERIAL, MSG3(0xB1, 22, 127), {'M', 0, 1}},
+    {"macro release", SERIAL, MSG3(0xB1, 22, 0), {0}},
+    {"note step", SERIAL, MSG3(0x90, 61, 100), {'U', SERIAL}},
+    {"program change", SERIAL, MSG2(0xC0, 5), {'P', SERIAL, 5}},
+};
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      monotonic time in usec
+* NOTES:       
+*****************************************************************************/
+static uint64_t check_get_time_us(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((uint64_t)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      pseudo random number, repeatable between runs
+* NOTES:       xorshift32
+*****************************************************************************/
+static uint32_t check_random(void)
+{
+    RandomState ^= RandomState << 13;
+    RandomState ^= RandomState >> 17;
+    RandomState ^= RandomState << 5;
+
+    return RandomState;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Parse a stream, split into reads of the given size
+* PARAMETERS:  split: bytes per read, the parser must carry messages across
+* RETURN:      1 if the messages match
+* NOTES:       
+*****************************************************************************/
+static uint8_t check_stream(const tParserCheck* check, uint16_t split)
+{
+    tMidiParser parser;
+    tMidiMessage messages[CHECK_MAX_MESSAGES];
+    tMidiMessage message;
+    uint8_t count = 0;
+
+    midi_parser_init(&parser);
+
+    for (uint16_t start = 0; start < check->Length; start += split)
+    {
+        for (uint16_t index = start; (index < (start + split)) && (index < check->Length); index++)
+        {
+            if (midi_parser_byte(&parser, check->Stream[index], &message) && (count < CHECK_MAX_MESSAGES))
+            {
+                messages[count++] = message;
+            }
+        }
+    }
+
+    if (count != check->ExpectedCount)
+    {
+        printf("%s, reads of %u: %u messages, expected %u\n", check->Name, (unsigned)split, (unsigned)count, (unsigned)check->ExpectedCount);
+        return 0;
+    }
+
+    for (uint8_t loop = 0; loop < count; loop++)
+    {
+        const tMidiMessage* expected = &check->Expected[loop];
+
+        if ((messages[loop].Status != expected->Status) || (messages[loop].Length != expected->Length) ||
+            ((expected->Length > 1) && (messages[loop].Data[0] != expected->Data[0])) ||
+            ((expected->Length > 2) && (messages[loop].Data[1] != expected->Data[1])))
+        {
+            printf("%s, reads of %u: message %u is %02X %02X %02X, expected %02X %02X %02X\n", check->Name, (unsigned)split, (unsigned)loop,
+                   messages[loop].Status, messages[loop].Data[0], messages[loop].Data[1], expected->Status, expected->Data[0], expected->Data[1]);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Check where the parser reports being part way through a message
+* PARAMETERS:  
+* RETURN:      1 if all pass
+* NOTES:       
+*****************************************************************************/
+static uint8_t check_boundary(void)
+{
+    tMidiParser parser;
+    tMidiMessage message;
+
+    midi_parser_init(&parser);
+
+    for (uint8_t index = 0; index < sizeof(StreamBoundary); index++)
+    {
+        midi_parser_byte(&parser, StreamBoundary[index], &message);
+
+        if (midi_parser_in_message(&parser) != ExpectBoundary[index])
+        {
+            printf("boundary: byte %u (%02X) in message %u, expected %u\n", (unsigned)index, StreamBoundary[index],
+                   (unsigned)midi_parser_in_message(&parser), (unsigned)ExpectBoundary[index]);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Check the dispatch and the Bluetooth packet framing
+* PARAMETERS:  
+* RETURN:      1 if all pass
+* NOTES:       
+*****************************************************************************/
+static uint8_t check_dispatch(void)
+{
+    // header, timestamp, PC 5 channel 1, then running status with no timestamp, then
+    // timestamp and CC 7 = 100 on channel 1, then PC on channel 2 which is ignored
+    static const uint8_t packet[] = {0x80, 0x81, 0xC0, 0x05, 0x06, 0x82, 0xB0, 0x07, 0x64, 0x83, 0xC1, 0x09};
+    static const tControlCall expected[] = {{'P', CONTROL_SOURCE_BT_CENTRAL, 5, 0}, {'P', CONTROL_SOURCE_BT_CENTRAL, 6, 0}, {'C', 0, 7, 100}};
+    tMidiParser parser;
+    tMidiMessage message;
+    uint8_t passed = 1;
+
+    midi_parser_init(&parser);
+    ControlCallCount = 0;
+    midi_parser_ble_packet(&parser, packet, sizeof(packet), CONTROL_SOURCE_BT_CENTRAL, 0);
+
+    if ((ControlCallCount != (sizeof(expected) / sizeof(expected[0]))) || (memcmp(ControlCalls, expected, sizeof(expected)) != 0))
+    {
+        printf("bluetooth packet: %u control requests, expected %u\n", (unsigned)ControlCallCount, (unsigned)(sizeof(expected) / sizeof(expected[0])));
+        passed = 0;
+    }
+
+    // omni takes any channel, realtime and system messages are never dispatched
+    ControlCallCount = 0;
+    message = (tMidiMessage)MSG2(0xCF, 0x03);
+    midi_parser_dispatch(CONTROL_SOURCE_MIDI_SERIAL, MIDI_CHANNEL_OMNI, &message);
+    message = (tMidiMessage)MSG1(0xF8);
+    midi_parser_dispatch(CONTROL_SOURCE_MIDI_SERIAL, MIDI_CHANNEL_OMNI, &message);
+    message = (tMidiMessage)MSG3(0x90, 0x3C, 0x7F);
+    midi_parser_dispatch(CONTROL_SOURCE_MIDI_SERIAL, 0, &message);
+
+    if ((ControlCallCount != 1) || (ControlCalls[0].Function != 'P') || (ControlCalls[0].Value1 != 3))
+    {
+        printf("dispatch: %u control requests, expected 1\n", (unsigned)ControlCallCount);
+        passed = 0;
+    }
+
+    return passed;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Dispatch one message on any channel
+* PARAMETERS:  
+* RETURN:      1 if it made the expected call, or none if Function is 0
+* NOTES:       
+*****************************************************************************/
+static uint8_t check_mapped_message(const char* name, uint8_t source, const tMidiMessage* message, const tControlCall* expected)
+{
+    ControlCallCount = 0;
+    midi_parser_dispatch(source, MIDI_CHANNEL_OMNI, message);
+
+    if (((expected->Function == 0) && (ControlCallCount != 0)) ||
+        ((expected->Function != 0) && ((ControlCallCount != 1) || (memcmp(&ControlCalls[0], expected, sizeof(tControlCall)) != 0))))
+    {
+        printf("mapping %s: %u control requests, first %c %u %u %u, expected %c %u %u %u\n", name, (unsigned)ControlCallCount,
+               ControlCallCount ? ControlCalls[0].Function : '-', ControlCalls[0].Source, ControlCalls[0].Value1, ControlCalls[0].Value2,
+               expected->Function ? expected->Function : '-', expected->Source, expected->Value1, expected->Value2);
+        return 0;
+    }
+
+    return 1;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Check the mapping compiler, lookup and learn
+* PARAMETERS:  
+* RETURN:      1 if all pass
+* NOTES:       
+*****************************************************************************/
+static uint8_t check_mapping(void)
+{
+    tMidiMapping mappings[MAX_MIDI_MAPPINGS];
+    tMidiMapping mapping;
+    tMidiMessage message;
+    uint8_t passed = 1;
+
+    memset((void*)mappings, 0, sizeof(mappings));
+
+    for (uint8_t loop = 0; loop < (sizeof(MappingText) / sizeof(MappingText[0])); loop++)
+    {
+        if (!midi_map_compile(MappingText[loop], &mappings[loop]))
+        {
+            printf("mapping \"%s\" rejected\n", MappingText[loop]);
+            passed = 0;
+        }
+    }
+
+    for (uint8_t loop = 0; loop < (sizeof(MappingInvalid) / sizeof(MappingInvalid[0])); loop++)
+    {
+        if (midi_map_compile(MappingInvalid[loop], &mapping) || (mapping.Inputs != 0))
+        {
+            printf("mapping \"%s\" accepted\n", MappingInvalid[loop]);
+            passed = 0;
+        }
+    }
+
+    midi_map_set(mappings, MAX_MIDI_MAPPINGS);
+
+    for (uint8_t loop = 0; loop < (sizeof(MappingChecks) / sizeof(MappingChecks[0])); loop++)
+    {
+        passed &= check_mapped_message(MappingChecks[loop].Name, MappingChecks[loop].Source, &MappingChecks[loop].Message, &MappingChecks[loop].Expected);
+    }
+
+    // learn takes the next message only, then it is up to control.c to fill in the mapping
+    midi_map_compile("learn = bankdown", &mappings[20]);
+    midi_map_set(mappings, MAX_MIDI_MAPPINGS);
+
+    message = (tMidiMessage)MSG3(0xB4, 30, 127);
+    passed &= check_mapped_message("learn", PERIPHERAL, &message, &(tControlCall){'L', MIDI_MAP_INPUT_BT_PERIPHERAL, 20, 4, MIDI_MAP_TYPE_CC, 30});
+    passed &= check_mapped_message("after learn", PERIPHERAL, &message, &(tControlCall){'C', 0, 30, 127});
+
+    mappings[20].Inputs = MIDI_MAP_INPUT_BT_PERIPHERAL;
+    mappings[20].Channel = 4;
+    mappings[20].Type = MIDI_MAP_TYPE_CC;
+    mappings[20].Number = 30;
+    midi_map_set(mappings, MAX_MIDI_MAPPINGS);
+
+    passed &= check_mapped_message("learned", PERIPHERAL, &message, &(tControlCall){'K', PERIPHERAL, 0});
+
+    // leave the mappings empty for the other checks
+    memset((void*)mappings, 0, sizeof(mappings));
+    midi_map_set(mappings, MAX_MIDI_MAPPINGS);
+
+    return passed;
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Time the mapping lookup with a full table
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       About one message in eight hits a mapping
+*****************************************************************************/
+static void check_map_benchmark(void)
+{
+    tMidiMapping mappings[MAX_MIDI_MAPPINGS];
+    tMidiMessage* messages = malloc(BENCH_MAP_MESSAGES * sizeof(tMidiMessage));
+    uint32_t mapped = 0;
+    uint64_t start;
+    uint64_t elapsed;
+
+    if (messages == NULL)
+    {
+        printf("Benchmark allocation failed\n");
+        return;
+    }
+
+    for (uint8_t loop = 0; loop < MAX_MIDI_MAPPINGS; loop++)
+    {
+        char text[64];
+
+        snprintf(text, sizeof(text), "any omni %s %d = presetup", (loop & 1) ? "note" : "cc", 64 + (loop * 2));
+        midi_map_compile(text, &mappings[loop]);
+    }
+
+    midi_map_set(mappings, MAX_MIDI_MAPPINGS);
+
+    for (uint32_t index = 0; index < BENCH_MAP_MESSAGES; index++)
+    {
+        uint32_t random = check_random();
+
+        messages[index] = (tMidiMessage)MSG3(((random & 1) ? MIDI_NOTE_ON : MIDI_CONTROL_CHANGE) | ((random >> 1) & 0x0F),
+                                             (random >> 8) & 0x7F, 1 + ((random >> 16) & 0x7E));
+    }
+
+    start = check_get_time_us();
+
+    for (uint32_t index = 0; index < BENCH_MAP_MESSAGES; index++)
+    {
+        ControlCallCount = 0;
+        mapped += midi_map_handle(CONTROL_SOURCE_MIDI_SERIAL, &messages[index]);
+    }
+
+    elapsed = check_get_time_us() - start;
+    if (elapsed == 0)
+    {
+        elapsed = 1;
+    }
+
+    printf("%u mappings, %u messages, %" PRIu32 " mapped, %.2f ns per lookup\n", (unsigned)MAX_MIDI_MAPPINGS, (unsigned)BENCH_MAP_MESSAGES,
+           mapped, (elapsed * 1000.0) / BENCH_MAP_MESSAGES);
+
+    free(messages);
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: Time the parser on a random stream
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       Mostly channel messages in running status, with clocks and the
+*              odd SysEx, roughly what a busy Midi cable carries
+*****************************************************************************/
+static void check_benchmark(uint32_t bytes)
+{
+    tMidiParser parser;
+    tMidiMessage message;
+    uint8_t* stream = malloc(bytes);
+    uint32_t messages = 0;
+    uint64_t start;
+    uint64_t elapsed;
+    double ns_per_byte;
+
+    if (stream == NULL)
+    {
+        printf("Benchmark allocation failed\n");
+        return;
+    }
+
+    for (uint32_t index = 0; index < bytes; index++)
+    {
+        uint32_t random = check_random();
+
+        switch (random & 0x0F)
+        {
+            case 0:
+            {
+                // clock
+                stream[index] = 0xF8;
+            } break;
+
+            case 1:
+            {
+                // new channel status
+                stream[index] = 0x80 | ((random >> 8) & 0x6F);
+            } break;
+
+            case 2:
+            {
+                stream[index] = ((random >> 8) & 0x07) ? 0xF7 : 0xF0;
+            } break;
+
+            default:
+            {
+                stream[index] = (random >> 8) & 0x7F;
+            } break;
+        }
+    }
+
+    midi_parser_init(&parser);
+    start = check_get_time_us();
+
+    for (uint32_t index = 0; index < bytes; index++)
+    {
+        messages += midi_parser_byte(&parser, stream[index], &message);
+    }
+
+    elapsed = check_get_time_us() - start;
+    if (elapsed == 0)
+    {
+        elapsed = 1;
+    }
+
+    ns_per_byte = (elapsed * 1000.0) / bytes;
+
+    printf("\n%" PRIu32 " bytes, %" PRIu32 " messages in %" PRIu64 " us\n", bytes, messages, elapsed);
+    printf("%.2f ns per byte, %.1f MB/s, %.0f times the Midi wire rate\n", ns_per_byte, bytes / (double)elapsed,
+           (bytes * 1000000.0 / elapsed) / MIDI_WIRE_BYTES_PER_SEC);
+
+    free(stream);
+}
+
+/****************************************************************************
+* NAME:        
+* DESCRIPTION: 
+* PARAMETERS:  
+* RETURN:      
+* NOTES:       
+*****************************************************************************/
+int main(int argc, char** argv)
+{
+    uint8_t bench = 0;
+    uint32_t bytes = BENCH_DEFAULT_BYTES;
+    uint8_t passed = 1;
+
+    for (int arg = 1; arg < argc; arg++)
+    {
+        if (strcmp(argv[arg], "--bench") == 0)
+        {
+            bench = 1;
+        }
+        else if ((strcmp(argv[arg], "--bytes") == 0) && ((arg + 1) < argc))
+        {
+            bytes = (uint32_t)atoi(argv[++arg]);
+        }
+        else
+        {
+            printf("usage: %s [--bench] [--bytes N]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    for (uint8_t loop = 0; loop < (sizeof(ParserChecks) / sizeof(ParserChecks[0])); loop++)
+    {
+        uint8_t check_passed = 1;
+
+        // whole stream in one read, a byte per read, and three bytes per read
+        check_passed &= check_stream(&ParserChecks[loop], ParserChecks[loop].Length);
+        check_passed &= check_stream(&ParserChecks[loop], 1);
+        check_passed &= check_stream(&ParserChecks[loop], 3);
+
+        printf("%-20s %s\n", ParserChecks[loop].Name, check_passed ? "pass" : "FAIL");
+        passed &= check_passed;
+    }
+
+    if (check_boundary())
+    {
+        printf("%-20s pass\n", "message boundary");
+    }
+    else
+    {
+        printf("%-20s FAIL\n", "message boundary");
+        passed = 0;
+    }
+
+    if (check_dispatch())
+    {
+        printf("%-20s pass\n", "dispatch");
+    }
+    else
+    {
+        printf("%-20s FAIL\n", "dispatch");
+        passed = 0;
+    }
+
+    if (check_mapping())
+    {
+        printf("%-20s pass\n", "mapping");
+    }
+    else
+    {
+        printf("%-20s FAIL\n", "mapping");
+        passed = 0;
+    }
+
+    if (bench && (bytes > 0))
+    {
+        check_benchmark(bytes);
+        check_map_benchmark();
+    }
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,203 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2024  Greg Smith
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#         http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# Packs the SquareLine generated skin images (ui_img_*.c) into a single
+# compressed bundle, decoded at run time by skin_store.c.
+#
+# usage: skin_pack.py [--background RRGGBB] output.bin image1.c image2.c ...
+#        images must be given in the same order as the Skins enum
+#
+#        --background pre-blends each skin against the given solid colour, producing
+#        opaque RGB565 images (2 bytes per pixel) that LVGL can copy without blending.
+#        Only valid where the area behind the skin is that one colour
+#
+#        skin_pack.py [--background RRGGBB] --sd output_folder image1.c image2.c ...
+#        writes the images as LVGL binary files plus manifest.txt, for copying to
+#        the skins folder of an SD card
+#
+# Bundle layout, little endian:
+#   header:  char[4] "SKN1", uint16 count, uint16 bytes per pixel
+#   entries: uint16 width, uint16 height, uint32 offset, uint32 packed size, uint32 raw size
+#   data:    RLE packed pixels, one stream per skin
+#
+# RLE works on whole pixels. Control byte:
+#   0x00 to 0x7F: literal, (n + 1) pixels follow
+#   0x80 to 0xFF: run, next pixel repeated (n - 0x80 + 2) times
+
+import os
+import re
+import struct
+import sys
+
+BYTES_PER_PIXEL = 3                 # LV_IMG_CF_TRUE_COLOR_ALPHA with 16 bit colour
+BYTES_PER_PIXEL_OPAQUE = 2          # LV_IMG_CF_TRUE_COLOR with 16 bit colour
+LV_IMG_CF_TRUE_COLOR = 4
+LV_IMG_CF_TRUE_COLOR_ALPHA = 5
+MAX_LITERAL = 128
+MAX_RUN = 129
+
+def parse_image(path):
+    with open(path, "r") as f:
+        text = f.read()
+
+    data_match = re.search(r"_data\[\]\s*=\s*\{(.*?)\};", text, re.S)
+    w_match = re.search(r"\.header\.w\s*=\s*(\d+)", text)
+    h_match = re.search(r"\.header\.h\s*=\s*(\d+)", text)
+    if not data_match or not w_match or not h_match:
+        raise ValueError("%s: not a generated image" % path)
+
+    width = int(w_match.group(1))
+    height = int(h_match.group(1))
+    raw = bytes(int(v, 16) for v in re.findall(r"0x([0-9A-Fa-f]{1,2})\b", data_match.group(1)))
+
+    expected = width * height * BYTES_PER_PIXEL
+    if len(raw) < expected:
+        # pad short images so a damaged source doesn't shift the decoder
+        print("warning: %s has %d bytes, expected %d. Padding" % (path, len(raw), expected))
+        raw = raw + bytes(expected - len(raw))
+
+    return width, height, raw[:expected]
+
+def udiv255(value):
+    # same as LV_UDIV255
+    return (value * 0x8081) >> 0x17
+
+def precomposite(raw, background):
+    # matches lv_color_mix() for 16 bit colour, so the result is identical to LVGL blending
+    bg_r = ((background >> 16) & 0xFF) >> 3
+    bg_g = ((background >> 8) & 0xFF) >> 2
+    bg_b = (background & 0xFF) >> 3
+    out = bytearray()
+
+    for i in range(0, len(raw), BYTES_PER_PIXEL):
+        colour = raw[i] | (raw[i + 1] << 8)
+        alpha = raw[i + 2]
+
+        red = udiv255(((colour >> 11) & 0x1F) * alpha + bg_r * (255 - alpha) + 128)
+        green = udiv255(((colour >> 5) & 0x3F) * alpha + bg_g * (255 - alpha) + 128)
+        blue = udiv255((colour & 0x1F) * alpha + bg_b * (255 - alpha) + 128)
+
+        out += struct.pack("<H", (red << 11) | (green << 5) | blue)
+
+    return bytes(out)
+
+def rle_pack(raw, bytes_per_pixel):
+    pixels = [raw[i:i + bytes_per_pixel] for i in range(0, len(raw), bytes_per_pixel)]
+    out = bytearray()
+    literal = []
+    i = 0
+
+    def flush_literal():
+        while literal:
+            chunk = literal[:MAX_LITERAL]
+            del literal[:MAX_LITERAL]
+            out.append(len(chunk) - 1)
+            for p in chunk:
+                out.extend(p)
+
+    while i < len(pixels):
+        run = 1
+        while (i + run < len(pixels)) and (run < MAX_RUN) and (pixels[i + run] == pixels[i]):
+            run += 1
+
+        if run >= 2:
+            flush_literal()
+            out.append(0x80 + run - 2)
+            out.extend(pixels[i])
+            i += run
+        else:
+            literal.append(pixels[i])
+            i += 1
+
+    flush_literal()
+    return bytes(out)
+
+def skin_name(path):
+    # ui_img_skin_jcm800_png.c -> jcm800
+    name = os.path.basename(path)
+    match = re.match(r"ui_img_p?skin_(.*)_png\.c$", name)
+    return match.group(1) if match else os.path.splitext(name)[0]
+
+def write_sd(folder, paths, images, bytes_per_pixel):
+    colour_format = LV_IMG_CF_TRUE_COLOR_ALPHA if bytes_per_pixel == BYTES_PER_PIXEL else LV_IMG_CF_TRUE_COLOR
+    os.makedirs(folder, exist_ok=True)
+
+    with open(os.path.join(folder, "manifest.txt"), "w") as manifest:
+        manifest.write("# name,file. Line order is the skin number\n")
+
+        for index, (path, (width, height, raw)) in enumerate(zip(paths, images)):
+            # 8.3 file names, long names may not be enabled in the firmware
+            file_name = "skin%03d.bin" % index
+
+            with open(os.path.join(folder, file_name), "wb") as f:
+                # lv_img_header_t: cf 5 bits, always zero 3, reserved 2, width 11, height 11
+                f.write(struct.pack("<I", colour_format | (width << 10) | (height << 21)))
+                f.write(raw)
+
+            manifest.write("%s,%s\n" % (skin_name(path), file_name))
+
+    print("skin_pack: %d skins written to %s" % (len(images), folder))
+
+def main():
+    args = sys.argv[1:]
+    background = None
+    bytes_per_pixel = BYTES_PER_PIXEL
+
+    sd_card = False
+
+    if (len(args) >= 2) and (args[0] == "--background"):
+        background = int(args[1], 16)
+        bytes_per_pixel = BYTES_PER_PIXEL_OPAQUE
+        args = args[2:]
+
+    if (len(args) >= 1) and (args[0] == "--sd"):
+        sd_card = True
+        args = args[1:]
+
+    if len(args) < 2:
+        print("usage: skin_pack.py [--background RRGGBB] [--sd] output image.c ...")
+        return 1
+
+    images = [parse_image(p) for p in args[1:]]
+
+    if background is not None:
+        images = [(width, height, precomposite(raw, background)) for width, height, raw in images]
+
+    if sd_card:
+        write_sd(args[0], args[1:], images, bytes_per_pixel)
+        return 0
+
+    header_size = 8 + len(images) * 16
+    entries = bytearray()
+    payload = bytearray()
+
+    for width, height, raw in images:
+        packed = rle_pack(raw, bytes_per_pixel)
+        entries += struct.pack("<HHIII", width, height, header_size + len(payload), len(packed), len(raw))
+        payload += packed
+
+    with open(args[0], "wb") as f:
+        f.write(b"SKN1")
+        f.write(struct.pack("<HH", len(images), bytes_per_pixel))
+        f.write(entries)
+        f.write(payload)
+
+    raw_total = sum(len(i[2]) for i in images)
+    print("skin_pack: %d skins, %d bytes raw, %d bytes packed" % (len(images), raw_total, len(payload)))
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())